@@ -0,0 +1,81 @@
+#include "acquisition.h"
+
+Acquisition::Acquisition(SensorHal &sensors, const uint8_t *inputs, const FilterConfig *filters, uint8_t count)
+    : sensors(sensors), inputs(inputs), filters(filters), count(count < ACQ_MAX_CHANNELS ? count : ACQ_MAX_CHANNELS),
+      done(0), scans(), airDone(false), airValue(), adcValues()
+{
+}
+
+static uint8_t burstSize(const FilterConfig &filter)
+{
+  if (filter.samples == 0)
+  {
+    return 1;
+  }
+  return filter.samples < FILTER_MAX_SAMPLES ? filter.samples : FILTER_MAX_SAMPLES;
+}
+
+uint8_t Acquisition::nextInput(uint8_t device, uint8_t index) const
+{
+  while (index < count && ADC_INPUT_DEVICE(inputs[index]) != device)
+  {
+    index++;
+  }
+  return index;
+}
+
+void Acquisition::start()
+{
+  done = 0;
+  airDone = false;
+
+  sensors.startAir();
+  for (uint8_t d = 0; d < ADC_MAX_DEVICES; d++)
+  {
+    Scan &scan = scans[d];
+    scan.index = nextInput(d, 0);
+    scan.collected = 0;
+    if (scan.index < count)
+    {
+      sensors.startAdc(inputs[scan.index]);
+    }
+  }
+}
+
+bool Acquisition::poll()
+{
+  if (!airDone)
+  {
+    airDone = sensors.pollAir(airValue);
+  }
+
+  for (uint8_t d = 0; d < ADC_MAX_DEVICES; d++)
+  {
+    Scan &scan = scans[d];
+    if (scan.index >= count || !sensors.adcReady(d))
+    {
+      continue;
+    }
+
+    uint8_t index = scan.index;
+    bool last = scan.collected + 1 >= burstSize(filters[index]);
+    uint8_t next = last ? nextInput(d, index + 1) : index;
+
+    // Read back before the next conversion starts, it may end before the read on a slow bus
+    scan.burst[scan.collected++] = sensors.readAdc(d);
+    if (next < count)
+    {
+      sensors.startAdc(inputs[next]);
+    }
+
+    if (last)
+    {
+      adcValues[index] = filterBurst(scan.burst, scan.collected, filters[index].trim);
+      scan.collected = 0;
+      scan.index = next;
+      done++;
+    }
+  }
+
+  return airDone && done == count;
+}
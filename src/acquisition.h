@@ -0,0 +1,50 @@
+#ifndef ACQUISITION_H
+#define ACQUISITION_H
+
+#include "compat.h"
+#include "filter.h"
+#include "hal.h"
+#include "sample.h"
+
+#define ACQ_MAX_CHANNELS (SAMPLE_MAX_PROBES + 2)
+
+// Non-blocking reading of the air sensor and of the ADC inputs.
+// The air sensor and the ADC devices convert at the same time, the inputs of a device one after
+// the other. Each input is read with a burst of conversions reduced by a trimmed mean. The result
+// of a conversion is read back before the next conversion of the device starts.
+class Acquisition
+{
+public:
+  Acquisition(SensorHal &sensors, const uint8_t *inputs, const FilterConfig *filters, uint8_t count);
+
+  void start();
+  // Advance the conversions, return true when all of them are done
+  bool poll();
+
+  const AirCondition &air() const { return airValue; }
+  int16_t adc(uint8_t index) const { return adcValues[index]; }
+
+private:
+  // Inputs of a device being converted
+  struct Scan
+  {
+    uint8_t index;     // Input being converted, count when done
+    uint8_t collected; // Conversions of the burst done
+    int16_t burst[FILTER_MAX_SAMPLES];
+  };
+
+  // First input of the device from index on, count if none
+  uint8_t nextInput(uint8_t device, uint8_t index) const;
+
+  SensorHal &sensors;
+  const uint8_t *inputs;
+  const FilterConfig *filters;
+  uint8_t count;
+  uint8_t done; // Inputs done
+  Scan scans[ADC_MAX_DEVICES];
+  bool airDone;
+  AirCondition airValue;
+  int16_t adcValues[ACQ_MAX_CHANNELS];
+};
+
+#endif
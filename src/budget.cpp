@@ -0,0 +1,56 @@
+#include "budget.h"
+
+WakeBudget::WakeBudget(ClockHal &clock, uint32_t totalMs) : clock(clock), totalMs(totalMs), deadlineMs(totalMs)
+{
+}
+
+void WakeBudget::startPhase(uint32_t phaseMs)
+{
+  uint32_t now = clock.millis();
+  deadlineMs = now < totalMs && totalMs - now > phaseMs ? now + phaseMs : totalMs;
+}
+
+uint32_t WakeBudget::left()
+{
+  uint32_t now = clock.millis();
+  return now < deadlineMs ? deadlineMs - now : 0;
+}
+
+bool WakeBudget::fits(uint32_t phaseMs)
+{
+  uint32_t now = clock.millis();
+  return now < totalMs && totalMs - now >= phaseMs;
+}
+
+bool WakeBudget::exhausted()
+{
+  return clock.millis() >= totalMs;
+}
+
+bool backoffReady(BackoffState &state)
+{
+  if (state.wait == 0)
+  {
+    return true;
+  }
+
+  state.wait--;
+  return false;
+}
+
+void backoffFailed(BackoffState &state, uint8_t maxWait)
+{
+  if (state.failures < UINT8_MAX)
+  {
+    state.failures++;
+  }
+
+  uint32_t wait = state.failures <= 8 ? 1UL << (state.failures - 1) : UINT32_MAX;
+  state.wait = wait < maxWait ? wait : maxWait;
+}
+
+void backoffSucceeded(BackoffState &state)
+{
+  state.failures = 0;
+  state.wait = 0;
+}
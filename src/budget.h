@@ -0,0 +1,43 @@
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include "compat.h"
+#include "hal.h"
+
+// Time budget of a wake: each blocking phase gets a deadline, never later than the end of
+// the whole budget. Times are millis() since boot.
+class WakeBudget
+{
+public:
+  WakeBudget(ClockHal &clock, uint32_t totalMs);
+
+  // Start a phase that may take up to phaseMs
+  void startPhase(uint32_t phaseMs);
+  // Time left before the deadline of the phase, 0 once it passed
+  uint32_t left();
+  bool expired() { return left() == 0; }
+  // Whether a phase of phaseMs still fits in the budget, for the ones that cannot be cut short
+  bool fits(uint32_t phaseMs);
+  // The whole budget is spent, the wake must end
+  bool exhausted();
+
+private:
+  ClockHal &clock;
+  uint32_t totalMs;
+  uint32_t deadlineMs;
+};
+
+// Upload attempts after consecutive failures, stored in RTC memory
+struct BackoffState
+{
+  uint8_t failures; // Saturated
+  uint8_t wait;     // Wakes left before the next attempt
+};
+
+// Whether to attempt this wake, otherwise count it as waited. Call once per wake.
+bool backoffReady(BackoffState &state);
+// Wait 1, 2, 4, ... wakes before the next attempt, at most maxWait
+void backoffFailed(BackoffState &state, uint8_t maxWait);
+void backoffSucceeded(BackoffState &state);
+
+#endif
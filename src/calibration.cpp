@@ -0,0 +1,31 @@
+#include "calibration.h"
+
+CalPoint calPoint(const CalCurve &curve, uint8_t i)
+{
+  return {(int16_t)pgm_read_word(&curve.points[i].x), (int16_t)pgm_read_word(&curve.points[i].y)};
+}
+
+int32_t calEvaluate(const CalCurve &curve, int32_t x)
+{
+  CalPoint a = calPoint(curve, 0);
+  if (x <= a.x)
+  {
+    return a.y;
+  }
+
+  // The curves have a few points, the segments are walked in order
+  for (uint8_t i = 1; i < curve.count; i++)
+  {
+    CalPoint b = calPoint(curve, i);
+    if (x < b.x)
+    {
+      // Fits in 32 bits, checked by tools/calibrate.py
+      int32_t dx = b.x - a.x;
+      int32_t num = (x - a.x) * (b.y - a.y);
+      return a.y + (num >= 0 ? num + dx / 2 : num - dx / 2) / dx;
+    }
+    a = b;
+  }
+
+  return a.y;
+}
@@ -0,0 +1,37 @@
+#ifndef CALIBRATION_H
+#define CALIBRATION_H
+
+#include "compat.h"
+
+// Piecewise linear calibration curves generated by tools/calibrate.py, evaluated in fixed
+// point: no float math on the ESP8266, which has no FPU.
+#define CAL_FRACTION_BITS 8 // Values are Q8 (1/256)
+#define CAL_ONE (1 << CAL_FRACTION_BITS)
+
+struct CalPoint
+{
+  int16_t x; // Raw value, increasing along the curve
+  int16_t y; // Calibrated value, Q8
+};
+
+struct CalCurve
+{
+  const CalPoint *points; // PROGMEM
+  uint8_t count;
+};
+
+// Point i of the curve
+CalPoint calPoint(const CalCurve &curve, uint8_t i);
+// Calibrated value of x in Q8, interpolated between the two points around it and held at the
+// ends of the curve
+int32_t calEvaluate(const CalCurve &curve, int32_t x);
+// Q8 value rounded to an integer
+inline int32_t calRound(int32_t value) { return (value + CAL_ONE / 2) >> CAL_FRACTION_BITS; }
+
+// Millivolts of an ADS1115 result at the full scale of its gain (e.g. 6144 for +/-6.144V)
+inline int32_t adcMilliVolts(int16_t raw, uint16_t fullScaleMilliVolts)
+{
+  return ((int32_t)raw * fullScaleMilliVolts + (1 << 14)) >> 15;
+}
+
+#endif
@@ -0,0 +1,15 @@
+// Generated by tools/calibrate.py from assets/calibration/battery.csv, assets/calibration/soil.csv, do not edit
+#ifndef CALIBRATION_CURVES_H
+#define CALIBRATION_CURVES_H
+
+#include "calibration.h"
+
+// 8 points fitted to 21 pairs, error rms 0.57 max 1.23
+static const CalPoint BATTERY_CURVE_POINTS[] PROGMEM = {{3270, 0}, {3610, 1280}, {3690, 2569}, {3770, 7654}, {3870, 15391}, {3910, 16586}, {3980, 19139}, {4200, 25600}};
+static const CalCurve BATTERY_CURVE = {BATTERY_CURVE_POINTS, 8};
+
+// 2 points fitted to 2 pairs, error rms 0.00 max 0.00
+static const CalPoint SOIL_CURVE_POINTS[] PROGMEM = {{6780, 25600}, {16000, 0}};
+static const CalCurve SOIL_CURVE = {SOIL_CURVE_POINTS, 2};
+
+#endif
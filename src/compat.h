@@ -0,0 +1,23 @@
+#ifndef COMPAT_H
+#define COMPAT_H
+
+// Allows the portable modules to be built outside of the Arduino framework
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#define PROGMEM
+#define PGM_P const char *
+#define PSTR(s) (s)
+#define strlen_P strlen
+#define memcpy_P memcpy
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define pgm_read_ptr(addr) (*(const void *const *)(addr))
+#endif
+
+#endif
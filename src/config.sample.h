@@ -4,26 +4,79 @@
 #define DEBUG 1               // Enable/disable debug log lines
 #define ENABLE_DISPLAY_OLED 0 // Enable/disable the external OLED display
 #define ENABLE_DISPLAY_EINK 0 // Enable/disable the external E-Ink display
+#define DISPLAY_LOW_POWER 1   // Skip the status screens, only the info screen is drawn
 #define SENSOR_ID "plant"     // Add unique name for this sensor
-#define SAMPLE_INTERVAL_SEC 5 // Sample interval (i.e. the duration between ESP wake-ups)
+#define SAMPLE_INTERVAL_SEC 5 // Sample interval (i.e. the duration between ESP wake-ups) until the scheduler has some history
+
+// Batching
+#define BATCH_UPLOAD_EVERY 1 // Number of wakes between uploads (1 = upload on every wake)
+#define BATCH_MAX_SAMPLES 6  // Max number of samples buffered in RTC memory (upload when full)
+
+// Flash queue, for the samples that cannot be uploaded (e.g. WiFi or Grafana down)
+#define QUEUE_ENABLE 1           // Move the samples to flash when the RTC buffer is full, instead of dropping the oldest
+#define QUEUE_SEGMENTS 16        // Files of the queue, used as a ring (power of 2), the oldest is dropped when full
+#define QUEUE_SEGMENT_RECORDS 64 // Samples per file (22 bytes each)
+#define QUEUE_DRAIN_BATCH 10     // Samples per upload of the backlog
+#define QUEUE_DRAIN_MS 5000      // Leave the rest of the backlog to the next wake after uploading it for this long
+
+// Wake budget (whatever is left when it is spent, the device goes back to deep sleep)
+#define WAKE_BUDGET_MS 20000   // Max time awake, from boot
+#define BUDGET_WIFI_MS 8000    // Max time to associate
+#define BUDGET_NTP_MS 3000     // Max time to sync the time
+#define BUDGET_UPLOAD_MS 10000 // Max time to upload, the backlog included
+#define BUDGET_DISPLAY_MS 3000 // Time the info screen needs, it is skipped when less is left
+#define BUDGET_UPDATE_MS 10000 // Max time to download and apply a firmware update, the check is skipped when less is left
+#define BUDGET_CONFIG_MS 3000  // Max time to fetch the remote config, the check is skipped when less is left
+#define BACKOFF_MAX_WAKES 32   // Failed uploads wait 1, 2, 4, ... wakes before the next attempt, up to this many
+
+// Scheduler (set both bounds to SAMPLE_INTERVAL_SEC for a fixed interval)
+#define SCHED_MIN_INTERVAL_SEC 5        // Shortest sample interval, used when values change fast and there is enough energy
+#define SCHED_MAX_INTERVAL_SEC 60       // Longest sample interval, used when nothing changes or on low battery
+#define SCHED_LOW_BATTERY_PERC 20       // Below this battery level always use the longest interval
+#define SCHED_SOLAR_CHARGING_VOLTS 4.5  // Solar panel voltage above which the battery is considered charging
+#define SCHED_TEMP_RATE 2.0             // Temperature change considered fast (C per hour)
+#define SCHED_SOIL_RATE 5.0             // Soil moisture change considered fast (% per hour)
+
+// Deadband (a sample is only sent if some value moved beyond its band since the last sent one)
+#define DEADBAND_HEARTBEAT_SEC 3600     // Send a sample anyway after this time (0 = send every sample)
+#define DEADBAND_TEMP 0.2               // Temperature band (C)
+#define DEADBAND_HUMIDITY 1.0           // Humidity band (%)
+#define DEADBAND_SOIL_MOISTURE 1.0      // Soil moisture band (%)
+#define DEADBAND_BATTERY_VOLTS 0.05     // Battery voltage band (V)
+#define DEADBAND_SOLAR_PANEL_VOLTS 0.2  // Solar panel voltage band (V)
 
 // Sensors
-#define SOIL_MOISTURE_PIN 3    // Analog pin where soil moisture sensor is connected
-#define BATTERY_VOLT_PIN 0     // Analog pin to read battery voltage
-#define SOLAR_PANEL_VOLT_PIN 1 // Analog pin to read solar panel voltage
-#define STATUS_LED_PIN A0      // Digital pin used by the status led
+#define ADC_ADDRESSES {0x48}                 // I2C addresses of the ADS1115 (ADDR to GND 0x48, VDD 0x49, SDA 0x4A, SCL 0x4B)
+#define BATTERY_VOLT_PIN ADC_INPUT(0, 0)     // ADC input to read battery voltage (index in ADC_ADDRESSES, channel)
+#define SOLAR_PANEL_VOLT_PIN ADC_INPUT(0, 1) // ADC input to read solar panel voltage
+#define STATUS_LED_PIN A0                    // Digital pin used by the status led
+#define SENSORS_TIMEOUT_MS 500               // Max time to wait for the conversions, the sample is dropped after it
+
+// ADC filtering
+#define ADC_RATE_SPS 860          // ADS1115 data rate (8, 16, 32, 64, 128, 250, 475 or 860)
+#define ADC_SAMPLES 9             // Conversions per channel on each wake (max 16)
+#define ADC_TRIM 2                // Lowest and highest conversions dropped before averaging ((ADC_SAMPLES - 1) / 2 = median)
+#define ADC_IIR_SHIFT_SOIL 2      // Smoothing of the soil moisture across wakes, new = old + (value - old) / 2^shift (0 = off)
+#define ADC_IIR_SHIFT_BATTERY 2   // Smoothing of the battery voltage across wakes (0 = off)
+#define ADC_IIR_SHIFT_SOLAR 0     // Smoothing of the solar panel voltage across wakes (0 = off)
 
 // E-Ink Display
 #define EINK_BUSY_PIN D6  // E-Ink display Busy pin
 #define EINK_RESET_PIN D4 // E-Ink display Reset pin
 #define EINK_DC_PIN D3    // E-Ink display D/C pin
+#define EINK_FULL_REFRESH_EVERY 20 // Full refresh (clears the ghosting) every this many refreshes, partial ones in between
+#define EINK_PAGE_HEIGHT 50        // Panel rows drawn at a time, the page buffer takes 25 bytes per row
 
-// Sensors const
-#define BATTERY_MIN_VOLTS 2.8 // Minimum battery voltage level
-#define BATTERY_MAX_VOLTS 4.2 // Maximum battery voltage level
+// Soil moisture probes (up to 4): ADC input, calibration curve (generated by tools/calibrate.py from assets/calibration/).
+// Each other probe takes 8 bytes of RTC memory plus 2 per buffered sample, e.g. 4 probes need BATCH_MAX_SAMPLES 3.
+#define SOIL_PROBES {{ADC_INPUT(0, 3), &SOIL_CURVE}}
 
-#define AIR_MOISTURE_VAL 16000  // Value given by the soil moisture in the air (empirically calculated)
-#define WATER_MOISTURE_VAL 6780 // Value given by the soil moisture in the water (empirically calculated)
+// Exporters (any combination, they run in this order on upload)
+#define EXPORT_GRAPHITE 1   // Metrics and trace to Grafana Cloud Graphite
+#define EXPORT_PROMETHEUS 0 // Same metrics and trace with Prometheus remote write
+#define EXPORT_LOKI 1       // Log lines to Grafana Cloud Loki
+#define EXPORT_RELAY 0      // Samples and trace in a UDP frame to the relay (see src/relay/)
+#define EXPORT_MQTT 0       // Samples and trace published to an MQTT broker
 
 // Loki client
 // Follow https://grafana.com/blog/2021/03/08/how-i-built-a-monitoring-system-for-my-avocado-plant-with-arduino-and-grafana-cloud/?src=email&cnt=trial-started&camp=grafana-cloud-trial
@@ -34,3 +87,53 @@
 #define GC_GRAPHITE_URL "something.grafana.net"
 #define GC_GRAPHITE_USER ""
 #define GC_GRAPHITE_PASS ""
+// Prometheus remote write client (same series as Graphite, protobuf + snappy)
+#define GC_PROM_URL "something.grafana.net"
+#define GC_PROM_PATH "/api/prom/push"
+#define GC_PROM_USER ""
+#define GC_PROM_PASS ""
+
+// Relay (compact binary frames over UDP to a relay on the local network)
+#define RELAY_HOST "192.168.1.2"    // Address of the relay
+#define RELAY_PORT 9500             // UDP port of the relay
+#define RELAY_ACK_TIMEOUT_MS 300    // Max time to wait for the acknowledgment of a frame
+#define RELAY_ATTEMPTS 3            // Frames sent before giving up
+// The relay acknowledges a frame once queued: frames it cannot forward after its requeues are lost
+
+// MQTT (the relay frame, QoS 1, persistent session with the sensor id as client id)
+#define MQTT_HOST "192.168.1.2"     // Address of the broker
+#define MQTT_PORT 1883              // TCP port of the broker (no TLS)
+#define MQTT_USER ""                // Empty = anonymous
+#define MQTT_PASS ""
+#define MQTT_TOPIC_PREFIX "plants/" // Followed by the sensor id
+#define MQTT_TIMEOUT_MS 2000        // Max time to wait for each reply of the broker
+#define MQTT_KEEP_ALIVE_SEC 60      // Keep alive of the connection, it only lasts for an upload
+
+// Firmware updates (patches from the running image, served by tools/delta.py serve over plain HTTP)
+#define OTA_ENABLE 0            // Check for an update while uploading, once per OTA_CHECK_SEC
+#define OTA_HOST "192.168.1.2"  // Address of the update server
+#define OTA_PORT 8266           // TCP port of the update server
+#define OTA_PATH "/update"
+#define OTA_CHECK_SEC 86400     // Time between checks, spread over the period by the sensor id
+
+// Remote configuration (settings pulled from a server on the local network, see src/remoteconfig.h)
+#define CONFIG_ENABLE 0           // Check for a new document every CONFIG_CHECK_WAKES wakes, the settings are cached in flash
+#define CONFIG_HOST "192.168.1.2" // Address of the config server
+#define CONFIG_PORT 8080          // TCP port of the config server
+#define CONFIG_PATH "/plants/"    // Followed by the sensor id
+#define CONFIG_CHECK_WAKES 60     // Wakes between checks (max 255), an unchanged document costs a 304 and no body
+
+// Time
+#define TIME_RESYNC_SEC 14400    // Max time between NTP syncs
+#define TIME_MAX_ERROR_MS 5000   // Sync with NTP earlier if the estimated time error grows over this bound
+#define TIME_NTP_ATTEMPTS 3      // NTP requests before giving up (1 sec timeout each)
+
+// Network
+#define NET_FAST_CONNECT_TIMEOUT_MS 3000 // Max time to reconnect with the cached access point and lease before falling back to a full connection
+#define NET_CACHE_BACKENDS 0             // Connect to the cached backend addresses skipping DNS (TLS handshake is done without SNI)
+
+// TLS
+#define TLS_SESSION_FLASH 1 // Keep a copy of the TLS sessions in flash to resume them after a power loss
+
+// Trace
+#define TRACE_ENABLE 1 // Send the duration and heap use of each phase of the wake cycle to Graphite (trace.*)
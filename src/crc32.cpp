@@ -0,0 +1,16 @@
+#include "crc32.h"
+
+uint32_t crc32(const uint8_t *data, size_t length, uint32_t crc)
+{
+  crc = ~crc;
+  while (length--)
+  {
+    crc ^= *data++;
+    for (uint8_t i = 0; i < 8; i++)
+    {
+      crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+    }
+  }
+
+  return ~crc;
+}
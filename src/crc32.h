@@ -0,0 +1,9 @@
+#ifndef CRC32_H
+#define CRC32_H
+
+#include "compat.h"
+
+// CRC-32 (zlib), continued from the CRC of the previous bytes if given
+uint32_t crc32(const uint8_t *data, size_t length, uint32_t crc = 0);
+
+#endif
@@ -0,0 +1,58 @@
+#include "deadband.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+static bool outside(float value, float last, float band)
+{
+  return fabsf(value - last) > band;
+}
+
+bool deadbandExpired(const DeadbandState &state, uint32_t now, uint32_t heartbeatSec)
+{
+  return heartbeatSec == 0 || !state.valid || now == 0 || now - state.ts >= heartbeatSec;
+}
+
+bool deadbandChanged(const DeadbandState &state, const Sample &sample, uint32_t now, const DeadbandConfig &config)
+{
+  if (deadbandExpired(state, now, config.heartbeatSec))
+  {
+    return true;
+  }
+
+  for (uint8_t p = 0; p < SOIL_PROBE_COUNT; p++)
+  {
+    if (soilChange(p, state.soilRaw[p], sample.soil[p].raw) > config.soilMoisture)
+    {
+      return true;
+    }
+  }
+
+  return outside(sample.air.temp, state.temp / 100.0, config.temp) ||
+         outside(sample.air.humidity, state.humidity / 100.0, config.humidity) ||
+         outside(sample.battery.raw, state.batteryMilliVolts / 1000.0, config.batteryVolts) ||
+         outside(sample.solarPanelVolt, state.solarPanelMilliVolts / 1000.0, config.solarPanelVolts);
+}
+
+void deadbandSent(DeadbandState &state, const Sample &sample)
+{
+  state.ts = sample.ts;
+  state.temp = lroundf(sample.air.temp * 100);
+  state.humidity = lroundf(sample.air.humidity * 100);
+  for (uint8_t p = 0; p < SOIL_PROBE_COUNT; p++)
+  {
+    state.soilRaw[p] = sample.soil[p].raw;
+  }
+  state.batteryMilliVolts = lroundf(sample.battery.raw * 1000);
+  state.solarPanelMilliVolts = lroundf(sample.solarPanelVolt * 1000);
+  state.valid = 1;
+  state.suppressed = 0;
+}
+
+void deadbandSuppressed(DeadbandState &state)
+{
+  if (state.suppressed < UINT8_MAX)
+  {
+    state.suppressed++;
+  }
+}
@@ -0,0 +1,42 @@
+#ifndef DEADBAND_H
+#define DEADBAND_H
+
+#include "compat.h"
+#include "probes.h"
+#include "sample.h"
+
+// Last sent values, stored in RTC memory
+struct DeadbandState
+{
+  uint32_t ts;
+  int16_t temp;      // 1/100 C
+  uint16_t humidity; // 1/100 %
+  int16_t soilRaw[SOIL_PROBE_COUNT];
+  uint16_t batteryMilliVolts;
+  uint16_t solarPanelMilliVolts;
+  uint8_t valid;
+  uint8_t suppressed; // Samples not sent since the last sent one, saturated
+};
+
+// Changes beyond which a sample is sent
+struct DeadbandConfig
+{
+  uint32_t heartbeatSec; // Send a sample anyway after this time (0 = send every sample)
+  float temp;            // C
+  float humidity;        // %
+  float soilMoisture;    // %
+  float batteryVolts;
+  float solarPanelVolts;
+};
+
+// Whether a sample must be sent regardless of its values. now is the current epoch, 0 if unknown.
+bool deadbandExpired(const DeadbandState &state, uint32_t now, uint32_t heartbeatSec);
+// Whether some value moved beyond its deadband since the last sent sample, or the heartbeat
+// expired. now is the current epoch, 0 if unknown.
+bool deadbandChanged(const DeadbandState &state, const Sample &sample, uint32_t now, const DeadbandConfig &config);
+// The sample is going to be sent
+void deadbandSent(DeadbandState &state, const Sample &sample);
+// The sample was dropped
+void deadbandSuppressed(DeadbandState &state);
+
+#endif
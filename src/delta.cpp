@@ -0,0 +1,299 @@
+#include "delta.h"
+
+#include "crc32.h"
+
+static uint32_t readLe32(const uint8_t *p)
+{
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+DeltaPatch::DeltaPatch(FirmwareHal &firmware, uint32_t imageCrc)
+    : firmware(firmware), imageSize(firmware.imageSize()), imageCrc(imageCrc), state(DELTA_HEADER), started(false),
+      headerLength(0), header(), value(0), shift(0), addLeft(0), extraLeft(0), runLeft(0), seek(0), oldPos(0),
+      written(0), crc(0), blockLength(0), oldCacheStart(0), oldCacheLength(0)
+{
+}
+
+bool DeltaPatch::feed(const uint8_t *data, size_t length)
+{
+  for (size_t i = 0; i < length && state != DELTA_FAILED; i++)
+  {
+    uint8_t byte = data[i];
+    switch (state)
+    {
+    case DELTA_HEADER:
+      headerBytes[headerLength++] = byte;
+      if (headerLength == DELTA_HEADER_SIZE && !begin())
+      {
+        abort();
+      }
+      break;
+
+    case DELTA_ADD_LENGTH:
+      if (varint(byte))
+      {
+        addLeft = value;
+        state = DELTA_EXTRA_LENGTH;
+      }
+      break;
+
+    case DELTA_EXTRA_LENGTH:
+      if (varint(byte))
+      {
+        extraLeft = value;
+        state = DELTA_SEEK;
+      }
+      break;
+
+    case DELTA_SEEK:
+      if (varint(byte))
+      {
+        seek = (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+        if (addLeft > header.newSize - written || extraLeft > header.newSize - written - addLeft ||
+            addLeft + extraLeft == 0)
+        {
+          abort();
+        }
+        else if (addLeft > 0)
+        {
+          state = DELTA_ZEROS;
+        }
+        else
+        {
+          addDone();
+        }
+      }
+      break;
+
+    case DELTA_ZEROS:
+      if (varint(byte))
+      {
+        if (value > addLeft)
+        {
+          abort();
+          break;
+        }
+        // Unchanged bytes of the old image
+        addLeft -= value;
+        while (value-- > 0 && state != DELTA_FAILED)
+        {
+          emit(oldByte());
+        }
+        if (state != DELTA_FAILED)
+        {
+          if (addLeft > 0)
+          {
+            state = DELTA_LITERALS;
+          }
+          else
+          {
+            addDone();
+          }
+        }
+      }
+      break;
+
+    case DELTA_LITERALS:
+      if (varint(byte))
+      {
+        if (value == 0 || value > addLeft)
+        {
+          abort();
+          break;
+        }
+        runLeft = value;
+        state = DELTA_DIFF;
+      }
+      break;
+
+    case DELTA_DIFF:
+      emit(oldByte() + byte);
+      addLeft--;
+      if (--runLeft == 0 && state != DELTA_FAILED)
+      {
+        if (addLeft > 0)
+        {
+          state = DELTA_ZEROS;
+        }
+        else
+        {
+          addDone();
+        }
+      }
+      break;
+
+    case DELTA_EXTRA:
+      emit(byte);
+      if (--extraLeft == 0 && state != DELTA_FAILED)
+      {
+        commandDone();
+      }
+      break;
+
+    case DELTA_DONE:
+      // Trailing bytes
+      abort();
+      break;
+
+    case DELTA_FAILED:
+      break;
+    }
+  }
+
+  return state != DELTA_FAILED;
+}
+
+bool DeltaPatch::finish()
+{
+  // The last block completes the staged image, only written if the CRC of the image matches
+  if (state != DELTA_DONE || crc32(block, blockLength, crc) != header.newCrc || !firmware.writeUpdate(block, blockLength))
+  {
+    abort();
+    return false;
+  }
+
+  started = false;
+  return firmware.endUpdate(true);
+}
+
+void DeltaPatch::abort()
+{
+  if (started)
+  {
+    firmware.endUpdate(false);
+    started = false;
+  }
+  state = DELTA_FAILED;
+}
+
+// Methods --------------------------------------------------------------------
+
+bool DeltaPatch::begin()
+{
+  header = {readLe32(headerBytes + 4), readLe32(headerBytes + 8), readLe32(headerBytes + 12), readLe32(headerBytes + 16)};
+  if (readLe32(headerBytes) != DELTA_MAGIC || header.oldSize != imageSize || header.oldCrc != imageCrc ||
+      header.newSize == 0)
+  {
+    return false;
+  }
+
+  if (!firmware.beginUpdate(header.newSize))
+  {
+    return false;
+  }
+  started = true;
+  state = DELTA_ADD_LENGTH;
+
+  return true;
+}
+
+bool DeltaPatch::varint(uint8_t byte)
+{
+  if (shift == 0)
+  {
+    value = 0;
+  }
+  else if (shift > 28)
+  {
+    abort();
+    return false;
+  }
+
+  value |= (uint32_t)(byte & 0x7f) << shift;
+  shift += 7;
+  if (byte & 0x80)
+  {
+    return false;
+  }
+
+  shift = 0;
+  return true;
+}
+
+void DeltaPatch::addDone()
+{
+  if (extraLeft > 0)
+  {
+    state = DELTA_EXTRA;
+  }
+  else
+  {
+    commandDone();
+  }
+}
+
+void DeltaPatch::commandDone()
+{
+  oldPos += seek;
+  state = written == header.newSize ? DELTA_DONE : DELTA_ADD_LENGTH;
+}
+
+uint8_t DeltaPatch::oldByte()
+{
+  if (oldPos >= imageSize)
+  {
+    abort();
+    return 0;
+  }
+
+  if (oldPos - oldCacheStart >= oldCacheLength)
+  {
+    // Word aligned reads
+    oldCacheStart = oldPos & ~3UL;
+    oldCacheLength = imageSize - oldCacheStart < DELTA_OLD_CACHE_SIZE ? imageSize - oldCacheStart : DELTA_OLD_CACHE_SIZE;
+    if (!firmware.readImage(oldCacheStart, oldCache, oldCacheLength))
+    {
+      oldCacheLength = 0;
+      abort();
+      return 0;
+    }
+  }
+
+  return oldCache[oldPos++ - oldCacheStart];
+}
+
+void DeltaPatch::emit(uint8_t byte)
+{
+  if (state == DELTA_FAILED)
+  {
+    return;
+  }
+
+  // A full block is only written once more bytes follow, the last one waits for the CRC
+  if (blockLength == DELTA_BLOCK_SIZE && !flush())
+  {
+    abort();
+    return;
+  }
+
+  block[blockLength++] = byte;
+  written++;
+}
+
+bool DeltaPatch::flush()
+{
+  crc = crc32(block, blockLength, crc);
+  bool ok = firmware.writeUpdate(block, blockLength);
+  blockLength = 0;
+
+  return ok;
+}
+
+// 0 if the image cannot be read, no patch matches it then
+uint32_t runningImageCrc(FirmwareHal &firmware)
+{
+  uint8_t buffer[DELTA_BLOCK_SIZE];
+  uint32_t size = firmware.imageSize();
+  uint32_t crc = 0;
+  for (uint32_t offset = 0; offset < size; offset += sizeof(buffer))
+  {
+    size_t length = size - offset < sizeof(buffer) ? size - offset : sizeof(buffer);
+    if (!firmware.readImage(offset, buffer, length))
+    {
+      return 0;
+    }
+    crc = crc32(buffer, length, crc);
+  }
+
+  return crc;
+}
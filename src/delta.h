@@ -0,0 +1,100 @@
+#ifndef DELTA_H
+#define DELTA_H
+
+#include "compat.h"
+#include "hal.h"
+
+// Binary patch from the running image to the next one, made by tools/delta.py (bsdiff-like).
+//   header    "PDLT", then the size and CRC-32 of the old image and of the new one (u32 LE)
+//   commands  until the new image is complete: add length, extra length and seek (varints,
+//             7 bits per byte, low first, the seek zigzag encoded), the add bytes, the extras
+// The add bytes are the new ones minus the old ones from the old position, mostly zero: they
+// are coded as a run of zeros (varint), then a run of literals (varint and the bytes), and so
+// on, the literal count being left out after the zeros that end them. The extras are copied
+// as they are. The old position moves on with the add bytes, then by the seek.
+#define DELTA_MAGIC 0x544c4450 // "PDLT"
+#define DELTA_HEADER_SIZE 20
+#define DELTA_BLOCK_SIZE 256    // Bytes of the new image written at a time
+#define DELTA_OLD_CACHE_SIZE 64 // Bytes of the old image read at a time
+
+// Applies a patch as it streams in, writing the new image to the staging area. The last block
+// is only written once the CRC of the whole image matched, the staged image can be dropped
+// until then.
+class DeltaPatch
+{
+public:
+  // The patch must be made against the running image, of the given CRC
+  DeltaPatch(FirmwareHal &firmware, uint32_t imageCrc);
+
+  // Apply the next bytes of the patch, return false if it cannot be applied
+  bool feed(const uint8_t *data, size_t length);
+  // Whether the whole new image was produced
+  bool complete() const { return state == DELTA_DONE; }
+  // Check the new image and commit it, drop it otherwise
+  bool finish();
+  // Drop the staged image
+  void abort();
+
+  uint32_t newSize() const { return header.newSize; }
+  uint32_t newCrc() const { return header.newCrc; }
+
+private:
+  enum State : uint8_t
+  {
+    DELTA_HEADER,
+    DELTA_ADD_LENGTH,
+    DELTA_EXTRA_LENGTH,
+    DELTA_SEEK,
+    DELTA_ZEROS,
+    DELTA_LITERALS,
+    DELTA_DIFF,
+    DELTA_EXTRA,
+    DELTA_DONE,
+    DELTA_FAILED
+  };
+
+  struct Header
+  {
+    uint32_t oldSize;
+    uint32_t oldCrc;
+    uint32_t newSize;
+    uint32_t newCrc;
+  };
+
+  bool begin();
+  // Accumulate a varint, return true once it is complete
+  bool varint(uint8_t byte);
+  void addDone();
+  void commandDone();
+  uint8_t oldByte();
+  void emit(uint8_t byte);
+  bool flush();
+
+  FirmwareHal &firmware;
+  uint32_t imageSize;
+  uint32_t imageCrc;
+  State state;
+  bool started; // The staging area is in use
+  uint8_t headerBytes[DELTA_HEADER_SIZE];
+  uint8_t headerLength;
+  Header header;
+  uint32_t value; // Varint being read
+  uint8_t shift;
+  uint32_t addLeft;
+  uint32_t extraLeft;
+  uint32_t runLeft;
+  int32_t seek;
+  uint32_t oldPos;
+  uint32_t written; // Bytes of the new image produced
+  uint32_t crc;     // Of the blocks written
+  uint8_t block[DELTA_BLOCK_SIZE];
+  uint16_t blockLength;
+  uint8_t oldCache[DELTA_OLD_CACHE_SIZE];
+  uint32_t oldCacheStart;
+  uint16_t oldCacheLength;
+};
+
+// CRC-32 of the running image
+uint32_t runningImageCrc(FirmwareHal &firmware);
+
+#endif
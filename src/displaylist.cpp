@@ -0,0 +1,114 @@
+#include "displaylist.h"
+
+#include <string.h>
+
+DisplayItem displayImage(int16_t x, int16_t y, const RleImage &image)
+{
+  DisplayItem item = {};
+  item.box = {x, y, (int16_t)(x + image.width), (int16_t)(y + image.height)};
+  item.x = x;
+  item.y = y;
+  item.image = &image;
+
+  return item;
+}
+
+DisplayItem displayText(int16_t x, int16_t y, const void *font, const char *text, const DisplayRect &box)
+{
+  DisplayItem item = {};
+  item.box = box;
+  item.x = x;
+  item.y = y;
+  item.font = font;
+  strncpy(item.text, text, sizeof(item.text) - 1);
+
+  return item;
+}
+
+bool displayIntersects(const DisplayRect &a, const DisplayRect &b)
+{
+  return a.x0 < b.x1 && b.x0 < a.x1 && a.y0 < b.y1 && b.y0 < a.y1;
+}
+
+void displayCover(DisplayRect &rect, const DisplayRect &other)
+{
+  rect.x0 = other.x0 < rect.x0 ? other.x0 : rect.x0;
+  rect.y0 = other.y0 < rect.y0 ? other.y0 : rect.y0;
+  rect.x1 = other.x1 > rect.x1 ? other.x1 : rect.x1;
+  rect.y1 = other.y1 > rect.y1 ? other.y1 : rect.y1;
+}
+
+DisplayList::DisplayList() : count(0)
+{
+}
+
+void DisplayList::clear()
+{
+  count = 0;
+}
+
+bool DisplayList::add(const DisplayItem &item)
+{
+  if (count >= DISPLAY_LIST_SIZE)
+  {
+    return false;
+  }
+
+  items[count++] = item;
+  return true;
+}
+
+uint8_t DisplayList::replay(DisplayCanvas &canvas, const DisplayRect &clip) const
+{
+  canvas.clear();
+
+  uint8_t drawn = 0;
+  for (uint8_t i = 0; i < count; i++)
+  {
+    const DisplayItem &item = items[i];
+    if (!displayIntersects(item.box, clip))
+    {
+      continue;
+    }
+
+    if (item.image)
+    {
+      drawImage(canvas, item, clip);
+    }
+    else
+    {
+      canvas.drawText(item);
+    }
+    drawn++;
+  }
+
+  return drawn;
+}
+
+void DisplayList::drawImage(DisplayCanvas &canvas, const DisplayItem &item, const DisplayRect &clip) const
+{
+  // The runs are still decoded for each page, but only those in the clip reach the display
+  RleReader reader(*item.image);
+  RleRun run;
+  while (reader.next(run))
+  {
+    int16_t y = item.y + run.y;
+    if (y >= clip.y1)
+    {
+      break;
+    }
+    if (run.white || y < clip.y0)
+    {
+      continue;
+    }
+
+    int16_t x0 = item.x + run.x;
+    int16_t x1 = x0 + run.length;
+    x0 = x0 < clip.x0 ? clip.x0 : x0;
+    x1 = x1 > clip.x1 ? clip.x1 : x1;
+    if (x0 < x1)
+    {
+      canvas.drawRun(x0, y, x1 - x0);
+    }
+  }
+}
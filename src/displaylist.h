@@ -0,0 +1,73 @@
+#ifndef DISPLAYLIST_H
+#define DISPLAYLIST_H
+
+#include "compat.h"
+#include "rle.h"
+
+// Frame laid out once (text measured, positions computed) and replayed for each page of a
+// paged display, drawing only the items that intersect the page.
+
+#define DISPLAY_LIST_SIZE 8  // Items of a frame
+#define DISPLAY_TEXT_SIZE 24 // Longest text + 1
+
+// Screen area, x1 and y1 excluded
+struct DisplayRect
+{
+  int16_t x0;
+  int16_t y0;
+  int16_t x1;
+  int16_t y1;
+};
+
+// Text run or image, with the area it covers
+struct DisplayItem
+{
+  DisplayRect box;
+  int16_t x; // Text cursor or image corner
+  int16_t y;
+  const RleImage *image; // nullptr for text
+  const void *font;      // Opaque to the list, used by the canvas
+  char text[DISPLAY_TEXT_SIZE];
+};
+
+// Drawing primitives of the display, clipped to the current page by the display itself
+class DisplayCanvas
+{
+public:
+  // Page all white
+  virtual void clear() = 0;
+  // Black run of pixels on a row
+  virtual void drawRun(int16_t x, int16_t y, int16_t length) = 0;
+  virtual void drawText(const DisplayItem &item) = 0;
+};
+
+DisplayItem displayImage(int16_t x, int16_t y, const RleImage &image);
+// The box comes from the font metrics, known to the display only
+DisplayItem displayText(int16_t x, int16_t y, const void *font, const char *text, const DisplayRect &box);
+
+bool displayIntersects(const DisplayRect &a, const DisplayRect &b);
+// Grow rect to cover other
+void displayCover(DisplayRect &rect, const DisplayRect &other);
+
+class DisplayList
+{
+public:
+  DisplayList();
+
+  void clear();
+  // Return false if the list is full
+  bool add(const DisplayItem &item);
+  uint8_t size() const { return count; }
+
+  // Clear the page and draw the items intersecting clip, in order. Only the black runs of
+  // the images are drawn. Return the number of items drawn.
+  uint8_t replay(DisplayCanvas &canvas, const DisplayRect &clip) const;
+
+private:
+  void drawImage(DisplayCanvas &canvas, const DisplayItem &item, const DisplayRect &clip) const;
+
+  DisplayItem items[DISPLAY_LIST_SIZE];
+  uint8_t count;
+};
+
+#endif
@@ -0,0 +1,235 @@
+#include "exporter.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "config.h"
+#include "frame.h"
+#include "mqtt.h"
+#include "payload.h"
+#include "remotewrite.h"
+
+static const char *const EXPORTER_NAMES[EXPORTER_COUNT] = {"graphite", "prometheus", "loki", "relay", "mqtt"};
+
+// Exporter -------------------------------------------------------------------
+
+const char *Exporter::name() const
+{
+  return EXPORTER_NAMES[id];
+}
+
+bool Exporter::post(Backend backend, size_t length)
+{
+  int httpCode = context.network.post(backend, context.buffer, length, context.budget.left());
+  log("%s [HTTPS] POST...  Code: %d", name(), httpCode);
+
+  return httpCode >= 200 && httpCode < 300;
+}
+
+void Exporter::log(const char *format, ...)
+{
+  char text[128];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(text, sizeof(text), format, args);
+  va_end(args);
+
+  context.system.log(text);
+}
+
+// HTTP -----------------------------------------------------------------------
+
+bool GraphiteExporter::send(const Sample *samples, size_t count, const Trace *trace)
+{
+  // Build hosted metrics json payload
+  size_t length = buildGraphitePayload(context.buffer, context.bufferSize, samples, count, trace);
+  if (length == 0)
+  {
+    log("Graphite payload does not fit in buffer");
+    return false;
+  }
+
+  return post(BACKEND_GRAPHITE, length);
+}
+
+bool PrometheusExporter::send(const Sample *samples, size_t count, const Trace *trace)
+{
+  size_t length = buildRemoteWritePayload((uint8_t *)context.buffer, context.bufferSize, samples, count, trace, context.sensorId);
+  if (length == 0)
+  {
+    log("Remote write payload does not fit in buffer");
+    return false;
+  }
+
+  return post(BACKEND_PROMETHEUS, length);
+}
+
+bool LokiExporter::send(const Sample *samples, size_t count, const Trace *trace)
+{
+  size_t length = buildLokiPayload(context.buffer, context.bufferSize, samples, count, context.sensorId, LOKI_MESSAGE);
+  if (length == 0)
+  {
+    log("Loki payload does not fit in buffer");
+    return false;
+  }
+
+  return post(BACKEND_LOKI, length);
+}
+
+// Relay ----------------------------------------------------------------------
+
+bool RelayExporter::send(const Sample *samples, size_t count, const Trace *trace)
+{
+  uint8_t *frame = (uint8_t *)context.buffer;
+  size_t length = encodeFrame(frame, context.bufferSize, context.sensorId, samples, count, trace);
+  if (length == 0)
+  {
+    log("Relay frame does not fit in buffer");
+    return false;
+  }
+
+  // The frame is sent again until acknowledged, the relay drops duplicates
+  for (uint8_t i = 0; i < RELAY_ATTEMPTS; i++)
+  {
+    uint8_t ack[FRAME_ACK_SIZE];
+    size_t ackLength = context.network.exchangeRelay(frame, length, ack, sizeof(ack));
+    if (frameAckMatches(ack, ackLength, frame, length))
+    {
+      log("Relay frame acknowledged (%u bytes)", (unsigned)length);
+      return true;
+    }
+  }
+
+  log("Relay frame not acknowledged");
+  return false;
+}
+
+// MQTT -----------------------------------------------------------------------
+
+bool MqttExporter::send(const Sample *samples, size_t count, const Trace *trace)
+{
+  char topic[sizeof(MQTT_TOPIC_PREFIX) + FRAME_MAX_ID_LENGTH];
+  snprintf(topic, sizeof(topic), "%s%s", MQTT_TOPIC_PREFIX, context.sensorId);
+
+  // CONNECT and PUBLISH are written at once, a client does not have to wait for the CONNACK
+  uint8_t *buffer = (uint8_t *)context.buffer;
+  size_t connectLength = mqttConnect(buffer, context.bufferSize, context.sensorId, MQTT_USER, MQTT_PASS, MQTT_KEEP_ALIVE_SEC, false);
+  size_t headerSize = MQTT_PUBLISH_HEADER_SIZE(strlen(topic));
+  size_t frameLength = 0;
+  if (connectLength > 0 && connectLength + headerSize < context.bufferSize)
+  {
+    frameLength = encodeFrame(buffer + connectLength + headerSize, context.bufferSize - connectLength - headerSize, context.sensorId, samples, count, trace);
+  }
+  if (frameLength == 0)
+  {
+    log("MQTT message does not fit in buffer");
+    return false;
+  }
+
+  // Only has to differ from the packets still in flight, the crc of the frame will do
+  const uint8_t *crc = buffer + connectLength + headerSize + frameLength - 4;
+  uint16_t packetId = (crc[0] | crc[1] << 8) % 65535 + 1;
+
+  // The header length depends on the payload length, move the frame right after it
+  size_t headerLength = mqttPublishHeader(buffer + connectLength, headerSize, topic, frameLength, packetId);
+  memmove(buffer + connectLength + headerLength, buffer + connectLength + headerSize, frameLength);
+
+  if (!context.network.openStream(MQTT_HOST, MQTT_PORT))
+  {
+    log("MQTT broker not reachable");
+    return false;
+  }
+
+  bool sent = publish(connectLength + headerLength + frameLength, packetId);
+
+  uint8_t disconnect[MQTT_DISCONNECT_SIZE];
+  context.network.writeStream(disconnect, mqttDisconnect(disconnect, sizeof(disconnect)));
+  context.network.closeStream();
+
+  return sent;
+}
+
+bool MqttExporter::publish(size_t length, uint16_t packetId)
+{
+  if (!context.network.writeStream((const uint8_t *)context.buffer, length))
+  {
+    log("MQTT write failed");
+    return false;
+  }
+
+  uint8_t reply[MQTT_CONNACK_SIZE > MQTT_PUBACK_SIZE ? MQTT_CONNACK_SIZE : MQTT_PUBACK_SIZE];
+  bool sessionPresent;
+  uint8_t returnCode;
+  if (!context.network.readStream(reply, MQTT_CONNACK_SIZE, MQTT_TIMEOUT_MS) || !mqttParseConnack(reply, sessionPresent, returnCode))
+  {
+    log("MQTT CONNACK not received");
+    return false;
+  }
+  if (returnCode != 0)
+  {
+    // The broker closes the connection without reading the PUBLISH
+    log("MQTT connection refused, code: %u", returnCode);
+    return false;
+  }
+  if (!sessionPresent)
+  {
+    log("MQTT session created");
+  }
+
+  uint16_t ackedId;
+  if (!context.network.readStream(reply, MQTT_PUBACK_SIZE, MQTT_TIMEOUT_MS) || !mqttParsePuback(reply, ackedId) || ackedId != packetId)
+  {
+    log("MQTT message not acknowledged");
+    return false;
+  }
+
+  log("MQTT message acknowledged (%u bytes)", (unsigned)length);
+  return true;
+}
+
+// Registry -------------------------------------------------------------------
+
+ExporterRegistry::ExporterRegistry(const ExportContext &context)
+    : graphite(context), prometheus(context), loki(context), relay(context), mqtt(context)
+{
+}
+
+Exporter &ExporterRegistry::get(ExporterId id)
+{
+  switch (id)
+  {
+  case EXPORTER_PROMETHEUS:
+    return prometheus;
+  case EXPORTER_LOKI:
+    return loki;
+  case EXPORTER_RELAY:
+    return relay;
+  case EXPORTER_MQTT:
+    return mqtt;
+  default:
+    return graphite;
+  }
+}
+
+bool parseExporters(const char *names, uint8_t &mask)
+{
+  mask = 0;
+  while (*names)
+  {
+    size_t length = strcspn(names, ",");
+    uint8_t id = 0;
+    while (id < EXPORTER_COUNT && (strlen(EXPORTER_NAMES[id]) != length || strncmp(names, EXPORTER_NAMES[id], length) != 0))
+    {
+      id++;
+    }
+    if (id == EXPORTER_COUNT)
+    {
+      return false;
+    }
+
+    mask |= EXPORTER_BIT(id);
+    names += length + (names[length] == ',' ? 1 : 0);
+  }
+
+  return true;
+}
@@ -0,0 +1,133 @@
+#ifndef EXPORTER_H
+#define EXPORTER_H
+
+#include "budget.h"
+#include "compat.h"
+#include "hal.h"
+#include "sample.h"
+#include "trace.h"
+
+#define LOKI_MESSAGE "New_samples!"
+
+// Exporters in the order they run on upload
+enum ExporterId
+{
+  EXPORTER_GRAPHITE,
+  EXPORTER_PROMETHEUS,
+  EXPORTER_LOKI,
+  EXPORTER_RELAY,
+  EXPORTER_MQTT,
+  EXPORTER_COUNT
+};
+
+#define EXPORTER_BIT(id) (1 << (id))
+
+// What the exporters share: the network, the log, the budget of the upload and the buffer of the payloads
+struct ExportContext
+{
+  NetworkHal &network;
+  SystemHal &system;
+  WakeBudget &budget;
+  const char *sensorId;
+  char *buffer; // Only one payload is built at a time
+  size_t bufferSize;
+};
+
+// Sends the buffered samples to a backend
+class Exporter
+{
+public:
+  Exporter(const ExportContext &context, ExporterId id) : context(context), id(id) {}
+
+  const char *name() const;
+  virtual TracePhase phase() const = 0;
+  // Whether the trace is sent along with the samples
+  virtual bool tracing() const { return false; }
+  // Return true once the backend accepted the samples
+  virtual bool send(const Sample *samples, size_t count, const Trace *trace) = 0;
+
+protected:
+  // POST the payload in the buffer, true on a 2xx code
+  bool post(Backend backend, size_t length);
+  void log(const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+  ExportContext context;
+  ExporterId id;
+};
+
+class GraphiteExporter : public Exporter
+{
+public:
+  GraphiteExporter(const ExportContext &context) : Exporter(context, EXPORTER_GRAPHITE) {}
+
+  TracePhase phase() const override { return TRACE_GRAPHITE; }
+  bool tracing() const override { return true; }
+  bool send(const Sample *samples, size_t count, const Trace *trace) override;
+};
+
+// Same series as Graphite, with Prometheus remote write
+class PrometheusExporter : public Exporter
+{
+public:
+  PrometheusExporter(const ExportContext &context) : Exporter(context, EXPORTER_PROMETHEUS) {}
+
+  TracePhase phase() const override { return TRACE_PROMETHEUS; }
+  bool tracing() const override { return true; }
+  bool send(const Sample *samples, size_t count, const Trace *trace) override;
+};
+
+class LokiExporter : public Exporter
+{
+public:
+  LokiExporter(const ExportContext &context) : Exporter(context, EXPORTER_LOKI) {}
+
+  TracePhase phase() const override { return TRACE_LOKI; }
+  bool send(const Sample *samples, size_t count, const Trace *trace) override;
+};
+
+// A single frame with the samples and the trace, forwarded by the relay to Graphite and Loki
+class RelayExporter : public Exporter
+{
+public:
+  RelayExporter(const ExportContext &context) : Exporter(context, EXPORTER_RELAY) {}
+
+  TracePhase phase() const override { return TRACE_RELAY; }
+  bool tracing() const override { return true; }
+  bool send(const Sample *samples, size_t count, const Trace *trace) override;
+};
+
+// The relay frame published with QoS 1 on MQTT_TOPIC_PREFIX + sensor id. The session is
+// persistent, so the broker keeps the messages for the subscribers that are offline.
+class MqttExporter : public Exporter
+{
+public:
+  MqttExporter(const ExportContext &context) : Exporter(context, EXPORTER_MQTT) {}
+
+  TracePhase phase() const override { return TRACE_MQTT; }
+  bool tracing() const override { return true; }
+  bool send(const Sample *samples, size_t count, const Trace *trace) override;
+
+private:
+  bool publish(size_t length, uint16_t packetId);
+};
+
+// All the exporters, without any allocation. The enabled ones are a bit mask of EXPORTER_BIT().
+class ExporterRegistry
+{
+public:
+  ExporterRegistry(const ExportContext &context);
+
+  Exporter &get(ExporterId id);
+
+private:
+  GraphiteExporter graphite;
+  PrometheusExporter prometheus;
+  LokiExporter loki;
+  RelayExporter relay;
+  MqttExporter mqtt;
+};
+
+// Parse a comma separated list of exporter names, return false on an unknown name
+bool parseExporters(const char *names, uint8_t &mask);
+
+#endif
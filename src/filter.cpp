@@ -0,0 +1,60 @@
+#include "filter.h"
+
+static void sortValues(int16_t *values, uint8_t count)
+{
+  // Insertion sort, bursts are short
+  for (uint8_t i = 1; i < count; i++)
+  {
+    int16_t value = values[i];
+    uint8_t j = i;
+    while (j > 0 && values[j - 1] > value)
+    {
+      values[j] = values[j - 1];
+      j--;
+    }
+    values[j] = value;
+  }
+}
+
+int16_t filterBurst(int16_t *values, uint8_t count, uint8_t trim)
+{
+  if (count == 0)
+  {
+    return 0;
+  }
+
+  if (2 * trim >= count)
+  {
+    trim = (count - 1) / 2;
+  }
+
+  sortValues(values, count);
+
+  int32_t sum = 0;
+  uint8_t kept = count - 2 * trim;
+  for (uint8_t i = trim; i < count - trim; i++)
+  {
+    sum += values[i];
+  }
+
+  // Rounded to the nearest
+  return sum >= 0 ? (sum + kept / 2) / kept : (sum - kept / 2) / kept;
+}
+
+int16_t filterIir(FilterState &state, uint8_t channel, int16_t value, uint8_t shift)
+{
+  int32_t fixed = (int32_t)value * (1 << FILTER_IIR_FRAC_BITS);
+
+  if (shift == 0 || !(state.valid & (1 << channel)))
+  {
+    state.iir[channel] = fixed;
+    state.valid |= 1 << channel;
+  }
+  else
+  {
+    // Arithmetic shift rounds towards -inf, add half to round to the nearest
+    state.iir[channel] += (fixed - state.iir[channel] + (1 << (shift - 1))) >> shift;
+  }
+
+  return (state.iir[channel] + (1 << (FILTER_IIR_FRAC_BITS - 1))) >> FILTER_IIR_FRAC_BITS;
+}
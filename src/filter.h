@@ -0,0 +1,32 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include "compat.h"
+#include "probes.h"
+
+#define FILTER_MAX_SAMPLES 16
+#define FILTER_CHANNELS (SOIL_PROBE_COUNT + 2) // Soil probes, battery, solar panel
+// Fractional bits of the IIR state
+#define FILTER_IIR_FRAC_BITS 8
+
+struct FilterConfig
+{
+  uint8_t samples;  // Conversions in a burst
+  uint8_t trim;     // Lowest and highest conversions dropped, (samples - 1) / 2 gives the median
+  uint8_t iirShift; // new = old + (value - old) / 2^shift, 0 = no smoothing across wakes
+};
+
+// Smoothing state of each channel kept across deep sleeps, stored in RTC memory
+struct FilterState
+{
+  int32_t iir[FILTER_CHANNELS]; // Fixed point, FILTER_IIR_FRAC_BITS fractional bits
+  uint8_t valid;                // Bit mask of the initialized channels
+  uint8_t reserved[3];
+};
+
+// Trimmed mean of a burst of conversions, sorts the values in place
+int16_t filterBurst(int16_t *values, uint8_t count, uint8_t trim);
+// Smooth the value of a channel with the previous wakes
+int16_t filterIir(FilterState &state, uint8_t channel, int16_t value, uint8_t shift);
+
+#endif
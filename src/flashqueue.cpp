@@ -0,0 +1,283 @@
+#include "flashqueue.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "crc32.h"
+
+#define QUEUE_NAME_SIZE 16
+
+static uint32_t readLe(const uint8_t *p, uint8_t bytes)
+{
+  uint32_t value = 0;
+  for (uint8_t i = 0; i < bytes; i++)
+  {
+    value |= (uint32_t)p[i] << (8 * i);
+  }
+
+  return value;
+}
+
+static void writeLe(uint8_t *p, uint32_t value, uint8_t bytes)
+{
+  for (uint8_t i = 0; i < bytes; i++)
+  {
+    p[i] = value >> (8 * i);
+  }
+}
+
+FlashQueue::FlashQueue(StorageHal &storage, QueueState &state, const QueueConfig &config)
+    : storage(storage), state(state), config(config), pending(0), droppedRecords(0)
+{
+}
+
+void FlashQueue::recover()
+{
+  memset(&state, 0, sizeof(state));
+
+  // Newest segment, seqs wrap around
+  bool found = false;
+  uint16_t head = 0;
+  for (uint8_t slot = 0; slot < config.segments; slot++)
+  {
+    uint16_t seq;
+    if (readHeader(slot, seq) && (!found || (int16_t)(seq - head) > 0))
+    {
+      head = seq;
+      found = true;
+    }
+  }
+  if (!found)
+  {
+    return;
+  }
+
+  // Oldest one, the leftovers of an older ring are not part of the queue
+  uint16_t tail = head;
+  for (uint8_t slot = 0; slot < config.segments; slot++)
+  {
+    uint16_t seq;
+    if (!readHeader(slot, seq))
+    {
+      continue;
+    }
+
+    uint16_t age = head - seq;
+    if (age >= config.segments)
+    {
+      char name[QUEUE_NAME_SIZE];
+      segmentName(seq, name, sizeof(name));
+      storage.remove(name);
+    }
+    else if (age > (uint16_t)(head - tail))
+    {
+      tail = seq;
+    }
+  }
+
+  char name[QUEUE_NAME_SIZE];
+  segmentName(head, name, sizeof(name));
+  int32_t recordLength = config.recordSize + QUEUE_CRC_SIZE;
+  int32_t length = storage.size(name) - QUEUE_HEADER_SIZE;
+  int32_t records = length / recordLength;
+  state.tail = tail;
+  state.head = head;
+  // A write cut by a power loss: the next records go to a new segment, not after the torn one
+  state.written = records < config.segmentRecords && length % recordLength == 0 ? records : config.segmentRecords;
+}
+
+uint32_t FlashQueue::size() const
+{
+  return (uint32_t)(uint16_t)(state.head - state.tail) * config.segmentRecords + state.written - state.read;
+}
+
+bool FlashQueue::push(const uint8_t *records, size_t count)
+{
+  size_t recordLength = config.recordSize + QUEUE_CRC_SIZE;
+  uint8_t buffer[QUEUE_READ_BUFFER];
+  size_t i = 0;
+
+  while (i < count)
+  {
+    if (state.written >= config.segmentRecords)
+    {
+      // The next segment takes the slot of the tail when the ring is full
+      if ((uint16_t)(state.head + 1 - state.tail) >= config.segments)
+      {
+        dropTail();
+      }
+      state.head++;
+      state.written = 0;
+    }
+
+    char name[QUEUE_NAME_SIZE];
+    segmentName(state.head, name, sizeof(name));
+    size_t length = 0;
+    if (state.written == 0)
+    {
+      // The slot may hold a segment of a lost state
+      storage.remove(name);
+      writeLe(buffer, state.head, 2);
+      writeLe(buffer + 2, config.recordSize, 2);
+      length = QUEUE_HEADER_SIZE;
+    }
+
+    // As many records as fit in the segment and in the buffer
+    uint8_t n = 0;
+    while (i < count && state.written + n < config.segmentRecords && length + recordLength <= sizeof(buffer))
+    {
+      const uint8_t *record = records + i * config.recordSize;
+      memcpy(buffer + length, record, config.recordSize);
+      writeLe(buffer + length + config.recordSize, crc32(record, config.recordSize), QUEUE_CRC_SIZE);
+      length += recordLength;
+      n++;
+      i++;
+    }
+
+    if (!storage.append(name, buffer, length))
+    {
+      // Part of it may be written, close the segment: the records not there fail their crc
+      state.written = config.segmentRecords;
+      return false;
+    }
+    state.written += n;
+  }
+
+  return true;
+}
+
+size_t FlashQueue::read(uint8_t *records, size_t count)
+{
+  size_t recordLength = config.recordSize + QUEUE_CRC_SIZE;
+  uint8_t buffer[QUEUE_READ_BUFFER];
+  uint16_t seq = state.tail;
+  uint32_t index = state.read;
+  bool checked = false;
+  size_t valid = 0;
+  pending = 0;
+
+  while (valid < count)
+  {
+    uint8_t length = segmentLength(seq);
+    if (index >= length)
+    {
+      if (seq == state.head)
+      {
+        break;
+      }
+      seq++;
+      index = 0;
+      checked = false;
+      continue;
+    }
+
+    char name[QUEUE_NAME_SIZE];
+    segmentName(seq, name, sizeof(name));
+
+    // A segment that is missing or from another ring is skipped whole
+    if (!checked)
+    {
+      uint8_t header[QUEUE_HEADER_SIZE];
+      checked = true;
+      if (storage.read(name, 0, header, sizeof(header)) != sizeof(header) ||
+          readLe(header, 2) != seq || readLe(header + 2, 2) != config.recordSize)
+      {
+        pending += length - index;
+        index = length;
+        continue;
+      }
+    }
+
+    size_t n = length - index;
+    n = n < count - valid ? n : count - valid;
+    n = n < sizeof(buffer) / recordLength ? n : sizeof(buffer) / recordLength;
+    size_t got = storage.read(name, QUEUE_HEADER_SIZE + index * recordLength, buffer, n * recordLength);
+
+    for (size_t k = 0; k < n; k++)
+    {
+      const uint8_t *record = buffer + k * recordLength;
+      if ((k + 1) * recordLength <= got &&
+          crc32(record, config.recordSize) == readLe(record + config.recordSize, QUEUE_CRC_SIZE))
+      {
+        memcpy(records + valid * config.recordSize, record, config.recordSize);
+        valid++;
+      }
+    }
+    pending += n;
+    index += n;
+  }
+
+  return valid;
+}
+
+void FlashQueue::commit()
+{
+  while (pending > 0)
+  {
+    uint8_t length = segmentLength(state.tail);
+    uint32_t take = length - state.read;
+    take = take < pending ? take : pending;
+    state.read += take;
+    pending -= take;
+
+    if (state.read < length || state.tail == state.head)
+    {
+      break;
+    }
+
+    char name[QUEUE_NAME_SIZE];
+    segmentName(state.tail, name, sizeof(name));
+    storage.remove(name);
+    state.tail++;
+    state.read = 0;
+  }
+  pending = 0;
+
+  // Empty: start a new segment, in the next slot
+  if (state.tail == state.head && state.read > 0 && state.read == state.written)
+  {
+    char name[QUEUE_NAME_SIZE];
+    segmentName(state.tail, name, sizeof(name));
+    storage.remove(name);
+    state.head++;
+    state.tail = state.head;
+    state.read = 0;
+    state.written = 0;
+  }
+}
+
+bool FlashQueue::readHeader(uint8_t slot, uint16_t &seq)
+{
+  char name[QUEUE_NAME_SIZE];
+  segmentName(slot, name, sizeof(name));
+
+  uint8_t header[QUEUE_HEADER_SIZE];
+  if (storage.read(name, 0, header, sizeof(header)) != sizeof(header))
+  {
+    return false;
+  }
+
+  seq = readLe(header, 2);
+  return readLe(header + 2, 2) == config.recordSize && seq % config.segments == slot;
+}
+
+void FlashQueue::segmentName(uint16_t seq, char *name, size_t size) const
+{
+  snprintf(name, size, QUEUE_FILE_PREFIX "%u", seq % config.segments);
+}
+
+uint8_t FlashQueue::segmentLength(uint16_t seq) const
+{
+  return seq == state.head ? state.written : config.segmentRecords;
+}
+
+void FlashQueue::dropTail()
+{
+  char name[QUEUE_NAME_SIZE];
+  segmentName(state.tail, name, sizeof(name));
+  storage.remove(name);
+
+  droppedRecords += config.segmentRecords - state.read;
+  state.tail++;
+  state.read = 0;
+}
@@ -0,0 +1,74 @@
+#ifndef FLASHQUEUE_H
+#define FLASHQUEUE_H
+
+#include "compat.h"
+#include "hal.h"
+
+// Append-only queue of fixed size records in flash, for the samples that could not be
+// uploaded. The records go into a ring of segment files, written once and removed when
+// read, so the writes move across the filesystem. When the ring is full the oldest
+// segment is dropped.
+//
+// Segment file: uint16_t seq, uint16_t record size, then the records, each followed by
+// the crc32 of its bytes. Corrupted or missing records are skipped when read.
+
+#define QUEUE_FILE_PREFIX "/queue-"
+#define QUEUE_HEADER_SIZE 4
+#define QUEUE_CRC_SIZE 4
+#define QUEUE_READ_BUFFER 256 // Bytes read from flash at once
+
+struct QueueConfig
+{
+  uint16_t recordSize;
+  uint8_t segments;       // Files of the ring, a power of 2 and at least 2
+  uint8_t segmentRecords; // Records per file
+};
+
+// Read and write positions, stored in RTC memory. All the segments between tail and head
+// are full.
+struct QueueState
+{
+  uint16_t tail;   // Sequence number of the oldest segment
+  uint16_t head;   // Sequence number of the segment written
+  uint8_t read;    // Records taken from the tail segment
+  uint8_t written; // Records in the head segment
+};
+
+class FlashQueue
+{
+public:
+  FlashQueue(StorageHal &storage, QueueState &state, const QueueConfig &config);
+
+  // Rebuild the state from the segment headers after the RTC memory was lost. The tail
+  // segment is read again from its start.
+  void recover();
+
+  uint32_t size() const;
+  bool empty() const { return size() == 0; }
+
+  // Append count records. Return false if some could not be written.
+  bool push(const uint8_t *records, size_t count);
+  // Read up to count of the oldest records, without taking them. Return the number of
+  // valid records, 0 may still have skipped some corrupted ones.
+  size_t read(uint8_t *records, size_t count);
+  // Take the records returned (and skipped) by the last read
+  void commit();
+
+  // Records lost because the ring was full
+  uint32_t dropped() const { return droppedRecords; }
+
+private:
+  // Sequence number of the segment in a slot, false if there is none
+  bool readHeader(uint8_t slot, uint16_t &seq);
+  void segmentName(uint16_t seq, char *name, size_t size) const;
+  uint8_t segmentLength(uint16_t seq) const;
+  void dropTail();
+
+  StorageHal &storage;
+  QueueState &state;
+  QueueConfig config;
+  uint32_t pending; // Records spanned by the last read
+  uint32_t droppedRecords;
+};
+
+#endif
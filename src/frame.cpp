@@ -0,0 +1,274 @@
+#include "frame.h"
+
+#include <math.h>
+
+#include "crc32.h"
+
+// Writer ---------------------------------------------------------------------
+
+namespace
+{
+
+class FrameWriter
+{
+public:
+  FrameWriter(uint8_t *buffer, size_t size) : buffer(buffer), size(size), len(0), overflowed(false) {}
+
+  void u8(uint8_t value)
+  {
+    if (len >= size)
+    {
+      overflowed = true;
+      return;
+    }
+    buffer[len++] = value;
+  }
+
+  void u16(uint16_t value)
+  {
+    u8(value);
+    u8(value >> 8);
+  }
+
+  void u32(uint32_t value)
+  {
+    u16(value);
+    u16(value >> 16);
+  }
+
+  size_t length() const { return len; }
+  bool overflow() const { return overflowed; }
+
+private:
+  uint8_t *buffer;
+  size_t size;
+  size_t len;
+  bool overflowed;
+};
+
+class FrameReader
+{
+public:
+  FrameReader(const uint8_t *data, size_t length) : data(data), length(length), pos(0), underflowed(false) {}
+
+  uint8_t u8()
+  {
+    if (pos >= length)
+    {
+      underflowed = true;
+      return 0;
+    }
+    return data[pos++];
+  }
+
+  uint16_t u16()
+  {
+    uint16_t low = u8();
+    return low | (u8() << 8);
+  }
+
+  uint32_t u32()
+  {
+    uint32_t low = u16();
+    return low | ((uint32_t)u16() << 16);
+  }
+
+  size_t position() const { return pos; }
+  bool underflow() const { return underflowed; }
+
+private:
+  const uint8_t *data;
+  size_t length;
+  size_t pos;
+  bool underflowed;
+};
+
+} // namespace
+
+static uint16_t toU16(float value, float scale)
+{
+  long scaled = lroundf(value * scale);
+  return scaled < 0 ? 0 : (scaled > UINT16_MAX ? UINT16_MAX : scaled);
+}
+
+static int16_t toI16(float value, float scale)
+{
+  long scaled = lroundf(value * scale);
+  return scaled < INT16_MIN ? INT16_MIN : (scaled > INT16_MAX ? INT16_MAX : scaled);
+}
+
+// Frame ----------------------------------------------------------------------
+
+size_t encodeFrame(uint8_t *buffer, size_t size, const char *sensorId, const Sample *samples, size_t count, const Trace *trace)
+{
+  size_t idLength = strlen(sensorId);
+  if (idLength > FRAME_MAX_ID_LENGTH || count > FRAME_MAX_SAMPLES)
+  {
+    return 0;
+  }
+
+  uint8_t probes = count > 0 ? samples[0].probes : 1;
+  if (probes == 0 || probes > SAMPLE_MAX_PROBES)
+  {
+    return 0;
+  }
+
+  FrameWriter w(buffer, size);
+  w.u8('P');
+  w.u8('S');
+  w.u8(FRAME_VERSION);
+  w.u8((trace ? FRAME_FLAG_TRACE : 0) | (probes > 1 ? FRAME_FLAG_PROBES : 0));
+  w.u8(idLength);
+  for (size_t i = 0; i < idLength; i++)
+  {
+    w.u8(sensorId[i]);
+  }
+
+  w.u8(count);
+  if (probes > 1)
+  {
+    w.u8(probes);
+  }
+  for (size_t i = 0; i < count; i++)
+  {
+    const Sample &s = samples[i];
+    w.u32(s.ts);
+    w.u16(toI16(s.air.temp, 100));
+    w.u16(toU16(s.air.humidity, 100));
+    w.u16(toI16(s.air.dew_point, 100));
+    w.u16(s.soil[0].raw);
+    w.u8(s.soil[0].percentage);
+    w.u8(s.suppressed < UINT8_MAX ? s.suppressed : UINT8_MAX);
+    w.u16(toU16(s.battery.raw, 1000));
+    w.u16(toU16(s.battery.percentage, 100));
+    w.u16(toU16(s.solarPanelVolt, 1000));
+    w.u16(toU16(s.timeError, 100));
+    w.u16(s.interval < UINT16_MAX ? s.interval : UINT16_MAX);
+    for (uint8_t p = 1; p < probes; p++)
+    {
+      w.u16(s.soil[p].raw);
+      w.u8(s.soil[p].percentage);
+    }
+  }
+
+  if (trace)
+  {
+    w.u32(trace->ts);
+    w.u16(trace->awakeMs);
+    w.u16(trace->phases);
+    w.u8(trace->overruns);
+    for (uint8_t p = 0; p < TRACE_PHASE_COUNT; p++)
+    {
+      w.u16(trace->phaseMs[p]);
+      w.u16(trace->freeHeap[p]);
+      w.u16(trace->maxFreeBlock[p]);
+      w.u8(trace->fragmentation[p]);
+    }
+  }
+
+  if (w.overflow())
+  {
+    return 0;
+  }
+
+  w.u32(crc32(buffer, w.length()));
+
+  return w.overflow() ? 0 : w.length();
+}
+
+bool decodeFrame(const uint8_t *data, size_t length, Frame &frame)
+{
+  if (length < 4 || crc32(data, length - 4) != (data[length - 4] | data[length - 3] << 8 | data[length - 2] << 16 | (uint32_t)data[length - 1] << 24))
+  {
+    return false;
+  }
+
+  FrameReader r(data, length - 4);
+  if (r.u8() != 'P' || r.u8() != 'S' || r.u8() != FRAME_VERSION)
+  {
+    return false;
+  }
+
+  uint8_t flags = r.u8();
+  uint8_t idLength = r.u8();
+  if (idLength > FRAME_MAX_ID_LENGTH)
+  {
+    return false;
+  }
+  for (uint8_t i = 0; i < idLength; i++)
+  {
+    frame.sensorId[i] = r.u8();
+  }
+  frame.sensorId[idLength] = '\0';
+
+  frame.count = r.u8();
+  uint8_t probes = flags & FRAME_FLAG_PROBES ? r.u8() : 1;
+  if (frame.count > FRAME_MAX_SAMPLES || probes == 0 || probes > SAMPLE_MAX_PROBES)
+  {
+    return false;
+  }
+  for (size_t i = 0; i < frame.count; i++)
+  {
+    Sample &s = frame.samples[i];
+    s.ts = r.u32();
+    s.air.temp = (int16_t)r.u16() / 100.0f;
+    s.air.humidity = r.u16() / 100.0f;
+    s.air.dew_point = (int16_t)r.u16() / 100.0f;
+    s.soil[0].raw = (int16_t)r.u16();
+    s.soil[0].percentage = r.u8();
+    s.suppressed = r.u8();
+    s.battery.raw = r.u16() / 1000.0f;
+    s.battery.percentage = r.u16() / 100.0f;
+    s.solarPanelVolt = r.u16() / 1000.0f;
+    s.timeError = r.u16() / 100.0f;
+    s.interval = r.u16();
+    for (uint8_t p = 1; p < probes; p++)
+    {
+      s.soil[p].raw = (int16_t)r.u16();
+      s.soil[p].percentage = r.u8();
+    }
+    s.probes = probes;
+  }
+
+  frame.hasTrace = flags & FRAME_FLAG_TRACE;
+  if (frame.hasTrace)
+  {
+    Trace &t = frame.trace;
+    t.ts = r.u32();
+    t.awakeMs = r.u16();
+    t.phases = r.u16();
+    t.overruns = r.u8();
+    t.reserved = 0;
+    for (uint8_t p = 0; p < TRACE_PHASE_COUNT; p++)
+    {
+      t.phaseMs[p] = r.u16();
+      t.freeHeap[p] = r.u16();
+      t.maxFreeBlock[p] = r.u16();
+      t.fragmentation[p] = r.u8();
+    }
+  }
+
+  // Nothing missing, nothing left
+  return !r.underflow() && r.position() == length - 4;
+}
+
+size_t encodeFrameAck(uint8_t *buffer, const uint8_t *frame, size_t length)
+{
+  uint32_t crc = crc32(frame, length);
+  buffer[0] = 'P';
+  buffer[1] = 'A';
+  buffer[2] = crc;
+  buffer[3] = crc >> 8;
+  buffer[4] = crc >> 16;
+  buffer[5] = crc >> 24;
+
+  return FRAME_ACK_SIZE;
+}
+
+bool frameAckMatches(const uint8_t *ack, size_t ackLength, const uint8_t *frame, size_t length)
+{
+  uint8_t expected[FRAME_ACK_SIZE];
+  encodeFrameAck(expected, frame, length);
+
+  return ackLength == FRAME_ACK_SIZE && memcmp(ack, expected, FRAME_ACK_SIZE) == 0;
+}
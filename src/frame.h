@@ -0,0 +1,46 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include "compat.h"
+#include "sample.h"
+#include "trace.h"
+
+// Compact binary frame sent to the relay in a single datagram, also the payload of the MQTT
+// messages (little endian):
+//   'P' 'S' version flags idLength id[idLength] count [probes] sample[count] [trace] crc32
+// Each sample is FRAME_SAMPLE_SIZE bytes, the trace is present if flags has FRAME_FLAG_TRACE.
+// With several soil probes, flags has FRAME_FLAG_PROBES and each sample ends with the values of
+// the probes after the first one, FRAME_PROBE_SIZE bytes each.
+// The relay acknowledges with 'P' 'A' crc32, the crc of the frame.
+
+#define FRAME_VERSION 3 // The trace layout follows TRACE_PHASE_COUNT
+#define FRAME_FLAG_TRACE 0x01
+#define FRAME_FLAG_PROBES 0x02
+#define FRAME_MAX_ID_LENGTH 32
+#define FRAME_MAX_SAMPLES 32
+#define FRAME_SAMPLE_SIZE 24
+#define FRAME_PROBE_SIZE 3
+#define FRAME_TRACE_SIZE (9 + TRACE_PHASE_COUNT * 7)
+#define FRAME_MAX_SAMPLE_SIZE (FRAME_SAMPLE_SIZE + (SAMPLE_MAX_PROBES - 1) * FRAME_PROBE_SIZE)
+#define FRAME_MAX_SIZE (7 + FRAME_MAX_ID_LENGTH + FRAME_MAX_SAMPLES * FRAME_MAX_SAMPLE_SIZE + FRAME_TRACE_SIZE + 4)
+#define FRAME_ACK_SIZE 6
+
+struct Frame
+{
+  char sensorId[FRAME_MAX_ID_LENGTH + 1];
+  size_t count;
+  Sample samples[FRAME_MAX_SAMPLES];
+  bool hasTrace;
+  Trace trace;
+};
+
+// Encode a frame, the samples have the same probes. Return its length, 0 if it does not fit.
+size_t encodeFrame(uint8_t *buffer, size_t size, const char *sensorId, const Sample *samples, size_t count, const Trace *trace);
+// Decode and check a frame. Return false if it is not valid.
+bool decodeFrame(const uint8_t *data, size_t length, Frame &frame);
+
+// Acknowledgment of a frame
+size_t encodeFrameAck(uint8_t *buffer, const uint8_t *frame, size_t length);
+bool frameAckMatches(const uint8_t *ack, size_t ackLength, const uint8_t *frame, size_t length);
+
+#endif
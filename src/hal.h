@@ -0,0 +1,149 @@
+#ifndef HAL_H
+#define HAL_H
+
+#include "compat.h"
+#include "sample.h"
+#include "screen.h"
+#include "trace.h"
+
+// Thin interfaces over the hardware, implemented by the ESP8266 backends
+// (main.cpp) and by the simulated ones (native/).
+
+enum Backend
+{
+  BACKEND_GRAPHITE,
+  BACKEND_LOKI,
+  BACKEND_PROMETHEUS,
+  BACKEND_COUNT
+};
+
+// RTC memory reserved to the network backend (cached association, TLS sessions, ...)
+#define NETWORK_STATE_SIZE 216
+
+struct NetworkState
+{
+  uint32_t data[NETWORK_STATE_SIZE / 4];
+};
+
+// ADC input: index of the ADS1115 (up to 4 on the bus) and multiplexer channel
+#define ADC_MAX_DEVICES 4
+#define ADC_INPUT(device, channel) ((device) << 2 | (channel))
+#define ADC_INPUT_DEVICE(input) ((input) >> 2)
+#define ADC_INPUT_CHANNEL(input) ((input) & 0x03)
+
+// Conversions are non-blocking: start one, then poll until it returns true
+class SensorHal
+{
+public:
+  virtual bool begin() = 0;
+  virtual void startAir() = 0;
+  virtual bool pollAir(AirCondition &air) = 0;
+  // Each ADC device converts one input at a time, the devices at the same time
+  virtual void startAdc(uint8_t input) = 0;
+  virtual bool adcReady(uint8_t device) = 0;
+  // Result of the last conversion done, until the next one started on the device ends
+  virtual int16_t readAdc(uint8_t device) = 0;
+  virtual int32_t adcToMilliVolts(int16_t raw) = 0;
+};
+
+class NetworkHal
+{
+public:
+  // Attach the state kept in RTC memory, lost is true if it was reset
+  virtual void begin(NetworkState &state, bool lost) = 0;
+  // Start the association in background
+  virtual void startConnect() = 0;
+  // Wait for the association up to timeoutMs, starting it if needed
+  virtual bool connect(uint32_t timeoutMs) = 0;
+  virtual void disconnect() = 0;
+  // Single NTP request, return false on timeout
+  virtual bool getTime(uint32_t &epoch) = 0;
+  // POST the payload to the backend within timeoutMs, return the HTTP code (< 0 on transport errors)
+  virtual int post(Backend backend, const char *body, size_t length, uint32_t timeoutMs) = 0;
+  // Send a datagram to the relay and wait for its reply, return the reply length (0 on timeout)
+  virtual size_t exchangeRelay(const uint8_t *data, size_t length, uint8_t *reply, size_t replySize) = 0;
+  // Plain TCP connection, a single one at a time
+  virtual bool openStream(const char *host, uint16_t port) = 0;
+  virtual bool writeStream(const uint8_t *data, size_t length) = 0;
+  // Wait for exactly length bytes, read as they come in, return false on timeout or if the
+  // connection was closed
+  virtual bool readStream(uint8_t *data, size_t length, uint32_t timeoutMs) = 0;
+  virtual void closeStream() = 0;
+};
+
+class ClockHal
+{
+public:
+  virtual uint32_t millis() = 0;
+  virtual uint32_t micros() = 0;
+  virtual void delay(uint32_t ms) = 0;
+};
+
+class SleepHal
+{
+public:
+  virtual void readRtc(void *data, size_t size) = 0;
+  virtual void writeRtc(const void *data, size_t size) = 0;
+  // Whether this boot was caused by the deep sleep timer
+  virtual bool timerWake() = 0;
+  virtual void deepSleep(uint64_t us) = 0;
+};
+
+// Files in flash, each call opens and closes the file
+class StorageHal
+{
+public:
+  // Return the bytes read, fewer at the end of the file and 0 if it does not exist
+  virtual size_t read(const char *path, uint32_t offset, void *data, size_t length) = 0;
+  // Append to the file, creating it if needed
+  virtual bool append(const char *path, const void *data, size_t length) = 0;
+  virtual void remove(const char *path) = 0;
+  // Return -1 if the file does not exist
+  virtual int32_t size(const char *path) = 0;
+};
+
+// The running firmware image and the staging area of the next one, copied over it by the
+// bootloader on the next boot once committed
+class FirmwareHal
+{
+public:
+  virtual uint32_t imageSize() = 0;
+  virtual bool readImage(uint32_t offset, void *data, size_t length) = 0;
+  // Stage an image of the given size, written in order
+  virtual bool beginUpdate(uint32_t size) = 0;
+  virtual bool writeUpdate(const uint8_t *data, size_t length) = 0;
+  // Commit the staged image, or drop it (only before it was completely written)
+  virtual bool endUpdate(bool commit) = 0;
+};
+
+class DisplayHal
+{
+public:
+  // Without the greeting in low power (NodeConfig::displayLowPower)
+  virtual void begin(bool lowPower) = 0;
+  virtual void setStatusLed(bool on) = 0;
+  virtual void showStatus(const char *text) = 0;
+  // Redraw what changed since the last info screen
+  virtual void showInfo(const ScreenValues &values, const ScreenUpdate &update) = 0;
+};
+
+class SystemHal
+{
+public:
+  virtual void log(const char *text) = 0;
+  virtual void getHeapStats(HeapStats &stats) = 0;
+};
+
+struct Hal
+{
+  SensorHal &sensors;
+  NetworkHal &network;
+  ClockHal &clock;
+  SleepHal &sleep;
+  StorageHal &storage;
+  DisplayHal &display;
+  SystemHal &system;
+  FirmwareHal &firmware;
+};
+
+#endif
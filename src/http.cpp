@@ -0,0 +1,103 @@
+#include "http.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char CONTENT_LENGTH[] = "content-length:";
+static const char ETAG[] = "etag:";
+
+// Line of the response header without the line break, false on timeout
+static bool readLine(NetworkHal &network, WakeBudget &budget, char *line, size_t size)
+{
+  size_t length = 0;
+  while (true)
+  {
+    char c;
+    if (budget.expired() || !network.readStream((uint8_t *)&c, 1, budget.left()))
+    {
+      return false;
+    }
+    if (c == '\n')
+    {
+      break;
+    }
+    if (c != '\r' && length + 1 < size)
+    {
+      line[length++] = c;
+    }
+  }
+
+  line[length] = '\0';
+  return true;
+}
+
+// Value of the header if the line is the given one (lower case), header names are case insensitive
+static const char *headerValue(const char *line, const char *lowerName)
+{
+  for (; *lowerName; line++, lowerName++)
+  {
+    char c = *line >= 'A' && *line <= 'Z' ? *line - 'A' + 'a' : *line;
+    if (c != *lowerName)
+    {
+      return nullptr;
+    }
+  }
+
+  while (*line == ' ')
+  {
+    line++;
+  }
+  return line;
+}
+
+static bool readHeader(NetworkHal &network, WakeBudget &budget, HttpResponse &response)
+{
+  // Status line, then the headers up to the empty line
+  char line[HTTP_LINE_SIZE];
+  if (!readLine(network, budget, line, sizeof(line)) || sscanf(line, "HTTP/%*s %d", &response.status) != 1)
+  {
+    return false;
+  }
+
+  do
+  {
+    if (!readLine(network, budget, line, sizeof(line)))
+    {
+      return false;
+    }
+
+    const char *value;
+    if ((value = headerValue(line, CONTENT_LENGTH)))
+    {
+      response.contentLength = strtol(value, nullptr, 10);
+    }
+    else if ((value = headerValue(line, ETAG)) && strlen(value) < sizeof(response.etag))
+    {
+      strcpy(response.etag, value);
+    }
+  } while (line[0] != '\0');
+
+  return true;
+}
+
+bool httpGet(NetworkHal &network, WakeBudget &budget, const char *host, uint16_t port, const char *target,
+             const char *etag, HttpResponse &response, char *buffer, size_t bufferSize)
+{
+  response = {0, -1, ""};
+  int length = etag && etag[0]
+                   ? snprintf(buffer, bufferSize, "GET %s HTTP/1.0\r\nHost: %s\r\nIf-None-Match: %s\r\n\r\n", target, host, etag)
+                   : snprintf(buffer, bufferSize, "GET %s HTTP/1.0\r\nHost: %s\r\n\r\n", target, host);
+  if (length <= 0 || (size_t)length >= bufferSize || !network.openStream(host, port))
+  {
+    return false;
+  }
+
+  if (!network.writeStream((const uint8_t *)buffer, length) || !readHeader(network, budget, response))
+  {
+    network.closeStream();
+    return false;
+  }
+
+  return true;
+}
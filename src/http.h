@@ -0,0 +1,27 @@
+#ifndef HTTP_H
+#define HTTP_H
+
+#include "budget.h"
+#include "compat.h"
+#include "hal.h"
+
+// Plain HTTP/1.0 GET over the stream of the network, for the servers on the local network
+// (firmware updates, remote configuration)
+#define HTTP_LINE_SIZE 80 // Longer header lines are cut
+#define HTTP_ETAG_SIZE 48 // Longer ETags are not kept
+
+struct HttpResponse
+{
+  int status;
+  int32_t contentLength; // -1 if not given
+  char etag[HTTP_ETAG_SIZE]; // Empty if not given
+};
+
+// Send the request and read the response header within the current phase of the budget, the
+// body then comes from the stream. The buffer holds the request. With an ETag the request is
+// conditional (If-None-Match), 304 when the resource did not change. The stream is left open
+// if the response header was read, closed otherwise.
+bool httpGet(NetworkHal &network, WakeBudget &budget, const char *host, uint16_t port, const char *target,
+             const char *etag, HttpResponse &response, char *buffer, size_t bufferSize);
+
+#endif
@@ -1,9 +1,10 @@
-
 //
 // Based on the following source code:
 // https://grafana.com/blog/2021/03/08/how-i-built-a-monitoring-system-for-my-avocado-plant-with-arduino-and-grafana-cloud/?src=email&cnt=trial-started&camp=grafana-cloud-trial
 // https://github.com/ivanahuckova/avocado_monitoring
 //
+// ESP8266 backends of the hardware interfaces (see hal.h), the wake cycle is in plant.cpp.
+//
 
 #include <Arduino.h>
 #include <ESP8266WiFi.h>
@@ -11,10 +12,14 @@
 #include <WiFiUdp.h>
 #include <NTPClient.h>
 #include <SPI.h>
-#include <uFire_SHT20.h>
 #include <Adafruit_ADS1X15.h>
+#include <LittleFS.h>
+#include <Updater.h>
 
 #include "config.h"
+#include "hal.h"
+#include "plant.h"
+#include "tlssessions.h"
 
 #if ENABLE_DISPLAY_OLED
 #include <Wire.h>
@@ -28,6 +33,7 @@
 #include <Fonts/FreeMonoBold9pt7b.h>
 #include <Fonts/FreeMonoBold12pt7b.h>
 #include <Fonts/FreeMonoBold24pt7b.h>
+#include "displaylist.h"
 #include "eink_background.h"
 #endif
 
@@ -35,13 +41,21 @@
 WiFiUDP ntpUDP;
 NTPClient ntpClient(ntpUDP);
 
+// Relay
+WiFiUDP relayUDP;
+
+// MQTT broker
+WiFiClient stream;
+
 // Sensors
-uFire_SHT20 sht20;
-Adafruit_ADS1115 ads;
+const uint8_t adcAddresses[] = ADC_ADDRESSES;
+#define ADC_DEVICES (sizeof(adcAddresses) / sizeof(adcAddresses[0]))
+Adafruit_ADS1115 ads[ADC_DEVICES];
+
+static_assert(ADC_DEVICES <= ADC_MAX_DEVICES, "Too many ADC_ADDRESSES");
 
 // Grafana client and transport
-HTTPClient httpLoki;
-HTTPClient httpGraphite;
+HTTPClient http;
 
 #if ENABLE_DISPLAY_OLED
 #define OLED_RESET 0 // GPIO0
@@ -49,7 +63,7 @@ Adafruit_SSD1306 display(OLED_RESET);
 #endif
 
 #if ENABLE_DISPLAY_EINK
-GxEPD2_BW<GxEPD2_154, GxEPD2_154::HEIGHT> display(GxEPD2_154(
+GxEPD2_BW<GxEPD2_154, EINK_PAGE_HEIGHT> display(GxEPD2_154(
     SS,
     EINK_DC_PIN,
     EINK_RESET_PIN,
@@ -58,310 +72,817 @@ GxEPD2_BW<GxEPD2_154, GxEPD2_154::HEIGHT> display(GxEPD2_154(
 
 // Defs -----------------------------------------------------------------------
 
-struct AirCondition
+// SHT20 commands, "no hold master" so the bus stays free during conversions
+#define SHT20_ADDRESS 0x40
+#define SHT20_TRIGGER_TEMP 0xF3
+#define SHT20_TRIGGER_HUMIDITY 0xF5
+#define SHT20_SOFT_RESET 0xFE
+
+static_assert(sizeof(BearSSL::Session) <= TLS_SESSION_SIZE, "BearSSL::Session does not fit in TLS_SESSION_SIZE");
+
+// Last good WiFi association and lease, used to skip scan and DHCP
+struct NetCache
 {
-  float temp;
-  float humidity;
-  float dew_point;
+  uint8_t bssid[6];
+  uint8_t channel;
+  uint8_t valid;
+  uint32_t ip;
+  uint32_t gateway;
+  uint32_t subnet;
+  uint32_t dns;
+  uint32_t backends[BACKEND_COUNT]; // Resolved backend addresses
 };
 
-struct ValPerc
+// Layout of the network state kept in RTC memory
+struct EspNetworkState
 {
-  int raw;
-  int percentage;
+  NetCache net;
+  TlsSessions tls;
 };
-struct ValPercFloat
+
+static_assert(sizeof(EspNetworkState) <= sizeof(NetworkState), "EspNetworkState does not fit in NetworkState");
+
+struct Endpoint
 {
-  float raw;
-  float percentage;
+  const char *host;
+  const char *path;
+  const char *user;
+  const char *pass;
+  const char *contentType;
+  bool snappy; // Prometheus remote write body
 };
 
-float mapFloat(float x, float in_min, float in_max, float out_min, float out_max);
+const Endpoint endpoints[BACKEND_COUNT] = {
+    {GC_GRAPHITE_URL, "/graphite/metrics", GC_GRAPHITE_USER, GC_GRAPHITE_PASS, "application/json", false},
+    {GC_LOKI_URL, "/loki/api/v1/push", GC_LOKI_USER, GC_LOKI_PASS, "application/json", false},
+    {GC_PROM_URL, GC_PROM_PATH, GC_PROM_USER, GC_PROM_PASS, "application/x-protobuf", true}};
 
-AirCondition measureAirCondition();
-ValPerc measureSoilMoisture();
-ValPercFloat measureBatteryVolt();
-float measureSolarPanelVolt();
-bool evaluateSamples(AirCondition air, ValPerc soil, ValPercFloat battery, float solarPanelVolt);
+void printDisplayInfo(const ScreenValues &values, const ScreenUpdate &update);
+void printDisplay(const char *text);
 
-void setupWiFi();
+// Backends -------------------------------------------------------------------
+
+class EspSensors : public SensorHal
+{
+public:
+  bool begin() override
+  {
+    // DHT20 --------
+    Wire.begin();
+    shtCommand(SHT20_SOFT_RESET);
+    delay(15);
 
-void sendToGraphite(unsigned long ts, AirCondition air, ValPerc soil, ValPercFloat battery, float solarPanelVolt);
-void sendToLoki(unsigned long ts, AirCondition air, ValPerc soil, ValPercFloat battery, float solarPanelVolt, String message);
+    // ADC ----------
+    for (uint8_t d = 0; d < ADC_DEVICES; d++)
+    {
+      if (!ads[d].begin(adcAddresses[d]))
+      {
+        return false;
+      }
+      ads[d].setDataRate(adsDataRate(ADC_RATE_SPS));
+    }
+    return true;
+  }
 
-String getTimeString(unsigned long ts);
-void printDisplayInfo(unsigned long ts, AirCondition air, ValPerc soil, ValPercFloat battery, float solarPanelVolt);
-void printDisplay(String text);
+  void startAir() override
+  {
+    humidityStarted = false;
+    shtCommand(SHT20_TRIGGER_TEMP);
+  }
 
-// Methods --------------------------------------------------------------------
+  bool pollAir(AirCondition &air) override
+  {
+    uint16_t raw;
+    if (!shtRead(raw))
+    {
+      return false;
+    }
 
-void setup()
+    if (!humidityStarted)
+    {
+      tempC = -46.85 + 175.72 * raw / 65536.0;
+      humidityStarted = true;
+      shtCommand(SHT20_TRIGGER_HUMIDITY);
+      return false;
+    }
+
+    float rh = -6.0 + 125.0 * raw / 65536.0;
+
+    air.temp = tempC;
+    air.humidity = rh;
+    air.dew_point = dewPoint(tempC, rh);
+
+    return true;
+  }
+
+  void startAdc(uint8_t input) override
+  {
+    if (ADC_INPUT_DEVICE(input) < ADC_DEVICES)
+    {
+      ads[ADC_INPUT_DEVICE(input)].startADCReading(MUX_BY_CHANNEL[ADC_INPUT_CHANNEL(input)], false);
+    }
+  }
+
+  bool adcReady(uint8_t device) override
+  {
+    return device >= ADC_DEVICES || ads[device].conversionComplete();
+  }
+
+  int16_t readAdc(uint8_t device) override
+  {
+    return device < ADC_DEVICES ? ads[device].getLastConversionResults() : 0;
+  }
+
+  // Same gain on every device
+  int32_t adcToMilliVolts(int16_t raw) override
+  {
+    return adcMilliVolts(raw, adsFullScale(ads[0].getGain()));
+  }
+
+private:
+  // Full scale of the gain in millivolts, as computeVolts() without the float math
+  static uint16_t adsFullScale(adsGain_t gain)
+  {
+    switch (gain)
+    {
+    case GAIN_ONE:
+      return 4096;
+    case GAIN_TWO:
+      return 2048;
+    case GAIN_FOUR:
+      return 1024;
+    case GAIN_EIGHT:
+      return 512;
+    case GAIN_SIXTEEN:
+      return 256;
+    default:
+      return 6144;
+    }
+  }
+
+  static uint16_t adsDataRate(uint16_t sps)
+  {
+    switch (sps)
+    {
+    case 8:
+      return RATE_ADS1115_8SPS;
+    case 16:
+      return RATE_ADS1115_16SPS;
+    case 32:
+      return RATE_ADS1115_32SPS;
+    case 64:
+      return RATE_ADS1115_64SPS;
+    case 250:
+      return RATE_ADS1115_250SPS;
+    case 475:
+      return RATE_ADS1115_475SPS;
+    case 860:
+      return RATE_ADS1115_860SPS;
+    default:
+      return RATE_ADS1115_128SPS;
+    }
+  }
+
+  void shtCommand(uint8_t command)
+  {
+    Wire.beginTransmission(SHT20_ADDRESS);
+    Wire.write(command);
+    Wire.endTransmission();
+  }
+
+  // The sensor does not acknowledge the read until the conversion is done
+  bool shtRead(uint16_t &raw)
+  {
+    if (Wire.requestFrom(SHT20_ADDRESS, 3) != 3)
+    {
+      return false;
+    }
+
+    uint8_t msb = Wire.read();
+    uint8_t lsb = Wire.read();
+    Wire.read(); // Checksum
+
+    // The last two bits are status
+    raw = ((msb << 8) | lsb) & 0xFFFC;
+    return true;
+  }
+
+  bool humidityStarted;
+  float tempC;
+};
+
+class EspNetwork : public NetworkHal
 {
+public:
+  void begin(NetworkState &networkState, bool lost) override;
+  void startConnect() override;
+  bool connect(uint32_t timeoutMs) override;
+  void disconnect() override;
+  bool getTime(uint32_t &epoch) override;
+  int post(Backend backend, const char *body, size_t length, uint32_t timeoutMs) override;
+  size_t exchangeRelay(const uint8_t *data, size_t length, uint8_t *reply, size_t replySize) override;
+  bool openStream(const char *host, uint16_t port) override;
+  bool writeStream(const uint8_t *data, size_t length) override;
+  bool readStream(uint8_t *data, size_t length, uint32_t timeoutMs) override;
+  void closeStream() override;
+
+private:
+  bool waitForWiFi(unsigned long timeoutMs);
+  void saveNetCache();
+  void invalidateNetCache();
+
+  void loadTlsSessions();
+  void restoreTlsSession(Backend backend, BearSSL::Session &session);
+  void storeTlsSession(Backend backend, const BearSSL::Session &session, int httpCode);
+
+  EspNetworkState *state;
+  bool connecting;
+  bool fastConnect; // Using the cached access point and lease
+  unsigned long connectStartMs;
+};
 
-#if DEBUG
-  // Serial -------
-  Serial.begin(115200);
-  delay(10);
-  Serial.println('\n');
-#endif
+class EspClock : public ClockHal
+{
+public:
+  uint32_t millis() override
+  {
+    return ::millis();
+  }
+
+  uint32_t micros() override
+  {
+    return ::micros();
+  }
+
+  void delay(uint32_t ms) override
+  {
+    ::delay(ms);
+  }
+};
+
+class EspSleep : public SleepHal
+{
+public:
+  void readRtc(void *data, size_t size) override
+  {
+    ESP.rtcUserMemoryRead(0, (uint32_t *)data, size);
+  }
+
+  void writeRtc(const void *data, size_t size) override
+  {
+    ESP.rtcUserMemoryWrite(0, (uint32_t *)data, size);
+  }
+
+  bool timerWake() override
+  {
+    return ESP.getResetInfoPtr()->reason == REASON_DEEP_SLEEP_AWAKE;
+  }
+
+  void deepSleep(uint64_t us) override
+  {
+    ESP.deepSleep(us);
+  }
+};
+
+// LittleFS stays mounted until the deep sleep
+bool mountFlash()
+{
+  static bool mounted = false;
+  if (!mounted)
+  {
+    mounted = LittleFS.begin();
+  }
+
+  return mounted;
+}
+
+class EspStorage : public StorageHal
+{
+public:
+  size_t read(const char *path, uint32_t offset, void *data, size_t length) override
+  {
+    if (!mountFlash() || !LittleFS.exists(path))
+    {
+      return 0;
+    }
+
+    File file = LittleFS.open(path, "r");
+    if (!file || !file.seek(offset))
+    {
+      return 0;
+    }
+    size_t read = file.read((uint8_t *)data, length);
+    file.close();
+
+    return read;
+  }
 
-  // Led ----------
-  pinMode(STATUS_LED_PIN, OUTPUT);
+  bool append(const char *path, const void *data, size_t length) override
+  {
+    if (!mountFlash())
+    {
+      return false;
+    }
+
+    File file = LittleFS.open(path, "a");
+    if (!file)
+    {
+      return false;
+    }
+    size_t written = file.write((const uint8_t *)data, length);
+    file.close();
+
+    return written == length;
+  }
 
-  // DHT20 --------
-  Wire.begin();
-  sht20.begin();
+  void remove(const char *path) override
+  {
+    if (mountFlash() && LittleFS.exists(path))
+    {
+      LittleFS.remove(path);
+    }
+  }
 
-  // ADC ----------
-  if (!ads.begin())
+  int32_t size(const char *path) override
   {
-    while (1)
+    if (!mountFlash() || !LittleFS.exists(path))
     {
-      Serial.println("Failed to initialize ADS!");
-      delay(1000);
+      return -1;
     }
+
+    File file = LittleFS.open(path, "r");
+    int32_t size = file ? file.size() : -1;
+    file.close();
+
+    return size;
   }
+};
+
+class EspDisplay : public DisplayHal
+{
+public:
+  void begin(bool lowPower) override
+  {
+    // Led ----------
+    pinMode(STATUS_LED_PIN, OUTPUT);
 
-// Display ------
 #if ENABLE_DISPLAY_OLED
-  display.begin(SSD1306_SWITCHCAPVCC, 0x3C); // initialize with the I2C addr 0x3C (for the 64x48)
-  display.display();
-  printDisplay("Ciao!\n\nWiFi...");
+    display.begin(SSD1306_SWITCHCAPVCC, 0x3C); // initialize with the I2C addr 0x3C (for the 64x48)
+    display.display();
+    if (!lowPower)
+    {
+      printDisplay("Ciao!\n\nWiFi...");
+    }
 #endif
 
 #if ENABLE_DISPLAY_EINK
-  display.init(DEBUG ? 115200 : 0);
+    // No initial full refresh, the panel still shows the last frame after a deep sleep
+    display.init(DEBUG ? 115200 : 0, false);
 #endif
+  }
 
-  // WiFi ---------
-  setupWiFi();
-  ntpClient.begin();
-}
-
-void loop()
-{
-  digitalWrite(STATUS_LED_PIN, HIGH);
+  void setStatusLed(bool on) override
+  {
+    digitalWrite(STATUS_LED_PIN, on ? HIGH : LOW);
+  }
 
-  // Reconnect to WiFi if required
-  if (WiFi.status() != WL_CONNECTED)
+  void showStatus(const char *text) override
   {
-    WiFi.disconnect();
-    yield();
-    setupWiFi();
+#if ENABLE_DISPLAY_OLED || ENABLE_DISPLAY_EINK
+    printDisplay(text);
+#endif
   }
 
+  void showInfo(const ScreenValues &values, const ScreenUpdate &update) override
+  {
 #if ENABLE_DISPLAY_OLED || ENABLE_DISPLAY_EINK
-  printDisplay("WiFi connected!");
+    printDisplayInfo(values, update);
 #endif
+  }
+};
 
-  // Update time via NTP if required
-  while (!ntpClient.update())
+class EspSystem : public SystemHal
+{
+public:
+  void log(const char *text) override
   {
-    yield();
-    ntpClient.forceUpdate();
+    Serial.println(text);
   }
 
-  // Get current timestamp
-  unsigned long ts = ntpClient.getEpochTime();
+  void getHeapStats(HeapStats &stats) override
+  {
+    stats.freeHeap = ESP.getFreeHeap();
+    stats.maxFreeBlock = ESP.getMaxFreeBlockSize();
+    stats.fragmentation = ESP.getHeapFragmentation();
+  }
+};
 
-  // Read sensors
-  Serial.println("Collect data...");
-  AirCondition air = measureAirCondition();
-  ValPerc soil_moisture = measureSoilMoisture();
-  ValPercFloat battery = measureBatteryVolt();
-  float solarPanelVolt = measureSolarPanelVolt();
+// The image is the .bin as uploaded, the bootloader included, from the start of the flash
+class EspFirmware : public FirmwareHal
+{
+public:
+  uint32_t imageSize() override
+  {
+    return ESP.getSketchSize();
+  }
 
-  // Check if values are valid
-  if (evaluateSamples(air, soil_moisture, battery, solarPanelVolt))
+  bool readImage(uint32_t offset, void *data, size_t length) override
   {
-    // Send
-    sendToGraphite(ts, air, soil_moisture, battery, solarPanelVolt);
-    sendToLoki(ts, air, soil_moisture, battery, solarPanelVolt, "New_samples!");
+    return ESP.flashRead(offset, (uint8_t *)data, length);
   }
 
-  digitalWrite(STATUS_LED_PIN, LOW);
+  bool beginUpdate(uint32_t size) override
+  {
+    return Update.begin(size);
+  }
 
-// Print on display
-#if ENABLE_DISPLAY_OLED || ENABLE_DISPLAY_EINK
-  printDisplayInfo(ts, air, soil_moisture, battery, solarPanelVolt);
+  bool writeUpdate(const uint8_t *data, size_t length) override
+  {
+    return Update.write((uint8_t *)data, length) == length;
+  }
+
+  bool endUpdate(bool commit) override
+  {
+    // Writes the copy command of the bootloader when the image is complete, a dropped one
+    // never is (see DeltaPatch)
+    bool ended = Update.end();
+    return commit ? ended : true;
+  }
+};
+
+EspSensors espSensors;
+EspNetwork espNetwork;
+EspClock espClock;
+EspSleep espSleep;
+EspStorage espStorage;
+EspDisplay espDisplay;
+EspSystem espSystem;
+EspFirmware espFirmware;
+
+const Hal hal = {espSensors, espNetwork, espClock, espSleep, espStorage, espDisplay, espSystem, espFirmware};
+PlantNode node(hal, defaultNodeConfig());
+
+// Methods --------------------------------------------------------------------
+
+void setup()
+{
+
+#if DEBUG
+  // Serial -------
+  Serial.begin(115200);
+  delay(10);
+  Serial.println('\n');
 #endif
 
-  // Put ESP in deep sleep
-  Serial.println("Go in deep sleep for " + String(SAMPLE_INTERVAL_SEC) + " sec");
-  ESP.deepSleep(SAMPLE_INTERVAL_SEC * 1000000);
-  // delay(SAMPLE_INTERVAL_SEC * 1000);
+  node.setup();
+}
+
+void loop()
+{
+  node.loop();
 }
 
-// Measures -------------------------------------------------------------------
+// Network --------------------------------------------------------------------
 
-AirCondition measureAirCondition()
+#if NET_CACHE_BACKENDS
+// Connects to the cached address of a backend, skipping the DNS lookup.
+// The TLS handshake is then done without SNI.
+class CachedBackendClient : public BearSSL::WiFiClientSecure
 {
-  sht20.measure_all();
+public:
+  CachedBackendClient(uint32_t &cached) : cached(cached) {}
 
-  AirCondition res = {
-      sht20.tempC,
-      sht20.RH,
-      sht20.dew_pointC};
+  using BearSSL::WiFiClientSecure::connect;
 
-  return res;
-}
+  int connect(const char *host, uint16_t port) override
+  {
+    if (cached != 0)
+    {
+      if (BearSSL::WiFiClientSecure::connect(IPAddress(cached), port))
+      {
+        return 1;
+      }
+      // Stale address, resolve it again
+      cached = 0;
+    }
+
+    int res = BearSSL::WiFiClientSecure::connect(host, port);
+    if (res)
+    {
+      cached = remoteIP();
+    }
+    return res;
+  }
+
+private:
+  uint32_t &cached;
+};
+#endif
 
-ValPerc measureSoilMoisture()
+void EspNetwork::begin(NetworkState &networkState, bool lost)
 {
+  state = (EspNetworkState *)networkState.data;
 
-  int16_t raw = ads.readADC_SingleEnded(SOIL_MOISTURE_PIN);
-  int16_t perc = map(raw, AIR_MOISTURE_VAL, WATER_MOISTURE_VAL, 0, 100);
+  // Keep the radio off until there is something to upload
+  WiFi.persistent(false);
+  disconnect();
 
-  if (perc >= 100)
+  if (lost)
   {
-    perc = 100;
+    loadTlsSessions();
   }
-  else if (perc <= 0)
+}
+
+void EspNetwork::startConnect()
+{
+  if (connecting)
   {
-    perc = 0;
+    return;
   }
 
-  ValPerc res = {
-      raw,
-      perc};
+  Serial.print("Connecting to '");
+  Serial.print(WIFI_SSID);
+  Serial.println("' ...");
+
+  WiFi.forceSleepWake();
+  delay(1);
+  WiFi.mode(WIFI_STA);
 
-  return res;
+  fastConnect = state->net.valid;
+  if (fastConnect)
+  {
+    // Reuse the last lease and access point
+    WiFi.config(IPAddress(state->net.ip), IPAddress(state->net.gateway), IPAddress(state->net.subnet), IPAddress(state->net.dns));
+    WiFi.begin(WIFI_SSID, WIFI_PASSWORD, state->net.channel, state->net.bssid);
+  }
+  else
+  {
+    WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
+  }
+
+  connecting = true;
+  connectStartMs = millis();
 }
 
-ValPercFloat measureBatteryVolt()
+bool EspNetwork::connect(uint32_t timeoutMs)
 {
+  startConnect();
+  unsigned long start = millis();
+
+  if (fastConnect)
+  {
+    // The association may already be done
+    unsigned long elapsed = millis() - connectStartMs;
+    unsigned long fastMs = elapsed < NET_FAST_CONNECT_TIMEOUT_MS ? NET_FAST_CONNECT_TIMEOUT_MS - elapsed : 0;
+    if (waitForWiFi(fastMs < timeoutMs ? fastMs : timeoutMs))
+    {
+      Serial.println("reconnected");
+      ntpClient.begin();
+      return true;
+    }
 
-  int16_t raw = ads.readADC_SingleEnded(BATTERY_VOLT_PIN);
-  float volt = ads.computeVolts(raw);
-  float perc = mapFloat(volt, BATTERY_MIN_VOLTS, BATTERY_MAX_VOLTS, 0.0, 100.0);
+    Serial.print("fast reconnect failed...");
+    invalidateNetCache();
+    WiFi.disconnect();
+    // Back to DHCP
+    WiFi.config(IPAddress(), IPAddress(), IPAddress());
+    WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
+  }
 
-  if (perc >= 100.0)
+  unsigned long waited = millis() - start;
+  if (waited >= timeoutMs || !waitForWiFi(timeoutMs - waited))
   {
-    perc = 100.0;
+    Serial.println("timeout");
+    return false;
   }
-  else if (perc <= 0.0)
+  saveNetCache();
+
+  Serial.println("connected");
+  Serial.print("IP address: ");
+  Serial.println(WiFi.localIP());
+
+  ntpClient.begin();
+  return true;
+}
+
+bool EspNetwork::waitForWiFi(unsigned long timeoutMs)
+{
+  unsigned long start = millis();
+  while (WiFi.status() != WL_CONNECTED)
   {
-    perc = 0.0;
+    if (millis() - start >= timeoutMs)
+    {
+      return false;
+    }
+    delay(10);
   }
 
-  ValPercFloat res = {
-      volt,
-      perc};
+  return true;
+}
 
-  return res;
+void EspNetwork::disconnect()
+{
+  connecting = false;
+  WiFi.disconnect(true);
+  WiFi.mode(WIFI_OFF);
+  WiFi.forceSleepBegin();
+  delay(1);
+}
+
+void EspNetwork::saveNetCache()
+{
+  memcpy(state->net.bssid, WiFi.BSSID(), sizeof(state->net.bssid));
+  state->net.channel = WiFi.channel();
+  state->net.ip = WiFi.localIP();
+  state->net.gateway = WiFi.gatewayIP();
+  state->net.subnet = WiFi.subnetMask();
+  state->net.dns = WiFi.dnsIP();
+  state->net.valid = 1;
 }
 
-float measureSolarPanelVolt()
+void EspNetwork::invalidateNetCache()
 {
-  int16_t raw = ads.readADC_SingleEnded(SOLAR_PANEL_VOLT_PIN);
-  float volt = ads.computeVolts(raw);
-  return volt;
+  memset(&state->net, 0, sizeof(state->net));
 }
 
-bool evaluateSamples(AirCondition air, ValPerc soil, ValPercFloat battery, float solarPanelVolt)
+bool EspNetwork::getTime(uint32_t &epoch)
 {
-  if (air.temp > 100 || air.humidity > 100 || air.dew_point > 100)
+  if (!ntpClient.forceUpdate())
   {
     return false;
   }
 
+  epoch = ntpClient.getEpochTime();
   return true;
 }
 
-// Setup ----------------------------------------------------------------------
-
-void setupWiFi()
+int EspNetwork::post(Backend backend, const char *body, size_t length, uint32_t timeoutMs)
 {
-  Serial.print("Connecting to '");
-  Serial.print(WIFI_SSID);
-  Serial.print("' ...");
+  const Endpoint &endpoint = endpoints[backend];
 
-  WiFi.mode(WIFI_STA);
-  WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
-  while (WiFi.status() != WL_CONNECTED)
+  BearSSL::Session session;
+  restoreTlsSession(backend, session);
+
+#if NET_CACHE_BACKENDS
+  std::unique_ptr<BearSSL::WiFiClientSecure> client(new CachedBackendClient(state->net.backends[backend]));
+#else
+  std::unique_ptr<BearSSL::WiFiClientSecure> client(new BearSSL::WiFiClientSecure);
+#endif
+  client->setInsecure();
+  client->setSession(&session);
+
+  // Submit POST request via HTTP
+  http.begin(*client, endpoint.host, 443, endpoint.path, true);
+  // Bounds the connection and each read of the response
+  http.setTimeout(timeoutMs < UINT16_MAX ? timeoutMs : UINT16_MAX);
+  http.setAuthorization(endpoint.user, endpoint.pass);
+  http.addHeader("Content-Type", endpoint.contentType);
+  if (endpoint.snappy)
   {
-    delay(500);
-    Serial.print(".");
+    http.addHeader("Content-Encoding", "snappy");
+    http.addHeader("X-Prometheus-Remote-Write-Version", "0.1.0");
   }
+  int httpCode = http.POST((uint8_t *)body, length);
+  http.end();
 
-  Serial.println("connected");
-  Serial.print("IP address: ");
-  Serial.println(WiFi.localIP());
+  storeTlsSession(backend, session, httpCode);
+
+  // Transport errors may come from a stale lease
+  if (httpCode < 0)
+  {
+    invalidateNetCache();
+  }
+
+  return httpCode;
 }
 
-void sendToLoki(unsigned long ts, AirCondition air, ValPerc soil, ValPercFloat battery, float solarPanelVolt, String message)
+size_t EspNetwork::exchangeRelay(const uint8_t *data, size_t length, uint8_t *reply, size_t replySize)
 {
-  String lokiUrl = String("https://") + GC_LOKI_USER + ":" + GC_LOKI_PASS + "@" + GC_LOKI_URL + "/loki/api/v1/push";
-  String body = "{\"streams\": [{ \"stream\": { \"plant_id\": \"" + String(SENSOR_ID) + "\", \"monitoring_type\": \"plant\"}, \"values\": [ [ \"" + ts + "000000000\", \"" + "temperature=" + air.temp + " humidity=" + air.humidity + " dew_point=" + air.dew_point + " soil_moisture=" + soil.percentage + +" soil_moisture_raw=" + soil.raw + " battery_volts=" + battery.raw + " battery_perc=" + battery.percentage + " solar_panel_volts=" + solarPanelVolt + " msg=\'" + message + "\'\" ] ] }]}";
+  // Any local port, the relay replies to the sender
+  relayUDP.begin(0);
+  relayUDP.beginPacket(RELAY_HOST, RELAY_PORT);
+  relayUDP.write(data, length);
+  if (!relayUDP.endPacket())
+  {
+    relayUDP.stop();
+    return 0;
+  }
 
-  std::unique_ptr<BearSSL::WiFiClientSecure> client(new BearSSL::WiFiClientSecure);
-  client->setInsecure();
+  size_t replyLength = 0;
+  unsigned long start = millis();
+  while (millis() - start < RELAY_ACK_TIMEOUT_MS)
+  {
+    if (relayUDP.parsePacket() > 0)
+    {
+      replyLength = relayUDP.read(reply, replySize);
+      break;
+    }
+    delay(1);
+  }
+  relayUDP.stop();
 
-  // Submit POST request via HTTP
-  httpLoki.begin(*client, lokiUrl);
-  httpLoki.addHeader("Content-Type", "application/json");
-  int httpCode = httpLoki.POST(body);
-  Serial.printf("Loki [HTTPS] POST...  Code: %d\n", httpCode);
-  httpLoki.end();
+  return replyLength;
 }
 
-void sendToGraphite(unsigned long ts, AirCondition air, ValPerc soil, ValPercFloat battery, float solarPanelVolt)
+bool EspNetwork::openStream(const char *host, uint16_t port)
 {
+  if (!stream.connect(host, port))
+  {
+    // May come from a stale lease
+    invalidateNetCache();
+    return false;
+  }
 
-  // Build hosted metrics json payload
-  String body = String("[") +
-                "{\"name\":\"temperature\",\"interval\":" + SAMPLE_INTERVAL_SEC + ",\"value\":" + air.temp + ",\"mtype\":\"gauge\",\"time\":" + ts + "}," +
-                "{\"name\":\"humidity\",\"interval\":" + SAMPLE_INTERVAL_SEC + ",\"value\":" + air.humidity + ",\"mtype\":\"gauge\",\"time\":" + ts + "}," +
-                "{\"name\":\"dew_point\",\"interval\":" + SAMPLE_INTERVAL_SEC + ",\"value\":" + air.dew_point + ",\"mtype\":\"gauge\",\"time\":" + ts + "}," +
-                "{\"name\":\"soil_moisture\",\"interval\":" + SAMPLE_INTERVAL_SEC + ",\"value\":" + soil.percentage + ",\"mtype\":\"gauge\",\"time\":" + ts + "}," +
-                "{\"name\":\"battery_volts\",\"interval\":" + SAMPLE_INTERVAL_SEC + ",\"value\":" + battery.raw + ",\"mtype\":\"gauge\",\"time\":" + ts + "}," +
-                "{\"name\":\"battery_perc\",\"interval\":" + SAMPLE_INTERVAL_SEC + ",\"value\":" + battery.percentage + ",\"mtype\":\"gauge\",\"time\":" + ts + "}," +
-                "{\"name\":\"solar_panel_volts\",\"interval\":" + SAMPLE_INTERVAL_SEC + ",\"value\":" + solarPanelVolt + ",\"mtype\":\"gauge\",\"time\":" + ts + "}]";
+  // Each write is a whole packet
+  stream.setNoDelay(true);
+  return true;
+}
 
-  std::unique_ptr<BearSSL::WiFiClientSecure> client(new BearSSL::WiFiClientSecure);
-  client->setInsecure();
+bool EspNetwork::writeStream(const uint8_t *data, size_t length)
+{
+  return stream.write(data, length) == length;
+}
 
-  // Submit POST request via HTTP
-  httpGraphite.begin(*client, String("https://") + GC_GRAPHITE_URL + "/graphite/metrics");
-  httpGraphite.setAuthorization(GC_GRAPHITE_USER, GC_GRAPHITE_PASS);
-  httpGraphite.addHeader("Content-Type", "application/json");
+bool EspNetwork::readStream(uint8_t *data, size_t length, uint32_t timeoutMs)
+{
+  // Taken as it comes in: length may be more than the TCP window, the peer would wait for room
+  unsigned long start = millis();
+  size_t got = 0;
+  while (got < length)
+  {
+    int available = stream.available();
+    if (available > 0)
+    {
+      size_t part = length - got < (size_t)available ? length - got : (size_t)available;
+      int read = stream.read(data + got, part);
+      got += read > 0 ? read : 0;
+      continue;
+    }
+    if (!stream.connected() || millis() - start >= timeoutMs)
+    {
+      return false;
+    }
+    delay(1);
+  }
 
-  int httpCode = httpGraphite.POST(body);
-  Serial.printf("Graphite [HTTPS] POST...  Code: %d\n", httpCode);
-  httpGraphite.end();
+  return true;
 }
 
-// Display --------------------------------------------------------------------
+void EspNetwork::closeStream()
+{
+  stream.stop();
+}
+
+// TLS sessions ---------------------------------------------------------------
 
-String getTimeString(unsigned long ts)
+void EspNetwork::loadTlsSessions()
 {
-  int hours = (ts / 60 / 60) % 24;
-  int min = (ts / 60) % 60;
-  String hoursStr = hours < 10 ? "0" + String(hours) : String(hours);
-  String minStr = min < 10 ? "0" + String(min) : String(min);
+#if TLS_SESSION_FLASH
+  // RTC memory was lost (e.g. power cycle), fall back to the copy in flash
+  ::loadTlsSessions(espStorage, state->tls);
+#endif
+}
 
-  return hoursStr + ":" + minStr;
+void EspNetwork::restoreTlsSession(Backend backend, BearSSL::Session &session)
+{
+  memcpy((void *)&session, tlsSession(state->tls, backend), sizeof(session));
 }
 
+void EspNetwork::storeTlsSession(Backend backend, const BearSSL::Session &session, int httpCode)
+{
+  TlsHandshake handshake = recordTlsSession(state->tls, backend, &session, sizeof(session), httpCode, TLS_SESSION_FLASH ? &espStorage : nullptr);
+  if (handshake != TLS_NO_HANDSHAKE)
+  {
+    Serial.printf("TLS handshake %s (resumed: %u, full: %u)\n", handshake == TLS_RESUMED ? "resumed" : "full", state->tls.resumed, state->tls.full);
+  }
+}
+
+// Display --------------------------------------------------------------------
+
 #if ENABLE_DISPLAY_OLED
 
-void printDisplayInfo(unsigned long ts, AirCondition air, ValPerc soil, ValPercFloat battery, float solarPanelVolt)
+// Cheap to redraw, the whole screen is drawn every time
+void printDisplayInfo(const ScreenValues &values, const ScreenUpdate &update)
 {
+  char time[SCREEN_TEXT_SIZE];
+  screenText(values, SCREEN_TIME, time, sizeof(time));
+
   Serial.println("Print on display full info");
   display.clearDisplay();
   display.setTextSize(1);
   display.setTextColor(WHITE);
   display.setCursor(0, 0);
 
-  display.printf("TEM  %.1f", air.temp);
+  display.printf("TEM  %.1f", values.temp / 10.0);
   display.println("C");
-  display.printf("HUM    %.0f", air.humidity);
+  display.printf("HUM    %u", values.humidity);
   display.println("%");
-  display.printf("SOIL   %i", soil.percentage);
+  display.printf("SOIL   %u", values.soil);
   display.println("%");
   display.println("");
   display.println("----------");
-  display.println("O    " + getTimeString(ts));
+  display.print("O    ");
+  display.println(time);
 
   display.display();
 
@@ -371,7 +892,7 @@ void printDisplayInfo(unsigned long ts, AirCondition air, ValPerc soil, ValPercF
   display.display();
 }
 
-void printDisplay(String text)
+void printDisplay(const char *text)
 {
   Serial.println("Print on display");
   display.clearDisplay();
@@ -387,78 +908,153 @@ void printDisplay(String text)
 
 #if ENABLE_DISPLAY_EINK
 
-void printTextOnDisplay(String text, uint16_t x, uint16_t y, const GFXfont *font, bool centerX, bool centerY)
+// Draws the display list into the page buffer
+class EinkCanvas : public DisplayCanvas
+{
+public:
+  void clear() override
+  {
+    display.fillScreen(GxEPD_WHITE);
+  }
+
+  void drawRun(int16_t x, int16_t y, int16_t length) override
+  {
+    display.drawFastHLine(x, y, length, GxEPD_BLACK);
+  }
+
+  void drawText(const DisplayItem &item) override
+  {
+    display.setFont((const GFXfont *)item.font);
+    display.setTextColor(GxEPD_BLACK);
+    display.setCursor(item.x, item.y);
+    display.print(item.text);
+  }
+};
+
+// Laid out once per frame, replayed for each page
+DisplayList displayList;
+
+// Position text wrt the given coord
+DisplayItem layoutText(const char *text, int16_t x, int16_t y, const GFXfont *font, bool centerX, bool centerY)
 {
   display.setFont(font);
-  display.setTextColor(GxEPD_BLACK);
 
   int16_t tbx, tby;
   uint16_t tbw, tbh;
   display.getTextBounds(text, x, y, &tbx, &tby, &tbw, &tbh);
-  // Center wrt the given coord
-  uint16_t lx = centerX ? (x - (tbw / 2)) : x;
-  uint16_t ly = centerY ? y + (tbh / 2) : y;
+  int16_t cursorX = centerX ? x - tbw / 2 : x;
+  int16_t cursorY = centerY ? y + tbh / 2 : y;
 
-  display.setCursor(lx, ly);
-  display.print(text);
+  int16_t boxX = tbx + cursorX - x;
+  int16_t boxY = tby + cursorY - y;
+  return displayText(cursorX, cursorY, font, text, {boxX, boxY, (int16_t)(boxX + tbw), (int16_t)(boxY + tbh)});
 }
 
-void printDisplayInfo(unsigned long ts, AirCondition air, ValPerc soil, ValPercFloat battery, float solarPanelVolt)
+// Layout of a field of the info screen (rotation 1)
+struct EinkField
 {
-  Serial.println("Print on display full info");
+  int16_t x;
+  int16_t y;
+  const GFXfont *font;
+  bool centerX;
+  bool centerY;
+};
 
-  display.setRotation(1);
-  display.setFullWindow();
-  display.firstPage();
+const EinkField EINK_FIELDS[SCREEN_FIELD_COUNT] = {
+    {100, 12, &FreeMonoBold9pt7b, true, false},   // Current time
+    {80, 60, &FreeMonoBold24pt7b, false, true},   // Soil moisture
+    {30, 160, &FreeMonoBold12pt7b, false, true},  // Air temperature
+    {145, 160, &FreeMonoBold12pt7b, false, true}, // Air humidity
+    {100, 198, &Org_01, true, false}};            // Next update time
 
-  do
-  {
-    display.fillScreen(GxEPD_BLACK);
-    // Draw background
-    display.drawBitmap(0, 0, EINK_BACKGROUND, display.epd2.WIDTH, display.epd2.HEIGHT, GxEPD_WHITE);
-
-    char buffer[10];
-    // Print current time
-    printTextOnDisplay(getTimeString(ts), display.height() / 2, 12, &FreeMonoBold9pt7b, true, false);
-    // Print soil moisture
-    sprintf(buffer, "%i%%", soil.percentage);
-    printTextOnDisplay(buffer, 80, 60, &FreeMonoBold24pt7b, false, true);
-    // Print air temperature
-    sprintf(buffer, "%.1fC", air.temp);
-    printTextOnDisplay(buffer, 30, 160, &FreeMonoBold12pt7b, false, true);
-    // Print air humidity
-    sprintf(buffer, "%.0f%%", air.humidity);
-    printTextOnDisplay(buffer, 145, 160, &FreeMonoBold12pt7b, false, true);
-    // Print next update time
-    printTextOnDisplay("Next at " + getTimeString(ts + SAMPLE_INTERVAL_SEC), display.height() / 2, display.width() - 2, &Org_01, true, false);
+DisplayItem layoutField(const ScreenValues &values, ScreenField f)
+{
+  char text[SCREEN_TEXT_SIZE];
+  screenText(values, f, text, sizeof(text));
 
-  } while (display.nextPage());
-  display.hibernate();
+  const EinkField &field = EINK_FIELDS[f];
+  return layoutText(text, field.x, field.y, field.font, field.centerX, field.centerY);
 }
 
-void printDisplay(String text)
+// Pages are bands of panel rows, that is of screen columns with rotation 1
+DisplayRect pageClip(uint16_t page, const DisplayRect &window)
 {
-  Serial.println("Print on display");
-  display.setRotation(1);
-  display.setFullWindow();
-  display.firstPage();
+  int16_t x0 = window.x0 + page * display.pageHeight();
+  int16_t x1 = x0 + display.pageHeight();
+  return {x0, window.y0, x1 < window.x1 ? x1 : window.x1, window.y1};
+}
 
+void drawPages(const DisplayRect &window)
+{
+  EinkCanvas canvas;
+  uint16_t page = 0;
+
+  display.firstPage();
   do
   {
-    display.fillScreen(GxEPD_WHITE);
-    printTextOnDisplay(text, display.width() / 2, display.height() / 2, &FreeMonoBold12pt7b, true, true);
+    displayList.replay(canvas, pageClip(page++, window));
   } while (display.nextPage());
-  // display.hibernate();
 }
-#endif
 
-// Utils ----------------------------------------------------------------------
+// Full refreshes take seconds and flash the panel, in between only the changed fields are
+// redrawn with a single partial refresh
+void printDisplayInfo(const ScreenValues &values, const ScreenUpdate &update)
+{
+  if (update.dirty == 0)
+  {
+    Serial.println("Display unchanged");
+    return;
+  }
+
+  display.setRotation(1);
+  displayList.clear();
+  displayList.add(displayImage(0, 0, EINK_BACKGROUND));
 
-float mapFloat(float x, float in_min, float in_max, float out_min, float out_max)
+  // Erase the old text of the changed fields and draw the new one
+  DisplayRect window = {display.width(), display.height(), 0, 0};
+  for (uint8_t f = 0; f < SCREEN_FIELD_COUNT; f++)
+  {
+    DisplayItem item = layoutField(values, (ScreenField)f);
+    displayList.add(item);
+    if (update.dirty & SCREEN_BIT(f))
+    {
+      displayCover(window, item.box);
+      displayCover(window, layoutField(update.previous, (ScreenField)f).box);
+    }
+  }
+
+  if (update.full)
+  {
+    Serial.println("Print on display full info");
+    window = {0, 0, display.width(), display.height()};
+    display.setFullWindow();
+  }
+  else
+  {
+    // Panel columns are written by bytes: align the window so that GxEPD2 does not grow it
+    window.x0 = max(window.x0, (int16_t)0);
+    window.y0 = max(window.y0, (int16_t)0) & ~7;
+    window.x1 = min(window.x1, (int16_t)display.width());
+    window.y1 = min((window.y1 + 7) & ~7, (int)display.height());
+
+    Serial.printf("Print on display partial info (%d,%d %dx%d)\n", window.x0, window.y0, window.x1 - window.x0, window.y1 - window.y0);
+    display.setPartialWindow(window.x0, window.y0, window.x1 - window.x0, window.y1 - window.y0);
+  }
+
+  // Every field in the window is redrawn, those overlapping it would be erased otherwise
+  drawPages(window);
+  display.hibernate();
+}
+
+void printDisplay(const char *text)
 {
-  const float dividend = out_max - out_min;
-  const float divisor = in_max - in_min;
-  const float delta = x - in_min;
+  Serial.println("Print on display");
+  display.setRotation(1);
+  display.setFullWindow();
 
-  return (delta * dividend + (divisor / 2.0)) / divisor + out_min;
+  displayList.clear();
+  displayList.add(layoutText(text, display.width() / 2, display.height() / 2, &FreeMonoBold12pt7b, true, true));
+  drawPages({0, 0, display.width(), display.height()});
+  // display.hibernate();
 }
+#endif
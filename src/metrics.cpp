@@ -0,0 +1,119 @@
+#include "metrics.h"
+
+// Names and units -------------------------------------------------------------
+
+#define METRIC_STRINGS(id, name, unit, type, value, min, max, series, perProbe) \
+  static const char METRIC_NAME_##id[] PROGMEM = name;                          \
+  static const char METRIC_UNIT_##id[] PROGMEM = unit;
+METRIC_TABLE(METRIC_STRINGS)
+#undef METRIC_STRINGS
+
+#define METRIC_NAME(id, name, unit, type, value, min, max, series, perProbe) METRIC_NAME_##id,
+static const char *const METRIC_NAMES[METRIC_COUNT] PROGMEM = {METRIC_TABLE(METRIC_NAME)};
+#undef METRIC_NAME
+
+#define METRIC_UNIT(id, name, unit, type, value, min, max, series, perProbe) METRIC_UNIT_##id,
+static const char *const METRIC_UNITS[METRIC_COUNT] PROGMEM = {METRIC_TABLE(METRIC_UNIT)};
+#undef METRIC_UNIT
+
+#define METRIC_TYPE(id, name, unit, type, value, min, max, series, perProbe) type,
+static const uint8_t METRIC_TYPES[METRIC_COUNT] PROGMEM = {METRIC_TABLE(METRIC_TYPE)};
+#undef METRIC_TYPE
+
+#define METRIC_PER_PROBE(id, name, unit, type, value, min, max, series, perProbe) perProbe,
+static const bool METRIC_PER_PROBE_FLAGS[METRIC_COUNT] PROGMEM = {METRIC_TABLE(METRIC_PER_PROBE)};
+#undef METRIC_PER_PROBE
+
+// Series ---------------------------------------------------------------------
+
+#define METRIC_SERIES(id, name, unit, type, value, min, max, series, perProbe) series,
+static constexpr bool METRIC_SERIES_FLAGS[METRIC_COUNT] = {METRIC_TABLE(METRIC_SERIES)};
+#undef METRIC_SERIES
+
+struct SeriesTable
+{
+  uint8_t metrics[METRIC_SERIES_COUNT];
+};
+
+// Metric of each series, computed by the compiler
+static constexpr SeriesTable seriesTable()
+{
+  SeriesTable table = {};
+  uint8_t n = 0;
+  for (uint8_t m = 0; m < METRIC_COUNT; m++)
+  {
+    if (METRIC_SERIES_FLAGS[m])
+    {
+      table.metrics[n++] = m;
+    }
+  }
+
+  return table;
+}
+
+static const SeriesTable SERIES PROGMEM = seriesTable();
+
+// Methods --------------------------------------------------------------------
+
+PGM_P metricName(MetricId metric)
+{
+  return (PGM_P)pgm_read_ptr(&METRIC_NAMES[metric]);
+}
+
+PGM_P metricUnit(MetricId metric)
+{
+  return (PGM_P)pgm_read_ptr(&METRIC_UNITS[metric]);
+}
+
+MetricType metricType(MetricId metric)
+{
+  return (MetricType)pgm_read_byte(&METRIC_TYPES[metric]);
+}
+
+bool metricPerProbe(MetricId metric)
+{
+  return pgm_read_byte(&METRIC_PER_PROBE_FLAGS[metric]);
+}
+
+float metricValue(const Sample &s, MetricId metric, uint8_t p)
+{
+#define METRIC_VALUE(id, name, unit, type, value, min, max, series, perProbe) \
+  case METRIC_##id:                                                           \
+    return value;
+
+  switch (metric)
+  {
+    METRIC_TABLE(METRIC_VALUE)
+  default:
+    return 0;
+  }
+#undef METRIC_VALUE
+}
+
+uint8_t metricProbes(const Sample &s, MetricId metric)
+{
+  return metricPerProbe(metric) ? s.probes : 1;
+}
+
+MetricId seriesMetric(uint8_t series)
+{
+  return (MetricId)pgm_read_byte(&SERIES.metrics[series]);
+}
+
+bool metricsValid(const Sample &s)
+{
+// Written so that NaN is out of every range
+#define METRIC_RANGE(id, name, unit, type, value, min, max, series, perProbe) \
+  for (uint8_t p = 0; p < ((perProbe) ? s.probes : 1); p++)                   \
+  {                                                                           \
+    if (!((float)(value) >= (min) && (float)(value) <= (max)))                \
+    {                                                                         \
+      return false;                                                           \
+    }                                                                         \
+  }
+
+  METRIC_TABLE(METRIC_RANGE)
+#undef METRIC_RANGE
+
+  return true;
+}
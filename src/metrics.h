@@ -0,0 +1,67 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <math.h>
+
+#include "compat.h"
+#include "sample.h"
+
+// Values of a sample, in the order of the Loki line. A metric added here goes into the
+// Graphite, remote write and Loki payloads and into the validity check of the samples.
+//   id        MetricId is METRIC_<id>
+//   name      Graphite and remote write series, key in the Loki line
+//   unit      shown after the value on the display
+//   type      METRIC_FLOAT (2 decimals) or METRIC_INT
+//   value     expression of the Sample s, and of the probe p for the values of each probe
+//   min, max  valid range, samples with a value outside are dropped
+//   series    false for the values only in the Loki line
+//   perProbe  true for the values of each soil probe, labelled with the probe if there are several
+#define METRIC_TABLE(X)                                                                                            \
+  X(TEMPERATURE, "temperature", "C", METRIC_FLOAT, s.air.temp, -40, 100, true, false)                              \
+  X(HUMIDITY, "humidity", "%", METRIC_FLOAT, s.air.humidity, 0, 100, true, false)                                  \
+  X(DEW_POINT, "dew_point", "C", METRIC_FLOAT, s.air.dew_point, -100, 100, true, false)                            \
+  X(SOIL_MOISTURE, "soil_moisture", "%", METRIC_INT, s.soil[p].percentage, 0, 100, true, true)                     \
+  X(SOIL_MOISTURE_RAW, "soil_moisture_raw", "", METRIC_INT, s.soil[p].raw, -INFINITY, INFINITY, false, true)       \
+  X(BATTERY_VOLTS, "battery_volts", "V", METRIC_FLOAT, s.battery.raw, -INFINITY, INFINITY, true, false)            \
+  X(BATTERY_PERC, "battery_perc", "%", METRIC_FLOAT, s.battery.percentage, 0, 100, true, false)                    \
+  X(SOLAR_PANEL_VOLTS, "solar_panel_volts", "V", METRIC_FLOAT, s.solarPanelVolt, -INFINITY, INFINITY, true, false) \
+  X(TIME_ERROR, "time_error", "s", METRIC_FLOAT, s.timeError, 0, INFINITY, true, false)                            \
+  X(SUPPRESSED, "suppressed_samples", "", METRIC_INT, s.suppressed, 0, INFINITY, true, false)
+
+enum MetricType
+{
+  METRIC_FLOAT,
+  METRIC_INT
+};
+
+#define METRIC_ENUM(id, name, unit, type, value, min, max, series, perProbe) METRIC_##id,
+enum MetricId
+{
+  METRIC_TABLE(METRIC_ENUM)
+  METRIC_COUNT
+};
+#undef METRIC_ENUM
+
+// Metrics that are also series
+#define METRIC_IS_SERIES(id, name, unit, type, value, min, max, series, perProbe) +((series) ? 1 : 0)
+#define METRIC_SERIES_COUNT (0 METRIC_TABLE(METRIC_IS_SERIES))
+// Series of each probe
+#define METRIC_IS_PROBE_SERIES(id, name, unit, type, value, min, max, series, perProbe) +((series) && (perProbe) ? 1 : 0)
+#define METRIC_PROBE_SERIES_COUNT (0 METRIC_TABLE(METRIC_IS_PROBE_SERIES))
+// Series of a sample with the given number of probes
+#define METRIC_SAMPLE_SERIES_COUNT(probes) (METRIC_SERIES_COUNT + ((probes) - 1) * METRIC_PROBE_SERIES_COUNT)
+
+PGM_P metricName(MetricId metric);
+PGM_P metricUnit(MetricId metric);
+MetricType metricType(MetricId metric);
+bool metricPerProbe(MetricId metric);
+// Value of the metric, of the given probe for the values of each probe
+float metricValue(const Sample &s, MetricId metric, uint8_t probe);
+// Probes of the sample the metric has a value for
+uint8_t metricProbes(const Sample &s, MetricId metric);
+// Metric of a series (0 <= series < METRIC_SERIES_COUNT)
+MetricId seriesMetric(uint8_t series);
+// Whether every value is in its valid range, NaN never is
+bool metricsValid(const Sample &s);
+
+#endif
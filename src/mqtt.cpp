@@ -0,0 +1,149 @@
+#include "mqtt.h"
+
+#define MQTT_CONNECT 0x10
+#define MQTT_CONNACK 0x20
+#define MQTT_PUBLISH 0x30
+#define MQTT_PUBACK 0x40
+#define MQTT_DISCONNECT 0xE0
+
+#define MQTT_PUBLISH_QOS1 0x02
+
+#define MQTT_CONNECT_USER 0x80
+#define MQTT_CONNECT_PASS 0x40
+#define MQTT_CONNECT_CLEAN 0x02
+#define MQTT_PROTOCOL_LEVEL 4
+
+// Writer ---------------------------------------------------------------------
+
+namespace
+{
+
+class PacketWriter
+{
+public:
+  PacketWriter(uint8_t *buffer, size_t size) : buffer(buffer), size(size), len(0), overflowed(false) {}
+
+  void u8(uint8_t value)
+  {
+    if (len >= size)
+    {
+      overflowed = true;
+      return;
+    }
+    buffer[len++] = value;
+  }
+
+  void u16(uint16_t value)
+  {
+    u8(value >> 8);
+    u8(value);
+  }
+
+  // Variable length integer of the fixed header
+  void remainingLength(size_t value)
+  {
+    do
+    {
+      uint8_t digit = value % 128;
+      value /= 128;
+      u8(value > 0 ? digit | 0x80 : digit);
+    } while (value > 0);
+  }
+
+  void string(const char *str)
+  {
+    size_t strLen = strlen(str);
+    u16(strLen);
+    for (size_t i = 0; i < strLen; i++)
+    {
+      u8(str[i]);
+    }
+  }
+
+  size_t length() const { return overflowed ? 0 : len; }
+
+private:
+  uint8_t *buffer;
+  size_t size;
+  size_t len;
+  bool overflowed;
+};
+
+} // namespace
+
+// Packets --------------------------------------------------------------------
+
+size_t mqttConnect(uint8_t *buffer, size_t size, const char *clientId, const char *user, const char *pass, uint16_t keepAliveSec, bool cleanSession)
+{
+  bool hasUser = user[0] != '\0';
+  bool hasPass = hasUser && pass[0] != '\0';
+
+  // Protocol name, level, flags, keep alive and the payload strings
+  size_t remaining = 6 + 1 + 1 + 2 + 2 + strlen(clientId);
+  remaining += hasUser ? 2 + strlen(user) : 0;
+  remaining += hasPass ? 2 + strlen(pass) : 0;
+
+  uint8_t flags = (hasUser ? MQTT_CONNECT_USER : 0) | (hasPass ? MQTT_CONNECT_PASS : 0) | (cleanSession ? MQTT_CONNECT_CLEAN : 0);
+
+  PacketWriter w(buffer, size);
+  w.u8(MQTT_CONNECT);
+  w.remainingLength(remaining);
+  w.string("MQTT");
+  w.u8(MQTT_PROTOCOL_LEVEL);
+  w.u8(flags);
+  w.u16(keepAliveSec);
+  w.string(clientId);
+  if (hasUser)
+  {
+    w.string(user);
+  }
+  if (hasPass)
+  {
+    w.string(pass);
+  }
+
+  return w.length();
+}
+
+size_t mqttPublishHeader(uint8_t *buffer, size_t size, const char *topic, size_t payloadLength, uint16_t packetId)
+{
+  PacketWriter w(buffer, size);
+  w.u8(MQTT_PUBLISH | MQTT_PUBLISH_QOS1);
+  w.remainingLength(2 + strlen(topic) + 2 + payloadLength);
+  w.string(topic);
+  w.u16(packetId);
+
+  return w.length();
+}
+
+size_t mqttDisconnect(uint8_t *buffer, size_t size)
+{
+  PacketWriter w(buffer, size);
+  w.u8(MQTT_DISCONNECT);
+  w.u8(0);
+
+  return w.length();
+}
+
+bool mqttParseConnack(const uint8_t *packet, bool &sessionPresent, uint8_t &returnCode)
+{
+  if (packet[0] != MQTT_CONNACK || packet[1] != 2)
+  {
+    return false;
+  }
+
+  sessionPresent = packet[2] & 0x01;
+  returnCode = packet[3];
+  return true;
+}
+
+bool mqttParsePuback(const uint8_t *packet, uint16_t &packetId)
+{
+  if (packet[0] != MQTT_PUBACK || packet[1] != 2)
+  {
+    return false;
+  }
+
+  packetId = packet[2] << 8 | packet[3];
+  return true;
+}
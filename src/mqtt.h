@@ -0,0 +1,25 @@
+#ifndef MQTT_H
+#define MQTT_H
+
+#include "compat.h"
+
+// Packets of MQTT 3.1.1 needed to publish with QoS 1 (the client never subscribes)
+
+#define MQTT_CONNACK_SIZE 4
+#define MQTT_PUBACK_SIZE 4
+#define MQTT_DISCONNECT_SIZE 2
+#define MQTT_CONNECT_SIZE(idLen, userLen, passLen) (5 + 10 + 2 + (idLen) + 2 + (userLen) + 2 + (passLen))
+#define MQTT_PUBLISH_HEADER_SIZE(topicLen) (5 + 2 + (topicLen) + 2)
+
+// CONNECT, cleanSession = false keeps the session (and its unacknowledged messages) on the broker.
+// user and pass may be empty. Return the packet length, 0 if it does not fit.
+size_t mqttConnect(uint8_t *buffer, size_t size, const char *clientId, const char *user, const char *pass, uint16_t keepAliveSec, bool cleanSession);
+// Fixed and variable header of a QoS 1 PUBLISH, the payload follows. Return the header length, 0 if it does not fit.
+size_t mqttPublishHeader(uint8_t *buffer, size_t size, const char *topic, size_t payloadLength, uint16_t packetId);
+size_t mqttDisconnect(uint8_t *buffer, size_t size);
+
+// Parse the replies of the broker, return false if the packet is not the expected one
+bool mqttParseConnack(const uint8_t *packet, bool &sessionPresent, uint8_t &returnCode);
+bool mqttParsePuback(const uint8_t *packet, uint16_t &packetId);
+
+#endif
@@ -0,0 +1,583 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include "../config.h"
+#include "../calibration.h"
+#include "../displaylist.h"
+#include "../eink_background.h"
+#include "../filter.h"
+#include "../frame.h"
+#include "../payload.h"
+#include "../probes.h"
+#include "../remotewrite.h"
+#include "sim.h"
+
+#define BENCH_RUNS 200000
+#define BENCH_CALIBRATION_RUNS 1000000
+#define BENCH_PAYLOAD_RUNS 2000
+#define BENCH_PAYLOAD_SIZE 16384
+#define BENCH_ASSET_RUNS 20000
+#define BENCH_DISPLAY_RUNS 2000
+#define BENCH_PANEL_SIZE 200
+
+struct BenchChannel
+{
+  const char *name;
+  FilterConfig filter;
+};
+
+// Cost of the ADC filtering of each channel: conversion time on the ADS1115 (modelled)
+// and computation time of the burst and IIR filters (measured on the host)
+int benchFilters()
+{
+  static const BenchChannel channels[] = {
+      {"soil", {ADC_SAMPLES, ADC_TRIM, ADC_IIR_SHIFT_SOIL}},
+      {"battery", {ADC_SAMPLES, ADC_TRIM, ADC_IIR_SHIFT_BATTERY}},
+      {"solar", {ADC_SAMPLES, ADC_TRIM, ADC_IIR_SHIFT_SOLAR}}};
+
+  printf("channel,samples,trim,iir_shift,conversion_us,filter_ns\n");
+
+  uint32_t seed = 1;
+  volatile int32_t sink = 0;
+  for (uint8_t c = 0; c < sizeof(channels) / sizeof(channels[0]); c++)
+  {
+    const FilterConfig &filter = channels[c].filter;
+    uint8_t samples = filter.samples > 0 && filter.samples <= FILTER_MAX_SAMPLES ? filter.samples : 1;
+    FilterState state = {};
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t run = 0; run < BENCH_RUNS; run++)
+    {
+      int16_t burst[FILTER_MAX_SAMPLES];
+      for (uint8_t i = 0; i < samples; i++)
+      {
+        seed = seed * 1103515245 + 12345;
+        burst[i] = 12000 + (seed >> 16) % 256;
+      }
+      int16_t value = filterBurst(burst, samples, filter.trim);
+      sink = sink + filterIir(state, c, value, filter.iirShift);
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+
+    printf("%s,%u,%u,%u,%u,%llu\n", channels[c].name, samples, filter.trim, filter.iirShift,
+           samples * (SIM_ADS_US(ADC_RATE_SPS) + 2 * SIM_I2C_US), (unsigned long long)(elapsed.count() / BENCH_RUNS));
+  }
+
+  return 0;
+}
+
+// Float path replaced by the calibration curves: computeVolts() of the ADS1115 library at the
+// default gain, then a line between two points as the former mapFloat() and map()
+#define BENCH_FLOAT_VOLTS_PER_BIT 0.0001875f
+#define BENCH_FLOAT_BATTERY_MIN_VOLTS 2.8
+#define BENCH_FLOAT_BATTERY_MAX_VOLTS 4.2
+
+static float benchFloatBattery(int16_t raw)
+{
+  float volt = raw * BENCH_FLOAT_VOLTS_PER_BIT;
+  float delta = volt - BENCH_FLOAT_BATTERY_MIN_VOLTS;
+  float divisor = BENCH_FLOAT_BATTERY_MAX_VOLTS - BENCH_FLOAT_BATTERY_MIN_VOLTS;
+  float perc = (delta * 100.0f + divisor / 2.0f) / divisor;
+  return perc >= 100.0f ? 100.0f : perc <= 0.0f ? 0.0f : perc;
+}
+
+static float benchFloatSoil(int16_t raw, float air, float water)
+{
+  float perc = (raw - air) * 100.0f / (water - air);
+  return perc >= 100.0f ? 100.0f : perc <= 0.0f ? 0.0f : roundf(perc);
+}
+
+// Largest difference between the fixed point evaluation and the exact line through the
+// points, over the curve and a bit past its ends
+static double benchCurveError(const CalCurve &curve)
+{
+  double worst = 0;
+  int32_t from = curve.points[0].x - 100;
+  int32_t to = curve.points[curve.count - 1].x + 100;
+  for (int32_t x = from; x <= to; x++)
+  {
+    const CalPoint *b = curve.points;
+    while (b < curve.points + curve.count - 1 && x >= b->x)
+    {
+      b++;
+    }
+    const CalPoint *a = b > curve.points ? b - 1 : b;
+    double exact = x <= a->x ? a->y : x >= b->x ? b->y : a->y + (double)(x - a->x) * (b->y - a->y) / (b->x - a->x);
+    double error = fabs(calEvaluate(curve, x) - exact) / CAL_ONE;
+    worst = error > worst ? error : worst;
+  }
+
+  return worst;
+}
+
+// Calibration of the ADC results, with the float path it replaced (soft-float on the ESP8266)
+// and with the fixed point curves (measured on the host, which has an FPU)
+int benchCalibration()
+{
+  printf("channel,points,float_ns,fixed_ns,max_error\n");
+
+  volatile float floatSink = 0;
+  volatile int32_t fixedSink = 0;
+  uint32_t seed = 1;
+  int16_t raws[256];
+  for (uint16_t i = 0; i < 256; i++)
+  {
+    seed = seed * 1103515245 + 12345;
+    raws[i] = 14000 + (seed >> 16) % 9000; // 2.6 to 4.3V
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t run = 0; run < BENCH_CALIBRATION_RUNS; run++)
+  {
+    floatSink = floatSink + benchFloatBattery(raws[run & 0xff]);
+  }
+  auto floatNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+  start = std::chrono::steady_clock::now();
+  for (uint32_t run = 0; run < BENCH_CALIBRATION_RUNS; run++)
+  {
+    fixedSink = fixedSink + calEvaluate(BATTERY_CURVE, adcMilliVolts(raws[run & 0xff], 6144));
+  }
+  auto fixedNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+  printf("battery,%u,%.1f,%.1f,%.4f\n", BATTERY_CURVE.count, (double)floatNs.count() / BENCH_CALIBRATION_RUNS,
+         (double)fixedNs.count() / BENCH_CALIBRATION_RUNS, benchCurveError(BATTERY_CURVE));
+
+  for (uint8_t p = 0; p < SOIL_PROBE_COUNT; p++)
+  {
+    const CalCurve &curve = *SOIL_PROBE_TABLE[p].curve;
+    const CalPoint &first = curve.points[0];
+    const CalPoint &last = curve.points[curve.count - 1];
+    float water = first.y > last.y ? first.x : last.x;
+    float air = first.y > last.y ? last.x : first.x;
+    for (uint16_t i = 0; i < 256; i++)
+    {
+      seed = seed * 1103515245 + 12345;
+      raws[i] = first.x + (seed >> 16) % (uint32_t)(last.x - first.x + 1);
+    }
+
+    start = std::chrono::steady_clock::now();
+    for (uint32_t run = 0; run < BENCH_CALIBRATION_RUNS; run++)
+    {
+      floatSink = floatSink + benchFloatSoil(raws[run & 0xff], air, water);
+    }
+    floatNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    start = std::chrono::steady_clock::now();
+    for (uint32_t run = 0; run < BENCH_CALIBRATION_RUNS; run++)
+    {
+      fixedSink = fixedSink + soilPercentage(p, raws[run & 0xff]);
+    }
+    fixedNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    printf("soil_%u,%u,%.1f,%.1f,%.4f\n", p, curve.count, (double)floatNs.count() / BENCH_CALIBRATION_RUNS,
+           (double)fixedNs.count() / BENCH_CALIBRATION_RUNS, benchCurveError(curve));
+  }
+
+  // Every result of the ADS1115 against the float conversion
+  double worst = 0;
+  for (int32_t raw = INT16_MIN; raw <= INT16_MAX; raw++)
+  {
+    double error = fabs(adcMilliVolts(raw, 6144) - raw * 0.1875);
+    worst = error > worst ? error : worst;
+  }
+  printf("# millivolts, max error: %.4f mV\n", worst);
+
+  return 0;
+}
+
+// Checks the decoded remote write series against the samples they were built from
+static bool checkRemoteWrite(const std::vector<SimSeries> &series, const Sample *samples, size_t count, const Trace &trace)
+{
+  size_t phases = 0;
+  for (uint8_t p = 0; p < TRACE_PHASE_COUNT; p++)
+  {
+    phases += traceHasPhase(trace, (TracePhase)p);
+  }
+  size_t n = METRIC_SAMPLE_SERIES_COUNT(samples[0].probes);
+  if (series.size() != n + 2 + phases * 4)
+  {
+    return false;
+  }
+
+  const SimSeries *s = series.data();
+  for (uint8_t m = 0; m < METRIC_SERIES_COUNT; m++)
+  {
+    MetricId metric = seriesMetric(m);
+    uint8_t probes = metricProbes(samples[0], metric);
+    for (uint8_t p = 0; p < probes; p++, s++)
+    {
+      if (s->labels.size() != (probes > 1 ? 3u : 2u) || s->labels[0].value != metricName(metric) || s->labels[1].name != "plant_id" ||
+          s->labels[1].value != SENSOR_ID || s->samples.size() != count)
+      {
+        return false;
+      }
+      if (probes > 1 && (s->labels[2].name != "probe" || s->labels[2].value != std::to_string(p)))
+      {
+        return false;
+      }
+      for (size_t i = 0; i < count; i++)
+      {
+        if (s->samples[i].value != (double)metricValue(samples[i], metric, p) || s->samples[i].timestampMs != (int64_t)samples[i].ts * 1000)
+        {
+          return false;
+        }
+      }
+    }
+  }
+
+  return series[n].samples[0].value == trace.awakeMs && series[n + 1].samples[0].value == trace.overruns;
+}
+
+// Checks the decoded relay frame against the samples it was built from
+static bool checkFrame(const uint8_t *data, size_t length, const Sample *samples, size_t count)
+{
+  static Frame frame;
+  if (!decodeFrame(data, length, frame) || frame.count != count)
+  {
+    return false;
+  }
+
+  for (size_t i = 0; i < count; i++)
+  {
+    if (frame.samples[i].probes != samples[i].probes)
+    {
+      return false;
+    }
+    for (uint8_t p = 0; p < samples[i].probes; p++)
+    {
+      if (frame.samples[i].soil[p].raw != samples[i].soil[p].raw || frame.samples[i].soil[p].percentage != samples[i].soil[p].percentage)
+      {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+// Size of the payloads of an upload, and cost of the remote write encoding (measured on the host)
+int benchPayloads()
+{
+  static char buffer[BENCH_PAYLOAD_SIZE];
+
+  Sample samples[BATCH_MAX_SAMPLES] = {};
+  for (size_t i = 0; i < BATCH_MAX_SAMPLES; i++)
+  {
+    Sample &s = samples[i];
+    s.ts = 1700000000 + i * 300;
+    s.air = {21.37f + i * 0.1f, 54.2f - i * 0.3f, 11.82f};
+    for (uint8_t p = 0; p < SOIL_PROBE_COUNT; p++)
+    {
+      s.soil[p] = {9312 + (int)i * 7 + p * 1500, 72 - p * 16};
+    }
+    s.probes = SOIL_PROBE_COUNT;
+    s.battery = {3.912f, 79.43f};
+    s.solarPanelVolt = 4.71f;
+    s.timeError = 0.4f;
+    s.interval = 300;
+    s.suppressed = i % 3;
+  }
+
+  Trace trace = {};
+  HeapStats heap = {41234, 28672, 12};
+  for (uint8_t p = 0; p < TRACE_PHASE_COUNT; p++)
+  {
+    traceRecord(trace, (TracePhase)p, 1000 * (100 + 37 * p), heap);
+  }
+  traceCycle(trace, samples[0].ts, 1234);
+  trace.overruns = 2;
+
+  printf("# soil probes: %u\n", (unsigned)SOIL_PROBE_COUNT);
+  printf("samples,graphite_bytes,loki_bytes,relay_frame_bytes,remote_write_proto_bytes,remote_write_bytes,remote_write_encode_us\n");
+
+  for (size_t count = 1; count <= BATCH_MAX_SAMPLES; count++)
+  {
+    size_t graphite = buildGraphitePayload(buffer, sizeof(buffer), samples, count, &trace);
+    size_t loki = buildLokiPayload(buffer, sizeof(buffer), samples, count, SENSOR_ID, "New_samples!");
+    size_t frame = encodeFrame((uint8_t *)buffer, sizeof(buffer), SENSOR_ID, samples, count, &trace);
+    if (frame == 0 || !checkFrame((const uint8_t *)buffer, frame, samples, count))
+    {
+      fprintf(stderr, "Relay frame of %zu samples not valid\n", count);
+      return 1;
+    }
+
+    size_t remoteWrite = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t run = 0; run < BENCH_PAYLOAD_RUNS; run++)
+    {
+      remoteWrite = buildRemoteWritePayload((uint8_t *)buffer, sizeof(buffer), samples, count, &trace, SENSOR_ID);
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+
+    // What a Prometheus receiver would make of it
+    std::vector<SimSeries> series;
+    size_t protoLength = 0;
+    if (remoteWrite == 0 || !receiveRemoteWrite((const uint8_t *)buffer, remoteWrite, series, protoLength) ||
+        !checkRemoteWrite(series, samples, count, trace))
+    {
+      fprintf(stderr, "Remote write payload of %zu samples not valid\n", count);
+      return 1;
+    }
+
+    printf("%zu,%zu,%zu,%zu,%zu,%zu,%.1f\n", count, graphite, loki, frame, protoLength, remoteWrite,
+           elapsed.count() / 1000.0 / BENCH_PAYLOAD_RUNS);
+  }
+
+  return 0;
+}
+
+// Size of the compressed e-ink background and cost of streaming its runs (measured on the host)
+int benchAssets()
+{
+  const RleImage &image = EINK_BACKGROUND;
+  size_t runs = 0;
+  size_t blackRuns = 0;
+  uint32_t pixels = 0;
+  uint32_t blackPixels = 0;
+
+  // Every pixel exactly once, in row order
+  RleReader reader(image);
+  RleRun run;
+  while (reader.next(run))
+  {
+    if (run.x + (uint32_t)run.y * image.width != pixels || run.length == 0 || run.x + run.length > image.width)
+    {
+      fprintf(stderr, "Run %zu out of place\n", runs);
+      return 1;
+    }
+    runs++;
+    pixels += run.length;
+    if (!run.white)
+    {
+      blackRuns++;
+      blackPixels += run.length;
+    }
+  }
+  if (pixels != (uint32_t)image.width * image.height)
+  {
+    fprintf(stderr, "%u pixels decoded instead of %u\n", pixels, (uint32_t)image.width * image.height);
+    return 1;
+  }
+
+  volatile uint32_t sink = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < BENCH_ASSET_RUNS; i++)
+  {
+    RleReader r(image);
+    while (r.next(run))
+    {
+      sink = sink + run.length;
+    }
+  }
+  auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+
+  printf("asset,width,height,raw_bytes,compressed_bytes,runs,black_runs,black_pixels,decode_us\n");
+  printf("background,%u,%u,%u,%zu,%zu,%zu,%u,%.2f\n", image.width, image.height, (image.width + 7) / 8 * image.height,
+         image.length, runs, blackRuns, blackPixels, elapsed.count() / 1000.0 / BENCH_ASSET_RUNS);
+
+  return 0;
+}
+
+// Fixed width stand-ins of the GFX fonts of the info screen
+struct BenchFont
+{
+  uint8_t advance;
+  uint8_t ascent;
+  uint8_t descent;
+};
+
+static const BenchFont BENCH_FONT_SMALL = {6, 5, 1}; // Org_01
+static const BenchFont BENCH_FONT_9 = {11, 10, 3};   // FreeMonoBold9pt7b
+static const BenchFont BENCH_FONT_12 = {14, 13, 4};  // FreeMonoBold12pt7b
+static const BenchFont BENCH_FONT_24 = {28, 26, 8};  // FreeMonoBold24pt7b
+
+struct BenchField
+{
+  int16_t x;
+  int16_t y;
+  const BenchFont *font;
+  bool centerX;
+  bool centerY;
+};
+
+// Same layout as EINK_FIELDS (main.cpp)
+static const BenchField BENCH_FIELDS[SCREEN_FIELD_COUNT] = {
+    {100, 12, &BENCH_FONT_9, true, false},
+    {80, 60, &BENCH_FONT_24, false, true},
+    {30, 160, &BENCH_FONT_12, false, true},
+    {145, 160, &BENCH_FONT_12, false, true},
+    {100, 198, &BENCH_FONT_SMALL, true, false}};
+
+// Rotated framebuffer fake: pages are bands of panel rows (screen columns), the pixels out
+// of the current page are dropped one by one as GxEPD2 does
+class BenchCanvas : public DisplayCanvas
+{
+public:
+  uint32_t pixelCalls = 0;
+
+  void setPage(int16_t x0, int16_t x1)
+  {
+    pageX0 = x0;
+    pageX1 = x1;
+  }
+
+  void clear() override
+  {
+    for (int16_t x = pageX0; x < pageX1; x++)
+    {
+      memset(panel[x], 0xff, sizeof(panel[x]));
+    }
+  }
+
+  void drawRun(int16_t x, int16_t y, int16_t length) override
+  {
+    for (int16_t i = 0; i < length; i++)
+    {
+      drawPixel(x + i, y);
+    }
+  }
+
+  // Glyphs are filled cells
+  void drawText(const DisplayItem &item) override
+  {
+    const BenchFont &font = *(const BenchFont *)item.font;
+    int16_t x = item.x;
+    for (const char *c = item.text; *c; c++, x += font.advance)
+    {
+      for (int16_t gy = item.y - font.ascent; gy < item.y + font.descent; gy++)
+      {
+        for (int16_t gx = x + 1; gx < x + font.advance - 1; gx++)
+        {
+          drawPixel(gx, gy);
+        }
+      }
+    }
+  }
+
+  bool same(const BenchCanvas &other) const
+  {
+    return !memcmp(panel, other.panel, sizeof(panel));
+  }
+
+private:
+  void drawPixel(int16_t x, int16_t y)
+  {
+    pixelCalls++;
+    if (x >= pageX0 && x < pageX1 && y >= 0 && y < BENCH_PANEL_SIZE)
+    {
+      panel[x][y / 8] &= ~(1 << (y % 8));
+    }
+  }
+
+  int16_t pageX0 = 0;
+  int16_t pageX1 = 0;
+  uint8_t panel[BENCH_PANEL_SIZE][BENCH_PANEL_SIZE / 8];
+};
+
+// What getTextBounds does with a fixed width font
+static DisplayItem benchLayout(const ScreenValues &values, ScreenField f)
+{
+  char text[SCREEN_TEXT_SIZE];
+  screenText(values, f, text, sizeof(text));
+
+  const BenchField &field = BENCH_FIELDS[f];
+  int16_t w = strlen(text) * field.font->advance;
+  int16_t h = field.font->ascent + field.font->descent;
+  int16_t x = field.centerX ? field.x - w / 2 : field.x;
+  int16_t y = field.centerY ? field.y + h / 2 : field.y;
+
+  return displayText(x, y, field.font, text, {x, (int16_t)(y - field.font->ascent), (int16_t)(x + w), (int16_t)(y + field.font->descent)});
+}
+
+// Before the display list: everything laid out and drawn again on each page
+static uint32_t drawPerPage(BenchCanvas &canvas, const ScreenValues &values, int16_t pageHeight)
+{
+  uint32_t drawn = 0;
+  for (int16_t x0 = 0; x0 < BENCH_PANEL_SIZE; x0 += pageHeight)
+  {
+    canvas.setPage(x0, x0 + pageHeight);
+    canvas.clear();
+
+    RleReader reader(EINK_BACKGROUND);
+    RleRun run;
+    while (reader.next(run))
+    {
+      if (!run.white)
+      {
+        canvas.drawRun(run.x, run.y, run.length);
+      }
+    }
+
+    for (uint8_t f = 0; f < SCREEN_FIELD_COUNT; f++)
+    {
+      canvas.drawText(benchLayout(values, (ScreenField)f));
+    }
+    drawn += 1 + SCREEN_FIELD_COUNT;
+  }
+
+  return drawn;
+}
+
+static uint32_t drawDisplayList(BenchCanvas &canvas, const ScreenValues &values, int16_t pageHeight)
+{
+  DisplayList list;
+  list.add(displayImage(0, 0, EINK_BACKGROUND));
+  for (uint8_t f = 0; f < SCREEN_FIELD_COUNT; f++)
+  {
+    list.add(benchLayout(values, (ScreenField)f));
+  }
+
+  uint32_t drawn = 0;
+  for (int16_t x0 = 0; x0 < BENCH_PANEL_SIZE; x0 += pageHeight)
+  {
+    int16_t x1 = x0 + pageHeight < BENCH_PANEL_SIZE ? x0 + pageHeight : BENCH_PANEL_SIZE;
+    canvas.setPage(x0, x1);
+    drawn += list.replay(canvas, {x0, 0, x1, BENCH_PANEL_SIZE});
+  }
+
+  return drawn;
+}
+
+// Cost of drawing the info screen in pages, laid out on each page or replayed from the
+// display list, on a framebuffer fake (measured on the host)
+int benchDisplay()
+{
+  static BenchCanvas perPage;
+  static BenchCanvas replayed;
+  ScreenValues values = {14 * 60 + 5, 14 * 60 + 10, 215, 72, 54};
+
+  printf("page_height,pages,mode,items_drawn,pixel_calls,frame_us\n");
+
+  static const int16_t pageHeights[] = {200, 100, 50, 25};
+  for (int16_t pageHeight : pageHeights)
+  {
+    uint32_t pages = (BENCH_PANEL_SIZE + pageHeight - 1) / pageHeight;
+    uint32_t items[2] = {};
+    uint32_t calls[2] = {};
+    double us[2] = {};
+
+    for (uint8_t mode = 0; mode < 2; mode++)
+    {
+      BenchCanvas &canvas = mode == 0 ? perPage : replayed;
+      auto start = std::chrono::steady_clock::now();
+      for (uint32_t i = 0; i < BENCH_DISPLAY_RUNS; i++)
+      {
+        canvas.pixelCalls = 0;
+        items[mode] = mode == 0 ? drawPerPage(canvas, values, pageHeight) : drawDisplayList(canvas, values, pageHeight);
+      }
+      auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+      calls[mode] = canvas.pixelCalls;
+      us[mode] = elapsed.count() / 1000.0 / BENCH_DISPLAY_RUNS;
+    }
+
+    if (!perPage.same(replayed))
+    {
+      fprintf(stderr, "Display list frame differs with pages of %d rows\n", pageHeight);
+      return 1;
+    }
+
+    printf("%d,%u,per_page_layout,%u,%u,%.1f\n", pageHeight, pages, items[0], calls[0], us[0]);
+    printf("%d,%u,display_list,%u,%u,%.1f\n", pageHeight, pages, items[1], calls[1], us[1]);
+  }
+
+  return 0;
+}
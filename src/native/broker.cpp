@@ -0,0 +1,257 @@
+#include "sim.h"
+
+#include <cstring>
+
+#include "../config.h"
+#include "../crc32.h"
+#include "../frame.h"
+
+// Parses the MQTT 3.1.1 packets from the spec, independently of the client, and replies as
+// mosquitto does. A client may send packets before the CONNACK, they are handled in order.
+
+#define BROKER_CONNECT 1
+#define BROKER_CONNACK 2
+#define BROKER_PUBLISH 3
+#define BROKER_PUBACK 4
+#define BROKER_DISCONNECT 14
+
+SimBroker::SimBroker(SimWorld &world) : world(world), connected(false), closed(true)
+{
+}
+
+void SimBroker::open()
+{
+  connected = false;
+  closed = false;
+  clientId.clear();
+  input.clear();
+  output.clear();
+}
+
+void SimBroker::receive(const uint8_t *data, size_t length)
+{
+  if (closed)
+  {
+    return;
+  }
+  input.insert(input.end(), data, data + length);
+
+  // Complete packets: type and flags, remaining length (1 to 4 bytes), body
+  while (!closed && input.size() >= 2)
+  {
+    size_t remaining = 0;
+    size_t pos = 1;
+    uint8_t shift = 0;
+    bool complete = false;
+    while (pos < input.size() && pos <= 4)
+    {
+      uint8_t b = input[pos++];
+      remaining |= (size_t)(b & 0x7f) << shift;
+      shift += 7;
+      if (!(b & 0x80))
+      {
+        complete = true;
+        break;
+      }
+    }
+    if (!complete)
+    {
+      if (pos > 4)
+      {
+        reject("bad remaining length");
+      }
+      return;
+    }
+    if (input.size() < pos + remaining)
+    {
+      return;
+    }
+
+    std::vector<uint8_t> body(input.begin() + pos, input.begin() + pos + remaining);
+    uint8_t header = input[0];
+    input.erase(input.begin(), input.begin() + pos + remaining);
+    handle(header, body.data(), body.size());
+  }
+}
+
+bool SimBroker::reply(uint8_t *data, size_t length)
+{
+  if (output.size() < length)
+  {
+    return false;
+  }
+
+  memcpy(data, output.data(), length);
+  output.erase(output.begin(), output.begin() + length);
+  return true;
+}
+
+void SimBroker::close()
+{
+  // The session stays, even without a DISCONNECT
+  closed = true;
+  connected = false;
+}
+
+// Packets --------------------------------------------------------------------
+
+static bool readString(const uint8_t *&p, const uint8_t *end, std::string &str)
+{
+  if (end - p < 2)
+  {
+    return false;
+  }
+  size_t length = p[0] << 8 | p[1];
+  p += 2;
+  if ((size_t)(end - p) < length)
+  {
+    return false;
+  }
+
+  str.assign((const char *)p, length);
+  p += length;
+  return true;
+}
+
+bool SimBroker::handle(uint8_t header, const uint8_t *body, size_t length)
+{
+  uint8_t type = header >> 4;
+  if (!connected && type != BROKER_CONNECT)
+  {
+    return reject("first packet is not CONNECT");
+  }
+
+  switch (type)
+  {
+  case BROKER_CONNECT:
+    return connected ? reject("second CONNECT") : handleConnect(body, length);
+  case BROKER_PUBLISH:
+    return handlePublish(header, body, length);
+  case BROKER_DISCONNECT:
+    if ((header & 0x0f) != 0 || length != 0)
+    {
+      return reject("malformed DISCONNECT");
+    }
+    close();
+    return true;
+  default:
+    return reject("unexpected packet type");
+  }
+}
+
+bool SimBroker::handleConnect(const uint8_t *body, size_t length)
+{
+  const uint8_t *p = body;
+  const uint8_t *end = body + length;
+  std::string protocol;
+  if (!readString(p, end, protocol) || protocol != "MQTT" || end - p < 4 || p[0] != 4)
+  {
+    return reject("not MQTT 3.1.1");
+  }
+
+  uint8_t flags = p[1];
+  p += 4; // Level, flags and keep alive
+  if (flags & 0x01)
+  {
+    return reject("reserved CONNECT flag set");
+  }
+  if (flags & 0x02)
+  {
+    return reject("clean session, the messages would not be kept");
+  }
+  if (flags & 0x04)
+  {
+    return reject("unexpected will");
+  }
+  if ((flags & 0x40) && !(flags & 0x80))
+  {
+    return reject("password without user name");
+  }
+
+  std::string user;
+  std::string pass;
+  if (!readString(p, end, clientId) || clientId.empty() ||
+      ((flags & 0x80) && !readString(p, end, user)) || ((flags & 0x40) && !readString(p, end, pass)) || p != end)
+  {
+    return reject("malformed CONNECT payload");
+  }
+
+  bool sessionPresent = sessions.count(clientId) > 0;
+  sessions[clientId];
+  connected = true;
+
+  const uint8_t connack[] = {BROKER_CONNACK << 4, 2, (uint8_t)(sessionPresent ? 1 : 0), 0};
+  output.insert(output.end(), connack, connack + sizeof(connack));
+  return true;
+}
+
+bool SimBroker::handlePublish(uint8_t header, const uint8_t *body, size_t length)
+{
+  uint8_t qos = (header >> 1) & 3;
+  if (qos != 1)
+  {
+    return reject("PUBLISH is not QoS 1");
+  }
+  if (header & 0x01)
+  {
+    return reject("retained PUBLISH");
+  }
+
+  const uint8_t *p = body;
+  const uint8_t *end = body + length;
+  std::string topic;
+  if (!readString(p, end, topic) || end - p < 2)
+  {
+    return reject("malformed PUBLISH");
+  }
+  uint16_t packetId = p[0] << 8 | p[1];
+  p += 2;
+  if (packetId == 0)
+  {
+    return reject("packet id 0");
+  }
+  if (topic != MQTT_TOPIC_PREFIX + clientId)
+  {
+    return reject("unexpected topic");
+  }
+
+  static Frame frame;
+  if (!decodeFrame(p, end - p, frame) || clientId != frame.sensorId)
+  {
+    return reject("payload is not a frame of the client");
+  }
+
+  // QoS 1 is at least once: the same message again after a lost PUBACK
+  Session &session = sessions[clientId];
+  uint32_t crc = crc32(p, end - p);
+  if (packetId == session.lastPacketId && crc == session.lastCrc)
+  {
+    if (world.verbose)
+    {
+      printf("  Broker: duplicate message %u\n", packetId);
+    }
+  }
+  else
+  {
+    session.queued++;
+    world.cycle.posts++;
+    if (world.verbose)
+    {
+      printf("  Broker: %zu samples%s on %s, %u messages queued\n", frame.count, frame.hasTrace ? " and trace" : "", topic.c_str(), session.queued);
+    }
+  }
+  session.lastPacketId = packetId;
+  session.lastCrc = crc;
+
+  const uint8_t puback[] = {BROKER_PUBACK << 4, 2, (uint8_t)(packetId >> 8), (uint8_t)packetId};
+  output.insert(output.end(), puback, puback + sizeof(puback));
+  return true;
+}
+
+bool SimBroker::reject(const char *reason)
+{
+  fprintf(stderr, "MQTT broker: %s, connection closed\n", reason);
+  world.rejected++;
+  close();
+  return false;
+}
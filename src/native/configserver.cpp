@@ -0,0 +1,62 @@
+#include "sim.h"
+
+#include <cstring>
+
+#include "../config.h"
+#include "../crc32.h"
+
+SimConfigServer::SimConfigServer(SimWorld &world)
+    : SimHttpServer(world), fullCount(0), notModifiedCount(0), servedBytes(0)
+{
+}
+
+bool SimConfigServer::load(const char *path)
+{
+  FILE *file = fopen(path, "rb");
+  if (!file)
+  {
+    return false;
+  }
+
+  std::string text;
+  char buffer[512];
+  size_t read;
+  while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+  {
+    text.append(buffer, read);
+  }
+  fclose(file);
+
+  // A strong ETag of the content, as nginx gives one of the size and time of the file
+  char tag[16];
+  snprintf(tag, sizeof(tag), "\"%08lx\"", (unsigned long)crc32((const uint8_t *)text.data(), text.size()));
+  simHeapServer = true;
+  document = text;
+  etag = tag;
+  simHeapServer = false;
+
+  return true;
+}
+
+// Methods --------------------------------------------------------------------
+
+void SimConfigServer::respond(const std::string &request)
+{
+  char path[128];
+  if (sscanf(request.c_str(), "GET %127s HTTP/1.%*d", path) != 1 || strncmp(path, CONFIG_PATH, strlen(CONFIG_PATH)))
+  {
+    send("400 Bad Request", "", nullptr, 0);
+    return;
+  }
+
+  if (header(request, "If-None-Match") == etag)
+  {
+    notModifiedCount++;
+    send("304 Not Modified", "ETag: " + etag + "\r\n", nullptr, 0);
+    return;
+  }
+
+  fullCount++;
+  servedBytes += document.size();
+  send("200 OK", "ETag: " + etag + "\r\n", (const uint8_t *)document.data(), document.size());
+}
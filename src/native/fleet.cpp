@@ -0,0 +1,242 @@
+#include "sim.h"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+#include "../plant.h"
+
+// A fleet of nodes waking up at their own pace against the same Graphite, Loki and remote
+// write endpoints. The endpoints serve SIM_INGEST_WORKERS requests at once each, first come
+// first served.
+
+#define FLEET_DRIFT_SPREAD_PPM 1000 // Nodes sleep a bit longer or shorter than each other
+
+static const char *const FLEET_BACKENDS[BACKEND_COUNT] = {"graphite", "loki", "prometheus"};
+
+struct FleetNode
+{
+  NodeConfig config;
+  char sensorId[20];
+  uint64_t awakeUs;
+  uint32_t wakes;
+  bool failed;
+};
+
+SimFleet::SimFleet(size_t nodes) : slots(nodes), running(nodes), servers()
+{
+}
+
+void SimFleet::sync(SimWorld &world)
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  Slot &slot = slots[world.node];
+  slot.waiting = true;
+  waiting.insert({world.nowUs, world.node});
+  running--;
+  if (running == 0)
+  {
+    next();
+  }
+
+  slot.turn.wait(lock, [&] { return !slot.waiting; });
+}
+
+void SimFleet::leave(SimWorld &world)
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  running--;
+  if (running == 0)
+  {
+    next();
+  }
+}
+
+void SimFleet::next()
+{
+  if (waiting.empty())
+  {
+    return;
+  }
+
+  Slot &slot = slots[waiting.begin()->second];
+  waiting.erase(waiting.begin());
+  slot.waiting = false;
+  running++;
+  slot.turn.notify_one();
+}
+
+uint64_t SimFleet::serve(Backend backend, uint64_t arrivalUs, uint32_t bytes)
+{
+  Server &server = servers[backend];
+  while (!server.inFlightUs.empty() && server.inFlightUs.top() <= arrivalUs)
+  {
+    server.inFlightUs.pop();
+  }
+
+  // The requests come in time order, the worker free first takes the next one
+  uint64_t *worker = std::min_element(server.workersFreeUs, server.workersFreeUs + SIM_INGEST_WORKERS);
+  uint64_t startUs = *worker > arrivalUs ? *worker : arrivalUs;
+  *worker = startUs + SIM_INGEST_US + (uint64_t)bytes * 1000000 / SIM_INGEST_BYTES_PER_SEC;
+
+  server.inFlightUs.push(*worker);
+  server.peak = server.inFlightUs.size() > server.peak ? server.inFlightUs.size() : server.peak;
+  server.residenceUs += *worker - arrivalUs;
+
+  return *worker;
+}
+
+void SimFleet::record(Backend backend, uint64_t latencyUs, uint32_t bytes, uint32_t samples)
+{
+  Server &server = servers[backend];
+  server.latenciesUs.push_back(latencyUs < UINT32_MAX ? latencyUs : UINT32_MAX);
+  server.bytes += bytes;
+  server.samples += samples;
+}
+
+void SimFleet::report(double seconds)
+{
+  printf("backend,requests,requests_per_s,bytes,bytes_per_sample,p50_ms,p99_ms,peak_concurrency,mean_concurrency\n");
+
+  for (uint8_t b = 0; b < BACKEND_COUNT; b++)
+  {
+    Server &server = servers[b];
+    std::vector<uint32_t> &latencies = server.latenciesUs;
+    if (latencies.empty())
+    {
+      continue;
+    }
+
+    // Nearest rank
+    std::sort(latencies.begin(), latencies.end());
+    size_t n = latencies.size();
+    uint32_t p50 = latencies[(n * 50 + 99) / 100 - 1];
+    uint32_t p99 = latencies[(n * 99 + 99) / 100 - 1];
+
+    printf("%s,%zu,%.3f,%llu,%.1f,%u,%u,%u,%.3f\n", FLEET_BACKENDS[b], n, n / seconds, (unsigned long long)server.bytes,
+           server.samples > 0 ? (double)server.bytes / server.samples : 0.0, p50 / 1000, p99 / 1000, server.peak,
+           server.residenceUs / (seconds * 1e6));
+  }
+}
+
+// Methods --------------------------------------------------------------------
+
+static void runNode(SimFleet &fleet, SimWorld &world, FleetNode &node, uint32_t cycles, const char *script)
+{
+  // Nothing runs before the turn of the node, the heap counters are shared
+  fleet.sync(world);
+
+  SimSensors sensors(world);
+  SimClock clock(world);
+  SimSleep sleep(world);
+  SimStorage storage(world);
+  SimNetwork network(world, storage);
+  SimDisplay display(world);
+  SimSystem system(world);
+  SimFirmware firmware(world);
+  const Hal hal = {sensors, network, clock, sleep, storage, display, system, firmware};
+
+  if (script && !sensors.load(script))
+  {
+    node.failed = true;
+    fleet.leave(world);
+    return;
+  }
+
+  for (uint32_t i = 0; i < cycles; i++)
+  {
+    world.cycle = {};
+    world.sleepUs = 0;
+    world.bootUs = world.nowUs;
+    firmware.boot();
+    world.advance(SIM_BOOT_US);
+    sensors.select(i);
+
+    bool slept = simWake(world, hal, node.config);
+    node.awakeUs += world.cycle.awakeUs;
+    node.wakes++;
+    if (!slept)
+    {
+      node.failed = true;
+      break;
+    }
+
+    // The next wake waits for the earlier ones of the other nodes
+    fleet.sync(world);
+  }
+
+  fleet.leave(world);
+}
+
+int runFleet(uint32_t nodes, uint32_t cycles, const NodeConfig &config, const char *script, int32_t driftPpm)
+{
+  SimFleet fleet(nodes);
+  std::vector<SimWorld> worlds(nodes);
+  std::vector<FleetNode> fleetNodes(nodes);
+  std::vector<std::thread> threads;
+
+  for (uint32_t i = 0; i < nodes; i++)
+  {
+    // Powered on one after the other over the first interval
+    SimWorld &world = worlds[i];
+    world.fleet = &fleet;
+    world.node = i;
+    world.nowUs = (uint64_t)config.sampleIntervalSec * 1000000 * i / nodes;
+    world.sleepDriftPpm = driftPpm + (int32_t)(i % 5) * FLEET_DRIFT_SPREAD_PPM - 2 * FLEET_DRIFT_SPREAD_PPM;
+
+    FleetNode &node = fleetNodes[i];
+    node.config = config;
+    snprintf(node.sensorId, sizeof(node.sensorId), "plant-%u", i);
+    node.config.sensorId = node.sensorId;
+  }
+
+  // The nodes only start once they are all waiting for their turn
+  for (uint32_t i = 0; i < nodes; i++)
+  {
+    threads.emplace_back(runNode, std::ref(fleet), std::ref(worlds[i]), std::ref(fleetNodes[i]), cycles, script);
+  }
+  for (std::thread &thread : threads)
+  {
+    thread.join();
+  }
+
+  uint64_t endUs = 0;
+  uint64_t awakeUs = 0;
+  uint64_t wakes = 0;
+  size_t delivered = 0;
+  uint32_t duplicates = 0;
+  uint32_t rejected = 0;
+  uint32_t failed = 0;
+  for (uint32_t i = 0; i < nodes; i++)
+  {
+    endUs = worlds[i].nowUs > endUs ? worlds[i].nowUs : endUs;
+    awakeUs += fleetNodes[i].awakeUs;
+    wakes += fleetNodes[i].wakes;
+    delivered += worlds[i].delivered.size();
+    duplicates += worlds[i].duplicates;
+    rejected += worlds[i].rejected;
+    failed += fleetNodes[i].failed;
+  }
+
+  double seconds = endUs / 1e6;
+  printf("# fleet: %u nodes, %u wakes each, simulated: %.1f h\n", nodes, cycles, seconds / 3600);
+  if (seconds > 0)
+  {
+    fleet.report(seconds);
+  }
+  printf("# samples received by graphite: %zu, duplicates: %u, mean awake: %llu ms\n", delivered, duplicates,
+         (unsigned long long)(wakes > 0 ? awakeUs / wakes / 1000 : 0));
+
+  if (failed > 0)
+  {
+    fprintf(stderr, "%u nodes failed (no script or no deep sleep)\n", failed);
+    return 1;
+  }
+  if (rejected > 0)
+  {
+    fprintf(stderr, "%u payloads rejected\n", rejected);
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,86 @@
+#include "sim.h"
+
+#include <cstring>
+
+SimHttpServer::SimHttpServer(SimWorld &world) : world(world), outputPos(0)
+{
+}
+
+void SimHttpServer::open()
+{
+  input.clear();
+  output.clear();
+  outputPos = 0;
+}
+
+void SimHttpServer::receive(const uint8_t *data, size_t length)
+{
+  bool complete = input.find("\r\n\r\n") != std::string::npos;
+  input.append((const char *)data, length);
+  if (!complete && input.find("\r\n\r\n") != std::string::npos)
+  {
+    respond(input);
+  }
+}
+
+bool SimHttpServer::reply(uint8_t *data, size_t length)
+{
+  if (output.size() - outputPos < length)
+  {
+    return false;
+  }
+
+  memcpy(data, output.data() + outputPos, length);
+  outputPos += length;
+  return true;
+}
+
+void SimHttpServer::close()
+{
+  open();
+}
+
+// Methods --------------------------------------------------------------------
+
+void SimHttpServer::send(const char *status, const std::string &headers, const uint8_t *body, size_t length)
+{
+  std::string head = std::string("HTTP/1.0 ") + status + "\r\n" + headers;
+  if (body)
+  {
+    head += "Content-Length: " + std::to_string(length) + "\r\n";
+  }
+  head += "\r\n";
+  output.assign(head.begin(), head.end());
+  if (body)
+  {
+    output.insert(output.end(), body, body + length);
+  }
+
+  if (world.verbose)
+  {
+    printf("  HTTP server: %s -> %s\n", input.substr(0, input.find("\r\n")).c_str(), status);
+  }
+}
+
+std::string SimHttpServer::header(const std::string &request, const char *name)
+{
+  // Names are case insensitive
+  std::string lower = request;
+  std::string wanted = std::string("\r\n") + name + ":";
+  for (char &c : lower)
+  {
+    c = tolower(c);
+  }
+  for (char &c : wanted)
+  {
+    c = tolower(c);
+  }
+
+  size_t start = lower.find(wanted);
+  if (start == std::string::npos)
+  {
+    return "";
+  }
+  start = request.find_first_not_of(' ', start + wanted.size());
+  return request.substr(start, request.find("\r\n", start) - start);
+}
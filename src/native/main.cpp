@@ -0,0 +1,368 @@
+//
+// Runs the wake cycle on the host with simulated hardware and reports, for each cycle,
+// the simulated awake and radio time, the bytes sent and the peak heap use.
+//
+// Usage: program [--cycles N] [--interval SEC] [--min-interval SEC] [--max-interval SEC] [--drift PPM] [--script FILE] [--exporters LIST] [--upload-every N] [--outage FROM:TO] [--ap-outage FROM:TO] [--eink] [--full-every N] [--verbose] [--fleet N] [--firmware FILE] [--updates DIR] [--update-check SEC] [--firmware-out FILE] [--config FILE] [--config-change CYCLE:FILE] [--config-every N]
+//        program --bench-filters
+//        program --bench-calibration
+//        program --bench-payloads
+//        program --bench-assets
+//        program --bench-display
+// --interval sets a fixed interval, the bounds then make it adaptive.
+// --exporters replaces the ones enabled in config.h, e.g. "graphite,loki" or "mqtt".
+// --outage makes the backends unreachable from cycle FROM to cycle TO (excluded), --ap-outage
+// the access point.
+// --upload-every replaces BATCH_UPLOAD_EVERY.
+// --fleet runs N nodes against shared backends and prints the load they see instead.
+// --eink models the refreshes of an e-ink display, a full one every --full-every refreshes.
+// --firmware runs the image of FILE (a generated one by default), --updates serves the patches
+// of DIR (tools/delta.py diff), checked every --update-check seconds, and --firmware-out saves
+// the image running at the end.
+// --config serves the document of FILE to the remote config checks, every --config-every wakes
+// (CONFIG_CHECK_WAKES by default), and --config-change serves the one of FILE from cycle CYCLE.
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include "../plant.h"
+#include "sim.h"
+
+// Heap -----------------------------------------------------------------------
+
+// Allocations are prefixed with their size to track the heap in use
+size_t simHeapUsed = 0;
+size_t simHeapPeak = 0;
+size_t simHeapAllocated = 0;
+bool simHeapServer = false;
+
+void *operator new(size_t size)
+{
+  size_t *block = (size_t *)malloc(sizeof(size_t) + size);
+  if (!block)
+  {
+    throw std::bad_alloc();
+  }
+
+  block[0] = simHeapServer ? 0 : size;
+  simHeapUsed += block[0];
+  simHeapAllocated += block[0];
+  if (simHeapUsed > simHeapPeak)
+  {
+    simHeapPeak = simHeapUsed;
+  }
+
+  return block + 1;
+}
+
+void operator delete(void *ptr) noexcept
+{
+  if (ptr)
+  {
+    size_t *block = (size_t *)ptr - 1;
+    simHeapUsed -= block[0];
+    free(block);
+  }
+}
+
+void operator delete(void *ptr, size_t size) noexcept
+{
+  operator delete(ptr);
+}
+
+// Methods --------------------------------------------------------------------
+
+// The tests (test/) link the simulated backends with their own main()
+#ifndef PIO_UNIT_TESTING
+
+int main(int argc, char **argv)
+{
+  uint32_t cycles = 100;
+  NodeConfig config = defaultNodeConfig();
+  static SimWorld world = {};
+  world.sleepDriftPpm = 30000;
+  const char *script = nullptr;
+  uint32_t minInterval = 0;
+  uint32_t maxInterval = 0;
+  uint32_t outageFrom = 0;
+  uint32_t outageTo = 0;
+  uint32_t apOutageFrom = 0;
+  uint32_t apOutageTo = 0;
+  uint32_t fleet = 0;
+  const char *firmwarePath = nullptr;
+  const char *updatesDir = nullptr;
+  const char *firmwareOut = nullptr;
+  const char *configPath = nullptr;
+  const char *configChangePath = nullptr;
+  uint32_t configChange = 0;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "--cycles") && i + 1 < argc)
+    {
+      cycles = strtoul(argv[++i], nullptr, 10);
+    }
+    else if (!strcmp(argv[i], "--interval") && i + 1 < argc)
+    {
+      config.sampleIntervalSec = strtoul(argv[++i], nullptr, 10);
+      config.minIntervalSec = config.sampleIntervalSec;
+      config.maxIntervalSec = config.sampleIntervalSec;
+    }
+    else if (!strcmp(argv[i], "--min-interval") && i + 1 < argc)
+    {
+      minInterval = strtoul(argv[++i], nullptr, 10);
+    }
+    else if (!strcmp(argv[i], "--max-interval") && i + 1 < argc)
+    {
+      maxInterval = strtoul(argv[++i], nullptr, 10);
+    }
+    else if (!strcmp(argv[i], "--drift") && i + 1 < argc)
+    {
+      world.sleepDriftPpm = strtol(argv[++i], nullptr, 10);
+    }
+    else if (!strcmp(argv[i], "--script") && i + 1 < argc)
+    {
+      script = argv[++i];
+    }
+    else if (!strcmp(argv[i], "--exporters") && i + 1 < argc)
+    {
+      if (!parseExporters(argv[++i], config.exporters))
+      {
+        fprintf(stderr, "Unknown exporter in %s (graphite, prometheus, loki, relay, mqtt)\n", argv[i]);
+        return 2;
+      }
+    }
+    else if (!strcmp(argv[i], "--upload-every") && i + 1 < argc)
+    {
+      config.uploadEvery = strtoul(argv[++i], nullptr, 10);
+    }
+    else if (!strcmp(argv[i], "--outage") && i + 1 < argc)
+    {
+      if (sscanf(argv[++i], "%u:%u", &outageFrom, &outageTo) != 2)
+      {
+        fprintf(stderr, "Bad outage %s (FROM:TO)\n", argv[i]);
+        return 2;
+      }
+    }
+    else if (!strcmp(argv[i], "--ap-outage") && i + 1 < argc)
+    {
+      if (sscanf(argv[++i], "%u:%u", &apOutageFrom, &apOutageTo) != 2)
+      {
+        fprintf(stderr, "Bad outage %s (FROM:TO)\n", argv[i]);
+        return 2;
+      }
+    }
+    else if (!strcmp(argv[i], "--eink"))
+    {
+      world.eink = true;
+    }
+    else if (!strcmp(argv[i], "--full-every") && i + 1 < argc)
+    {
+      config.displayFullEvery = strtoul(argv[++i], nullptr, 10);
+    }
+    else if (!strcmp(argv[i], "--verbose"))
+    {
+      world.verbose = true;
+    }
+    else if (!strcmp(argv[i], "--fleet") && i + 1 < argc)
+    {
+      fleet = strtoul(argv[++i], nullptr, 10);
+    }
+    else if (!strcmp(argv[i], "--firmware") && i + 1 < argc)
+    {
+      firmwarePath = argv[++i];
+    }
+    else if (!strcmp(argv[i], "--updates") && i + 1 < argc)
+    {
+      updatesDir = argv[++i];
+    }
+    else if (!strcmp(argv[i], "--update-check") && i + 1 < argc)
+    {
+      config.updateCheckSec = strtoul(argv[++i], nullptr, 10);
+    }
+    else if (!strcmp(argv[i], "--firmware-out") && i + 1 < argc)
+    {
+      firmwareOut = argv[++i];
+    }
+    else if (!strcmp(argv[i], "--config") && i + 1 < argc)
+    {
+      configPath = argv[++i];
+    }
+    else if (!strcmp(argv[i], "--config-change") && i + 1 < argc)
+    {
+      static char changePath[256];
+      if (sscanf(argv[++i], "%u:%255s", &configChange, changePath) != 2)
+      {
+        fprintf(stderr, "Bad config change %s (CYCLE:FILE)\n", argv[i]);
+        return 2;
+      }
+      configChangePath = changePath;
+    }
+    else if (!strcmp(argv[i], "--config-every") && i + 1 < argc)
+    {
+      config.configEvery = strtoul(argv[++i], nullptr, 10);
+    }
+    else if (!strcmp(argv[i], "--bench-filters"))
+    {
+      return benchFilters();
+    }
+    else if (!strcmp(argv[i], "--bench-calibration"))
+    {
+      return benchCalibration();
+    }
+    else if (!strcmp(argv[i], "--bench-payloads"))
+    {
+      return benchPayloads();
+    }
+    else if (!strcmp(argv[i], "--bench-assets"))
+    {
+      return benchAssets();
+    }
+    else if (!strcmp(argv[i], "--bench-display"))
+    {
+      return benchDisplay();
+    }
+    else
+    {
+      fprintf(stderr, "Usage: %s [--cycles N] [--interval SEC] [--min-interval SEC] [--max-interval SEC] [--drift PPM] [--script FILE] [--exporters LIST] [--upload-every N] [--outage FROM:TO] [--ap-outage FROM:TO] [--eink] [--full-every N] [--verbose] [--fleet N] [--firmware FILE] [--updates DIR] [--update-check SEC] [--firmware-out FILE] [--config FILE] [--config-change CYCLE:FILE] [--config-every N]\n       %s --bench-filters\n       %s --bench-calibration\n       %s --bench-payloads\n       %s --bench-assets\n       %s --bench-display\n", argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+      return 2;
+    }
+  }
+
+  config.minIntervalSec = minInterval ? minInterval : config.minIntervalSec;
+  config.maxIntervalSec = maxInterval ? maxInterval : config.maxIntervalSec;
+
+  if (fleet > 0)
+  {
+    return runFleet(fleet, cycles, config, script, world.sleepDriftPpm);
+  }
+
+  SimSensors sensors(world);
+  SimClock clock(world);
+  SimSleep sleep(world);
+  SimStorage storage(world);
+  SimNetwork network(world, storage);
+  SimDisplay display(world);
+  SimSystem system(world);
+  SimFirmware firmware(world);
+  const Hal hal = {sensors, network, clock, sleep, storage, display, system, firmware};
+  SimUpdateServer updates(world);
+  SimConfigServer configServer(world);
+
+  if (script && !sensors.load(script))
+  {
+    fprintf(stderr, "Cannot read script %s\n", script);
+    return 1;
+  }
+  if (firmwarePath && !firmware.load(firmwarePath))
+  {
+    fprintf(stderr, "Cannot read firmware %s\n", firmwarePath);
+    return 1;
+  }
+  if (updatesDir)
+  {
+    if (!updates.load(updatesDir))
+    {
+      fprintf(stderr, "Cannot read the patches of %s\n", updatesDir);
+      return 1;
+    }
+    world.updates = &updates;
+  }
+  if (configPath)
+  {
+    if (!configServer.load(configPath))
+    {
+      fprintf(stderr, "Cannot read config %s\n", configPath);
+      return 1;
+    }
+    world.config = &configServer;
+    config.configEvery = config.configEvery ? config.configEvery : CONFIG_CHECK_WAKES;
+  }
+
+  printf("# static: %zu bytes, rtc: %zu bytes\n", sizeof(PlantNode), sizeof(RtcState));
+  printf("cycle,awake_ms,radio_ms,bytes_sent,posts,tls_resumed,heap_peak,sleep_s\n");
+
+  uint64_t totalAwakeUs = 0;
+  uint64_t totalRadioUs = 0;
+  uint64_t totalBytes = 0;
+  uint64_t maxAwakeUs = 0;
+  size_t maxHeap = 0;
+
+  for (uint32_t i = 0; i < cycles; i++)
+  {
+    world.cycle = {};
+    world.sleepUs = 0;
+    world.bootUs = world.nowUs;
+    if (configPath && configChangePath && i == configChange && !configServer.load(configChangePath))
+    {
+      fprintf(stderr, "Cannot read config %s\n", configChangePath);
+      return 1;
+    }
+    if (firmware.boot() && world.verbose)
+    {
+      printf("  Bootloader: new image %08lx\n", (unsigned long)firmware.crc());
+    }
+    world.outage = i >= outageFrom && i < outageTo;
+    world.apOutage = i >= apOutageFrom && i < apOutageTo;
+    world.advance(SIM_BOOT_US);
+    sensors.select(i);
+
+    bool slept = simWake(world, hal, config);
+
+    SimCycle &cycle = world.cycle;
+    printf("%u,%llu,%llu,%u,%u,%u,%u,%llu\n", i, (unsigned long long)(cycle.awakeUs / 1000),
+           (unsigned long long)(cycle.radioUs / 1000), cycle.bytesSent, cycle.posts, cycle.tlsResumed,
+           cycle.heapPeak, (unsigned long long)(world.sleepUs / 1000000));
+
+    totalAwakeUs += cycle.awakeUs;
+    totalRadioUs += cycle.radioUs;
+    totalBytes += cycle.bytesSent;
+    maxAwakeUs = cycle.awakeUs > maxAwakeUs ? cycle.awakeUs : maxAwakeUs;
+    maxHeap = cycle.heapPeak > maxHeap ? cycle.heapPeak : maxHeap;
+
+    if (!slept)
+    {
+      fprintf(stderr, "Cycle %u did not go to deep sleep\n", i);
+      return 1;
+    }
+  }
+
+  if (cycles > 0)
+  {
+    double hours = world.nowUs / 3600e6;
+    printf("# mean awake: %llu ms, max awake: %llu ms, mean radio: %llu ms, bytes sent: %llu, max heap: %zu bytes, simulated: %.1f h, awake per hour: %.1f s\n",
+           (unsigned long long)(totalAwakeUs / cycles / 1000), (unsigned long long)(maxAwakeUs / 1000),
+           (unsigned long long)(totalRadioUs / cycles / 1000),
+           (unsigned long long)totalBytes, maxHeap, hours, totalAwakeUs / 1e6 / hours);
+    printf("# samples received by graphite: %zu, duplicates: %u, overruns reported: %u, flash peak: %zu bytes\n",
+           world.delivered.size(), world.duplicates, world.overruns, storage.peak());
+    if (updatesDir)
+    {
+      printf("# firmware updates: %u, image: %08lx (%u bytes), patches: %zu, patch bytes served: %llu\n", firmware.updates(),
+             (unsigned long)firmware.crc(), firmware.imageSize(), updates.patchCount(), (unsigned long long)updates.served());
+    }
+    if (configPath)
+    {
+      printf("# config checks: %u, not modified: %u, document bytes served: %llu\n", configServer.requests(),
+             configServer.notModified(), (unsigned long long)configServer.served());
+    }
+  }
+
+  if (firmwareOut && !firmware.save(firmwareOut))
+  {
+    fprintf(stderr, "Cannot write firmware %s\n", firmwareOut);
+    return 1;
+  }
+
+  if (world.rejected > 0)
+  {
+    fprintf(stderr, "%u payloads rejected\n", world.rejected);
+    return 1;
+  }
+
+  return 0;
+}
+
+#endif
@@ -0,0 +1,268 @@
+#include "sim.h"
+
+#include <cstring>
+
+// Receives remote write payloads as Prometheus does: snappy block format, then the
+// WriteRequest protobuf. Written from the format specs, independently of the encoder.
+
+// Snappy ---------------------------------------------------------------------
+
+static bool readVarint(const uint8_t *&p, const uint8_t *end, uint64_t &value)
+{
+  value = 0;
+  for (uint8_t shift = 0; shift < 64; shift += 7)
+  {
+    if (p >= end)
+    {
+      return false;
+    }
+    uint8_t b = *p++;
+    value |= (uint64_t)(b & 0x7f) << shift;
+    if (!(b & 0x80))
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool snappyUncompress(const uint8_t *data, size_t length, std::vector<uint8_t> &out)
+{
+  const uint8_t *p = data;
+  const uint8_t *end = data + length;
+  uint64_t expected;
+  if (!readVarint(p, end, expected))
+  {
+    return false;
+  }
+
+  out.clear();
+  while (p < end)
+  {
+    uint8_t tag = *p++;
+    size_t len;
+    size_t offset;
+
+    switch (tag & 3)
+    {
+    case 0: // Literal
+      len = (tag >> 2) + 1;
+      if (len > 60)
+      {
+        size_t bytes = len - 60;
+        if (p + bytes > end)
+        {
+          return false;
+        }
+        len = 0;
+        for (size_t i = 0; i < bytes; i++)
+        {
+          len |= (size_t)p[i] << (8 * i);
+        }
+        len += 1;
+        p += bytes;
+      }
+      if (p + len > end)
+      {
+        return false;
+      }
+      out.insert(out.end(), p, p + len);
+      p += len;
+      continue;
+    case 1: // Copy, 1 byte offset
+      if (p + 1 > end)
+      {
+        return false;
+      }
+      len = ((tag >> 2) & 7) + 4;
+      offset = (tag >> 5) << 8 | p[0];
+      p += 1;
+      break;
+    case 2: // Copy, 2 bytes offset
+      if (p + 2 > end)
+      {
+        return false;
+      }
+      len = (tag >> 2) + 1;
+      offset = p[0] | p[1] << 8;
+      p += 2;
+      break;
+    default: // Copy, 4 bytes offset
+      if (p + 4 > end)
+      {
+        return false;
+      }
+      len = (tag >> 2) + 1;
+      offset = p[0] | p[1] << 8 | p[2] << 16 | (size_t)p[3] << 24;
+      p += 4;
+      break;
+    }
+
+    if (offset == 0 || offset > out.size())
+    {
+      return false;
+    }
+    // Copies may overlap their own output
+    for (size_t i = 0; i < len; i++)
+    {
+      out.push_back(out[out.size() - offset]);
+    }
+  }
+
+  return out.size() == expected;
+}
+
+// Protobuf -------------------------------------------------------------------
+
+// Calls field(number, wireType, data, length) for the length delimited fields and
+// field(number, wireType, nullptr, value) for the others
+template <typename Field>
+static bool parseMessage(const uint8_t *p, const uint8_t *end, Field field)
+{
+  while (p < end)
+  {
+    uint64_t key;
+    if (!readVarint(p, end, key))
+    {
+      return false;
+    }
+
+    uint32_t number = key >> 3;
+    uint8_t wireType = key & 7;
+    uint64_t value;
+    switch (wireType)
+    {
+    case 0:
+      if (!readVarint(p, end, value) || !field(number, wireType, nullptr, value))
+      {
+        return false;
+      }
+      break;
+    case 1:
+      if (p + 8 > end)
+      {
+        return false;
+      }
+      memcpy(&value, p, 8);
+      p += 8;
+      if (!field(number, wireType, nullptr, value))
+      {
+        return false;
+      }
+      break;
+    case 2:
+      if (!readVarint(p, end, value) || value > (uint64_t)(end - p) || !field(number, wireType, p, value))
+      {
+        return false;
+      }
+      p += value;
+      break;
+    default:
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static bool parseLabel(const uint8_t *p, size_t length, SimLabel &label)
+{
+  return parseMessage(p, p + length, [&](uint32_t number, uint8_t wireType, const uint8_t *data, uint64_t value) {
+    if (wireType != 2 || (number != 1 && number != 2))
+    {
+      return false;
+    }
+    (number == 1 ? label.name : label.value).assign((const char *)data, value);
+    return true;
+  });
+}
+
+static bool parseSample(const uint8_t *p, size_t length, SimSeriesSample &sample)
+{
+  return parseMessage(p, p + length, [&](uint32_t number, uint8_t wireType, const uint8_t *data, uint64_t value) {
+    if (number == 1 && wireType == 1)
+    {
+      memcpy(&sample.value, &value, sizeof(sample.value));
+      return true;
+    }
+    if (number == 2 && wireType == 0)
+    {
+      sample.timestampMs = value;
+      return true;
+    }
+    return false;
+  });
+}
+
+static bool parseSeries(const uint8_t *p, size_t length, SimSeries &series)
+{
+  return parseMessage(p, p + length, [&](uint32_t number, uint8_t wireType, const uint8_t *data, uint64_t value) {
+    if (wireType != 2)
+    {
+      return false;
+    }
+    if (number == 1)
+    {
+      series.labels.emplace_back();
+      return parseLabel(data, value, series.labels.back());
+    }
+    if (number == 2)
+    {
+      series.samples.emplace_back();
+      return parseSample(data, value, series.samples.back());
+    }
+    return false;
+  });
+}
+
+// Receiver -------------------------------------------------------------------
+
+bool receiveRemoteWrite(const uint8_t *data, size_t length, std::vector<SimSeries> &series, size_t &protoLength)
+{
+  std::vector<uint8_t> proto;
+  if (!snappyUncompress(data, length, proto))
+  {
+    return false;
+  }
+  protoLength = proto.size();
+
+  series.clear();
+  bool parsed = parseMessage(proto.data(), proto.data() + proto.size(), [&](uint32_t number, uint8_t wireType, const uint8_t *p, uint64_t value) {
+    if (number != 1 || wireType != 2)
+    {
+      return false;
+    }
+    series.emplace_back();
+    return parseSeries(p, value, series.back());
+  });
+  if (!parsed)
+  {
+    return false;
+  }
+
+  // Prometheus rejects unsorted labels, series without a name and samples out of order
+  for (const SimSeries &s : series)
+  {
+    if (s.labels.empty() || s.labels[0].name != "__name__" || s.samples.empty())
+    {
+      return false;
+    }
+    for (size_t i = 1; i < s.labels.size(); i++)
+    {
+      if (s.labels[i - 1].name >= s.labels[i].name)
+      {
+        return false;
+      }
+    }
+    for (size_t i = 1; i < s.samples.size(); i++)
+    {
+      if (s.samples[i - 1].timestampMs >= s.samples[i].timestampMs)
+      {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
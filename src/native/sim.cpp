@@ -0,0 +1,865 @@
+#include "sim.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "../config.h"
+#include "../crc32.h"
+#include "../frame.h"
+#include "../plant.h"
+#include "../probes.h"
+
+// ADS1115 at the default gain (+/-6.144V)
+#define SIM_ADS_FULL_SCALE_MV 6144
+#define SIM_ADS_VOLTS_PER_BIT (SIM_ADS_FULL_SCALE_MV / 1000.0f / 32768)
+
+void SimWorld::advance(uint64_t us)
+{
+  nowUs += us;
+}
+
+// Wake -----------------------------------------------------------------------
+
+bool simWake(SimWorld &world, const Hal &hal, const NodeConfig &config)
+{
+  size_t heapStart = simHeapUsed;
+  simHeapPeak = simHeapUsed;
+
+  {
+    PlantNode node(hal, config);
+    node.setup();
+    node.loop();
+  }
+
+  world.cycle.awakeUs = world.nowUs - world.bootUs;
+  world.cycle.heapPeak = simHeapPeak - heapStart;
+  if (world.sleepUs == 0)
+  {
+    return false;
+  }
+
+  // The deep sleep timer runs off the RC oscillator
+  world.advance(world.sleepUs + (int64_t)world.sleepUs * world.sleepDriftPpm / 1000000);
+  world.timerWake = true;
+
+  return true;
+}
+
+// Sensors --------------------------------------------------------------------
+
+SimSensors::SimSensors(SimWorld &world) : world(world), reading(), airReadyUs(0), humidityStarted(false), adcs(), noiseSeed(1)
+{
+}
+
+bool SimSensors::load(const char *path)
+{
+  FILE *file = fopen(path, "r");
+  if (!file)
+  {
+    return false;
+  }
+
+  char line[128];
+  while (fgets(line, sizeof(line), file))
+  {
+    SimReading r;
+    int soil[SAMPLE_MAX_PROBES], battery, solar;
+    int fields = sscanf(line, "%f,%f,%f,%d,%d,%d,%d,%d,%d", &r.temp, &r.humidity, &r.dewPoint, &soil[0], &battery, &solar, &soil[1], &soil[2], &soil[3]);
+    if (fields >= 6)
+    {
+      for (uint8_t p = 0; p < SAMPLE_MAX_PROBES; p++)
+      {
+        r.soilRaw[p] = p < fields - 5 ? soil[p] : soil[0];
+      }
+      r.batteryRaw = battery;
+      r.solarRaw = solar;
+      script.push_back(r);
+    }
+  }
+  fclose(file);
+
+  return !script.empty();
+}
+
+void SimSensors::select(uint32_t cycle)
+{
+  if (!script.empty())
+  {
+    reading = script[cycle % script.size()];
+    return;
+  }
+
+  // Daily cycle of temperature and light, soil drying out over three days (a day more for each
+  // other probe)
+  double sec = world.nowUs / 1000000.0;
+  double day = sin(2 * M_PI * sec / 86400);
+  float solar = day > 0 ? 6.0 * day : 0;
+
+  reading.temp = 21 + 3 * day;
+  reading.humidity = 55 - 10 * day;
+  reading.dewPoint = reading.temp - (100 - reading.humidity) / 5;
+  for (uint8_t p = 0; p < SOIL_PROBE_COUNT; p++)
+  {
+    // From the wettest end of the curve to the driest one
+    const CalCurve &curve = *SOIL_PROBE_TABLE[p].curve;
+    const CalPoint &first = curve.points[0];
+    const CalPoint &last = curve.points[curve.count - 1];
+    int16_t water = first.y > last.y ? first.x : last.x;
+    int16_t air = first.y > last.y ? last.x : first.x;
+    double dry = fmod(sec / ((3 + p) * 86400), 1.0);
+    reading.soilRaw[p] = water + (air - water) * dry;
+  }
+  reading.batteryRaw = (3.7 + 0.3 * day) / SIM_ADS_VOLTS_PER_BIT;
+  reading.solarRaw = solar / SIM_ADS_VOLTS_PER_BIT;
+}
+
+bool SimSensors::begin()
+{
+  return true;
+}
+
+void SimSensors::startAir()
+{
+  world.advance(SIM_I2C_US);
+  airReadyUs = world.nowUs + SIM_SHT20_TEMP_US;
+  humidityStarted = false;
+}
+
+bool SimSensors::pollAir(AirCondition &air)
+{
+  world.advance(SIM_I2C_US);
+  if (world.nowUs < airReadyUs)
+  {
+    return false;
+  }
+
+  if (!humidityStarted)
+  {
+    world.advance(SIM_I2C_US);
+    airReadyUs = world.nowUs + SIM_SHT20_HUMIDITY_US;
+    humidityStarted = true;
+    return false;
+  }
+
+  air.temp = reading.temp;
+  air.humidity = reading.humidity;
+  air.dew_point = reading.dewPoint;
+
+  return true;
+}
+
+int16_t SimSensors::convert(uint8_t input)
+{
+  int32_t raw = 0;
+  if (input == BATTERY_VOLT_PIN)
+  {
+    raw = reading.batteryRaw;
+  }
+  else if (input == SOLAR_PANEL_VOLT_PIN)
+  {
+    raw = reading.solarRaw;
+  }
+  for (uint8_t p = 0; p < SOIL_PROBE_COUNT; p++)
+  {
+    if (input == SOIL_PROBE_TABLE[p].input)
+    {
+      raw = reading.soilRaw[p];
+    }
+  }
+
+  // Deterministic noise: triangular, with some spikes
+  noiseSeed = noiseSeed * 1103515245 + 12345;
+  int32_t noise = (int32_t)((noiseSeed >> 8) % (SIM_ADC_NOISE + 1)) + (int32_t)((noiseSeed >> 20) % (SIM_ADC_NOISE + 1)) - SIM_ADC_NOISE;
+  if ((noiseSeed >> 16) % SIM_ADC_SPIKE_RATE == 0)
+  {
+    noise += SIM_ADC_SPIKE;
+  }
+  return raw + noise > INT16_MAX ? INT16_MAX : raw + noise;
+}
+
+void SimSensors::settle(Adc &adc)
+{
+  if (adc.converting && world.nowUs >= adc.readyUs)
+  {
+    adc.result = adc.next;
+    adc.converting = false;
+  }
+}
+
+void SimSensors::startAdc(uint8_t input)
+{
+  world.advance(SIM_I2C_US);
+  Adc &adc = adcs[ADC_INPUT_DEVICE(input)];
+  settle(adc);
+  adc.converting = true;
+  adc.readyUs = world.nowUs + SIM_ADS_US(ADC_RATE_SPS);
+  adc.next = convert(input);
+}
+
+bool SimSensors::adcReady(uint8_t device)
+{
+  world.advance(SIM_I2C_US);
+  settle(adcs[device]);
+  return !adcs[device].converting;
+}
+
+int16_t SimSensors::readAdc(uint8_t device)
+{
+  world.advance(SIM_I2C_US);
+  settle(adcs[device]);
+  return adcs[device].result;
+}
+
+int32_t SimSensors::adcToMilliVolts(int16_t raw)
+{
+  return adcMilliVolts(raw, SIM_ADS_FULL_SCALE_MV);
+}
+
+// Network --------------------------------------------------------------------
+
+SimNetwork::SimNetwork(SimWorld &world, StorageHal &flash) : world(world), flash(flash), state(nullptr), connecting(false), connectStartUs(0), associatedUs(0), broker(world), stream(nullptr), replyUs(0)
+{
+}
+
+void SimNetwork::begin(NetworkState &networkState, bool lost)
+{
+  static_assert(sizeof(State) <= sizeof(NetworkState), "State does not fit in NetworkState");
+  state = (State *)networkState.data;
+
+#if TLS_SESSION_FLASH
+  if (lost)
+  {
+    loadTlsSessions(flash, state->tls);
+  }
+#endif
+}
+
+void SimNetwork::startConnect()
+{
+  if (connecting)
+  {
+    return;
+  }
+
+  // Associates in background
+  connectStartUs = world.nowUs;
+  associatedUs = world.nowUs + (state->associated ? SIM_WIFI_FAST_US : SIM_WIFI_FULL_US);
+  connecting = true;
+}
+
+bool SimNetwork::connect(uint32_t timeoutMs)
+{
+  startConnect();
+  uint64_t deadlineUs = world.nowUs + (uint64_t)timeoutMs * 1000;
+  if (world.apOutage || associatedUs > deadlineUs)
+  {
+    world.advance(deadlineUs - world.nowUs);
+    return false;
+  }
+
+  if (world.nowUs < associatedUs)
+  {
+    world.advance(associatedUs - world.nowUs);
+  }
+  state->associated = 1;
+
+  return true;
+}
+
+void SimNetwork::disconnect()
+{
+  if (connecting)
+  {
+    world.cycle.radioUs += world.nowUs - connectStartUs;
+    connecting = false;
+  }
+}
+
+bool SimNetwork::getTime(uint32_t &epoch)
+{
+  // The NTP servers are out there with the backends
+  if (world.outage)
+  {
+    world.advance(SIM_NTP_TIMEOUT_US);
+    return false;
+  }
+
+  world.advance(SIM_NTP_US / 2);
+  epoch = SIM_EPOCH_START + world.nowUs / 1000000;
+  world.advance(SIM_NTP_US / 2);
+
+  return true;
+}
+
+// Timestamps of the samples in a Graphite payload, return the number of samples
+static uint32_t receiveGraphite(SimWorld &world, const char *body, size_t length)
+{
+  static const char entry[] = "{\"name\":\"temperature\"";
+  static const char time[] = "\"time\":";
+  static const char overruns[] = "{\"name\":\"trace.overruns\"";
+  static const char suppressed[] = "{\"name\":\"suppressed_samples\"";
+  static const char value[] = "\"value\":";
+
+  simHeapServer = true;
+  std::string text(body, length);
+  uint32_t samples = 0;
+  size_t pos = 0;
+  while ((pos = text.find(entry, pos)) != std::string::npos)
+  {
+    samples++;
+    pos = text.find(time, pos);
+    if (pos == std::string::npos)
+    {
+      break;
+    }
+    pos += sizeof(time) - 1;
+    if (!world.delivered.insert(strtoul(text.c_str() + pos, nullptr, 10)).second)
+    {
+      world.duplicates++;
+    }
+  }
+
+  pos = text.find(overruns);
+  if (pos != std::string::npos && (pos = text.find(value, pos)) != std::string::npos)
+  {
+    world.overruns += strtoul(text.c_str() + pos + sizeof(value) - 1, nullptr, 10);
+  }
+  pos = 0;
+  while ((pos = text.find(suppressed, pos)) != std::string::npos && (pos = text.find(value, pos)) != std::string::npos)
+  {
+    pos += sizeof(value) - 1;
+    world.suppressed += strtoul(text.c_str() + pos, nullptr, 10);
+  }
+  simHeapServer = false;
+
+  return samples;
+}
+
+// Number of samples in a Loki payload, one log line each
+static uint32_t receiveLoki(const char *body, size_t length)
+{
+  static const char entry[] = "\"temperature=";
+
+  uint32_t samples = 0;
+  const char *end = body + length;
+  for (const char *p = body; (p = std::search(p, end, entry, entry + sizeof(entry) - 1)) != end; p++)
+  {
+    samples++;
+  }
+
+  return samples;
+}
+
+// Wait for a step of a request, false once its deadline passed
+static bool waitRequest(SimWorld &world, uint64_t us, uint64_t deadlineUs)
+{
+  if (world.nowUs + us > deadlineUs)
+  {
+    world.advance(deadlineUs > world.nowUs ? deadlineUs - world.nowUs : 0);
+    return false;
+  }
+
+  world.advance(us);
+  return true;
+}
+
+int SimNetwork::post(Backend backend, const char *body, size_t length, uint32_t timeoutMs)
+{
+  uint64_t deadlineUs = world.nowUs + (uint64_t)timeoutMs * 1000;
+  if (world.outage)
+  {
+    // Connection timeout
+    world.advance(deadlineUs - world.nowUs);
+    return -1;
+  }
+
+  // Heap of the TLS and HTTP clients while the request runs
+  std::vector<uint8_t> client(SIM_TLS_HEAP_BYTES);
+
+  uint64_t startUs = world.nowUs;
+  bool resumed = handshake(backend);
+  if (resumed)
+  {
+    world.cycle.tlsResumed++;
+  }
+  if (!waitRequest(world, resumed ? SIM_TLS_RESUMED_US : SIM_TLS_FULL_US, deadlineUs))
+  {
+    return SIM_HTTP_TIMEOUT;
+  }
+
+  uint32_t bytes = length + SIM_HTTP_HEADER_BYTES;
+  world.cycle.bytesSent += bytes;
+  world.cycle.posts++;
+  if (!waitRequest(world, SIM_HTTP_US / 2 + (uint64_t)bytes * 1000000 / SIM_TX_BYTES_PER_SEC, deadlineUs))
+  {
+    return SIM_HTTP_TIMEOUT;
+  }
+
+  // The servers of a fleet are shared, the request may queue past the deadline, the node gives
+  // up on the response then
+  if (world.fleet)
+  {
+    world.fleet->sync(world);
+    if (!waitRequest(world, world.fleet->serve(backend, world.nowUs, bytes) - world.nowUs, deadlineUs))
+    {
+      return SIM_HTTP_TIMEOUT;
+    }
+  }
+  if (!waitRequest(world, SIM_HTTP_US - SIM_HTTP_US / 2, deadlineUs))
+  {
+    return SIM_HTTP_TIMEOUT;
+  }
+
+  uint32_t samples = 0;
+  if (backend == BACKEND_GRAPHITE)
+  {
+    samples = receiveGraphite(world, body, length);
+  }
+  else if (backend == BACKEND_LOKI)
+  {
+    samples = receiveLoki(body, length);
+  }
+  else if (backend == BACKEND_PROMETHEUS)
+  {
+    simHeapServer = true;
+    std::vector<SimSeries> series;
+    size_t protoLength;
+    bool received = receiveRemoteWrite((const uint8_t *)body, length, series, protoLength);
+    size_t seriesCount = series.size();
+    samples = series.empty() ? 0 : series[0].samples.size();
+    series = std::vector<SimSeries>();
+    simHeapServer = false;
+
+    if (!received)
+    {
+      fprintf(stderr, "Remote write payload rejected\n");
+      world.rejected++;
+      return 400;
+    }
+    if (world.verbose)
+    {
+      printf("  Remote write: %zu series, %zu bytes of protobuf in %zu bytes\n", seriesCount, protoLength, length);
+    }
+  }
+
+  if (world.fleet)
+  {
+    world.fleet->record(backend, world.nowUs - startUs, bytes, samples);
+  }
+
+  return 200;
+}
+
+// A session is the id the backend issued, in the first bytes
+bool SimNetwork::handshake(Backend backend)
+{
+  uint8_t session[TLS_SESSION_SIZE];
+  memcpy(session, tlsSession(state->tls, backend), sizeof(session));
+  uint32_t id;
+  memcpy(&id, session, sizeof(id));
+
+  simHeapServer = true;
+  auto cached = world.tlsSessions.find({backend, id});
+  bool resumed = id != 0 && cached != world.tlsSessions.end() && cached->second > world.nowUs;
+  if (!resumed)
+  {
+    id = ++world.tlsSessionIds;
+    world.tlsSessions[{backend, id}] = world.nowUs + SIM_TLS_SESSION_US;
+    memset(session, 0, sizeof(session));
+    memcpy(session, &id, sizeof(id));
+  }
+  simHeapServer = false;
+
+  recordTlsSession(state->tls, backend, session, sizeof(session), 200, TLS_SESSION_FLASH ? &flash : nullptr);
+
+  return resumed;
+}
+
+size_t SimNetwork::exchangeRelay(const uint8_t *data, size_t length, uint8_t *reply, size_t replySize)
+{
+  if (world.outage)
+  {
+    world.advance(RELAY_ACK_TIMEOUT_MS * 1000);
+    return 0;
+  }
+
+  uint32_t bytes = length + SIM_UDP_HEADER_BYTES;
+  world.advance(SIM_LAN_RTT_US + (uint64_t)bytes * 1000000 / SIM_TX_BYTES_PER_SEC);
+  world.cycle.bytesSent += bytes;
+  world.cycle.posts++;
+
+  // The relay is always there
+  return replySize >= FRAME_ACK_SIZE ? encodeFrameAck(reply, data, length) : 0;
+}
+
+bool SimNetwork::openStream(const char *host, uint16_t port)
+{
+  stream = port == OTA_PORT ? (SimStreamServer *)world.updates : port == CONFIG_PORT ? (SimStreamServer *)world.config : &broker;
+  if (world.outage || !stream)
+  {
+    world.advance(SIM_HTTP_US);
+    return false;
+  }
+
+  // SYN and SYN-ACK
+  world.advance(SIM_LAN_RTT_US);
+  client.assign(SIM_TCP_HEAP_BYTES, 0);
+  world.cycle.bytesSent += SIM_TCP_HEADER_BYTES;
+  simHeapServer = true;
+  stream->open();
+  simHeapServer = false;
+
+  return true;
+}
+
+bool SimNetwork::writeStream(const uint8_t *data, size_t length)
+{
+  uint32_t bytes = length + SIM_TCP_HEADER_BYTES;
+  world.advance((uint64_t)bytes * 1000000 / SIM_TX_BYTES_PER_SEC);
+  world.cycle.bytesSent += bytes;
+  replyUs = world.nowUs + SIM_LAN_RTT_US;
+
+  simHeapServer = true;
+  stream->receive(data, length);
+  simHeapServer = false;
+
+  return true;
+}
+
+bool SimNetwork::readStream(uint8_t *data, size_t length, uint32_t timeoutMs)
+{
+  if (world.nowUs < replyUs)
+  {
+    world.advance(replyUs - world.nowUs);
+  }
+
+  if (!stream->reply(data, length))
+  {
+    world.advance((uint64_t)timeoutMs * 1000);
+    return false;
+  }
+  world.advance((uint64_t)length * 1000000 / SIM_RX_BYTES_PER_SEC);
+
+  return true;
+}
+
+void SimNetwork::closeStream()
+{
+  std::vector<uint8_t>().swap(client);
+  simHeapServer = true;
+  stream->close();
+  simHeapServer = false;
+}
+
+// Clock ----------------------------------------------------------------------
+
+SimClock::SimClock(SimWorld &world) : world(world)
+{
+}
+
+uint32_t SimClock::millis()
+{
+  return (world.nowUs - world.bootUs) / 1000;
+}
+
+uint32_t SimClock::micros()
+{
+  return world.nowUs - world.bootUs;
+}
+
+void SimClock::delay(uint32_t ms)
+{
+  world.advance((uint64_t)ms * 1000);
+}
+
+// Sleep ----------------------------------------------------------------------
+
+SimSleep::SimSleep(SimWorld &world) : world(world)
+{
+}
+
+void SimSleep::readRtc(void *data, size_t size)
+{
+  memcpy(data, world.rtc, size);
+}
+
+void SimSleep::writeRtc(const void *data, size_t size)
+{
+  memcpy(world.rtc, data, size);
+}
+
+bool SimSleep::timerWake()
+{
+  return world.timerWake;
+}
+
+void SimSleep::deepSleep(uint64_t us)
+{
+  world.sleepUs = us;
+}
+
+// Storage --------------------------------------------------------------------
+
+SimStorage::SimStorage(SimWorld &world) : world(world), totalBytes(0), peakBytes(0)
+{
+}
+
+size_t SimStorage::read(const char *path, uint32_t offset, void *data, size_t length)
+{
+  world.advance(SIM_FLASH_OPEN_US);
+  auto file = find(path);
+  if (file == files.end() || offset >= file->second.size())
+  {
+    return 0;
+  }
+
+  size_t read = file->second.size() - offset < length ? file->second.size() - offset : length;
+  memcpy(data, file->second.data() + offset, read);
+  world.advance((uint64_t)read * 1000000 / SIM_FLASH_READ_BYTES_PER_SEC);
+
+  return read;
+}
+
+bool SimStorage::append(const char *path, const void *data, size_t length)
+{
+  world.advance(SIM_FLASH_OPEN_US + (uint64_t)length * 1000000 / SIM_FLASH_WRITE_BYTES_PER_SEC);
+
+  simHeapServer = true;
+  std::vector<uint8_t> &file = files[path];
+  file.insert(file.end(), (const uint8_t *)data, (const uint8_t *)data + length);
+  simHeapServer = false;
+
+  totalBytes += length;
+  peakBytes = totalBytes > peakBytes ? totalBytes : peakBytes;
+  return true;
+}
+
+void SimStorage::remove(const char *path)
+{
+  world.advance(SIM_FLASH_OPEN_US);
+  auto file = find(path);
+  if (file != files.end())
+  {
+    totalBytes -= file->second.size();
+    simHeapServer = true;
+    files.erase(file);
+    simHeapServer = false;
+  }
+}
+
+// The key of a long path is allocated, not by the node
+std::map<std::string, std::vector<uint8_t>>::iterator SimStorage::find(const char *path)
+{
+  simHeapServer = true;
+  auto file = files.find(path);
+  simHeapServer = false;
+
+  return file;
+}
+
+int32_t SimStorage::size(const char *path)
+{
+  world.advance(SIM_FLASH_OPEN_US);
+  auto file = find(path);
+  return file == files.end() ? -1 : (int32_t)file->second.size();
+}
+
+// Firmware -------------------------------------------------------------------
+
+#define SIM_EBOOT_MAGIC 0xea0000ea
+
+SimFirmware::SimFirmware(SimWorld &world) : world(world), stagedSize(0), staging(false), copies(0)
+{
+  // Some code, repeating itself a bit. The flash is not part of the heap.
+  simHeapServer = true;
+  image.resize(SIM_IMAGE_BYTES);
+  uint32_t seed = 1;
+  for (size_t i = 0; i < image.size(); i++)
+  {
+    seed = seed * 1103515245 + 12345;
+    image[i] = i % 7 == 0 ? 0 : seed >> 24;
+  }
+  simHeapServer = false;
+}
+
+bool SimFirmware::load(const char *path)
+{
+  FILE *file = fopen(path, "rb");
+  if (!file)
+  {
+    return false;
+  }
+
+  simHeapServer = true;
+  std::vector<uint8_t> data;
+  uint8_t buffer[4096];
+  size_t read;
+  while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+  {
+    data.insert(data.end(), buffer, buffer + read);
+  }
+  fclose(file);
+  bool loaded = !data.empty();
+  if (loaded)
+  {
+    image.swap(data);
+  }
+  simHeapServer = false;
+
+  return loaded;
+}
+
+bool SimFirmware::save(const char *path)
+{
+  FILE *file = fopen(path, "wb");
+  if (!file)
+  {
+    return false;
+  }
+
+  bool ok = fwrite(image.data(), 1, image.size(), file) == image.size();
+  return fclose(file) == 0 && ok;
+}
+
+bool SimFirmware::boot()
+{
+  Command command;
+  memcpy(&command, world.rtc, sizeof(command));
+  if (command.magic != SIM_EBOOT_MAGIC || command.size != staged.size() ||
+      command.crc != crc32(staged.data(), staged.size()))
+  {
+    return false;
+  }
+
+  // The bootloader clears its command, the node finds its state gone
+  world.advance((uint64_t)staged.size() * 1000000 / SIM_IMAGE_WRITE_BYTES_PER_SEC);
+  memset(world.rtc, 0, 128);
+  image.swap(staged);
+  staged.clear();
+  copies++;
+
+  return true;
+}
+
+uint32_t SimFirmware::crc() const
+{
+  return crc32(image.data(), image.size());
+}
+
+uint32_t SimFirmware::imageSize()
+{
+  return image.size();
+}
+
+bool SimFirmware::readImage(uint32_t offset, void *data, size_t length)
+{
+  if (offset > image.size() || length > image.size() - offset)
+  {
+    return false;
+  }
+
+  memcpy(data, image.data() + offset, length);
+  world.advance((uint64_t)length * 1000000 / SIM_FLASH_READ_BYTES_PER_SEC);
+  return true;
+}
+
+bool SimFirmware::beginUpdate(uint32_t size)
+{
+  // The staging area is the free flash after the running image
+  staging = size <= image.size() * 2;
+  stagedSize = size;
+  staged.clear();
+  if (staging)
+  {
+    simHeapServer = true;
+    staged.reserve(size);
+    simHeapServer = false;
+  }
+  return staging;
+}
+
+bool SimFirmware::writeUpdate(const uint8_t *data, size_t length)
+{
+  if (!staging || length > stagedSize - staged.size())
+  {
+    return false;
+  }
+
+  staged.insert(staged.end(), data, data + length);
+  world.advance((uint64_t)length * 1000000 / SIM_IMAGE_WRITE_BYTES_PER_SEC);
+  return true;
+}
+
+bool SimFirmware::endUpdate(bool commit)
+{
+  bool complete = staging && staged.size() == stagedSize;
+  staging = false;
+  if (!complete)
+  {
+    staged.clear();
+    return !commit;
+  }
+
+  Command command = {SIM_EBOOT_MAGIC, (uint32_t)staged.size(), crc32(staged.data(), staged.size())};
+  memcpy(world.rtc, &command, sizeof(command));
+  return true;
+}
+
+// Display --------------------------------------------------------------------
+
+SimDisplay::SimDisplay(SimWorld &world) : world(world)
+{
+}
+
+void SimDisplay::begin(bool lowPower)
+{
+}
+
+void SimDisplay::setStatusLed(bool on)
+{
+}
+
+void SimDisplay::showStatus(const char *text)
+{
+  if (world.eink)
+  {
+    world.advance(SIM_EINK_STATUS_US);
+  }
+}
+
+void SimDisplay::showInfo(const ScreenValues &values, const ScreenUpdate &update)
+{
+  if (!world.eink || update.dirty == 0)
+  {
+    return;
+  }
+
+  world.advance(update.full ? SIM_EINK_FULL_US : SIM_EINK_PARTIAL_US);
+  if (world.verbose)
+  {
+    printf("  Display: %s refresh, fields: 0x%02x\n", update.full ? "full" : "partial", update.dirty);
+  }
+}
+
+// System ---------------------------------------------------------------------
+
+SimSystem::SimSystem(SimWorld &world) : world(world)
+{
+}
+
+void SimSystem::log(const char *text)
+{
+  if (world.verbose)
+  {
+    printf("  %s\n", text);
+  }
+}
+
+void SimSystem::getHeapStats(HeapStats &stats)
+{
+  // No fragmentation is modelled
+  stats.freeHeap = simHeapUsed < SIM_HEAP_SIZE ? SIM_HEAP_SIZE - simHeapUsed : 0;
+  stats.maxFreeBlock = stats.freeHeap;
+  stats.fragmentation = 0;
+}
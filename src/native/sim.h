@@ -0,0 +1,535 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include <condition_variable>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <queue>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "../hal.h"
+#include "../tlssessions.h"
+
+// Simulated backends of the hardware interfaces, used by the native environment.
+// Every call advances the simulated time by the modelled cost of the real one.
+
+// Costs (us) of the modelled operations
+#define SIM_BOOT_US 80000           // ROM and core startup before setup()
+#define SIM_SHT20_TEMP_US 85000     // 14 bit temperature conversion
+#define SIM_SHT20_HUMIDITY_US 29000 // 12 bit humidity conversion
+#define SIM_ADS_US(sps) (1000000 / (sps) + 30) // Single shot conversion, with the startup
+#define SIM_I2C_US 300              // Command or read on the bus
+#define SIM_ADC_NOISE 60            // Peak noise of a conversion (raw)
+#define SIM_ADC_SPIKE 2500          // Offset of a spike (raw)
+#define SIM_ADC_SPIKE_RATE 50       // One conversion in this many is a spike
+#define SIM_WIFI_FULL_US 3500000    // Scan, association and DHCP
+#define SIM_WIFI_FAST_US 900000     // Association on a known channel and BSSID, static lease
+#define SIM_NTP_US 60000            // Single NTP round trip
+#define SIM_NTP_TIMEOUT_US 1000000  // NTPClient gives up on a request after a second
+#define SIM_TLS_FULL_US 1600000     // Full handshake (RSA on the ESP8266)
+#define SIM_TLS_RESUMED_US 250000   // Abbreviated handshake
+#define SIM_TLS_SESSION_US 86400000000ULL // Lifetime of a session in the cache of a backend
+#define SIM_TLS_HEAP_BYTES 22000    // BearSSL client (16709 + 597 bytes of I/O buffers), HTTPClient
+#define SIM_TCP_HEAP_BYTES 600      // WiFiClient and its lwIP connection
+#define SIM_HTTP_US 180000          // Request and response round trip
+#define SIM_HTTP_TIMEOUT -11        // HTTPC_ERROR_READ_TIMEOUT
+#define SIM_TX_BYTES_PER_SEC 40000  // Effective upload throughput
+#define SIM_RX_BYTES_PER_SEC 100000 // Effective download throughput
+#define SIM_HTTP_HEADER_BYTES 260   // Request line and headers
+#define SIM_LAN_RTT_US 8000         // Round trip to a host on the local network (relay, MQTT broker)
+#define SIM_UDP_HEADER_BYTES 28     // IP and UDP headers
+#define SIM_TCP_HEADER_BYTES 40     // IP and TCP headers of a segment
+#define SIM_EINK_FULL_US 2000000    // Full refresh of the 1.54" e-ink panel
+#define SIM_EINK_PARTIAL_US 300000  // Partial refresh, whatever the window size
+#define SIM_EINK_STATUS_US 2000000  // Status screen (full refresh)
+#define SIM_FLASH_OPEN_US 1500      // Open, close or remove a LittleFS file
+#define SIM_FLASH_READ_BYTES_PER_SEC 1000000
+#define SIM_FLASH_WRITE_BYTES_PER_SEC 50000
+#define SIM_IMAGE_WRITE_BYTES_PER_SEC 100000 // Erase and write of raw sectors (firmware image)
+#define SIM_IMAGE_BYTES 320000      // Size of the generated firmware image, when none is loaded
+#define SIM_INGEST_WORKERS 4        // Requests a backend serves at once, the others queue (fleet)
+#define SIM_INGEST_US 15000         // Server time of a request, on top of the round trip (fleet)
+#define SIM_INGEST_BYTES_PER_SEC 2000000 // Parsing of the request body (fleet)
+
+#define SIM_EPOCH_START 1700000000 // Wall-clock time at the start of the simulation
+#define SIM_HEAP_SIZE 52000        // Free heap at boot of the ESP8266 core with WiFi
+
+// Heap in use, its peak and the bytes allocated so far, tracked by the allocation operators
+extern size_t simHeapUsed;
+extern size_t simHeapPeak;
+extern size_t simHeapAllocated;
+// Set while the simulated servers run, their allocations are not the node's
+extern bool simHeapServer;
+
+// Scripted readings of a single cycle
+struct SimReading
+{
+  float temp;
+  float humidity;
+  float dewPoint;
+  int16_t soilRaw[SAMPLE_MAX_PROBES];
+  int16_t batteryRaw;
+  int16_t solarRaw;
+};
+
+// Counters of a single wake cycle
+struct SimCycle
+{
+  uint64_t awakeUs;
+  uint64_t radioUs;
+  uint32_t bytesSent;
+  uint32_t posts;
+  uint32_t tlsResumed;
+  uint32_t heapPeak;
+};
+
+class SimFleet;
+class SimUpdateServer;
+class SimConfigServer;
+struct NodeConfig;
+
+// True time and everything that survives a deep sleep
+struct SimWorld
+{
+  uint64_t nowUs;  // True time since the start of the simulation
+  uint64_t bootUs; // True time of the last boot
+  int32_t sleepDriftPpm;
+  bool timerWake;
+  uint64_t sleepUs; // Requested deep sleep, 0 if the node did not sleep
+  uint8_t rtc[512];
+  bool verbose;
+  bool eink;         // Model an e-ink display
+  bool outage;       // The backends are unreachable
+  bool apOutage;     // The access point does not answer
+  uint32_t rejected; // Payloads the receivers refused
+  std::set<uint32_t> delivered; // Timestamps of the samples Graphite received
+  uint32_t duplicates;          // Samples Graphite received again
+  uint32_t overruns;            // Wake budget overruns reported in the Graphite traces
+  uint32_t suppressed;          // Samples within the deadbands reported in the Graphite payloads
+  SimCycle cycle;
+  SimFleet *fleet;          // Shared servers, nullptr for a single node
+  SimUpdateServer *updates; // nullptr when there is no update server
+  SimConfigServer *config;  // nullptr when there is no config server
+  uint32_t node;            // Index in the fleet
+  std::map<std::pair<uint8_t, uint32_t>, uint64_t> tlsSessions; // Sessions the backends can resume, by backend and id, until when
+  uint32_t tlsSessionIds;                                       // Last session id issued
+
+  void advance(uint64_t us);
+};
+
+// Wake of a fresh PlantNode after the boot, as a deep sleep wake restarts the program with only
+// the RTC memory kept, then the deep sleep it asked for. Fills the awake time and the heap peak
+// of world.cycle, return false if the node did not go to deep sleep.
+bool simWake(SimWorld &world, const Hal &hal, const NodeConfig &config);
+
+// Run cycles wakes of a fleet of nodes against shared backends, print the load they see (fleet.cpp)
+int runFleet(uint32_t nodes, uint32_t cycles, const NodeConfig &config, const char *script, int32_t driftPpm);
+
+// Print the cost of the ADC filters (bench.cpp)
+int benchFilters();
+// Print the cost and the error of the fixed point calibration, against the float path (bench.cpp)
+int benchCalibration();
+// Print the size of each payload and check the remote write one (bench.cpp)
+int benchPayloads();
+// Print the size of the compressed e-ink assets and check their runs (bench.cpp)
+int benchAssets();
+// Print the cost of drawing the info screen in pages, with and without the display list (bench.cpp)
+int benchDisplay();
+
+// Decoded remote write series
+struct SimLabel
+{
+  std::string name;
+  std::string value;
+};
+
+struct SimSeriesSample
+{
+  double value;
+  int64_t timestampMs;
+};
+
+struct SimSeries
+{
+  std::vector<SimLabel> labels;
+  std::vector<SimSeriesSample> samples;
+};
+
+// Uncompress a snappy block, false if it is not valid (receiver.cpp)
+bool snappyUncompress(const uint8_t *data, size_t length, std::vector<uint8_t> &out);
+// Decode and check a remote write payload as Prometheus would (receiver.cpp)
+bool receiveRemoteWrite(const uint8_t *data, size_t length, std::vector<SimSeries> &series, size_t &protoLength);
+
+// Server at the other end of a stream of the node
+class SimStreamServer
+{
+public:
+  virtual ~SimStreamServer() {}
+
+  virtual void open() = 0;
+  // Bytes written by the client, the replies are queued
+  virtual void receive(const uint8_t *data, size_t length) = 0;
+  // Take length bytes of the replies, false if there are not as many (the server closed the connection)
+  virtual bool reply(uint8_t *data, size_t length) = 0;
+  virtual void close() = 0;
+};
+
+// MQTT broker stand-in (broker.cpp): checks the packets of the node as mosquitto would and
+// keeps the persistent sessions, with the messages queued for the subscribers, across wakes
+class SimBroker : public SimStreamServer
+{
+public:
+  SimBroker(SimWorld &world);
+
+  void open() override;
+  void receive(const uint8_t *data, size_t length) override;
+  bool reply(uint8_t *data, size_t length) override;
+  void close() override;
+
+private:
+  struct Session
+  {
+    uint16_t lastPacketId;
+    uint32_t lastCrc;
+    uint32_t queued; // Messages for the subscribers, delivered when they connect
+  };
+
+  bool handle(uint8_t header, const uint8_t *body, size_t length);
+  bool handleConnect(const uint8_t *body, size_t length);
+  bool handlePublish(uint8_t header, const uint8_t *body, size_t length);
+  bool reject(const char *reason);
+
+  SimWorld &world;
+  bool connected;
+  bool closed;
+  std::string clientId;
+  std::vector<uint8_t> input;
+  std::vector<uint8_t> output;
+  std::map<std::string, Session> sessions;
+};
+
+// HTTP/1.0 server stand-in (httpserver.cpp): the response is queued once the request header is
+// complete, the connection closes after it
+class SimHttpServer : public SimStreamServer
+{
+public:
+  SimHttpServer(SimWorld &world);
+
+  void open() override;
+  void receive(const uint8_t *data, size_t length) override;
+  bool reply(uint8_t *data, size_t length) override;
+  void close() override;
+
+protected:
+  // Queue the response to the request header with send()
+  virtual void respond(const std::string &request) = 0;
+  // Headers end with their line break
+  void send(const char *status, const std::string &headers, const uint8_t *body, size_t length);
+  // Value of a request header, empty if missing
+  static std::string header(const std::string &request, const char *name);
+
+  SimWorld &world;
+
+private:
+  std::string input;
+  std::vector<uint8_t> output;
+  size_t outputPos;
+};
+
+// Update server stand-in (updates.cpp): answers the update checks with the patches of a
+// directory, made by tools/delta.py, as tools/delta.py serve does
+class SimUpdateServer : public SimHttpServer
+{
+public:
+  SimUpdateServer(SimWorld &world);
+
+  // Load the *.patch files of a directory, false if one cannot be read
+  bool load(const char *dir);
+
+  size_t patchCount() const { return patches.size(); }
+  uint64_t served() const { return servedBytes; }
+
+private:
+  void respond(const std::string &request) override;
+
+  std::map<std::pair<uint32_t, uint32_t>, std::vector<uint8_t>> patches; // By CRC and size of the image they apply to
+  uint64_t servedBytes; // Patch bytes sent
+};
+
+// Remote config server stand-in (configserver.cpp): serves a document with its ETag, as a static
+// file server does, and a 304 without the body to the requests that already have it
+class SimConfigServer : public SimHttpServer
+{
+public:
+  SimConfigServer(SimWorld &world);
+
+  // Serve this document from now on
+  bool load(const char *path);
+
+  uint32_t requests() const { return fullCount + notModifiedCount; }
+  uint32_t notModified() const { return notModifiedCount; }
+  uint64_t served() const { return servedBytes; }
+
+private:
+  void respond(const std::string &request) override;
+
+  std::string document;
+  std::string etag;
+  uint32_t fullCount;
+  uint32_t notModifiedCount;
+  uint64_t servedBytes; // Document bytes sent
+};
+
+// Nodes of a fleet, each in its own thread, and the ingestion stand-in of the HTTP backends
+// they share. A single node runs at a time: before a request or a wake it waits for all the
+// others to wait as well, then the earliest goes on. The servers see the requests in
+// simulated time order.
+class SimFleet
+{
+public:
+  SimFleet(size_t nodes);
+
+  // Wait for the turn of the node, at its current time
+  void sync(SimWorld &world);
+  // The node has no more wakes
+  void leave(SimWorld &world);
+
+  // Serve a request reaching the backend at arrivalUs, return when the response leaves it
+  uint64_t serve(Backend backend, uint64_t arrivalUs, uint32_t bytes);
+  // Upload as seen by the node, from the first byte out to the response
+  void record(Backend backend, uint64_t latencyUs, uint32_t bytes, uint32_t samples);
+  // Print the load of each backend over the simulated time
+  void report(double seconds);
+
+private:
+  struct Slot
+  {
+    bool waiting;
+    std::condition_variable turn;
+  };
+
+  struct Server
+  {
+    uint64_t workersFreeUs[SIM_INGEST_WORKERS];
+    std::priority_queue<uint64_t, std::vector<uint64_t>, std::greater<uint64_t>> inFlightUs; // End of the requests in the server
+    std::vector<uint32_t> latenciesUs;
+    uint64_t bytes;
+    uint64_t samples;
+    uint64_t residenceUs; // Sum of the time the requests spent in the server
+    uint32_t peak;        // Most requests in the server at once
+  };
+
+  // Let the earliest waiting node run, with the mutex held
+  void next();
+
+  std::mutex mutex;
+  std::vector<Slot> slots;
+  std::set<std::pair<uint64_t, uint32_t>> waiting; // Time and index of the waiting nodes
+  size_t running;                                  // Nodes not waiting nor done
+  Server servers[BACKEND_COUNT];
+};
+
+class SimSensors : public SensorHal
+{
+public:
+  SimSensors(SimWorld &world);
+
+  // Load readings from a CSV file (temp,humidity,dew_point,soil_raw,battery_raw,solar_raw), then the
+  // soil_raw of the other probes, the same as the first one if missing
+  bool load(const char *path);
+  // Readings of the given cycle, generated if no script was loaded
+  void select(uint32_t cycle);
+
+  bool begin() override;
+  void startAir() override;
+  bool pollAir(AirCondition &air) override;
+  void startAdc(uint8_t input) override;
+  bool adcReady(uint8_t device) override;
+  int16_t readAdc(uint8_t device) override;
+  int32_t adcToMilliVolts(int16_t raw) override;
+
+private:
+  // ADS1115 in single shot mode
+  struct Adc
+  {
+    bool converting;
+    uint64_t readyUs;
+    int16_t next;   // Result of the conversion running
+    int16_t result; // Conversion register
+  };
+
+  // Reading of an input, with noise
+  int16_t convert(uint8_t input);
+  // Finish the conversion if its time has come
+  void settle(Adc &adc);
+
+  SimWorld &world;
+  std::vector<SimReading> script;
+  SimReading reading;
+  uint64_t airReadyUs;
+  bool humidityStarted;
+  Adc adcs[ADC_MAX_DEVICES];
+  uint32_t noiseSeed;
+};
+
+class SimNetwork : public NetworkHal
+{
+public:
+  // The TLS sessions are copied to flash (TLS_SESSION_FLASH)
+  SimNetwork(SimWorld &world, StorageHal &flash);
+
+  void begin(NetworkState &state, bool lost) override;
+  void startConnect() override;
+  bool connect(uint32_t timeoutMs) override;
+  void disconnect() override;
+  bool getTime(uint32_t &epoch) override;
+  int post(Backend backend, const char *body, size_t length, uint32_t timeoutMs) override;
+  size_t exchangeRelay(const uint8_t *data, size_t length, uint8_t *reply, size_t replySize) override;
+  bool openStream(const char *host, uint16_t port) override;
+  bool writeStream(const uint8_t *data, size_t length) override;
+  bool readStream(uint8_t *data, size_t length, uint32_t timeoutMs) override;
+  void closeStream() override;
+
+private:
+  // Layout of the network state kept in RTC memory
+  struct State
+  {
+    uint8_t associated;
+    TlsSessions tls;
+  };
+
+  // Handshake with the session cache of the backend, return whether it was resumed. Takes
+  // SIM_TLS_RESUMED_US or SIM_TLS_FULL_US, left to the caller.
+  bool handshake(Backend backend);
+
+  SimWorld &world;
+  StorageHal &flash;
+  State *state;
+  bool connecting;
+  uint64_t connectStartUs;
+  uint64_t associatedUs; // When the association completes
+  SimBroker broker;       // Outlives the node, like the sessions of a real broker
+  SimStreamServer *stream; // At the other end of the open stream
+  uint64_t replyUs;       // When the replies to the last write arrive
+  std::vector<uint8_t> client; // Heap of the client of the open stream
+};
+
+class SimClock : public ClockHal
+{
+public:
+  SimClock(SimWorld &world);
+
+  uint32_t millis() override;
+  uint32_t micros() override;
+  void delay(uint32_t ms) override;
+
+private:
+  SimWorld &world;
+};
+
+class SimSleep : public SleepHal
+{
+public:
+  SimSleep(SimWorld &world);
+
+  void readRtc(void *data, size_t size) override;
+  void writeRtc(const void *data, size_t size) override;
+  bool timerWake() override;
+  void deepSleep(uint64_t us) override;
+
+private:
+  SimWorld &world;
+};
+
+// LittleFS stand-in, the files outlive the node like the flash
+class SimStorage : public StorageHal
+{
+public:
+  SimStorage(SimWorld &world);
+
+  size_t read(const char *path, uint32_t offset, void *data, size_t length) override;
+  bool append(const char *path, const void *data, size_t length) override;
+  void remove(const char *path) override;
+  int32_t size(const char *path) override;
+
+  // Largest size of all the files together
+  size_t peak() const { return peakBytes; }
+
+private:
+  std::map<std::string, std::vector<uint8_t>>::iterator find(const char *path);
+
+  SimWorld &world;
+  std::map<std::string, std::vector<uint8_t>> files;
+  size_t totalBytes;
+  size_t peakBytes;
+};
+
+// Flash of the firmware: the running image and the staging area, copied over it on the next
+// boot as the bootloader does, if its command in RTC memory survived the deep sleep
+class SimFirmware : public FirmwareHal
+{
+public:
+  SimFirmware(SimWorld &world);
+
+  // Run this image, a generated one otherwise
+  bool load(const char *path);
+  bool save(const char *path);
+  // Bootloader, before each wake: true if it copied a new image
+  bool boot();
+
+  uint32_t crc() const;
+  uint32_t updates() const { return copies; }
+
+  uint32_t imageSize() override;
+  bool readImage(uint32_t offset, void *data, size_t length) override;
+  bool beginUpdate(uint32_t size) override;
+  bool writeUpdate(const uint8_t *data, size_t length) override;
+  bool endUpdate(bool commit) override;
+
+private:
+  // Copy command of the bootloader, at the start of the RTC user memory
+  struct Command
+  {
+    uint32_t magic;
+    uint32_t size;
+    uint32_t crc;
+  };
+
+  SimWorld &world;
+  std::vector<uint8_t> image;
+  std::vector<uint8_t> staged;
+  uint32_t stagedSize; // Size given to beginUpdate
+  bool staging;
+  uint32_t copies;
+};
+
+class SimDisplay : public DisplayHal
+{
+public:
+  SimDisplay(SimWorld &world);
+
+  void begin(bool lowPower) override;
+  void setStatusLed(bool on) override;
+  void showStatus(const char *text) override;
+  void showInfo(const ScreenValues &values, const ScreenUpdate &update) override;
+
+private:
+  SimWorld &world;
+};
+
+class SimSystem : public SystemHal
+{
+public:
+  SimSystem(SimWorld &world);
+
+  void log(const char *text) override;
+  void getHeapStats(HeapStats &stats) override;
+
+private:
+  SimWorld &world;
+};
+
+#endif
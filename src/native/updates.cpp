@@ -0,0 +1,91 @@
+#include "sim.h"
+
+#include <cstring>
+#include <dirent.h>
+
+#include "../config.h"
+#include "../delta.h"
+
+// Answers as tools/delta.py serve does: the patch from the image of the request, or 204 when
+// there is none (the image is the latest one).
+
+SimUpdateServer::SimUpdateServer(SimWorld &world) : SimHttpServer(world), servedBytes(0)
+{
+}
+
+bool SimUpdateServer::load(const char *dir)
+{
+  DIR *entries = opendir(dir);
+  if (!entries)
+  {
+    return false;
+  }
+
+  bool ok = true;
+  while (struct dirent *entry = readdir(entries))
+  {
+    size_t length = strlen(entry->d_name);
+    if (length < 6 || strcmp(entry->d_name + length - 6, ".patch"))
+    {
+      continue;
+    }
+
+    std::string path = std::string(dir) + "/" + entry->d_name;
+    FILE *file = fopen(path.c_str(), "rb");
+    std::vector<uint8_t> patch;
+    uint8_t buffer[4096];
+    size_t read;
+    while (file && (read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+      patch.insert(patch.end(), buffer, buffer + read);
+    }
+    if (file)
+    {
+      fclose(file);
+    }
+
+    uint32_t header[5];
+    if (patch.size() < DELTA_HEADER_SIZE)
+    {
+      fprintf(stderr, "Bad patch %s\n", path.c_str());
+      ok = false;
+      continue;
+    }
+    memcpy(header, patch.data(), sizeof(header));
+    if (header[0] != DELTA_MAGIC)
+    {
+      fprintf(stderr, "Bad patch %s\n", path.c_str());
+      ok = false;
+      continue;
+    }
+    patches[{header[2], header[1]}] = patch;
+  }
+  closedir(entries);
+
+  return ok;
+}
+
+// Methods --------------------------------------------------------------------
+
+void SimUpdateServer::respond(const std::string &request)
+{
+  char path[128];
+  unsigned long crc;
+  unsigned long size;
+  if (sscanf(request.c_str(), "GET %127s HTTP/1.%*d", path) != 1 || strncmp(path, OTA_PATH "?", strlen(OTA_PATH "?")) ||
+      sscanf(path + strlen(OTA_PATH "?"), "image=%8lx&size=%lu", &crc, &size) != 2)
+  {
+    send("400 Bad Request", "", nullptr, 0);
+    return;
+  }
+
+  auto found = patches.find({(uint32_t)crc, (uint32_t)size});
+  if (found == patches.end())
+  {
+    send("204 No Content", "", nullptr, 0);
+    return;
+  }
+
+  send("200 OK", "", found->second.data(), found->second.size());
+  servedBytes += found->second.size();
+}
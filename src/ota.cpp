@@ -0,0 +1,53 @@
+#include "ota.h"
+
+#include <stdio.h>
+
+#include "config.h"
+#include "delta.h"
+#include "http.h"
+
+static UpdateResult applyPatch(NetworkHal &network, FirmwareHal &firmware, WakeBudget &budget, uint8_t *buffer, size_t bufferSize, uint32_t crc, uint32_t length)
+{
+  // Applied as it comes in, nothing is kept but the staged image
+  DeltaPatch patch(firmware, crc);
+  while (length > 0)
+  {
+    // A block at a time, the flash writes keep pace with the download
+    size_t part = length < bufferSize ? length : bufferSize;
+    part = part < DELTA_BLOCK_SIZE ? part : DELTA_BLOCK_SIZE;
+    if (budget.expired() || !network.readStream(buffer, part, budget.left()) || !patch.feed(buffer, part))
+    {
+      patch.abort();
+      return UPDATE_FAILED;
+    }
+    length -= part;
+  }
+
+  return patch.finish() ? UPDATE_STAGED : UPDATE_FAILED;
+}
+
+UpdateResult checkUpdate(NetworkHal &network, FirmwareHal &firmware, WakeBudget &budget, uint8_t *buffer, size_t bufferSize)
+{
+  uint32_t crc = runningImageCrc(firmware);
+  char target[sizeof(OTA_PATH) + 32];
+  snprintf(target, sizeof(target), "%s?image=%08lx&size=%lu", OTA_PATH, (unsigned long)crc, (unsigned long)firmware.imageSize());
+
+  HttpResponse response;
+  if (!httpGet(network, budget, OTA_HOST, OTA_PORT, target, nullptr, response, (char *)buffer, bufferSize))
+  {
+    return UPDATE_FAILED;
+  }
+
+  UpdateResult result = UPDATE_FAILED;
+  if (response.status == 204 || response.status == 304)
+  {
+    result = UPDATE_LATEST;
+  }
+  else if (response.status == 200 && response.contentLength > 0)
+  {
+    result = applyPatch(network, firmware, budget, buffer, bufferSize, crc, response.contentLength);
+  }
+  network.closeStream();
+
+  return result;
+}
@@ -0,0 +1,23 @@
+#ifndef OTA_H
+#define OTA_H
+
+#include "budget.h"
+#include "compat.h"
+#include "hal.h"
+
+// Update check against the local update server (tools/delta.py serve), plain HTTP:
+//   GET OTA_PATH?image=<CRC-32 of the running image, 8 hex digits>&size=<bytes> HTTP/1.0
+// answered with 200 and the patch to the latest image (see delta.h) with its Content-Length,
+// or 204 when the running image is the latest one.
+enum UpdateResult
+{
+  UPDATE_LATEST,
+  UPDATE_STAGED, // Copied over the running image by the bootloader on the next boot
+  UPDATE_FAILED  // The running image stays
+};
+
+// Download and apply the patch within the current phase of the budget, the buffer holds the
+// parts of the patch as they come in
+UpdateResult checkUpdate(NetworkHal &network, FirmwareHal &firmware, WakeBudget &budget, uint8_t *buffer, size_t bufferSize);
+
+#endif
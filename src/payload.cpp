@@ -0,0 +1,402 @@
+#include "payload.h"
+
+#include <math.h>
+
+// Graphite -------------------------------------------------------------------
+
+// Start of the entry of each series, up to its interval
+#define GRAPHITE_HEAD(id, name, unit, type, value, min, max, series, perProbe) \
+  static const char GRAPHITE_HEAD_##id[] PROGMEM = "{\"name\":\"" name "\",\"interval\":";
+METRIC_TABLE(GRAPHITE_HEAD)
+#undef GRAPHITE_HEAD
+
+#define GRAPHITE_HEAD(id, name, unit, type, value, min, max, series, perProbe) GRAPHITE_HEAD_##id,
+static const char *const GRAPHITE_HEADS[METRIC_COUNT] PROGMEM = {METRIC_TABLE(GRAPHITE_HEAD)};
+#undef GRAPHITE_HEAD
+
+static const char GRAPHITE_TRACE_SETUP[] PROGMEM = "setup";
+static const char GRAPHITE_TRACE_SENSORS[] PROGMEM = "sensors";
+static const char GRAPHITE_TRACE_WIFI[] PROGMEM = "wifi";
+static const char GRAPHITE_TRACE_NTP[] PROGMEM = "ntp";
+static const char GRAPHITE_TRACE_GRAPHITE[] PROGMEM = "graphite";
+static const char GRAPHITE_TRACE_PROMETHEUS[] PROGMEM = "prometheus";
+static const char GRAPHITE_TRACE_LOKI[] PROGMEM = "loki";
+static const char GRAPHITE_TRACE_RELAY[] PROGMEM = "relay";
+static const char GRAPHITE_TRACE_MQTT[] PROGMEM = "mqtt";
+static const char GRAPHITE_TRACE_DISPLAY[] PROGMEM = "display";
+
+static const char *const GRAPHITE_TRACE_PHASES[TRACE_PHASE_COUNT] PROGMEM = {
+    GRAPHITE_TRACE_SETUP,
+    GRAPHITE_TRACE_SENSORS,
+    GRAPHITE_TRACE_WIFI,
+    GRAPHITE_TRACE_NTP,
+    GRAPHITE_TRACE_GRAPHITE,
+    GRAPHITE_TRACE_PROMETHEUS,
+    GRAPHITE_TRACE_LOKI,
+    GRAPHITE_TRACE_RELAY,
+    GRAPHITE_TRACE_MQTT,
+    GRAPHITE_TRACE_DISPLAY};
+
+static const char GRAPHITE_TRACE_PREFIX[] PROGMEM = "trace.";
+static const char GRAPHITE_TRACE_AWAKE[] PROGMEM = "awake_ms";
+static const char GRAPHITE_TRACE_OVERRUNS[] PROGMEM = "overruns";
+static const char GRAPHITE_TRACE_MS[] PROGMEM = ".ms";
+static const char GRAPHITE_TRACE_FREE_HEAP[] PROGMEM = ".free_heap";
+static const char GRAPHITE_TRACE_MAX_FREE_BLOCK[] PROGMEM = ".max_free_block";
+static const char GRAPHITE_TRACE_FRAGMENTATION[] PROGMEM = ".fragmentation";
+
+static const char GRAPHITE_ENTRY_NAME[] PROGMEM = "{\"name\":\"";
+static const char GRAPHITE_ENTRY_INTERVAL[] PROGMEM = "\",\"interval\":";
+static const char GRAPHITE_ENTRY_VALUE[] PROGMEM = ",\"value\":";
+static const char GRAPHITE_ENTRY_TIME[] PROGMEM = ",\"mtype\":\"gauge\",\"time\":";
+static const char GRAPHITE_ENTRY_TAGS[] PROGMEM = ",\"tags\":[";
+static const char GRAPHITE_ENTRY_PLANT_TAG[] PROGMEM = "\"plant_id=";
+static const char GRAPHITE_ENTRY_PROBE_TAG[] PROGMEM = "\"probe=";
+
+// Loki -----------------------------------------------------------------------
+
+static const char LOKI_HEAD[] PROGMEM = "{\"streams\": [";
+static const char LOKI_STREAM_HEAD[] PROGMEM = "{ \"stream\": { \"plant_id\": \"";
+static const char LOKI_HEAD_VALUES[] PROGMEM = "\", \"monitoring_type\": \"plant\"}, \"values\": [ ";
+static const char LOKI_VALUE_TS[] PROGMEM = "[ \"";
+static const char LOKI_VALUE_TS_END[] PROGMEM = "000000000\", \"";
+
+// Key of each metric in the line
+#define LOKI_KEY(id, name, unit, type, value, min, max, series, perProbe) static const char LOKI_KEY_##id[] PROGMEM = name "=";
+METRIC_TABLE(LOKI_KEY)
+#undef LOKI_KEY
+
+#define LOKI_KEY(id, name, unit, type, value, min, max, series, perProbe) LOKI_KEY_##id,
+static const char *const LOKI_KEYS[METRIC_COUNT] PROGMEM = {METRIC_TABLE(LOKI_KEY)};
+#undef LOKI_KEY
+
+static const char LOKI_VALUE_MSG[] PROGMEM = " msg='";
+static const char LOKI_VALUE_END[] PROGMEM = "'\" ]";
+static const char LOKI_STREAM_TAIL[] PROGMEM = " ] }";
+static const char LOKI_TAIL[] PROGMEM = "]}";
+
+// Writer ---------------------------------------------------------------------
+
+PayloadWriter::PayloadWriter(char *buffer, size_t size) : buffer(buffer), size(size), len(0), overflowed(false)
+{
+  if (size > 0)
+  {
+    buffer[0] = '\0';
+  }
+}
+
+void PayloadWriter::write(char c)
+{
+  // Always keep room for the terminator
+  if (len + 1 >= size)
+  {
+    overflowed = true;
+    return;
+  }
+
+  buffer[len++] = c;
+  buffer[len] = '\0';
+}
+
+void PayloadWriter::write(const char *str)
+{
+  while (*str)
+  {
+    write(*str++);
+  }
+}
+
+void PayloadWriter::write_P(PGM_P str)
+{
+  size_t strLen = strlen_P(str);
+  if (len + strLen >= size)
+  {
+    overflowed = true;
+    return;
+  }
+
+  memcpy_P(buffer + len, str, strLen);
+  len += strLen;
+  buffer[len] = '\0';
+}
+
+void PayloadWriter::writeUInt(unsigned long value)
+{
+  // unsigned long is 64 bits on the hosts of the tests
+  char digits[20];
+  uint8_t n = 0;
+  do
+  {
+    digits[n++] = '0' + value % 10;
+    value /= 10;
+  } while (value > 0);
+
+  while (n > 0)
+  {
+    write(digits[--n]);
+  }
+}
+
+void PayloadWriter::writeInt(long value)
+{
+  if (value < 0)
+  {
+    write('-');
+    writeUInt(0UL - (unsigned long)value);
+  }
+  else
+  {
+    writeUInt(value);
+  }
+}
+
+void PayloadWriter::writeFloat(float value)
+{
+  if (isnan(value))
+  {
+    write("nan");
+    return;
+  }
+  if (isinf(value))
+  {
+    write("inf");
+    return;
+  }
+
+  // Same steps as dtostrf(value, 4, 2) so the output matches String(float)
+  double number = value;
+  if (number < 0.0)
+  {
+    write('-');
+    number = -number;
+  }
+  number += 0.005;
+
+  double tenpow = 1.0;
+  uint8_t digits = 1;
+  while (number >= 10.0 * tenpow)
+  {
+    tenpow *= 10.0;
+    digits++;
+  }
+  number /= tenpow;
+
+  digits += 2;
+  while (digits-- > 0)
+  {
+    uint8_t digit = (uint8_t)number;
+    if (digit > 9)
+    {
+      digit = 9;
+    }
+    write('0' + digit);
+    if (digits == 2)
+    {
+      write('.');
+    }
+    number -= digit;
+    number *= 10.0;
+  }
+}
+
+// Series ---------------------------------------------------------------------
+
+PGM_P tracePhaseName(uint8_t phase)
+{
+  return (PGM_P)pgm_read_ptr(&GRAPHITE_TRACE_PHASES[phase]);
+}
+
+// Payloads -------------------------------------------------------------------
+
+static void writeMetricValue(PayloadWriter &w, const Sample &s, MetricId metric, uint8_t probe)
+{
+  float value = metricValue(s, metric, probe);
+  if (metricType(metric) == METRIC_INT)
+  {
+    w.writeInt((long)value);
+  }
+  else
+  {
+    w.writeFloat(value);
+  }
+}
+
+// Closes an entry, tagged with the plant if not null and with the probe if not negative
+static void writeEntryEnd(PayloadWriter &w, const char *plantTag, int8_t probe)
+{
+  if (plantTag || probe >= 0)
+  {
+    w.write_P(GRAPHITE_ENTRY_TAGS);
+    if (plantTag)
+    {
+      w.write_P(GRAPHITE_ENTRY_PLANT_TAG);
+      w.write(plantTag);
+      w.write('"');
+    }
+    if (probe >= 0)
+    {
+      if (plantTag)
+      {
+        w.write(',');
+      }
+      w.write_P(GRAPHITE_ENTRY_PROBE_TAG);
+      w.writeUInt(probe);
+      w.write('"');
+    }
+    w.write(']');
+  }
+  w.write('}');
+}
+
+// Entry of a trace series, the name is "trace." + phase + suffix
+static void writeTraceEntry(PayloadWriter &w, PGM_P phase, PGM_P suffix, unsigned long value, unsigned long interval, unsigned long ts, const char *plantTag)
+{
+  w.write_P(GRAPHITE_ENTRY_NAME);
+  w.write_P(GRAPHITE_TRACE_PREFIX);
+  w.write_P(phase);
+  w.write_P(suffix);
+  w.write_P(GRAPHITE_ENTRY_INTERVAL);
+  w.writeUInt(interval);
+  w.write_P(GRAPHITE_ENTRY_VALUE);
+  w.writeUInt(value);
+  w.write_P(GRAPHITE_ENTRY_TIME);
+  w.writeUInt(ts);
+  writeEntryEnd(w, plantTag, -1);
+}
+
+static void writeTrace(PayloadWriter &w, const Trace &trace, unsigned long interval, const char *plantTag)
+{
+  writeTraceEntry(w, GRAPHITE_TRACE_AWAKE, PSTR(""), trace.awakeMs, interval, trace.ts, plantTag);
+  w.write(',');
+  writeTraceEntry(w, GRAPHITE_TRACE_OVERRUNS, PSTR(""), trace.overruns, interval, trace.ts, plantTag);
+
+  for (uint8_t p = 0; p < TRACE_PHASE_COUNT; p++)
+  {
+    if (!traceHasPhase(trace, (TracePhase)p))
+    {
+      continue;
+    }
+
+    PGM_P phase = tracePhaseName(p);
+    w.write(',');
+    writeTraceEntry(w, phase, GRAPHITE_TRACE_MS, trace.phaseMs[p], interval, trace.ts, plantTag);
+    w.write(',');
+    writeTraceEntry(w, phase, GRAPHITE_TRACE_FREE_HEAP, trace.freeHeap[p], interval, trace.ts, plantTag);
+    w.write(',');
+    writeTraceEntry(w, phase, GRAPHITE_TRACE_MAX_FREE_BLOCK, trace.maxFreeBlock[p], interval, trace.ts, plantTag);
+    w.write(',');
+    writeTraceEntry(w, phase, GRAPHITE_TRACE_FRAGMENTATION, trace.fragmentation[p], interval, trace.ts, plantTag);
+  }
+}
+
+void writeGraphiteEntries(PayloadWriter &w, const Sample *samples, size_t count, const Trace *trace, const char *plantTag)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    const Sample &s = samples[i];
+    for (uint8_t m = 0; m < METRIC_SERIES_COUNT; m++)
+    {
+      MetricId metric = seriesMetric(m);
+      uint8_t probes = metricProbes(s, metric);
+      for (uint8_t p = 0; p < probes; p++)
+      {
+        if (i > 0 || m > 0 || p > 0)
+        {
+          w.write(',');
+        }
+        w.write_P((PGM_P)pgm_read_ptr(&GRAPHITE_HEADS[metric]));
+        w.writeUInt(s.interval);
+        w.write_P(GRAPHITE_ENTRY_VALUE);
+        writeMetricValue(w, s, metric, p);
+        w.write_P(GRAPHITE_ENTRY_TIME);
+        w.writeUInt(s.ts);
+        writeEntryEnd(w, plantTag, probes > 1 ? p : -1);
+      }
+    }
+  }
+  if (trace)
+  {
+    if (count > 0)
+    {
+      w.write(',');
+    }
+    writeTrace(w, *trace, count > 0 ? samples[count - 1].interval : 0, plantTag);
+  }
+}
+
+size_t buildGraphitePayload(char *buffer, size_t size, const Sample *samples, size_t count, const Trace *trace)
+{
+  PayloadWriter w(buffer, size);
+
+  w.write('[');
+  writeGraphiteEntries(w, samples, count, trace, nullptr);
+  w.write(']');
+
+  return w.overflow() ? 0 : w.length();
+}
+
+void writeLokiHead(PayloadWriter &w)
+{
+  w.write_P(LOKI_HEAD);
+}
+
+void writeLokiStream(PayloadWriter &w, const Sample *samples, size_t count, const char *sensorId, const char *message)
+{
+  w.write_P(LOKI_STREAM_HEAD);
+  w.write(sensorId);
+  w.write_P(LOKI_HEAD_VALUES);
+  for (size_t i = 0; i < count; i++)
+  {
+    const Sample &s = samples[i];
+    if (i > 0)
+    {
+      w.write(", ");
+    }
+    w.write_P(LOKI_VALUE_TS);
+    w.writeUInt(s.ts);
+    w.write_P(LOKI_VALUE_TS_END);
+    for (uint8_t m = 0; m < METRIC_COUNT; m++)
+    {
+      uint8_t probes = metricProbes(s, (MetricId)m);
+      for (uint8_t p = 0; p < probes; p++)
+      {
+        if (m > 0 || p > 0)
+        {
+          w.write(' ');
+        }
+        if (probes > 1)
+        {
+          w.write_P(metricName((MetricId)m));
+          w.write('_');
+          w.writeUInt(p);
+          w.write('=');
+        }
+        else
+        {
+          w.write_P((PGM_P)pgm_read_ptr(&LOKI_KEYS[m]));
+        }
+        writeMetricValue(w, s, (MetricId)m, p);
+      }
+    }
+    w.write_P(LOKI_VALUE_MSG);
+    w.write(message);
+    w.write_P(LOKI_VALUE_END);
+  }
+  w.write_P(LOKI_STREAM_TAIL);
+}
+
+void writeLokiTail(PayloadWriter &w)
+{
+  w.write_P(LOKI_TAIL);
+}
+
+size_t buildLokiPayload(char *buffer, size_t size, const Sample *samples, size_t count, const char *sensorId, const char *message)
+{
+  PayloadWriter w(buffer, size);
+
+  writeLokiHead(w);
+  writeLokiStream(w, samples, count, sensorId, message);
+  writeLokiTail(w);
+
+  return w.overflow() ? 0 : w.length();
+}
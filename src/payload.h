@@ -0,0 +1,66 @@
+#ifndef PAYLOAD_H
+#define PAYLOAD_H
+
+#include "compat.h"
+#include "metrics.h"
+#include "sample.h"
+#include "trace.h"
+
+#define GRAPHITE_TRACE_METRIC_COUNT (2 + TRACE_PHASE_COUNT * 4)
+
+// Upper bound of the payload size for the given number of samples, with the given number of soil
+// probes each. The entries labelled with their probe are short enough to fit in the bound too.
+#define GRAPHITE_PAYLOAD_SIZE(count, probes, trace) \
+  (2 + ((count) * METRIC_SAMPLE_SERIES_COUNT(probes) + ((trace) ? GRAPHITE_TRACE_METRIC_COUNT : 0)) * 112)
+#define LOKI_PAYLOAD_SIZE(count, probes, msgLen) (128 + (count) * (LOKI_LINE_SIZE(probes) + (msgLen)))
+// Upper bound of a Loki line without the message: timestamp and quotes, then each key and value.
+// With several probes, their keys end with _<probe>.
+#define LOKI_LINE_SIZE(probes) (40 METRIC_TABLE(LOKI_LINE_METRIC_SIZE) + ((probes) - 1) * (0 METRIC_TABLE(LOKI_LINE_PROBE_SIZE)))
+#define LOKI_LINE_METRIC_SIZE(id, name, unit, type, value, min, max, series, perProbe) +sizeof(name "=") + 12 + ((perProbe) ? 2 : 0)
+#define LOKI_LINE_PROBE_SIZE(id, name, unit, type, value, min, max, series, perProbe) +((perProbe) ? sizeof(name "_0=") + 12 : 0)
+// Extra size of a Graphite entry tagged with the plant id
+#define GRAPHITE_TAG_SIZE(idLen) (24 + (idLen))
+
+// Appends text to a fixed buffer without any heap allocation.
+// Writes past the end of the buffer are dropped and flag an overflow.
+class PayloadWriter
+{
+public:
+  PayloadWriter(char *buffer, size_t size);
+
+  void write(char c);
+  void write(const char *str);
+  void write_P(PGM_P str);
+  void writeUInt(unsigned long value);
+  void writeInt(long value);
+  // Same format as String(float), i.e. 2 decimal places
+  void writeFloat(float value);
+
+  size_t length() const { return len; }
+  bool overflow() const { return overflowed; }
+
+private:
+  char *buffer;
+  size_t size;
+  size_t len;
+  bool overflowed;
+};
+
+PGM_P tracePhaseName(uint8_t phase);
+
+// Build the Grafana hosted metrics (Graphite) json payload, with the trace series if not null.
+// The trace series use the interval of the newest sample. Return the payload length, 0 if it does not fit.
+size_t buildGraphitePayload(char *buffer, size_t size, const Sample *samples, size_t count, const Trace *trace);
+// Build the Loki push json payload. Return the payload length, 0 if it does not fit.
+size_t buildLokiPayload(char *buffer, size_t size, const Sample *samples, size_t count, const char *sensorId, const char *message);
+
+// Building blocks of the payloads, to batch several plants in one (relay)
+// Graphite entries without the enclosing brackets, tagged with plant_id if plantTag is not null.
+// With several probes, the entries of their values are tagged with probe too.
+void writeGraphiteEntries(PayloadWriter &w, const Sample *samples, size_t count, const Trace *trace, const char *plantTag);
+// Loki streams, separated by ", " between the head and the tail
+void writeLokiHead(PayloadWriter &w);
+void writeLokiStream(PayloadWriter &w, const Sample *samples, size_t count, const char *sensorId, const char *message);
+void writeLokiTail(PayloadWriter &w);
+
+#endif
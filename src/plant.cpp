@@ -0,0 +1,669 @@
+#include "plant.h"
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "crc32.h"
+
+NodeConfig defaultNodeConfig()
+{
+  NodeConfig config = {
+      SENSOR_ID,
+      SAMPLE_INTERVAL_SEC,
+      SCHED_MIN_INTERVAL_SEC,
+      SCHED_MAX_INTERVAL_SEC,
+      BATCH_UPLOAD_EVERY,
+      (EXPORT_GRAPHITE ? EXPORTER_BIT(EXPORTER_GRAPHITE) : 0) |
+          (EXPORT_PROMETHEUS ? EXPORTER_BIT(EXPORTER_PROMETHEUS) : 0) |
+          (EXPORT_LOKI ? EXPORTER_BIT(EXPORTER_LOKI) : 0) |
+          (EXPORT_RELAY ? EXPORTER_BIT(EXPORTER_RELAY) : 0) |
+          (EXPORT_MQTT ? EXPORTER_BIT(EXPORTER_MQTT) : 0),
+      EINK_FULL_REFRESH_EVERY,
+      OTA_ENABLE ? OTA_CHECK_SEC : 0,
+      CONFIG_ENABLE ? CONFIG_CHECK_WAKES : 0,
+      DISPLAY_LOW_POWER,
+      {DEADBAND_HEARTBEAT_SEC, DEADBAND_TEMP, DEADBAND_HUMIDITY, DEADBAND_SOIL_MOISTURE, DEADBAND_BATTERY_VOLTS,
+       DEADBAND_SOLAR_PANEL_VOLTS},
+      {}};
+
+  return config;
+}
+
+PlantNode::PlantNode(const Hal &hal, const NodeConfig &config)
+    : hal(hal), config(config), cycleTrace(), phaseStartUs(0), budget(this->hal.clock, WAKE_BUDGET_MS),
+      sensorsReady(false), exportFailed(false),
+      exporters({this->hal.network, this->hal.system, budget, this->config.sensorId, payloadBuffer, sizeof(payloadBuffer)}),
+      queue(this->hal.storage, rtcState.queue, {sizeof(PackedSample), QUEUE_SEGMENTS, QUEUE_SEGMENT_RECORDS}),
+      configCache()
+{
+}
+
+// Methods --------------------------------------------------------------------
+
+void PlantNode::setup()
+{
+  // Sensors ------
+  // Without them the wake still uploads the buffered samples
+  sensorsReady = hal.sensors.begin();
+  if (!sensorsReady)
+  {
+    log("Failed to initialize ADS!");
+  }
+
+  // RTC ----------
+  bool rtcValid = loadRtcState();
+
+  // Queue --------
+  // Its positions were lost with the RTC memory, the backlog is still in flash
+  if (QUEUE_ENABLE && !rtcValid)
+  {
+    queue.recover();
+    log("Backlog of %lu samples in flash", (unsigned long)queue.size());
+  }
+
+  // Config -------
+  // The settings of the last document, the only config I/O of an ordinary wake
+  if (config.configEvery > 0 && loadConfigCache(hal.storage, configCache))
+  {
+    applyConfig(configCache.config, config);
+  }
+
+  // Display ------
+  // After the config, it may turn the low power on
+  hal.display.begin(config.displayLowPower);
+
+  // Network ------
+  // Keeps the radio off until there is something to upload
+  hal.network.begin(rtcState.net, !rtcValid);
+
+  // Time ---------
+  // The elapsed time is only known when waking up from the deep sleep timer
+  if (hal.sleep.timerWake())
+  {
+    timeWake(rtcState.time);
+  }
+  else
+  {
+    timeReset(rtcState.time);
+  }
+
+  // Everything since boot
+  traceEnd(TRACE_SETUP);
+}
+
+void PlantNode::loop()
+{
+  hal.display.setStatusLed(true);
+
+  bool sync = timeNeedsSync(rtcState.time, hal.clock.millis(), TIME_RESYNC_SEC, TIME_MAX_ERROR_MS);
+  uint32_t now = rtcState.time.valid ? timeNow(rtcState.time, hal.clock.millis()) : 0;
+
+  // After failed uploads the radio stays off for a few wakes
+  bool online = backoffReady(rtcState.backoff);
+  if (!online)
+  {
+    log("Upload backed off for %u more wakes", rtcState.backoff.wait);
+  }
+
+  // When an upload is certain, associate while the sensors convert
+  if (online && (sync || (deadbandExpired(rtcState.deadband, now, config.deadband.heartbeatSec) && needsUpload())))
+  {
+    hal.network.startConnect();
+  }
+
+  // Read sensors
+  log("Collect data...");
+  traceStart();
+  Sample sample = {};
+  bool measured = measure(sample);
+  traceEnd(TRACE_SENSORS);
+
+  // Check if values are valid
+  bool valid = measured && metricsValid(sample);
+  sample.interval = scheduleNext(sample, valid);
+
+  // Only send samples that moved beyond the deadbands, the radio stays off otherwise
+  bool send = valid && deadbandChanged(rtcState.deadband, sample, now, config.deadband);
+  bool update = online && updateDue(now, sample.interval);
+  bool configure = online && configDue();
+  bool upload = online && (sync || update || configure || (send && needsUpload()));
+  bool connected = false;
+  bool synced = true;
+  bool staged = false;
+
+  // Cheap to send if the radio is on anyway
+  send = valid && (send || upload);
+
+  if (upload)
+  {
+    traceStart();
+    budget.startPhase(BUDGET_WIFI_MS);
+    connected = hal.network.connect(budget.left());
+    if (connected && !config.displayLowPower)
+    {
+      hal.display.showStatus("WiFi connected!");
+    }
+    traceEnd(TRACE_WIFI);
+
+    // Update time via NTP only when the estimate is too old or uncertain
+    if (connected && sync)
+    {
+      traceStart();
+      budget.startPhase(BUDGET_NTP_MS);
+      synced = syncTime();
+      traceEnd(TRACE_NTP);
+    }
+  }
+
+  // Get current timestamp
+  sample.ts = timeNow(rtcState.time, hal.clock.millis());
+  sample.timeError = timeError(rtcState.time) / 1000.0;
+  if (rtcState.wakes < UINT8_MAX)
+  {
+    rtcState.wakes++;
+  }
+  if (rtcState.configWakes < UINT8_MAX)
+  {
+    rtcState.configWakes++;
+  }
+
+  if (send && !rtcState.time.valid)
+  {
+    // Not suppressed: it changed, but cannot be timestamped
+    log("No valid time, sample not sent");
+  }
+  else if (send)
+  {
+    sample.suppressed = rtcState.deadband.suppressed;
+    deadbandSent(rtcState.deadband, sample);
+    pushSample(sample);
+  }
+  else if (valid)
+  {
+    log("Sample within the deadbands, not sent");
+    deadbandSuppressed(rtcState.deadband);
+  }
+
+  if (upload)
+  {
+    if (connected)
+    {
+      budget.startPhase(BUDGET_UPLOAD_MS);
+
+      // Oldest first, the backends may refuse samples older than the last ones
+      bool drained = drainQueue();
+
+      // Send all buffered samples at once
+      Sample samples[BATCH_MAX_SAMPLES];
+      size_t count = getBufferedSamples(samples);
+      if (drained && count > 0 && exportSamples(samples, count, true))
+      {
+        rtcState.head = 0;
+        rtcState.count = 0;
+      }
+    }
+
+    // A failed check waits for the next one too, the radio is not turned on for it meanwhile
+    if (connected && configure && budget.fits(BUDGET_CONFIG_MS))
+    {
+      budget.startPhase(BUDGET_CONFIG_MS);
+      ConfigResult result = checkConfig(hal.network, budget, config.sensorId, configCache, payloadBuffer, sizeof(payloadBuffer));
+      if (result == CONFIG_CHANGED && !saveConfigCache(hal.storage, configCache))
+      {
+        log("Failed to cache the config");
+      }
+      rtcState.configWakes = 0;
+      log(result == CONFIG_UNCHANGED ? "Config unchanged" : result == CONFIG_CHANGED ? "New config, from the next wake" : "Config check failed");
+    }
+
+    // Takes a while, only once the samples are out
+    if (connected && update && budget.fits(BUDGET_UPDATE_MS))
+    {
+      budget.startPhase(BUDGET_UPDATE_MS);
+      UpdateResult result = checkUpdate(hal.network, hal.firmware, budget, (uint8_t *)payloadBuffer, sizeof(payloadBuffer));
+      staged = result == UPDATE_STAGED;
+      log(result == UPDATE_LATEST ? "Firmware up to date" : staged ? "Firmware update staged" : "Firmware update failed");
+    }
+
+    // A failed time sync backs off as well, the NTP servers are as far as the backends
+    if (connected && synced && !exportFailed)
+    {
+      backoffSucceeded(rtcState.backoff);
+    }
+    else
+    {
+      backoffFailed(rtcState.backoff, BACKOFF_MAX_WAKES);
+      log("Upload failed, next attempt in %u wakes", rtcState.backoff.wait + 1);
+    }
+    rtcState.wakes = 0;
+    hal.network.disconnect();
+  }
+
+  // Keep them in flash before the next sample overwrites the oldest
+  if (QUEUE_ENABLE && rtcState.count >= BATCH_MAX_SAMPLES)
+  {
+    spillSamples();
+  }
+
+  hal.display.setStatusLed(false);
+
+  // Print on display, only what changed since the last wake. The refresh cannot be cut
+  // short, it is skipped when it does not fit in the budget.
+  if (budget.fits(BUDGET_DISPLAY_MS))
+  {
+    traceStart();
+    ScreenValues screen = screenValues(sample, sample.ts + sample.interval);
+    ScreenUpdate update = screenUpdate(rtcState.screen, screen, config.displayFullEvery);
+    hal.display.showInfo(screen, update);
+    traceEnd(TRACE_DISPLAY);
+  }
+
+  // Reported with the trace of the next upload
+  if (budget.exhausted())
+  {
+    log("Wake budget spent");
+    cycleTrace.overruns = 1;
+  }
+
+  traceCycle(cycleTrace, sample.ts, hal.clock.millis());
+  traceMerge(rtcState.trace, cycleTrace);
+
+  timeSleep(rtcState.time, hal.clock.millis(), sample.interval * 1000);
+  if (staged)
+  {
+    // The bootloader takes the RTC memory for the copy of the new image, the samples are
+    // kept in flash and the rest of the state is reset on the next boot
+    if (QUEUE_ENABLE && rtcState.count > 0)
+    {
+      spillSamples();
+    }
+  }
+  else
+  {
+    saveRtcState();
+  }
+
+  // Put ESP in deep sleep
+  log("Go in deep sleep for %lu sec", (unsigned long)sample.interval);
+  hal.sleep.deepSleep((uint64_t)sample.interval * 1000000);
+}
+
+// Measures -------------------------------------------------------------------
+
+bool PlantNode::measure(Sample &sample)
+{
+  static const FilterConfig soilFilter = {ADC_SAMPLES, ADC_TRIM, ADC_IIR_SHIFT_SOIL};
+  static const FilterConfig batteryFilter = {ADC_SAMPLES, ADC_TRIM, ADC_IIR_SHIFT_BATTERY};
+  static const FilterConfig solarFilter = {ADC_SAMPLES, ADC_TRIM, ADC_IIR_SHIFT_SOLAR};
+
+  if (!sensorsReady)
+  {
+    return false;
+  }
+
+  // The soil probes, then the battery and the solar panel
+  uint8_t inputs[FILTER_CHANNELS];
+  FilterConfig filters[FILTER_CHANNELS];
+  for (uint8_t p = 0; p < SOIL_PROBE_COUNT; p++)
+  {
+    inputs[p] = SOIL_PROBE_TABLE[p].input;
+    filters[p] = soilFilter;
+  }
+  inputs[SOIL_PROBE_COUNT] = BATTERY_VOLT_PIN;
+  filters[SOIL_PROBE_COUNT] = batteryFilter;
+  inputs[SOIL_PROBE_COUNT + 1] = SOLAR_PANEL_VOLT_PIN;
+  filters[SOIL_PROBE_COUNT + 1] = solarFilter;
+
+  Acquisition acquisition(hal.sensors, inputs, filters, FILTER_CHANNELS);
+  acquisition.start();
+
+  // Let the radio work while waiting
+  budget.startPhase(SENSORS_TIMEOUT_MS);
+  while (!acquisition.poll())
+  {
+    if (budget.expired())
+    {
+      log("Sensors timeout!");
+      return false;
+    }
+    hal.clock.delay(1);
+  }
+
+  int16_t raw[FILTER_CHANNELS];
+  for (uint8_t i = 0; i < FILTER_CHANNELS; i++)
+  {
+    raw[i] = filterIir(rtcState.filter, i, acquisition.adc(i), filters[i].iirShift);
+  }
+
+  sample.air = acquisition.air();
+  for (uint8_t p = 0; p < SOIL_PROBE_COUNT; p++)
+  {
+    sample.soil[p] = measureSoilMoisture(p, soilTrimmed(p, config.soilTrims[p], raw[p]));
+  }
+  sample.probes = SOIL_PROBE_COUNT;
+  sample.battery = measureBatteryVolt(raw[SOIL_PROBE_COUNT]);
+  sample.solarPanelVolt = measureSolarPanelVolt(raw[SOIL_PROBE_COUNT + 1]);
+
+  return true;
+}
+
+ValPerc PlantNode::measureSoilMoisture(uint8_t probe, int16_t raw)
+{
+  ValPerc res = {
+      raw,
+      soilPercentage(probe, raw)};
+
+  return res;
+}
+
+ValPercFloat PlantNode::measureBatteryVolt(int16_t raw)
+{
+  int32_t milliVolts = hal.sensors.adcToMilliVolts(raw);
+
+  ValPercFloat res = {
+      milliVolts / 1000.0f,
+      batteryPercentage(milliVolts)};
+
+  return res;
+}
+
+float PlantNode::measureSolarPanelVolt(int16_t raw)
+{
+  return hal.sensors.adcToMilliVolts(raw) / 1000.0f;
+}
+
+// Scheduler ------------------------------------------------------------------
+
+uint32_t PlantNode::scheduleNext(const Sample &sample, bool valid)
+{
+  if (!valid)
+  {
+    // The rates would be computed over a longer time than recorded
+    scheduleReset(rtcState.schedule);
+    return config.sampleIntervalSec;
+  }
+
+  uint32_t interval = scheduleInterval(rtcState.schedule, sample, config.sampleIntervalSec, config.minIntervalSec, config.maxIntervalSec);
+  log("Next sample in %lu sec (battery: %.0f%%, solar: %.2fV)", (unsigned long)interval, sample.battery.percentage, sample.solarPanelVolt);
+
+  return interval;
+}
+
+// RTC memory -----------------------------------------------------------------
+
+bool PlantNode::loadRtcState()
+{
+  hal.sleep.readRtc(&rtcState, sizeof(rtcState));
+
+  uint32_t crc = crc32((uint8_t *)&rtcState + sizeof(rtcState.crc), sizeof(rtcState) - sizeof(rtcState.crc));
+  if (rtcState.magic == RTC_STATE_MAGIC && rtcState.crc == crc && rtcState.count <= BATCH_MAX_SAMPLES && rtcState.head < BATCH_MAX_SAMPLES)
+  {
+    return true;
+  }
+
+  log("RTC state not valid, reset it");
+  memset(&rtcState, 0, sizeof(rtcState));
+  rtcState.magic = RTC_STATE_MAGIC;
+  rtcState.configWakes = UINT8_MAX; // Check the config on the first wake online
+  return false;
+}
+
+void PlantNode::saveRtcState()
+{
+  rtcState.crc = crc32((uint8_t *)&rtcState + sizeof(rtcState.crc), sizeof(rtcState) - sizeof(rtcState.crc));
+  hal.sleep.writeRtc(&rtcState, sizeof(rtcState));
+}
+
+bool PlantNode::needsUpload()
+{
+  return rtcState.wakes + 1 >= config.uploadEvery || rtcState.count + 1 >= BATCH_MAX_SAMPLES;
+}
+
+// Once per update check period, at an offset of the sensor id so that the sensors do not all
+// download at once: due in the wake before the next one crosses the offset
+bool PlantNode::updateDue(uint32_t now, uint32_t interval)
+{
+  if (config.updateCheckSec == 0 || !rtcState.time.valid)
+  {
+    return false;
+  }
+
+  uint32_t offset = crc32((const uint8_t *)config.sensorId, strlen(config.sensorId)) % config.updateCheckSec;
+  return (now + offset) / config.updateCheckSec != (now + interval + offset) / config.updateCheckSec;
+}
+
+bool PlantNode::configDue()
+{
+  return config.configEvery > 0 && rtcState.configWakes + 1 >= config.configEvery;
+}
+
+void PlantNode::pushSample(const Sample &sample)
+{
+  uint8_t index = (rtcState.head + rtcState.count) % BATCH_MAX_SAMPLES;
+  rtcState.samples[index] = packSample(sample);
+
+  if (rtcState.count < BATCH_MAX_SAMPLES)
+  {
+    rtcState.count++;
+  }
+  else
+  {
+    // Ring is full, drop the oldest sample
+    rtcState.head = (rtcState.head + 1) % BATCH_MAX_SAMPLES;
+  }
+}
+
+size_t PlantNode::getBufferedSamples(Sample *out)
+{
+  for (uint8_t i = 0; i < rtcState.count; i++)
+  {
+    out[i] = unpackSample(rtcState.samples[(rtcState.head + i) % BATCH_MAX_SAMPLES]);
+  }
+
+  return rtcState.count;
+}
+
+PackedSample packSample(const Sample &sample)
+{
+  PackedSample packed = {
+      {(uint16_t)sample.ts, (uint16_t)(sample.ts >> 16)},
+      (int16_t)lroundf(sample.air.temp * 100),
+      (uint16_t)lroundf(sample.air.humidity * 100),
+      {},
+      (uint8_t)(sample.suppressed < UINT8_MAX ? sample.suppressed : UINT8_MAX),
+      (uint8_t)(sample.timeError < 25.5 ? lroundf(sample.timeError * 10) : 255),
+      (uint16_t)lroundf(sample.battery.raw * 1000),
+      (uint16_t)(sample.interval < UINT16_MAX ? sample.interval : UINT16_MAX),
+      (uint16_t)lroundf(sample.solarPanelVolt * 1000)};
+  for (uint8_t p = 0; p < SOIL_PROBE_COUNT; p++)
+  {
+    packed.soilRaw[p] = sample.soil[p].raw;
+  }
+
+  return packed;
+}
+
+Sample unpackSample(const PackedSample &packed)
+{
+  float temp = packed.temp / 100.0f;
+  float humidity = packed.humidity / 100.0f;
+
+  Sample sample = {
+      packed.ts[0] | (uint32_t)packed.ts[1] << 16,
+      {temp, humidity, dewPoint(temp, humidity)},
+      {},
+      SOIL_PROBE_COUNT,
+      {packed.batteryMilliVolts / 1000.0f, batteryPercentage(packed.batteryMilliVolts)},
+      packed.solarPanelMilliVolts / 1000.0f,
+      packed.timeError / 10.0f,
+      packed.interval,
+      packed.suppressed};
+  for (uint8_t p = 0; p < SOIL_PROBE_COUNT; p++)
+  {
+    sample.soil[p] = {packed.soilRaw[p], soilPercentage(p, packed.soilRaw[p])};
+  }
+
+  return sample;
+}
+
+// Flash queue ----------------------------------------------------------------
+
+void PlantNode::spillSamples()
+{
+  PackedSample packed[BATCH_MAX_SAMPLES];
+  for (uint8_t i = 0; i < rtcState.count; i++)
+  {
+    packed[i] = rtcState.samples[(rtcState.head + i) % BATCH_MAX_SAMPLES];
+  }
+
+  uint32_t dropped = queue.dropped();
+  if (!queue.push((const uint8_t *)packed, rtcState.count))
+  {
+    log("Flash queue write failed");
+    return;
+  }
+  if (queue.dropped() > dropped)
+  {
+    log("Flash queue full, %lu oldest samples dropped", (unsigned long)(queue.dropped() - dropped));
+  }
+
+  log("%u samples moved to flash, backlog: %lu", rtcState.count, (unsigned long)queue.size());
+  rtcState.head = 0;
+  rtcState.count = 0;
+}
+
+// Upload the backlog in batches until it is empty, QUEUE_DRAIN_MS passed or the upload
+// deadline. Return true if it is empty.
+bool PlantNode::drainQueue()
+{
+  uint32_t start = hal.clock.millis();
+  while (!queue.empty())
+  {
+    if (hal.clock.millis() - start >= QUEUE_DRAIN_MS || budget.expired())
+    {
+      log("Backlog of %lu samples left for the next wake", (unsigned long)queue.size());
+      return false;
+    }
+
+    PackedSample packed[QUEUE_DRAIN_BATCH];
+    Sample samples[QUEUE_DRAIN_BATCH];
+    size_t count = queue.read((uint8_t *)packed, QUEUE_DRAIN_BATCH);
+    for (size_t i = 0; i < count; i++)
+    {
+      samples[i] = unpackSample(packed[i]);
+    }
+
+    // The trace goes with the samples of this wake
+    if (count > 0 && !exportSamples(samples, count, false))
+    {
+      return false;
+    }
+    queue.commit();
+  }
+
+  return true;
+}
+
+// Time -----------------------------------------------------------------------
+
+bool PlantNode::syncTime()
+{
+  for (uint8_t i = 0; i < TIME_NTP_ATTEMPTS && !budget.expired(); i++)
+  {
+    uint32_t epoch;
+    if (hal.network.getTime(epoch))
+    {
+      timeSynced(rtcState.time, epoch, hal.clock.millis());
+      log("Time synced, drift: %ld ppm", (long)rtcState.time.driftPpm);
+      return true;
+    }
+  }
+
+  log("NTP sync failed");
+  return false;
+}
+
+// Send -----------------------------------------------------------------------
+
+bool PlantNode::exportSamples(const Sample *samples, size_t count, bool withTrace)
+{
+  // The trace of this cycle is only complete at the end, ship the previous ones
+  const Trace *trace = TRACE_ENABLE && withTrace && rtcState.trace.ts != 0 ? &rtcState.trace : nullptr;
+  bool sent = true;
+  bool traceSent = false;
+
+  for (uint8_t id = 0; id < EXPORTER_COUNT; id++)
+  {
+    if (!(config.exporters & EXPORTER_BIT(id)))
+    {
+      continue;
+    }
+
+    // The samples are kept for the exporters left
+    if (budget.expired())
+    {
+      log("Upload deadline passed");
+      sent = false;
+      break;
+    }
+
+    Exporter &exporter = exporters.get((ExporterId)id);
+    traceStart();
+    bool exported = exporter.send(samples, count, exporter.tracing() ? trace : nullptr);
+    traceEnd(exporter.phase());
+
+    exportFailed = exportFailed || !exported;
+    sent = exported && sent;
+    traceSent = traceSent || (exported && exporter.tracing());
+  }
+
+  if (traceSent)
+  {
+    memset(&rtcState.trace, 0, sizeof(rtcState.trace));
+  }
+
+  // The samples are kept until every exporter took them
+  return sent;
+}
+
+// Trace ----------------------------------------------------------------------
+
+void PlantNode::traceStart()
+{
+  phaseStartUs = hal.clock.micros();
+}
+
+void PlantNode::traceEnd(TracePhase phase)
+{
+  uint32_t durationUs = hal.clock.micros() - phaseStartUs;
+
+  HeapStats heap;
+  hal.system.getHeapStats(heap);
+  traceRecord(cycleTrace, phase, durationUs, heap);
+}
+
+// Utils ----------------------------------------------------------------------
+
+void PlantNode::log(const char *format, ...)
+{
+  char text[128];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(text, sizeof(text), format, args);
+  va_end(args);
+
+  hal.system.log(text);
+}
+
+float batteryPercentage(int32_t milliVolts)
+{
+  return calEvaluate(BATTERY_CURVE, milliVolts) / (float)CAL_ONE;
+}
+
+float dewPoint(float temp, float humidity)
+{
+  float gamma = log(humidity / 100.0) + 17.62 * temp / (243.12 + temp);
+
+  return 243.12 * gamma / (17.62 - gamma);
+}
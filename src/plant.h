@@ -0,0 +1,168 @@
+#ifndef PLANT_H
+#define PLANT_H
+
+#include "config.h"
+#include "acquisition.h"
+#include "budget.h"
+#include "compat.h"
+#include "deadband.h"
+#include "exporter.h"
+#include "flashqueue.h"
+#include "frame.h"
+#include "hal.h"
+#include "metrics.h"
+#include "mqtt.h"
+#include "ota.h"
+#include "payload.h"
+#include "probes.h"
+#include "remoteconfig.h"
+#include "remotewrite.h"
+#include "sample.h"
+#include "scheduler.h"
+#include "screen.h"
+#include "timekeeper.h"
+#include "trace.h"
+
+// Compact form of a sample stored in RTC memory (fixed point)
+struct PackedSample
+{
+  uint16_t ts[2];    // Low word first, keeps the struct 2 byte aligned
+  int16_t temp;      // 1/100 C
+  uint16_t humidity; // 1/100 % (dew point is derived from temperature and humidity)
+  int16_t soilRaw[SOIL_PROBE_COUNT];
+  uint8_t suppressed; // Saturated (soil percentages are derived from the raw values)
+  uint8_t timeError;  // 1/10 s, saturated
+  uint16_t batteryMilliVolts;
+  uint16_t interval; // Seconds until the next sample (battery percentage is derived from the volts)
+  uint16_t solarPanelMilliVolts;
+};
+
+// State kept in RTC user memory across deep sleeps
+struct RtcState
+{
+  uint32_t crc;
+  uint32_t magic;
+  uint8_t wakes;       // Wakes since last upload, saturated
+  uint8_t configWakes; // Wakes since the last config check, saturated
+  BackoffState backoff;
+  uint8_t head;   // Index of the oldest buffered sample
+  uint8_t count;  // Number of buffered samples
+  QueueState queue;
+  TimeState time;
+  PackedSample samples[BATCH_MAX_SAMPLES];
+  NetworkState net;
+  Trace trace; // Phases of the previous cycles not shipped yet
+  ScheduleState schedule;
+  DeadbandState deadband;
+  FilterState filter;
+  ScreenState screen;
+};
+
+#define RTC_STATE_MAGIC 0x504c4e10
+
+// Each soil probe takes 8 bytes, plus 2 per buffered sample
+static_assert(sizeof(RtcState) <= 512, "RtcState does not fit in RTC user memory, lower BATCH_MAX_SAMPLES");
+static_assert(BATCH_MAX_SAMPLES <= 255, "BATCH_MAX_SAMPLES too big");
+static_assert(BATCH_MAX_SAMPLES <= FRAME_MAX_SAMPLES, "BATCH_MAX_SAMPLES does not fit in a relay frame");
+
+#define GRAPHITE_BUFFER_SIZE GRAPHITE_PAYLOAD_SIZE(BATCH_MAX_SAMPLES, SOIL_PROBE_COUNT, TRACE_ENABLE)
+#define LOKI_BUFFER_SIZE LOKI_PAYLOAD_SIZE(BATCH_MAX_SAMPLES, SOIL_PROBE_COUNT, sizeof(LOKI_MESSAGE))
+#define REMOTE_WRITE_BUFFER_SIZE REMOTE_WRITE_PAYLOAD_SIZE(BATCH_MAX_SAMPLES, SOIL_PROBE_COUNT, sizeof(SENSOR_ID), TRACE_ENABLE)
+#define PAYLOAD_BUFFER_SIZE (GRAPHITE_BUFFER_SIZE > LOKI_BUFFER_SIZE ? GRAPHITE_BUFFER_SIZE : LOKI_BUFFER_SIZE)
+
+static_assert(PAYLOAD_BUFFER_SIZE >= REMOTE_WRITE_BUFFER_SIZE, "Remote write payloads do not fit in the payload buffer");
+
+static_assert(PAYLOAD_BUFFER_SIZE >= FRAME_MAX_SIZE, "Relay frames do not fit in the payload buffer");
+
+#define MQTT_BUFFER_SIZE (MQTT_CONNECT_SIZE(sizeof(SENSOR_ID), sizeof(MQTT_USER), sizeof(MQTT_PASS)) + MQTT_PUBLISH_HEADER_SIZE(sizeof(MQTT_TOPIC_PREFIX) + sizeof(SENSOR_ID)) + FRAME_MAX_SIZE)
+
+static_assert(PAYLOAD_BUFFER_SIZE >= MQTT_BUFFER_SIZE, "MQTT messages do not fit in the payload buffer");
+
+// The backlog is uploaded without the trace
+static_assert(PAYLOAD_BUFFER_SIZE >= GRAPHITE_PAYLOAD_SIZE(QUEUE_DRAIN_BATCH, SOIL_PROBE_COUNT, false) &&
+                  PAYLOAD_BUFFER_SIZE >= LOKI_PAYLOAD_SIZE(QUEUE_DRAIN_BATCH, SOIL_PROBE_COUNT, sizeof(LOKI_MESSAGE)) &&
+                  PAYLOAD_BUFFER_SIZE >= REMOTE_WRITE_PAYLOAD_SIZE(QUEUE_DRAIN_BATCH, SOIL_PROBE_COUNT, sizeof(SENSOR_ID), false),
+              "QUEUE_DRAIN_BATCH samples do not fit in the payload buffer");
+static_assert(QUEUE_DRAIN_BATCH <= FRAME_MAX_SAMPLES, "QUEUE_DRAIN_BATCH does not fit in a relay frame");
+static_assert(QUEUE_SEGMENTS >= 2 && QUEUE_SEGMENT_RECORDS <= 255, "Bad flash queue layout");
+// The slot of a segment is its sequence number modulo QUEUE_SEGMENTS, across the wrap of the uint16_t
+static_assert((QUEUE_SEGMENTS & (QUEUE_SEGMENTS - 1)) == 0 && QUEUE_SEGMENTS <= 255, "QUEUE_SEGMENTS must be a power of 2");
+
+// Settings that can change between nodes at runtime
+struct NodeConfig
+{
+  const char *sensorId;
+  uint32_t sampleIntervalSec; // Until the scheduler has some history
+  uint32_t minIntervalSec;
+  uint32_t maxIntervalSec;
+  uint8_t uploadEvery; // Wakes between uploads
+  uint8_t exporters;   // Bit mask of EXPORTER_BIT()
+  uint8_t displayFullEvery; // Full refresh of the e-ink display every this many refreshes, partial ones in between
+  uint32_t updateCheckSec;  // Time between firmware update checks, 0 = never
+  uint8_t configEvery;      // Wakes between remote config checks, 0 = never
+  bool displayLowPower;     // Skip the status screens
+  DeadbandConfig deadband;
+  SoilTrim soilTrims[SOIL_PROBE_COUNT];
+};
+
+NodeConfig defaultNodeConfig();
+
+// The wake cycle of a plant sensor: a deep sleep wake runs setup() and loop() once
+class PlantNode
+{
+public:
+  PlantNode(const Hal &hal, const NodeConfig &config);
+
+  void setup();
+  void loop();
+
+private:
+  bool measure(Sample &sample);
+  ValPerc measureSoilMoisture(uint8_t probe, int16_t raw);
+  ValPercFloat measureBatteryVolt(int16_t raw);
+  float measureSolarPanelVolt(int16_t raw);
+  uint32_t scheduleNext(const Sample &sample, bool valid);
+
+  bool loadRtcState();
+  void saveRtcState();
+  bool needsUpload();
+  bool updateDue(uint32_t now, uint32_t interval);
+  bool configDue();
+  void pushSample(const Sample &sample);
+  size_t getBufferedSamples(Sample *out);
+  void spillSamples();
+  bool drainQueue();
+
+  bool syncTime();
+
+  bool exportSamples(const Sample *samples, size_t count, bool withTrace);
+
+  void traceStart();
+  void traceEnd(TracePhase phase);
+
+  void log(const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+  Hal hal;
+  NodeConfig config;
+  RtcState rtcState;
+  Trace cycleTrace; // Phases of this cycle
+  uint32_t phaseStartUs;
+  WakeBudget budget;
+  bool sensorsReady;
+  bool exportFailed; // Some exporter failed during this wake
+  // Shared by all the payloads, they are never built at the same time
+  char payloadBuffer[PAYLOAD_BUFFER_SIZE];
+  ExporterRegistry exporters;
+  FlashQueue queue; // Samples that could not be uploaded
+  ConfigCache configCache;
+};
+
+PackedSample packSample(const Sample &sample);
+Sample unpackSample(const PackedSample &packed);
+
+// Charge left along the discharge curve (assets/calibration/battery.csv)
+float batteryPercentage(int32_t milliVolts);
+// Magnus formula
+float dewPoint(float temp, float humidity);
+
+#endif
@@ -0,0 +1,45 @@
+#include "probes.h"
+
+#include <stdlib.h>
+
+int16_t soilTrimmed(uint8_t probe, const SoilTrim &trim, int16_t raw)
+{
+  if (trim.air == trim.water)
+  {
+    return raw;
+  }
+
+  const CalCurve &curve = *SOIL_PROBE_TABLE[probe].curve;
+  CalPoint first = calPoint(curve, 0);
+  CalPoint last = calPoint(curve, curve.count - 1);
+  int32_t air = first.y < last.y ? first.x : last.x;
+  int32_t water = first.y < last.y ? last.x : first.x;
+
+  int64_t num = (int64_t)(raw - trim.air) * (water - air);
+  int32_t den = trim.water - trim.air;
+  int64_t trimmed = air + ((num >= 0) == (den >= 0) ? num + den / 2 : num - den / 2) / den;
+
+  return trimmed < INT16_MIN ? INT16_MIN : trimmed > INT16_MAX ? INT16_MAX : trimmed;
+}
+
+int soilPercentage(uint8_t probe, int raw)
+{
+  int32_t perc = calRound(calEvaluate(*SOIL_PROBE_TABLE[probe].curve, raw));
+
+  if (perc >= 100)
+  {
+    perc = 100;
+  }
+  else if (perc <= 0)
+  {
+    perc = 0;
+  }
+
+  return perc;
+}
+
+float soilChange(uint8_t probe, int from, int to)
+{
+  const CalCurve &curve = *SOIL_PROBE_TABLE[probe].curve;
+  return abs(calEvaluate(curve, to) - calEvaluate(curve, from)) / (float)CAL_ONE;
+}
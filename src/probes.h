@@ -0,0 +1,39 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+#include "config.h"
+#include "calibration_curves.h"
+#include "compat.h"
+#include "hal.h"
+#include "sample.h"
+
+// Soil probe on an ADC input, with its own calibration
+struct SoilProbe
+{
+  uint8_t input;         // ADC_INPUT(device, channel)
+  const CalCurve *curve; // Raw value to moisture (calibration_curves.h)
+};
+
+// The probes of SOIL_PROBES, in the order of their values in the samples
+static constexpr SoilProbe SOIL_PROBE_TABLE[] = SOIL_PROBES;
+#define SOIL_PROBE_COUNT (sizeof(SOIL_PROBE_TABLE) / sizeof(SOIL_PROBE_TABLE[0]))
+
+static_assert(SOIL_PROBE_COUNT <= SAMPLE_MAX_PROBES, "Too many SOIL_PROBES");
+
+// Readings of a probe in air and in water, when they differ from the ones of the probe the
+// curve was fitted to (both 0 = none)
+struct SoilTrim
+{
+  int16_t air;
+  int16_t water;
+};
+
+// Raw value of the probe mapped linearly onto the probe of its curve, from the dry end of the
+// curve to the wet one
+int16_t soilTrimmed(uint8_t probe, const SoilTrim &trim, int16_t raw);
+// Percentage of the probe from its raw value, within 0 and 100
+int soilPercentage(uint8_t probe, int raw);
+// Change between two raw values of the probe, in %
+float soilChange(uint8_t probe, int from, int to);
+
+#endif
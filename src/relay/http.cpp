@@ -0,0 +1,233 @@
+#include "http.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+// Client ---------------------------------------------------------------------
+
+static size_t discardResponse(char *data, size_t size, size_t count, void *user)
+{
+  return size * count;
+}
+
+HttpClient::HttpClient(bool reuse) : curl(curl_easy_init()), headers(nullptr), reuse(reuse)
+{
+  headers = curl_slist_append(headers, "Content-Type: application/json");
+  // No 100-continue round trip before the body
+  headers = curl_slist_append(headers, "Expect:");
+
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, discardResponse);
+  curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);
+  curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+  curl_easy_setopt(curl, CURLOPT_TCP_NODELAY, 1L);
+  curl_easy_setopt(curl, CURLOPT_FORBID_REUSE, reuse ? 0L : 1L);
+}
+
+HttpClient::~HttpClient()
+{
+  curl_easy_cleanup(curl);
+  curl_slist_free_all(headers);
+}
+
+long HttpClient::post(const std::string &url, const std::string &auth, const char *body, size_t length)
+{
+  curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+  curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body);
+  curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)length);
+  if (auth.empty())
+  {
+    curl_easy_setopt(curl, CURLOPT_HTTPAUTH, CURLAUTH_NONE);
+  }
+  else
+  {
+    curl_easy_setopt(curl, CURLOPT_HTTPAUTH, CURLAUTH_BASIC);
+    curl_easy_setopt(curl, CURLOPT_USERPWD, auth.c_str());
+  }
+
+  if (curl_easy_perform(curl) != CURLE_OK)
+  {
+    return -1;
+  }
+
+  long code = 0;
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+  return code;
+}
+
+// Stand-in -------------------------------------------------------------------
+
+HttpStandIn::HttpStandIn(unsigned latencyMs)
+    : latencyMs(latencyMs), listenFd(-1), boundPort(0), stopping(false), requestCount(0), connectionCount(0), byteCount(0), lokiSampleCount(0)
+{
+}
+
+HttpStandIn::~HttpStandIn()
+{
+  stop();
+}
+
+bool HttpStandIn::start()
+{
+  listenFd = socket(AF_INET, SOCK_STREAM, 0);
+  if (listenFd < 0)
+  {
+    return false;
+  }
+
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = 0;
+  socklen_t addrLen = sizeof(addr);
+  if (bind(listenFd, (sockaddr *)&addr, sizeof(addr)) < 0 || listen(listenFd, 128) < 0 || getsockname(listenFd, (sockaddr *)&addr, &addrLen) < 0)
+  {
+    close(listenFd);
+    listenFd = -1;
+    return false;
+  }
+  boundPort = ntohs(addr.sin_port);
+
+  acceptThread = std::thread(&HttpStandIn::acceptLoop, this);
+  return true;
+}
+
+void HttpStandIn::stop()
+{
+  if (listenFd < 0 || stopping.exchange(true))
+  {
+    return;
+  }
+
+  // Wake the threads blocked on the sockets
+  shutdown(listenFd, SHUT_RDWR);
+  acceptThread.join();
+  close(listenFd);
+
+  std::unique_lock<std::mutex> lock(mutex);
+  for (int fd : connectionFds)
+  {
+    shutdown(fd, SHUT_RDWR);
+  }
+  closed.wait(lock, [this] { return connectionFds.empty(); });
+}
+
+void HttpStandIn::acceptLoop()
+{
+  while (!stopping)
+  {
+    int fd = accept(listenFd, nullptr, nullptr);
+    if (fd < 0)
+    {
+      continue;
+    }
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    connectionCount++;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (stopping)
+    {
+      close(fd);
+      break;
+    }
+    connectionFds.push_back(fd);
+    // Detached, many short connections come and go in the benchmarks
+    std::thread(&HttpStandIn::serve, this, fd).detach();
+  }
+}
+
+void HttpStandIn::closeConnection(int fd)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  connectionFds.erase(std::find(connectionFds.begin(), connectionFds.end(), fd));
+  close(fd);
+  closed.notify_all();
+}
+
+static size_t countOccurrences(const char *data, size_t length, const char *needle)
+{
+  size_t count = 0;
+  size_t needleLen = strlen(needle);
+  const char *end = data + length;
+  for (const char *p = data; (p = (const char *)memmem(p, end - p, needle, needleLen)) != nullptr; p += needleLen)
+  {
+    count++;
+  }
+
+  return count;
+}
+
+void HttpStandIn::serve(int fd)
+{
+  static const char RESPONSE[] = "HTTP/1.1 204 No Content\r\n\r\n";
+
+  std::string buffer;
+  char chunk[16384];
+  while (true)
+  {
+    // Headers
+    size_t headerEnd;
+    while ((headerEnd = buffer.find("\r\n\r\n")) == std::string::npos)
+    {
+      ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+      if (n <= 0)
+      {
+        closeConnection(fd);
+        return;
+      }
+      buffer.append(chunk, n);
+    }
+
+    size_t contentLength = 0;
+    size_t pos = 0;
+    while (pos < headerEnd)
+    {
+      size_t lineEnd = buffer.find("\r\n", pos);
+      if (strncasecmp(buffer.c_str() + pos, "Content-Length:", 15) == 0)
+      {
+        contentLength = strtoul(buffer.c_str() + pos + 15, nullptr, 10);
+      }
+      pos = lineEnd + 2;
+    }
+
+    // Body
+    size_t requestLength = headerEnd + 4 + contentLength;
+    while (buffer.size() < requestLength)
+    {
+      ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+      if (n <= 0)
+      {
+        closeConnection(fd);
+        return;
+      }
+      buffer.append(chunk, n);
+    }
+
+    lokiSampleCount += countOccurrences(buffer.data() + headerEnd + 4, contentLength, "\"temperature=");
+    byteCount += requestLength;
+    requestCount++;
+    buffer.erase(0, requestLength);
+
+    if (latencyMs > 0)
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(latencyMs));
+    }
+    if (send(fd, RESPONSE, sizeof(RESPONSE) - 1, MSG_NOSIGNAL) < 0)
+    {
+      closeConnection(fd);
+      return;
+    }
+  }
+}
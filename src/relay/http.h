@@ -0,0 +1,71 @@
+#ifndef RELAY_HTTP_H
+#define RELAY_HTTP_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <curl/curl.h>
+
+// HTTP client keeping its connection open across requests (one per thread)
+class HttpClient
+{
+public:
+  // reuse = false opens a new connection for each request, as the sensors do
+  explicit HttpClient(bool reuse = true);
+  ~HttpClient();
+
+  HttpClient(const HttpClient &) = delete;
+  HttpClient &operator=(const HttpClient &) = delete;
+
+  // POST a json body, auth is "user:password" (empty = none).
+  // Return the HTTP code, < 0 on transport errors.
+  long post(const std::string &url, const std::string &auth, const char *body, size_t length);
+
+private:
+  CURL *curl;
+  curl_slist *headers;
+  bool reuse;
+};
+
+// Local HTTP/1.1 server answering every request with 204, stands in for Graphite and Loki in the benchmarks
+class HttpStandIn
+{
+public:
+  explicit HttpStandIn(unsigned latencyMs = 0);
+  ~HttpStandIn();
+
+  bool start();
+  void stop();
+  uint16_t port() const { return boundPort; }
+
+  uint64_t requests() const { return requestCount; }
+  uint64_t connections() const { return connectionCount; }
+  uint64_t bytes() const { return byteCount; }
+  // Loki sample lines received
+  uint64_t lokiSamples() const { return lokiSampleCount; }
+
+private:
+  void acceptLoop();
+  void serve(int fd);
+  void closeConnection(int fd);
+
+  unsigned latencyMs; // Delay of each response, as a remote backend
+  int listenFd;
+  uint16_t boundPort;
+  std::atomic<bool> stopping;
+  std::thread acceptThread;
+  std::mutex mutex;
+  std::condition_variable closed;
+  std::vector<int> connectionFds; // Open connections, each served by a thread
+  std::atomic<uint64_t> requestCount;
+  std::atomic<uint64_t> connectionCount;
+  std::atomic<uint64_t> byteCount;
+  std::atomic<uint64_t> lokiSampleCount;
+};
+
+#endif
@@ -0,0 +1,355 @@
+//
+// Relay daemon: receives the compact frames of the sensors over UDP (see frame.h) and
+// forwards them in batches to Graphite and Loki, keeping the connections open.
+//
+// Usage: relay [--port N] [--graphite URL] [--graphite-auth USER:PASS] [--loki URL] [--loki-auth USER:PASS]
+//              [--workers N] [--batch-frames N] [--batch-ms N]
+//        relay --bench [--sensors N] [--frames N] [--samples N] [--latency-ms N] [--workers N] [--batch-frames N] [--batch-ms N]
+// --bench forwards generated frames to local HTTP stand-ins and compares with a request per frame.
+//
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "../payload.h"
+#include "relay.h"
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void onSignal(int signal)
+{
+  stopRequested = 1;
+}
+
+static double elapsedSec(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Daemon ---------------------------------------------------------------------
+
+static int runDaemon(const RelayConfig &config)
+{
+  Relay relay(config);
+  if (!relay.start())
+  {
+    fprintf(stderr, "Cannot listen on UDP port %u\n", config.port);
+    return 1;
+  }
+  fprintf(stderr, "Listening on UDP port %u, %u workers\n", relay.port(), config.workers);
+
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+
+  unsigned seconds = 0;
+  while (!stopRequested)
+  {
+    sleep(1);
+    if (++seconds % 60 == 0)
+    {
+      const RelayStats &stats = relay.stats();
+      fprintf(stderr, "frames: %llu received, %llu forwarded, %llu refused, %llu requeued, %llu lost, %llu invalid, %llu duplicates, %llu rejected; requests: %llu, failures: %llu\n",
+              (unsigned long long)stats.received, (unsigned long long)stats.forwarded, (unsigned long long)stats.refused, (unsigned long long)stats.requeued,
+              (unsigned long long)stats.lost, (unsigned long long)stats.invalid, (unsigned long long)stats.duplicates, (unsigned long long)stats.rejected,
+              (unsigned long long)stats.requests, (unsigned long long)stats.failures);
+    }
+  }
+
+  fprintf(stderr, "Forwarding the queued frames...\n");
+  relay.stop();
+
+  return 0;
+}
+
+// Benchmark ------------------------------------------------------------------
+
+struct BenchConfig
+{
+  unsigned sensors;
+  unsigned frames;  // Per sensor
+  unsigned samples; // Per frame
+  unsigned latencyMs;
+};
+
+#define BENCH_CLIENT_THREADS 8
+#define BENCH_ACK_TIMEOUT_MS 500
+#define BENCH_ATTEMPTS 5
+
+static void benchFrame(std::vector<uint8_t> &frame, unsigned sensor, unsigned index, unsigned samplesPerFrame)
+{
+  char sensorId[FRAME_MAX_ID_LENGTH + 1];
+  snprintf(sensorId, sizeof(sensorId), "plant-%u", sensor);
+
+  Sample samples[FRAME_MAX_SAMPLES] = {};
+  for (unsigned i = 0; i < samplesPerFrame; i++)
+  {
+    Sample &s = samples[i];
+    s.ts = 1700000000 + (index * samplesPerFrame + i) * 60;
+    s.air = {21.5f + sensor % 5, 55.0f, 12.0f};
+    s.soil[0] = {9000 + (int)(i * 10), 70};
+    s.probes = 1;
+    s.battery = {3.9f, 78.5f};
+    s.solarPanelVolt = 4.6f;
+    s.timeError = 0.2f;
+    s.interval = 60;
+  }
+
+  Trace trace = {};
+  trace.ts = samples[0].ts;
+  trace.awakeMs = 600;
+  HeapStats heap = {40000, 30000, 5};
+  traceRecord(trace, TRACE_SENSORS, 150000, heap);
+  traceRecord(trace, TRACE_RELAY, 20000, heap);
+
+  frame.resize(FRAME_MAX_SIZE);
+  frame.resize(encodeFrame(frame.data(), frame.size(), sensorId, samples, samplesPerFrame, &trace));
+}
+
+// Sends the frames of some sensors as they would, waiting for each acknowledgment
+static void benchClient(uint16_t port, const BenchConfig &bench, unsigned first, unsigned step, std::atomic<uint64_t> &acked)
+{
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  timeval timeout = {0, BENCH_ACK_TIMEOUT_MS * 1000};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+
+  std::vector<uint8_t> frame;
+  for (unsigned index = 0; index < bench.frames; index++)
+  {
+    for (unsigned sensor = first; sensor < bench.sensors; sensor += step)
+    {
+      benchFrame(frame, sensor, index, bench.samples);
+      for (unsigned i = 0; i < BENCH_ATTEMPTS; i++)
+      {
+        sendto(fd, frame.data(), frame.size(), 0, (sockaddr *)&addr, sizeof(addr));
+
+        uint8_t ack[FRAME_ACK_SIZE + 1];
+        ssize_t length = recv(fd, ack, sizeof(ack), 0);
+        if (length > 0 && frameAckMatches(ack, length, frame.data(), frame.size()))
+        {
+          acked++;
+          break;
+        }
+      }
+    }
+  }
+
+  close(fd);
+}
+
+// A request per frame and backend on a new connection, as the sensors do without the relay
+static double benchDirect(const BenchConfig &bench, uint16_t port, unsigned threads, uint64_t &requests)
+{
+  std::string graphiteUrl = "http://127.0.0.1:" + std::to_string(port) + "/graphite/metrics";
+  std::string lokiUrl = "http://127.0.0.1:" + std::to_string(port) + "/loki/api/v1/push";
+  std::atomic<uint64_t> posted(0);
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> clients;
+  for (unsigned t = 0; t < threads; t++)
+  {
+    clients.emplace_back([&, t]() {
+      HttpClient client(false);
+      std::vector<uint8_t> frame;
+      Frame decoded;
+      std::vector<char> buffer(GRAPHITE_PAYLOAD_SIZE(FRAME_MAX_SAMPLES, SAMPLE_MAX_PROBES, 1) +
+                               LOKI_PAYLOAD_SIZE(FRAME_MAX_SAMPLES, SAMPLE_MAX_PROBES, sizeof(RELAY_LOKI_MESSAGE)));
+      for (unsigned index = 0; index < bench.frames; index++)
+      {
+        for (unsigned sensor = t; sensor < bench.sensors; sensor += threads)
+        {
+          benchFrame(frame, sensor, index, bench.samples);
+          decodeFrame(frame.data(), frame.size(), decoded);
+
+          size_t length = buildGraphitePayload(buffer.data(), buffer.size(), decoded.samples, decoded.count, &decoded.trace);
+          client.post(graphiteUrl, "", buffer.data(), length);
+          length = buildLokiPayload(buffer.data(), buffer.size(), decoded.samples, decoded.count, decoded.sensorId, RELAY_LOKI_MESSAGE);
+          client.post(lokiUrl, "", buffer.data(), length);
+          posted += 2;
+        }
+      }
+    });
+  }
+  for (std::thread &client : clients)
+  {
+    client.join();
+  }
+
+  requests = posted;
+  return elapsedSec(start);
+}
+
+static int runBench(RelayConfig config, const BenchConfig &bench)
+{
+  uint64_t totalFrames = (uint64_t)bench.sensors * bench.frames;
+  printf("# %u sensors, %u frames each, %u samples per frame, backend latency: %u ms\n", bench.sensors, bench.frames, bench.samples, bench.latencyMs);
+
+  // Relay
+  HttpStandIn relayBackend(bench.latencyMs);
+  if (!relayBackend.start())
+  {
+    fprintf(stderr, "Cannot start the HTTP stand-in\n");
+    return 1;
+  }
+
+  config.port = 0;
+  config.graphiteUrl = "http://127.0.0.1:" + std::to_string(relayBackend.port()) + "/graphite/metrics";
+  config.lokiUrl = "http://127.0.0.1:" + std::to_string(relayBackend.port()) + "/loki/api/v1/push";
+  config.graphiteAuth = "";
+  config.lokiAuth = "";
+
+  Relay relay(config);
+  if (!relay.start())
+  {
+    fprintf(stderr, "Cannot start the relay\n");
+    return 1;
+  }
+
+  std::atomic<uint64_t> acked(0);
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> clients;
+  unsigned clientThreads = bench.sensors < BENCH_CLIENT_THREADS ? bench.sensors : BENCH_CLIENT_THREADS;
+  for (unsigned t = 0; t < clientThreads; t++)
+  {
+    clients.emplace_back(benchClient, relay.port(), std::cref(bench), t, clientThreads, std::ref(acked));
+  }
+  for (std::thread &client : clients)
+  {
+    client.join();
+  }
+  double ingestSec = elapsedSec(start);
+
+  // Everything acknowledged is forwarded on stop
+  relay.stop();
+  double relaySec = elapsedSec(start);
+  relayBackend.stop();
+
+  const RelayStats &stats = relay.stats();
+  printf("relay:  %llu/%llu frames acked in %.2f s (%.0f frames/s), forwarded in %.2f s (%.0f frames/s)\n",
+         (unsigned long long)acked.load(), (unsigned long long)totalFrames, ingestSec, acked / ingestSec, relaySec, stats.forwarded / relaySec);
+  printf("        %llu batches, %llu requests on %llu connections, %.1f frames per request, %.1f KB posted\n",
+         (unsigned long long)stats.batches, (unsigned long long)relayBackend.requests(), (unsigned long long)relayBackend.connections(),
+         stats.requests ? (double)stats.forwarded * 2 / stats.requests : 0.0, relayBackend.bytes() / 1024.0);
+
+  // Same frames sent directly
+  HttpStandIn directBackend(bench.latencyMs);
+  if (!directBackend.start())
+  {
+    fprintf(stderr, "Cannot start the HTTP stand-in\n");
+    return 1;
+  }
+
+  uint64_t requests;
+  double directSec = benchDirect(bench, directBackend.port(), config.workers, requests);
+  directBackend.stop();
+  printf("direct: %llu frames in %.2f s (%.0f frames/s), %llu requests on %llu connections, %.1f KB posted\n",
+         (unsigned long long)totalFrames, directSec, totalFrames / directSec, (unsigned long long)directBackend.requests(),
+         (unsigned long long)directBackend.connections(), directBackend.bytes() / 1024.0);
+
+  // Every sample has to reach Loki exactly once
+  uint64_t expectedSamples = totalFrames * bench.samples;
+  if (relayBackend.lokiSamples() != expectedSamples || stats.lost > 0)
+  {
+    fprintf(stderr, "Loki samples: %llu, expected %llu, lost frames: %llu\n", (unsigned long long)relayBackend.lokiSamples(),
+            (unsigned long long)expectedSamples, (unsigned long long)stats.lost.load());
+    return 1;
+  }
+
+  return 0;
+}
+
+// Main -----------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+  RelayConfig config = defaultRelayConfig();
+  BenchConfig bench = {200, 50, 1, 0};
+  bool runBenchmark = false;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "--port") && i + 1 < argc)
+    {
+      config.port = strtoul(argv[++i], nullptr, 10);
+    }
+    else if (!strcmp(argv[i], "--graphite") && i + 1 < argc)
+    {
+      config.graphiteUrl = argv[++i];
+    }
+    else if (!strcmp(argv[i], "--graphite-auth") && i + 1 < argc)
+    {
+      config.graphiteAuth = argv[++i];
+    }
+    else if (!strcmp(argv[i], "--loki") && i + 1 < argc)
+    {
+      config.lokiUrl = argv[++i];
+    }
+    else if (!strcmp(argv[i], "--loki-auth") && i + 1 < argc)
+    {
+      config.lokiAuth = argv[++i];
+    }
+    else if (!strcmp(argv[i], "--workers") && i + 1 < argc)
+    {
+      config.workers = strtoul(argv[++i], nullptr, 10);
+    }
+    else if (!strcmp(argv[i], "--batch-frames") && i + 1 < argc)
+    {
+      config.batchFrames = strtoul(argv[++i], nullptr, 10);
+    }
+    else if (!strcmp(argv[i], "--batch-ms") && i + 1 < argc)
+    {
+      config.batchMs = strtoul(argv[++i], nullptr, 10);
+    }
+    else if (!strcmp(argv[i], "--bench"))
+    {
+      runBenchmark = true;
+    }
+    else if (!strcmp(argv[i], "--sensors") && i + 1 < argc)
+    {
+      bench.sensors = strtoul(argv[++i], nullptr, 10);
+    }
+    else if (!strcmp(argv[i], "--frames") && i + 1 < argc)
+    {
+      bench.frames = strtoul(argv[++i], nullptr, 10);
+    }
+    else if (!strcmp(argv[i], "--samples") && i + 1 < argc)
+    {
+      bench.samples = strtoul(argv[++i], nullptr, 10);
+    }
+    else if (!strcmp(argv[i], "--latency-ms") && i + 1 < argc)
+    {
+      bench.latencyMs = strtoul(argv[++i], nullptr, 10);
+    }
+    else
+    {
+      fprintf(stderr, "Usage: %s [--port N] [--graphite URL] [--graphite-auth USER:PASS] [--loki URL] [--loki-auth USER:PASS] [--workers N] [--batch-frames N] [--batch-ms N]\n"
+                      "       %s --bench [--sensors N] [--frames N] [--samples N] [--latency-ms N] [--workers N] [--batch-frames N] [--batch-ms N]\n",
+              argv[0], argv[0]);
+      return 2;
+    }
+  }
+
+  if (config.workers == 0 || config.batchFrames == 0 || bench.sensors == 0 || bench.samples == 0 || bench.samples > FRAME_MAX_SAMPLES)
+  {
+    fprintf(stderr, "Workers, batch frames, sensors and samples must be > 0 (max %d samples)\n", FRAME_MAX_SAMPLES);
+    return 2;
+  }
+
+  curl_global_init(CURL_GLOBAL_DEFAULT);
+  int result = runBenchmark ? runBench(config, bench) : runDaemon(config);
+  curl_global_cleanup();
+
+  return result;
+}
@@ -0,0 +1,420 @@
+#include "relay.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+
+#include "../payload.h"
+
+RelayConfig defaultRelayConfig()
+{
+  RelayConfig config;
+  config.port = 9500;
+  config.workers = 4;
+  config.batchFrames = 64;
+  config.batchMs = 1000;
+  config.queueFrames = 100000;
+
+  return config;
+}
+
+Relay::Relay(const RelayConfig &config)
+    : config(config), backends((config.graphiteUrl.empty() ? 0 : RELAY_GRAPHITE) | (config.lokiUrl.empty() ? 0 : RELAY_LOKI)),
+      fd(-1), boundPort(0), stopping(false)
+{
+}
+
+Relay::~Relay()
+{
+  stop();
+}
+
+bool Relay::start()
+{
+  fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0)
+  {
+    return false;
+  }
+
+  // Room for the bursts of a fleet waking up together
+  int bufferSize = 4 << 20;
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+  // Check for stop() now and then
+  timeval timeout = {0, 100000};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(config.port);
+  socklen_t addrLen = sizeof(addr);
+  if (bind(fd, (sockaddr *)&addr, sizeof(addr)) < 0 || getsockname(fd, (sockaddr *)&addr, &addrLen) < 0)
+  {
+    close(fd);
+    fd = -1;
+    return false;
+  }
+  boundPort = ntohs(addr.sin_port);
+
+  receiveThread = std::thread(&Relay::receive, this);
+  for (unsigned i = 0; i < (config.workers > 0 ? config.workers : 1); i++)
+  {
+    forwardThreads.emplace_back(&Relay::forward, this);
+  }
+
+  return true;
+}
+
+void Relay::stop()
+{
+  {
+    // Under the lock, a worker is either before its check of stopping or waiting for the notification
+    std::lock_guard<std::mutex> lock(mutex);
+    if (fd < 0 || stopping)
+    {
+      return;
+    }
+    stopping = true;
+  }
+
+  receiveThread.join();
+  close(fd);
+
+  ready.notify_all();
+  for (std::thread &thread : forwardThreads)
+  {
+    thread.join();
+  }
+}
+
+// Receive --------------------------------------------------------------------
+
+void Relay::receive()
+{
+  uint8_t data[FRAME_MAX_SIZE + 1];
+  Frame frame;
+
+  while (!stopping)
+  {
+    sockaddr_in from;
+    socklen_t fromLen = sizeof(from);
+    ssize_t length = recvfrom(fd, data, sizeof(data), 0, (sockaddr *)&from, &fromLen);
+    if (length <= 0)
+    {
+      continue;
+    }
+
+    if (length > FRAME_MAX_SIZE || !decodeFrame(data, length, frame))
+    {
+      counters.invalid++;
+      continue;
+    }
+
+    // Same crc as the previous frame of the sensor: the acknowledgment was lost
+    uint32_t crc = data[length - 4] | data[length - 3] << 8 | data[length - 2] << 16 | (uint32_t)data[length - 1] << 24;
+    auto last = lastCrc.find(frame.sensorId);
+    if (last != lastCrc.end() && last->second == crc)
+    {
+      counters.duplicates++;
+    }
+    else
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (queue.size() >= config.queueFrames)
+        {
+          counters.rejected++;
+          continue;
+        }
+        queue.push_back({frame, std::chrono::steady_clock::now(), 0, backends, false});
+      }
+      ready.notify_one();
+      lastCrc[frame.sensorId] = crc;
+      counters.received++;
+    }
+
+    uint8_t ack[FRAME_ACK_SIZE];
+    encodeFrameAck(ack, data, length);
+    sendto(fd, ack, sizeof(ack), 0, (sockaddr *)&from, fromLen);
+  }
+}
+
+// Forward --------------------------------------------------------------------
+
+void Relay::forward()
+{
+  // Connections are kept open between the batches
+  HttpClient graphite;
+  HttpClient loki;
+  std::vector<Entry> batch;
+  std::vector<Entry> failed;
+  std::vector<char> buffer;
+
+  while (takeBatch(batch))
+  {
+    counters.batches++;
+    postBatch(graphite, loki, batch, buffer);
+
+    // The frames a backend failed go back to the queue, only for the backends they did not reach
+    failed.clear();
+    for (Entry &entry : batch)
+    {
+      if (entry.pending != 0)
+      {
+        failed.push_back(std::move(entry));
+      }
+      else if (!entry.refused)
+      {
+        counters.forwarded++;
+      }
+    }
+    if (failed.empty())
+    {
+      continue;
+    }
+    if (requeueBatch(failed))
+    {
+      counters.requeued += failed.size();
+    }
+    else
+    {
+      counters.lost += failed.size();
+      fprintf(stderr, "%zu frames dropped\n", failed.size());
+    }
+  }
+}
+
+bool Relay::takeBatch(std::vector<Entry> &batch)
+{
+  std::chrono::milliseconds batchTimeout(config.batchMs);
+  std::unique_lock<std::mutex> lock(mutex);
+
+  // Wait for a full batch or for the oldest frame to be due, send everything on stop
+  while (!stopping && queue.size() < config.batchFrames)
+  {
+    if (queue.empty())
+    {
+      ready.wait(lock, [this] { return stopping || !queue.empty(); });
+    }
+    else if (ready.wait_until(lock, queue.front().received + batchTimeout) == std::cv_status::timeout)
+    {
+      break;
+    }
+  }
+
+  if (queue.empty())
+  {
+    // Only here on stop, or if another worker took the frames
+    return !stopping;
+  }
+
+  size_t count = queue.size() < config.batchFrames ? queue.size() : config.batchFrames;
+  batch.assign(std::make_move_iterator(queue.begin()), std::make_move_iterator(queue.begin() + count));
+  queue.erase(queue.begin(), queue.begin() + count);
+  lock.unlock();
+
+  // More for the other workers
+  ready.notify_one();
+
+  return true;
+}
+
+bool Relay::requeueBatch(std::vector<Entry> &batch)
+{
+  // The frames are acknowledged already, keep them while there is room. On stop, or once a batch
+  // failed too often, they are dropped.
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (stopping || queue.size() + batch.size() > config.queueFrames)
+    {
+      return false;
+    }
+    for (const Entry &entry : batch)
+    {
+      if (entry.requeues >= RELAY_BATCH_REQUEUES)
+      {
+        return false;
+      }
+    }
+
+    // In front, the oldest frames go first
+    for (Entry &entry : batch)
+    {
+      entry.requeues++;
+    }
+    queue.insert(queue.begin(), std::make_move_iterator(batch.begin()), std::make_move_iterator(batch.end()));
+  }
+  ready.notify_one();
+
+  return true;
+}
+
+void Relay::postBatch(HttpClient &graphite, HttpClient &loki, std::vector<Entry> &batch, std::vector<char> &buffer)
+{
+  std::vector<Entry *> entries;
+  for (Backend backend : {RELAY_GRAPHITE, RELAY_LOKI})
+  {
+    entries.clear();
+    for (Entry &entry : batch)
+    {
+      if (entry.pending & backend)
+      {
+        entries.push_back(&entry);
+      }
+    }
+    if (!entries.empty())
+    {
+      postFrames(backend, backend == RELAY_GRAPHITE ? graphite : loki, entries.data(), entries.size(), buffer);
+    }
+  }
+}
+
+bool Relay::postFrames(Backend backend, HttpClient &client, Entry *const *entries, size_t count, std::vector<char> &buffer)
+{
+  size_t length;
+  PostResult result;
+  if (backend == RELAY_GRAPHITE)
+  {
+    result = !buildGraphite(entries, count, buffer, length) ? POST_REFUSED
+             : length == 0                                  ? POST_SENT
+                                                            : post(client, config.graphiteUrl, config.graphiteAuth, buffer, length);
+  }
+  else
+  {
+    result = !buildLoki(entries, count, buffer, length) ? POST_REFUSED
+             : length == 0                              ? POST_SENT
+                                                        : post(client, config.lokiUrl, config.lokiAuth, buffer, length);
+  }
+
+  if (result == POST_FAILED)
+  {
+    return false;
+  }
+  if (result == POST_REFUSED && count > 1)
+  {
+    // Split down to the frames the backend refuses, the other frames of the batch still get through
+    size_t half = count / 2;
+    return postFrames(backend, client, entries, half, buffer) &&
+           postFrames(backend, client, entries + half, count - half, buffer);
+  }
+
+  for (size_t i = 0; i < count; i++)
+  {
+    entries[i]->pending &= ~backend;
+    if (result == POST_REFUSED)
+    {
+      entries[i]->refused = true;
+      counters.refused++;
+      fprintf(stderr, "Frame of %s refused by %s\n", entries[i]->frame.sensorId, backend == RELAY_GRAPHITE ? "Graphite" : "Loki");
+    }
+  }
+
+  return true;
+}
+
+bool Relay::buildGraphite(Entry *const *entries, size_t count, std::vector<char> &buffer, size_t &length)
+{
+  size_t size = 2;
+  for (size_t i = 0; i < count; i++)
+  {
+    const Frame &f = entries[i]->frame;
+    uint8_t probes = f.count > 0 ? f.samples[0].probes : 1;
+    size += (f.count * METRIC_SAMPLE_SERIES_COUNT(probes) + (f.hasTrace ? GRAPHITE_TRACE_METRIC_COUNT : 0)) * (112 + GRAPHITE_TAG_SIZE(strlen(f.sensorId))) + 1;
+  }
+  buffer.resize(size);
+
+  // A single array with the series of all the sensors, tagged with their id
+  PayloadWriter w(buffer.data(), buffer.size());
+  bool first = true;
+  w.write('[');
+  for (size_t i = 0; i < count; i++)
+  {
+    const Frame &f = entries[i]->frame;
+    if (f.count == 0 && !f.hasTrace)
+    {
+      continue;
+    }
+    if (!first)
+    {
+      w.write(',');
+    }
+    writeGraphiteEntries(w, f.samples, f.count, f.hasTrace ? &f.trace : nullptr, f.sensorId);
+    first = false;
+  }
+  w.write(']');
+
+  length = first ? 0 : w.length();
+  return !w.overflow();
+}
+
+bool Relay::buildLoki(Entry *const *entries, size_t count, std::vector<char> &buffer, size_t &length)
+{
+  size_t size = 128;
+  for (size_t i = 0; i < count; i++)
+  {
+    const Frame &f = entries[i]->frame;
+    uint8_t probes = f.count > 0 ? f.samples[0].probes : 1;
+    size += LOKI_PAYLOAD_SIZE(f.count, probes, sizeof(RELAY_LOKI_MESSAGE)) + strlen(f.sensorId);
+  }
+  buffer.resize(size);
+
+  // A stream for each sensor
+  PayloadWriter w(buffer.data(), buffer.size());
+  bool first = true;
+  writeLokiHead(w);
+  for (size_t i = 0; i < count; i++)
+  {
+    const Frame &f = entries[i]->frame;
+    if (f.count == 0)
+    {
+      continue;
+    }
+    if (!first)
+    {
+      w.write(", ");
+    }
+    writeLokiStream(w, f.samples, f.count, f.sensorId, RELAY_LOKI_MESSAGE);
+    first = false;
+  }
+  writeLokiTail(w);
+
+  length = first ? 0 : w.length();
+  return !w.overflow();
+}
+
+Relay::PostResult Relay::post(HttpClient &client, const std::string &url, const std::string &auth, const std::vector<char> &buffer, size_t length)
+{
+  unsigned delayMs = RELAY_RETRY_DELAY_MS;
+  for (uint8_t i = 0; i < RELAY_POST_ATTEMPTS; i++)
+  {
+    if (i > 0)
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(delayMs));
+      delayMs *= 2;
+    }
+
+    long code = client.post(url, auth, buffer.data(), length);
+    counters.requests++;
+    if (code >= 200 && code < 300)
+    {
+      counters.bytesPosted += length;
+      return POST_SENT;
+    }
+
+    counters.failures++;
+    fprintf(stderr, "POST %s failed, code: %ld\n", url.c_str(), code);
+
+    // Not worth retrying a payload the backend refuses, unlike a timeout or a rate limit
+    if (code >= 400 && code < 500 && code != 408 && code != 429)
+    {
+      return POST_REFUSED;
+    }
+  }
+
+  return POST_FAILED;
+}
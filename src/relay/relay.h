@@ -0,0 +1,120 @@
+#ifndef RELAY_H
+#define RELAY_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "../frame.h"
+#include "http.h"
+
+#define RELAY_LOKI_MESSAGE "New_samples!"
+#define RELAY_POST_ATTEMPTS 3     // Requests of a batch before dropping it
+#define RELAY_RETRY_DELAY_MS 1000 // Doubled after each failed request
+#define RELAY_BATCH_REQUEUES 5    // Times a failed batch goes back to the queue before dropping it
+
+struct RelayConfig
+{
+  uint16_t port;            // UDP port of the frames (0 = any, see Relay::port())
+  std::string graphiteUrl;  // Empty = not forwarded
+  std::string graphiteAuth; // user:password
+  std::string lokiUrl;      // Empty = not forwarded
+  std::string lokiAuth;     // user:password
+  unsigned workers;         // Forwarding threads, each keeps its own connections
+  size_t batchFrames;       // Max frames in a batch
+  unsigned batchMs;         // Max time a frame waits for its batch to fill
+  size_t queueFrames;       // Frames are not acknowledged beyond this, the sensors send them again later
+};
+
+RelayConfig defaultRelayConfig();
+
+struct RelayStats
+{
+  std::atomic<uint64_t> received{0};   // Valid frames
+  std::atomic<uint64_t> invalid{0};    // Bad crc, version or layout
+  std::atomic<uint64_t> duplicates{0}; // Sent again after a lost acknowledgment
+  std::atomic<uint64_t> rejected{0};   // Queue full
+  std::atomic<uint64_t> forwarded{0};  // Frames accepted by all their backends
+  std::atomic<uint64_t> refused{0};    // Frames a backend refused (4xx), not sent to it again
+  std::atomic<uint64_t> requeued{0};   // Frames a backend failed, queued again for that backend
+  std::atomic<uint64_t> lost{0};       // Frames dropped after the last requeue
+  std::atomic<uint64_t> batches{0};
+  std::atomic<uint64_t> requests{0};
+  std::atomic<uint64_t> failures{0};   // Failed requests
+  std::atomic<uint64_t> bytesPosted{0};
+};
+
+// Receives the frames of the sensors over UDP, acknowledges them and forwards them
+// to Graphite and Loki in batches, one payload per backend for all the sensors of a batch.
+class Relay
+{
+public:
+  explicit Relay(const RelayConfig &config);
+  ~Relay();
+
+  bool start();
+  // Forward the queued frames and stop
+  void stop();
+
+  uint16_t port() const { return boundPort; }
+  const RelayStats &stats() const { return counters; }
+
+private:
+  // Bits of Entry::pending
+  enum Backend : uint8_t
+  {
+    RELAY_GRAPHITE = 0x01,
+    RELAY_LOKI = 0x02
+  };
+
+  enum PostResult
+  {
+    POST_SENT,
+    POST_REFUSED, // The backend will not take this payload
+    POST_FAILED   // Worth sending again later
+  };
+
+  struct Entry
+  {
+    Frame frame;
+    std::chrono::steady_clock::time_point received;
+    uint8_t requeues;
+    uint8_t pending; // Backends the frame has still to reach
+    bool refused;    // By a backend
+  };
+
+  void receive();
+  void forward();
+  bool takeBatch(std::vector<Entry> &batch);
+  bool requeueBatch(std::vector<Entry> &batch);
+  void postBatch(HttpClient &graphite, HttpClient &loki, std::vector<Entry> &batch, std::vector<char> &buffer);
+  // Post the frames to a backend, false if it failed: the frames stay pending for it
+  bool postFrames(Backend backend, HttpClient &client, Entry *const *entries, size_t count, std::vector<char> &buffer);
+  // Payloads of the frames, length 0 if none has something for the backend
+  bool buildGraphite(Entry *const *entries, size_t count, std::vector<char> &buffer, size_t &length);
+  bool buildLoki(Entry *const *entries, size_t count, std::vector<char> &buffer, size_t &length);
+  PostResult post(HttpClient &client, const std::string &url, const std::string &auth, const std::vector<char> &buffer, size_t length);
+
+  RelayConfig config;
+  uint8_t backends; // Configured, Entry::pending of the new frames
+  int fd;
+  uint16_t boundPort;
+  std::atomic<bool> stopping;
+  std::thread receiveThread;
+  std::vector<std::thread> forwardThreads;
+
+  std::mutex mutex;
+  std::condition_variable ready;
+  std::deque<Entry> queue;
+  std::unordered_map<std::string, uint32_t> lastCrc; // Of each sensor, only used by the receive thread
+
+  RelayStats counters;
+};
+
+#endif
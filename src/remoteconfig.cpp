@@ -0,0 +1,263 @@
+#include "remoteconfig.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "crc32.h"
+#include "plant.h"
+
+static const char SOIL_TRIM[] = "soil_trim_";
+
+struct ConfigField
+{
+  const char *name;
+  int32_t scale; // Of the value, 1000 for the bands
+  int32_t min;
+  int32_t max;
+};
+
+// In the order of ConfigKey
+static const ConfigField FIELDS[CONFIG_VALUE_COUNT] = {
+    {"interval", 1, 1, UINT16_MAX},
+    {"min_interval", 1, 1, UINT16_MAX},
+    {"max_interval", 1, 1, UINT16_MAX},
+    {"upload_every", 1, 1, UINT8_MAX},
+    {"heartbeat", 1, 0, INT32_MAX},
+    {"temp_band", 1000, 0, 100000},
+    {"humidity_band", 1000, 0, 100000},
+    {"soil_band", 1000, 0, 100000},
+    {"battery_band", 1000, 0, 10000},
+    {"solar_band", 1000, 0, 100000},
+    {"display_low_power", 1, 0, 1},
+    {"display_full_every", 1, 1, UINT8_MAX},
+    {"update_check", 1, 0, INT32_MAX}};
+
+// Without the spaces around, in place
+static char *trim(char *text)
+{
+  while (*text == ' ' || *text == '\t')
+  {
+    text++;
+  }
+  char *end = text + strlen(text);
+  while (end > text && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r'))
+  {
+    *--end = '\0';
+  }
+
+  return text;
+}
+
+static bool parseValue(const ConfigField &field, const char *text, int32_t &value)
+{
+  char *end;
+  double parsed = field.scale == 1 ? strtol(text, &end, 10) : strtod(text, &end) * field.scale;
+  // NaN is out of any range
+  if (end == text || *end != '\0' || !(parsed >= field.min && parsed <= field.max))
+  {
+    return false;
+  }
+
+  value = lround(parsed);
+  return true;
+}
+
+static bool parseTrim(const char *key, const char *text, RemoteConfig &config)
+{
+  char *end;
+  unsigned long probe = strtoul(key + sizeof(SOIL_TRIM) - 1, &end, 10);
+  int air;
+  int water;
+  int length = 0;
+  if (*end != '\0' || probe >= SOIL_PROBE_COUNT || sscanf(text, "%d:%d%n", &air, &water, &length) != 2 ||
+      text[length] != '\0' || air == water || air < INT16_MIN || air > INT16_MAX || water < INT16_MIN || water > INT16_MAX)
+  {
+    return false;
+  }
+
+  config.soilTrims[probe] = {(int16_t)air, (int16_t)water};
+  config.set |= CONFIG_BIT(CONFIG_SOIL_TRIM + probe);
+  return true;
+}
+
+static bool parseLine(char *line, RemoteConfig &config)
+{
+  char *comment = strchr(line, '#');
+  if (comment)
+  {
+    *comment = '\0';
+  }
+  char *equals = strchr(line, '=');
+  if (!equals)
+  {
+    return *trim(line) == '\0';
+  }
+
+  *equals = '\0';
+  const char *key = trim(line);
+  const char *value = trim(equals + 1);
+  for (uint8_t i = 0; i < CONFIG_VALUE_COUNT; i++)
+  {
+    if (!strcmp(key, FIELDS[i].name))
+    {
+      config.set |= CONFIG_BIT(i);
+      return parseValue(FIELDS[i], value, config.values[i]);
+    }
+  }
+  if (!strncmp(key, SOIL_TRIM, sizeof(SOIL_TRIM) - 1))
+  {
+    return parseTrim(key, value, config);
+  }
+
+  // Unknown, e.g. for a newer firmware
+  return true;
+}
+
+// Methods --------------------------------------------------------------------
+
+bool parseConfig(char *document, RemoteConfig &config)
+{
+  config = {};
+  while (document)
+  {
+    char *next = strchr(document, '\n');
+    if (next)
+    {
+      *next++ = '\0';
+    }
+    if (!parseLine(document, config))
+    {
+      return false;
+    }
+    document = next;
+  }
+
+  // The bounds of the scheduler, with the ones of config.h for the missing keys
+  int32_t minInterval = config.set & CONFIG_BIT(CONFIG_MIN_INTERVAL) ? config.values[CONFIG_MIN_INTERVAL] : SCHED_MIN_INTERVAL_SEC;
+  int32_t maxInterval = config.set & CONFIG_BIT(CONFIG_MAX_INTERVAL) ? config.values[CONFIG_MAX_INTERVAL] : SCHED_MAX_INTERVAL_SEC;
+  return minInterval <= maxInterval;
+}
+
+void applyConfig(const RemoteConfig &config, NodeConfig &node)
+{
+  for (uint8_t key = 0; key < CONFIG_VALUE_COUNT; key++)
+  {
+    if (!(config.set & CONFIG_BIT(key)))
+    {
+      continue;
+    }
+
+    int32_t value = config.values[key];
+    switch ((ConfigKey)key)
+    {
+    case CONFIG_INTERVAL:
+      node.sampleIntervalSec = value;
+      break;
+    case CONFIG_MIN_INTERVAL:
+      node.minIntervalSec = value;
+      break;
+    case CONFIG_MAX_INTERVAL:
+      node.maxIntervalSec = value;
+      break;
+    case CONFIG_UPLOAD_EVERY:
+      node.uploadEvery = value;
+      break;
+    case CONFIG_HEARTBEAT:
+      node.deadband.heartbeatSec = value;
+      break;
+    case CONFIG_TEMP_BAND:
+      node.deadband.temp = value / 1000.0f;
+      break;
+    case CONFIG_HUMIDITY_BAND:
+      node.deadband.humidity = value / 1000.0f;
+      break;
+    case CONFIG_SOIL_BAND:
+      node.deadband.soilMoisture = value / 1000.0f;
+      break;
+    case CONFIG_BATTERY_BAND:
+      node.deadband.batteryVolts = value / 1000.0f;
+      break;
+    case CONFIG_SOLAR_BAND:
+      node.deadband.solarPanelVolts = value / 1000.0f;
+      break;
+    case CONFIG_DISPLAY_LOW_POWER:
+      node.displayLowPower = value;
+      break;
+    case CONFIG_DISPLAY_FULL_EVERY:
+      node.displayFullEvery = value;
+      break;
+    case CONFIG_UPDATE_CHECK:
+      node.updateCheckSec = value;
+      break;
+    default:
+      break;
+    }
+  }
+
+  for (uint8_t p = 0; p < SOIL_PROBE_COUNT; p++)
+  {
+    if (config.set & CONFIG_BIT(CONFIG_SOIL_TRIM + p))
+    {
+      node.soilTrims[p] = config.soilTrims[p];
+    }
+  }
+}
+
+bool loadConfigCache(StorageHal &storage, ConfigCache &cache)
+{
+  if (storage.read(CONFIG_CACHE_PATH, 0, &cache, sizeof(cache)) == sizeof(cache) && cache.magic == CONFIG_CACHE_MAGIC &&
+      cache.crc == crc32((const uint8_t *)&cache + sizeof(cache.crc), sizeof(cache) - sizeof(cache.crc)))
+  {
+    return true;
+  }
+
+  memset(&cache, 0, sizeof(cache));
+  return false;
+}
+
+bool saveConfigCache(StorageHal &storage, ConfigCache &cache)
+{
+  cache.magic = CONFIG_CACHE_MAGIC;
+  cache.crc = crc32((const uint8_t *)&cache + sizeof(cache.crc), sizeof(cache) - sizeof(cache.crc));
+
+  // A power loss in between only costs a full fetch
+  storage.remove(CONFIG_CACHE_PATH);
+  return storage.append(CONFIG_CACHE_PATH, &cache, sizeof(cache));
+}
+
+ConfigResult checkConfig(NetworkHal &network, WakeBudget &budget, const char *sensorId, ConfigCache &cache, char *buffer, size_t bufferSize)
+{
+  char target[sizeof(CONFIG_PATH) + 32];
+  int length = snprintf(target, sizeof(target), "%s%s", CONFIG_PATH, sensorId);
+  HttpResponse response;
+  if (length <= 0 || (size_t)length >= sizeof(target) ||
+      !httpGet(network, budget, CONFIG_HOST, CONFIG_PORT, target, cache.etag, response, buffer, bufferSize))
+  {
+    return CONFIG_FAILED;
+  }
+
+  ConfigResult result = CONFIG_FAILED;
+  if (response.status == 304)
+  {
+    result = CONFIG_UNCHANGED;
+  }
+  else if (response.status == 200 && response.contentLength >= 0 && (size_t)response.contentLength < bufferSize &&
+           (response.contentLength == 0 || network.readStream((uint8_t *)buffer, response.contentLength, budget.left())))
+  {
+    // Kept until the whole document is valid
+    RemoteConfig config;
+    buffer[response.contentLength] = '\0';
+    if (parseConfig(buffer, config))
+    {
+      cache.config = config;
+      strcpy(cache.etag, response.etag);
+      result = CONFIG_CHANGED;
+    }
+  }
+  network.closeStream();
+
+  return result;
+}
@@ -0,0 +1,88 @@
+#ifndef REMOTECONFIG_H
+#define REMOTECONFIG_H
+
+#include "budget.h"
+#include "compat.h"
+#include "hal.h"
+#include "http.h"
+#include "probes.h"
+
+// Settings pulled from a document on a server of the local network (CONFIG_PATH followed by the
+// sensor id), conditionally: an unchanged document costs a 304 and no body. One "key=value" per
+// line, "#" starts a comment, unknown keys are ignored and missing ones keep their value of
+// config.h. A new document takes effect from the next wake.
+//   interval, min_interval, max_interval  seconds (see SAMPLE_INTERVAL_SEC, SCHED_*_INTERVAL_SEC)
+//   upload_every                          wakes (BATCH_UPLOAD_EVERY)
+//   heartbeat                             seconds (DEADBAND_HEARTBEAT_SEC)
+//   temp_band, humidity_band, soil_band,  (DEADBAND_*)
+//   battery_band, solar_band
+//   display_low_power                     0 or 1 (DISPLAY_LOW_POWER)
+//   display_full_every                    refreshes (EINK_FULL_REFRESH_EVERY)
+//   update_check                          seconds (OTA_CHECK_SEC, 0 = never)
+//   soil_trim_<probe>                     "air:water" readings of the probe (see SoilTrim)
+#define CONFIG_CACHE_PATH "/config"
+#define CONFIG_CACHE_MAGIC 0x43464731
+
+struct NodeConfig;
+
+enum ConfigKey : uint8_t
+{
+  CONFIG_INTERVAL,
+  CONFIG_MIN_INTERVAL,
+  CONFIG_MAX_INTERVAL,
+  CONFIG_UPLOAD_EVERY,
+  CONFIG_HEARTBEAT,
+  CONFIG_TEMP_BAND,
+  CONFIG_HUMIDITY_BAND,
+  CONFIG_SOIL_BAND,
+  CONFIG_BATTERY_BAND,
+  CONFIG_SOLAR_BAND,
+  CONFIG_DISPLAY_LOW_POWER,
+  CONFIG_DISPLAY_FULL_EVERY,
+  CONFIG_UPDATE_CHECK,
+  CONFIG_VALUE_COUNT,
+  CONFIG_SOIL_TRIM = CONFIG_VALUE_COUNT // One per probe
+};
+
+#define CONFIG_BIT(key) (1UL << (key))
+
+static_assert(CONFIG_SOIL_TRIM + SAMPLE_MAX_PROBES <= 32, "Config keys do not fit in the bit mask");
+
+// Settings of a document, in the units of the keys (bands in 1/1000)
+struct RemoteConfig
+{
+  uint32_t set; // CONFIG_BIT() of the keys in the document
+  int32_t values[CONFIG_VALUE_COUNT];
+  SoilTrim soilTrims[SOIL_PROBE_COUNT];
+};
+
+// Kept in flash, read once per wake
+struct ConfigCache
+{
+  uint32_t crc; // Of the rest
+  uint32_t magic;
+  char etag[HTTP_ETAG_SIZE]; // Of the document, empty if there is none
+  RemoteConfig config;
+};
+
+enum ConfigResult
+{
+  CONFIG_UNCHANGED,
+  CONFIG_CHANGED, // The cache holds the new document, to be saved
+  CONFIG_FAILED
+};
+
+// Parse a document, false if a value is not valid or min_interval is over max_interval
+bool parseConfig(char *document, RemoteConfig &config);
+// Replace the settings of the node with the ones of the document
+void applyConfig(const RemoteConfig &config, NodeConfig &node);
+
+// Cached document, an empty one if there is none or it is corrupt
+bool loadConfigCache(StorageHal &storage, ConfigCache &cache);
+bool saveConfigCache(StorageHal &storage, ConfigCache &cache);
+
+// Fetch the document of the sensor within the current phase of the budget, unless it is the
+// cached one. The buffer holds the request and the document.
+ConfigResult checkConfig(NetworkHal &network, WakeBudget &budget, const char *sensorId, ConfigCache &cache, char *buffer, size_t bufferSize);
+
+#endif
@@ -0,0 +1,218 @@
+#include "remotewrite.h"
+
+// Protobuf fields of remote.proto and types.proto
+#define RW_REQUEST_TIMESERIES 1
+#define RW_SERIES_LABELS 1
+#define RW_SERIES_SAMPLES 2
+#define RW_LABEL_NAME 1
+#define RW_LABEL_VALUE 2
+#define RW_SAMPLE_VALUE 1
+#define RW_SAMPLE_TIMESTAMP 2
+
+#define PB_VARINT 0
+#define PB_FIXED64 1
+#define PB_LENGTH 2
+
+static const char RW_NAME[] PROGMEM = "__name__";
+static const char RW_PHASE[] PROGMEM = "phase";
+static const char RW_PLANT_ID[] PROGMEM = "plant_id";
+static const char RW_PROBE[] PROGMEM = "probe";
+
+static const char RW_TRACE_AWAKE[] PROGMEM = "trace_awake_ms";
+static const char RW_TRACE_OVERRUNS[] PROGMEM = "trace_overruns";
+static const char RW_TRACE_MS[] PROGMEM = "trace_ms";
+static const char RW_TRACE_FREE_HEAP[] PROGMEM = "trace_free_heap";
+static const char RW_TRACE_MAX_FREE_BLOCK[] PROGMEM = "trace_max_free_block";
+static const char RW_TRACE_FRAGMENTATION[] PROGMEM = "trace_fragmentation";
+
+// Writer ---------------------------------------------------------------------
+
+namespace
+{
+
+// Encodes protobuf into the compressor, or only counts the bytes if there is none
+class ProtoWriter
+{
+public:
+  explicit ProtoWriter(SnappyWriter *out) : out(out), len(0) {}
+
+  void byte(uint8_t c)
+  {
+    if (out)
+    {
+      out->write(c);
+    }
+    len++;
+  }
+
+  void varint(uint64_t value)
+  {
+    while (value >= 0x80)
+    {
+      byte(value | 0x80);
+      value >>= 7;
+    }
+    byte(value);
+  }
+
+  void tag(uint8_t field, uint8_t wireType)
+  {
+    varint(field << 3 | wireType);
+  }
+
+  void string(uint8_t field, const char *str)
+  {
+    size_t strLen = strlen(str);
+    tag(field, PB_LENGTH);
+    varint(strLen);
+    for (size_t i = 0; i < strLen; i++)
+    {
+      byte(str[i]);
+    }
+  }
+
+  void string_P(uint8_t field, PGM_P str)
+  {
+    size_t strLen = strlen_P(str);
+    tag(field, PB_LENGTH);
+    varint(strLen);
+    for (size_t i = 0; i < strLen; i++)
+    {
+      byte(pgm_read_byte(str + i));
+    }
+  }
+
+  void fixed64(uint8_t field, double value)
+  {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    tag(field, PB_FIXED64);
+    for (uint8_t i = 0; i < 8; i++)
+    {
+      byte(bits >> (8 * i));
+    }
+  }
+
+  // Nested messages are prefixed with their length, found by encoding them twice
+  template <typename Encode>
+  void message(uint8_t field, Encode encode)
+  {
+    ProtoWriter counter(nullptr);
+    encode(counter);
+    tag(field, PB_LENGTH);
+    varint(counter.length());
+    encode(*this);
+  }
+
+  size_t length() const { return len; }
+
+private:
+  SnappyWriter *out;
+  size_t len;
+};
+
+} // namespace
+
+// Series ---------------------------------------------------------------------
+
+// Labels must be sorted by name: __name__, phase, plant_id, probe
+static void writeLabels(ProtoWriter &w, PGM_P name, PGM_P phase, const char *sensorId, int8_t probe)
+{
+  w.message(RW_SERIES_LABELS, [&](ProtoWriter &m) {
+    m.string_P(RW_LABEL_NAME, RW_NAME);
+    m.string_P(RW_LABEL_VALUE, name);
+  });
+  if (phase)
+  {
+    w.message(RW_SERIES_LABELS, [&](ProtoWriter &m) {
+      m.string_P(RW_LABEL_NAME, RW_PHASE);
+      m.string_P(RW_LABEL_VALUE, phase);
+    });
+  }
+  w.message(RW_SERIES_LABELS, [&](ProtoWriter &m) {
+    m.string_P(RW_LABEL_NAME, RW_PLANT_ID);
+    m.string(RW_LABEL_VALUE, sensorId);
+  });
+  if (probe >= 0)
+  {
+    // Single digit, SAMPLE_MAX_PROBES <= 10
+    char value[2] = {(char)('0' + probe), '\0'};
+    w.message(RW_SERIES_LABELS, [&](ProtoWriter &m) {
+      m.string_P(RW_LABEL_NAME, RW_PROBE);
+      m.string(RW_LABEL_VALUE, value);
+    });
+  }
+}
+
+static void writeSample(ProtoWriter &w, double value, unsigned long ts)
+{
+  w.message(RW_SERIES_SAMPLES, [&](ProtoWriter &m) {
+    m.fixed64(RW_SAMPLE_VALUE, value);
+    m.tag(RW_SAMPLE_TIMESTAMP, PB_VARINT);
+    m.varint((uint64_t)ts * 1000);
+  });
+}
+
+static void writeTraceSeries(ProtoWriter &w, PGM_P name, PGM_P phase, unsigned long value, unsigned long ts, const char *sensorId)
+{
+  w.message(RW_REQUEST_TIMESERIES, [&](ProtoWriter &m) {
+    writeLabels(m, name, phase, sensorId, -1);
+    writeSample(m, value, ts);
+  });
+}
+
+static void writeRequest(ProtoWriter &w, const Sample *samples, size_t count, const Trace *trace, const char *sensorId)
+{
+  for (uint8_t series = 0; series < METRIC_SERIES_COUNT && count > 0; series++)
+  {
+    MetricId metric = seriesMetric(series);
+    uint8_t probes = metricProbes(samples[0], metric);
+    for (uint8_t p = 0; p < probes; p++)
+    {
+      // Samples are oldest first, as remote write wants them
+      w.message(RW_REQUEST_TIMESERIES, [&](ProtoWriter &m) {
+        writeLabels(m, metricName(metric), nullptr, sensorId, probes > 1 ? p : -1);
+        for (size_t i = 0; i < count; i++)
+        {
+          writeSample(m, metricValue(samples[i], metric, p), samples[i].ts);
+        }
+      });
+    }
+  }
+
+  if (!trace)
+  {
+    return;
+  }
+
+  writeTraceSeries(w, RW_TRACE_AWAKE, nullptr, trace->awakeMs, trace->ts, sensorId);
+  writeTraceSeries(w, RW_TRACE_OVERRUNS, nullptr, trace->overruns, trace->ts, sensorId);
+  for (uint8_t p = 0; p < TRACE_PHASE_COUNT; p++)
+  {
+    if (!traceHasPhase(*trace, (TracePhase)p))
+    {
+      continue;
+    }
+
+    PGM_P phase = tracePhaseName(p);
+    writeTraceSeries(w, RW_TRACE_MS, phase, trace->phaseMs[p], trace->ts, sensorId);
+    writeTraceSeries(w, RW_TRACE_FREE_HEAP, phase, trace->freeHeap[p], trace->ts, sensorId);
+    writeTraceSeries(w, RW_TRACE_MAX_FREE_BLOCK, phase, trace->maxFreeBlock[p], trace->ts, sensorId);
+    writeTraceSeries(w, RW_TRACE_FRAGMENTATION, phase, trace->fragmentation[p], trace->ts, sensorId);
+  }
+}
+
+// Payload --------------------------------------------------------------------
+
+size_t buildRemoteWritePayload(uint8_t *buffer, size_t size, const Sample *samples, size_t count, const Trace *trace, const char *sensorId)
+{
+  // The compressed stream starts with the uncompressed length
+  ProtoWriter counter(nullptr);
+  writeRequest(counter, samples, count, trace, sensorId);
+
+  SnappyWriter snappy(buffer, size, counter.length());
+  ProtoWriter w(&snappy);
+  writeRequest(w, samples, count, trace, sensorId);
+
+  return snappy.finish();
+}
@@ -0,0 +1,25 @@
+#ifndef REMOTEWRITE_H
+#define REMOTEWRITE_H
+
+#include "compat.h"
+#include "payload.h"
+#include "sample.h"
+#include "snappy.h"
+#include "trace.h"
+
+// Prometheus remote write (WriteRequest protobuf, snappy compressed) with the same series as
+// the Graphite payload, labelled with plant_id. The trace series are trace_* with a phase label,
+// with several soil probes the series of their values have a probe label.
+
+// Upper bound of the encoded size of a series, with the probe label
+#define REMOTE_WRITE_SERIES_SIZE(samples, idLen) (96 + (idLen) + (samples) * 22)
+#define REMOTE_WRITE_PROTO_SIZE(count, probes, idLen, trace)                     \
+  (METRIC_SAMPLE_SERIES_COUNT(probes) * REMOTE_WRITE_SERIES_SIZE(count, idLen) + \
+   ((trace) ? GRAPHITE_TRACE_METRIC_COUNT * REMOTE_WRITE_SERIES_SIZE(1, idLen) : 0))
+#define REMOTE_WRITE_PAYLOAD_SIZE(count, probes, idLen, trace) SNAPPY_MAX_COMPRESSED(REMOTE_WRITE_PROTO_SIZE(count, probes, idLen, trace))
+
+// Build the payload, the protobuf is compressed while it is encoded. The samples have the same probes.
+// Return the payload length, 0 if it does not fit.
+size_t buildRemoteWritePayload(uint8_t *buffer, size_t size, const Sample *samples, size_t count, const Trace *trace, const char *sensorId);
+
+#endif
@@ -0,0 +1,47 @@
+#include "rle.h"
+
+RleReader::RleReader(const RleImage &image) : image(image), pos(0), remaining(0), white(false), x(0), y(0)
+{
+}
+
+bool RleReader::next(RleRun &run)
+{
+  while (remaining == 0)
+  {
+    if (pos >= image.length || y >= image.height)
+    {
+      return false;
+    }
+
+    uint8_t shift = 0;
+    uint8_t b;
+    do
+    {
+      b = pgm_read_byte(&image.runs[pos++]);
+      remaining |= (uint32_t)(b & 0x7f) << shift;
+      shift += 7;
+    } while ((b & 0x80) && pos < image.length && shift < 32);
+    white = !white;
+  }
+
+  if (y >= image.height)
+  {
+    return false;
+  }
+
+  uint16_t length = remaining < (uint32_t)(image.width - x) ? remaining : image.width - x;
+  run.x = x;
+  run.y = y;
+  run.length = length;
+  run.white = white;
+
+  remaining -= length;
+  x += length;
+  if (x == image.width)
+  {
+    x = 0;
+    y++;
+  }
+
+  return true;
+}
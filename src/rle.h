@@ -0,0 +1,44 @@
+#ifndef RLE_H
+#define RLE_H
+
+#include "compat.h"
+
+// 1 bpp image compressed by tools/eink_asset.py: the lengths of the runs of pixels of the
+// same color in row order, as varints (7 bits per byte, low first). Colors alternate, the
+// first run is white and may be empty. Runs can span several rows.
+struct RleImage
+{
+  uint16_t width;
+  uint16_t height;
+  const uint8_t *runs; // PROGMEM
+  size_t length;
+};
+
+// Run of pixels on a single row
+struct RleRun
+{
+  uint16_t x;
+  uint16_t y;
+  uint16_t length;
+  bool white;
+};
+
+// Streams the runs of an image, without decompressing it anywhere
+class RleReader
+{
+public:
+  RleReader(const RleImage &image);
+
+  // Next run, split at the end of the rows. Return false at the end of the image.
+  bool next(RleRun &run);
+
+private:
+  const RleImage &image;
+  size_t pos;
+  uint32_t remaining; // Pixels left in the current run
+  bool white;
+  uint16_t x;
+  uint16_t y;
+};
+
+#endif
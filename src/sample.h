@@ -0,0 +1,39 @@
+#ifndef SAMPLE_H
+#define SAMPLE_H
+
+struct AirCondition
+{
+  float temp;
+  float humidity;
+  float dew_point;
+};
+
+struct ValPerc
+{
+  int raw;
+  int percentage;
+};
+
+struct ValPercFloat
+{
+  float raw;
+  float percentage;
+};
+
+// Soil probes a sample can carry
+#define SAMPLE_MAX_PROBES 4
+
+struct Sample
+{
+  unsigned long ts;
+  AirCondition air;
+  ValPerc soil[SAMPLE_MAX_PROBES];
+  uint8_t probes; // Soil probes measured, at least 1
+  ValPercFloat battery;
+  float solarPanelVolt;
+  float timeError;        // Estimated error of ts, in seconds
+  unsigned long interval; // Seconds until the next sample
+  unsigned int suppressed; // Samples not sent (within the deadbands) before this one
+};
+
+#endif
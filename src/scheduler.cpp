@@ -0,0 +1,96 @@
+#include "scheduler.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "config.h"
+
+static uint16_t saturate16(float value)
+{
+  return value < UINT16_MAX ? (uint16_t)lroundf(value) : UINT16_MAX;
+}
+
+static uint32_t clampInterval(uint32_t sec, uint32_t minSec, uint32_t maxSec)
+{
+  if (sec < minSec)
+  {
+    return minSec;
+  }
+  if (sec > maxSec)
+  {
+    return maxSec;
+  }
+  return sec;
+}
+
+// Fraction of the range between the bounds that can be used, 1 = down to the shortest interval
+static float energyLevel(const Sample &sample)
+{
+  if (sample.battery.percentage < SCHED_LOW_BATTERY_PERC)
+  {
+    return 0;
+  }
+  if (sample.solarPanelVolt >= SCHED_SOLAR_CHARGING_VOLTS)
+  {
+    return 1;
+  }
+  return sample.battery.percentage / 100.0;
+}
+
+uint32_t scheduleInterval(ScheduleState &state, const Sample &sample, uint32_t defaultSec, uint32_t minSec, uint32_t maxSec)
+{
+  int16_t temp = lroundf(sample.air.temp * 100);
+  uint32_t interval;
+
+  if (minSec == 0)
+  {
+    minSec = 1;
+  }
+
+  if (!state.valid || state.intervalSec == 0)
+  {
+    // Nothing to compare with yet
+    interval = clampInterval(defaultSec, minSec, maxSec);
+  }
+  else
+  {
+    // Rates since the last sample, smoothed to ignore single noisy readings
+    float hours = state.intervalSec / 3600.0;
+    float tempRate = abs(temp - state.temp) / hours;
+    float soilRate = 0;
+    for (uint8_t p = 0; p < SOIL_PROBE_COUNT; p++)
+    {
+      float rate = soilChange(p, state.soilRaw[p], sample.soil[p].raw) * 10 / hours;
+      soilRate = rate > soilRate ? rate : soilRate;
+    }
+    state.tempRate = saturate16((state.tempRate + tempRate) / 2);
+    state.soilRate = saturate16((state.soilRate + soilRate) / 2);
+
+    // 1 when changing at the configured fast rates
+    float activity = state.tempRate / (SCHED_TEMP_RATE * 100.0);
+    float soilActivity = state.soilRate / (SCHED_SOIL_RATE * 10.0);
+    activity = activity > soilActivity ? activity : soilActivity;
+
+    // The longest interval when nothing changes, the shortest when changing fast
+    float wanted = maxSec / (1 + activity * ((float)maxSec / minSec - 1));
+    // Without enough energy, do not go below a share of the range
+    float allowed = maxSec - (maxSec - minSec) * energyLevel(sample);
+
+    interval = clampInterval(lroundf(wanted > allowed ? wanted : allowed), minSec, maxSec);
+  }
+
+  state.temp = temp;
+  for (uint8_t p = 0; p < SOIL_PROBE_COUNT; p++)
+  {
+    state.soilRaw[p] = sample.soil[p].raw;
+  }
+  state.intervalSec = interval < UINT16_MAX ? interval : UINT16_MAX;
+  state.valid = 1;
+
+  return interval;
+}
+
+void scheduleReset(ScheduleState &state)
+{
+  memset(&state, 0, sizeof(state));
+}
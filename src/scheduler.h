@@ -0,0 +1,27 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "compat.h"
+#include "probes.h"
+#include "sample.h"
+
+// History used to choose the sample interval, stored in RTC memory
+struct ScheduleState
+{
+  int16_t temp;                      // Last sample, 1/100 C
+  int16_t soilRaw[SOIL_PROBE_COUNT]; // Last sample
+  uint16_t intervalSec;              // Interval chosen after the last sample
+  uint8_t valid;
+  uint8_t reserved;
+  uint16_t tempRate; // Smoothed rate of change, 1/100 C per hour
+  uint16_t soilRate; // Smoothed rate of change, 1/10 % per hour, of the fastest probe
+};
+
+// Choose the interval until the next sample, within the given bounds.
+// It gets longer when the battery is low and not charging, shorter when the
+// temperature or the soil moisture are changing fast.
+uint32_t scheduleInterval(ScheduleState &state, const Sample &sample, uint32_t defaultSec, uint32_t minSec, uint32_t maxSec);
+// Forget the history, e.g. after an invalid sample
+void scheduleReset(ScheduleState &state);
+
+#endif
@@ -0,0 +1,113 @@
+#include "screen.h"
+
+#include <math.h>
+#include <stdio.h>
+
+#include "metrics.h"
+
+// Append the unit of the metric to the value in text
+static void appendUnit(char *text, size_t size, MetricId metric)
+{
+  PGM_P unit = metricUnit(metric);
+  size_t length = strlen(text);
+  size_t unitLength = strlen_P(unit);
+  if (length + unitLength < size)
+  {
+    memcpy_P(text + length, unit, unitLength + 1);
+  }
+}
+
+static uint16_t minuteOfDay(unsigned long ts)
+{
+  return (ts / 60) % (24 * 60);
+}
+
+ScreenValues screenValues(const Sample &sample, unsigned long nextTs)
+{
+  // The driest of the probes, the first pot to water
+  int soil = sample.soil[0].percentage;
+  for (uint8_t p = 1; p < sample.probes; p++)
+  {
+    soil = sample.soil[p].percentage < soil ? sample.soil[p].percentage : soil;
+  }
+
+  ScreenValues values = {
+      minuteOfDay(sample.ts),
+      minuteOfDay(nextTs),
+      (int16_t)lroundf(sample.air.temp * 10),
+      (uint8_t)soil,
+      (uint8_t)lroundf(sample.air.humidity)};
+
+  return values;
+}
+
+ScreenUpdate screenUpdate(ScreenState &state, const ScreenValues &values, uint8_t fullEvery)
+{
+  ScreenUpdate update = {};
+  update.previous = state.shown;
+
+  if (values.timeMin != state.shown.timeMin)
+  {
+    update.dirty |= SCREEN_BIT(SCREEN_TIME);
+  }
+  if (values.soil != state.shown.soil)
+  {
+    update.dirty |= SCREEN_BIT(SCREEN_SOIL);
+  }
+  if (values.temp != state.shown.temp)
+  {
+    update.dirty |= SCREEN_BIT(SCREEN_TEMP);
+  }
+  if (values.humidity != state.shown.humidity)
+  {
+    update.dirty |= SCREEN_BIT(SCREEN_HUMIDITY);
+  }
+  if (values.nextMin != state.shown.nextMin)
+  {
+    update.dirty |= SCREEN_BIT(SCREEN_NEXT);
+  }
+
+  if (!state.valid || (update.dirty && state.partials + 1 >= fullEvery))
+  {
+    update.full = true;
+    update.dirty = SCREEN_ALL;
+    state.partials = 0;
+  }
+  else if (update.dirty)
+  {
+    state.partials++;
+  }
+
+  state.shown = values;
+  state.valid = 1;
+
+  return update;
+}
+
+void screenText(const ScreenValues &values, ScreenField field, char *text, size_t size)
+{
+  switch (field)
+  {
+  case SCREEN_TIME:
+    snprintf(text, size, "%02u:%02u", values.timeMin / 60, values.timeMin % 60);
+    break;
+  case SCREEN_SOIL:
+    snprintf(text, size, "%u", values.soil);
+    appendUnit(text, size, METRIC_SOIL_MOISTURE);
+    break;
+  case SCREEN_TEMP:
+    snprintf(text, size, "%.1f", values.temp / 10.0);
+    appendUnit(text, size, METRIC_TEMPERATURE);
+    break;
+  case SCREEN_HUMIDITY:
+    snprintf(text, size, "%u", values.humidity);
+    appendUnit(text, size, METRIC_HUMIDITY);
+    break;
+  case SCREEN_NEXT:
+    snprintf(text, size, "Next at %02u:%02u", values.nextMin / 60, values.nextMin % 60);
+    break;
+  default:
+    text[0] = '\0';
+    break;
+  }
+}
@@ -0,0 +1,55 @@
+#ifndef SCREEN_H
+#define SCREEN_H
+
+#include "compat.h"
+#include "sample.h"
+
+// Fields of the info screen
+enum ScreenField
+{
+  SCREEN_TIME,
+  SCREEN_SOIL,
+  SCREEN_TEMP,
+  SCREEN_HUMIDITY,
+  SCREEN_NEXT, // Time of the next wake
+  SCREEN_FIELD_COUNT
+};
+
+#define SCREEN_BIT(field) (1 << (field))
+#define SCREEN_ALL ((1 << SCREEN_FIELD_COUNT) - 1)
+#define SCREEN_TEXT_SIZE 16
+
+// Values with the resolution they are shown with, a change of the value is a change on screen
+struct ScreenValues
+{
+  uint16_t timeMin; // Minutes since midnight
+  uint16_t nextMin;
+  int16_t temp;     // 1/10 C
+  uint8_t soil;     // %, of the driest probe
+  uint8_t humidity; // %
+};
+
+// Last rendered screen, stored in RTC memory
+struct ScreenState
+{
+  ScreenValues shown;
+  uint8_t partials; // Partial refreshes since the last full one
+  uint8_t valid;
+};
+
+// What to redraw
+struct ScreenUpdate
+{
+  bool full;             // Whole screen, clears the ghosting of the partial refreshes
+  uint8_t dirty;         // Fields that changed (bit mask of SCREEN_BIT())
+  ScreenValues previous; // Shown before, their text has to be erased
+};
+
+ScreenValues screenValues(const Sample &sample, unsigned long nextTs);
+// Compare with the last rendered screen and record the new one. A full refresh is done on
+// the first render and after fullEvery - 1 partial ones.
+ScreenUpdate screenUpdate(ScreenState &state, const ScreenValues &values, uint8_t fullEvery);
+// Text of a field, e.g. "21.5C"
+void screenText(const ScreenValues &values, ScreenField field, char *text, size_t size);
+
+#endif
@@ -0,0 +1,141 @@
+#include "snappy.h"
+
+#define SNAPPY_TAG_LITERAL 0
+#define SNAPPY_TAG_COPY_1 1 // Length 4..11, offset < 2048
+#define SNAPPY_TAG_COPY_2 2 // Length 1..64, offset < 65536
+#define SNAPPY_MAX_COPY 64
+
+SnappyWriter::SnappyWriter(uint8_t *buffer, size_t size, size_t inputLength)
+    : buffer(buffer), size(size), len(0), overflowed(inputLength > SNAPPY_MAX_INPUT), inputLength(inputLength),
+      pos(0), literalStart(0), matchSource(0), matchLength(0), table()
+{
+  // Preamble: uncompressed length as varint
+  uint32_t value = inputLength;
+  while (value >= 0x80)
+  {
+    output(value | 0x80);
+    value >>= 7;
+  }
+  output(value);
+}
+
+void SnappyWriter::write(const uint8_t *data, size_t length)
+{
+  for (size_t i = 0; i < length; i++)
+  {
+    write(data[i]);
+  }
+}
+
+void SnappyWriter::write(uint8_t c)
+{
+  uint32_t p = pos++;
+  window[p & (SNAPPY_WINDOW - 1)] = c;
+
+  if (matchLength > 0)
+  {
+    if (matchLength < SNAPPY_MAX_COPY && at(matchSource + matchLength) == c)
+    {
+      matchLength++;
+      return;
+    }
+    flushCopy();
+  }
+
+  // Look for an earlier occurrence of the last 4 pending bytes
+  if (p + 1 - literalStart >= 4)
+  {
+    uint32_t start = p - 3;
+    uint32_t bytes = at(start) | at(start + 1) << 8 | at(start + 2) << 16 | (uint32_t)at(start + 3) << 24;
+    uint16_t hash = ((bytes * 0x1e35a7bdUL) >> 16) & (SNAPPY_HASH_SIZE - 1);
+    uint32_t candidate = table[hash];
+    table[hash] = start + 1;
+
+    if (candidate > 0 && start - (candidate - 1) < SNAPPY_WINDOW)
+    {
+      uint32_t source = candidate - 1;
+      if (at(source) == at(start) && at(source + 1) == at(start + 1) && at(source + 2) == at(start + 2) && at(source + 3) == at(start + 3))
+      {
+        flushLiteral(start);
+        matchSource = source;
+        matchLength = 4;
+        return;
+      }
+    }
+  }
+
+  // Keep the last 3 bytes pending, they may start a match
+  if (pos - literalStart >= SNAPPY_MAX_LITERAL)
+  {
+    flushLiteral(pos - 3);
+  }
+}
+
+size_t SnappyWriter::finish()
+{
+  if (matchLength > 0)
+  {
+    flushCopy();
+  }
+  flushLiteral(pos);
+
+  return overflowed || pos != inputLength ? 0 : len;
+}
+
+void SnappyWriter::output(uint8_t c)
+{
+  if (len >= size)
+  {
+    overflowed = true;
+    return;
+  }
+
+  buffer[len++] = c;
+}
+
+void SnappyWriter::flushLiteral(uint32_t end)
+{
+  uint32_t length = end - literalStart;
+  if (length == 0)
+  {
+    return;
+  }
+
+  // Lengths over 60 take an extra byte
+  if (length <= 60)
+  {
+    output(SNAPPY_TAG_LITERAL | (length - 1) << 2);
+  }
+  else
+  {
+    output(SNAPPY_TAG_LITERAL | 60 << 2);
+    output(length - 1);
+  }
+
+  for (uint32_t i = literalStart; i < end; i++)
+  {
+    output(at(i));
+  }
+  literalStart = end;
+}
+
+void SnappyWriter::flushCopy()
+{
+  // The literal before the match was flushed when it started
+  uint32_t offset = literalStart - matchSource;
+
+  if (matchLength <= 11 && offset < 2048)
+  {
+    output(SNAPPY_TAG_COPY_1 | (matchLength - 4) << 2 | (offset >> 8) << 5);
+    output(offset);
+  }
+  else
+  {
+    output(SNAPPY_TAG_COPY_2 | (matchLength - 1) << 2);
+    output(offset);
+    output(offset >> 8);
+  }
+
+  literalStart += matchLength;
+  matchLength = 0;
+}
@@ -0,0 +1,49 @@
+#ifndef SNAPPY_H
+#define SNAPPY_H
+
+#include "compat.h"
+
+// Snappy block format compressor fed a few bytes at a time, so the input never
+// has to be in memory at once. Matches are only searched in the last SNAPPY_WINDOW
+// bytes, which is plenty for the repeated labels of a payload.
+
+#define SNAPPY_WINDOW 1024    // Power of 2
+#define SNAPPY_HASH_SIZE 256  // Power of 2
+#define SNAPPY_MAX_LITERAL 64 // Pending literal bytes flushed at once
+#define SNAPPY_MAX_INPUT 65535
+
+// Upper bound of the compressed size
+#define SNAPPY_MAX_COMPRESSED(length) (32 + (length) + (length) / 6)
+
+class SnappyWriter
+{
+public:
+  // The uncompressed length comes first in the output, so it must be known up front
+  SnappyWriter(uint8_t *buffer, size_t size, size_t inputLength);
+
+  void write(uint8_t c);
+  void write(const uint8_t *data, size_t length);
+  // Flush the pending bytes. Return the compressed length, 0 on overflow or if the input length was wrong.
+  size_t finish();
+
+private:
+  void output(uint8_t c);
+  void flushLiteral(uint32_t end);
+  void flushCopy();
+  uint8_t at(uint32_t pos) const { return window[pos & (SNAPPY_WINDOW - 1)]; }
+
+  uint8_t *buffer;
+  size_t size;
+  size_t len;
+  bool overflowed;
+  uint32_t inputLength;
+
+  uint32_t pos;          // Input bytes so far
+  uint32_t literalStart; // First input byte not emitted yet
+  uint32_t matchSource;  // Start of the copy source, if matchLength > 0
+  uint32_t matchLength;
+  uint8_t window[SNAPPY_WINDOW];
+  uint16_t table[SNAPPY_HASH_SIZE]; // Position + 1 of the last 4 bytes with each hash
+};
+
+#endif
@@ -0,0 +1,98 @@
+#include "timekeeper.h"
+
+// Drift uncertainty before anything was learned, and the best it can get to
+#define TIME_DRIFT_ERROR_PPM 50000
+#define TIME_DRIFT_MIN_ERROR_PPM 500
+// NTP only gives whole seconds
+#define TIME_SYNC_ERROR_MS 500
+
+static uint64_t getRefMs(const TimeState &state)
+{
+  return (uint64_t)state.refSec * 1000 + state.refMs;
+}
+
+static void setRefMs(TimeState &state, uint64_t ms)
+{
+  state.refSec = ms / 1000;
+  state.refMs = ms % 1000;
+}
+
+static uint32_t getDriftErrorPpm(const TimeState &state)
+{
+  return state.driftErrorPpm > 0 ? state.driftErrorPpm : TIME_DRIFT_ERROR_PPM;
+}
+
+void timeWake(TimeState &state)
+{
+  if (!state.valid)
+  {
+    return;
+  }
+
+  int64_t slept = (int64_t)state.sleepMs * (1000000 + state.driftPpm) / 1000000;
+
+  setRefMs(state, getRefMs(state) + slept);
+  state.errorMs += (uint64_t)state.sleepMs * getDriftErrorPpm(state) / 1000000;
+  state.sleptSinceSyncMs = state.sleptSinceSyncMs < UINT32_MAX - state.sleepMs ? state.sleptSinceSyncMs + state.sleepMs : UINT32_MAX;
+  state.sleepMs = 0;
+}
+
+void timeReset(TimeState &state)
+{
+  state.valid = 0;
+  state.sleepMs = 0;
+  state.sleptSinceSyncMs = 0;
+}
+
+uint32_t timeNow(const TimeState &state, uint32_t awakeMs)
+{
+  return (getRefMs(state) + awakeMs) / 1000;
+}
+
+uint32_t timeError(const TimeState &state)
+{
+  return state.valid ? state.errorMs : UINT32_MAX;
+}
+
+bool timeNeedsSync(const TimeState &state, uint32_t awakeMs, uint32_t resyncSec, uint32_t maxErrorMs)
+{
+  if (!state.valid)
+  {
+    return true;
+  }
+
+  return timeNow(state, awakeMs) - state.syncEpoch >= resyncSec || state.errorMs > maxErrorMs;
+}
+
+void timeSynced(TimeState &state, uint32_t epoch, uint32_t awakeMs)
+{
+  int64_t syncedMs = (int64_t)epoch * 1000 + TIME_SYNC_ERROR_MS;
+
+  // The residual error over the slept time gives the drift left to correct.
+  // Only learn from it if it is more precise than what is already known.
+  if (state.valid && state.sleptSinceSyncMs > 0)
+  {
+    uint32_t measureErrorPpm = (uint64_t)2 * TIME_SYNC_ERROR_MS * 1000000 / state.sleptSinceSyncMs;
+    if (measureErrorPpm < getDriftErrorPpm(state))
+    {
+      int64_t estimatedMs = getRefMs(state) + awakeMs;
+      int32_t residualPpm = (syncedMs - estimatedMs) * 1000000 / state.sleptSinceSyncMs;
+      state.driftPpm += state.driftErrorPpm > 0 ? residualPpm / 2 : residualPpm;
+
+      uint32_t driftErrorPpm = measureErrorPpm + (residualPpm < 0 ? -residualPpm : residualPpm) / 2;
+      state.driftErrorPpm = driftErrorPpm > TIME_DRIFT_MIN_ERROR_PPM ? driftErrorPpm : TIME_DRIFT_MIN_ERROR_PPM;
+    }
+  }
+
+  setRefMs(state, syncedMs - awakeMs);
+  state.errorMs = TIME_SYNC_ERROR_MS;
+  state.sleptSinceSyncMs = 0;
+  state.syncEpoch = epoch;
+  state.valid = 1;
+}
+
+void timeSleep(TimeState &state, uint32_t awakeMs, uint32_t sleepMs)
+{
+  setRefMs(state, getRefMs(state) + awakeMs);
+  state.sleepMs = sleepMs;
+}
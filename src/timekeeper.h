@@ -0,0 +1,37 @@
+#ifndef TIMEKEEPER_H
+#define TIMEKEEPER_H
+
+#include "compat.h"
+
+// Wall-clock time kept across deep sleeps, stored in RTC memory.
+// The reference is the epoch (in ms) at boot, i.e. when millis() was 0.
+struct TimeState
+{
+  uint32_t refSec;
+  uint16_t refMs;
+  uint8_t valid;
+  uint8_t reserved;
+  int32_t driftPpm;          // Learned deviation of the sleep duration from the intended one
+  uint32_t driftErrorPpm;    // Uncertainty of the learned drift (0 = not learned yet)
+  uint32_t errorMs;          // Estimated error of the reference
+  uint32_t sleepMs;          // Intended duration of the ongoing deep sleep
+  uint32_t sleptSinceSyncMs; // Intended sleep time since the last sync
+  uint32_t syncEpoch;        // Epoch of the last sync
+};
+
+// Move the reference from the start of the deep sleep to this boot
+void timeWake(TimeState &state);
+// Invalidate the time, e.g. if the wake was not caused by the deep sleep timer
+void timeReset(TimeState &state);
+// Estimated epoch (seconds) at the given millis()
+uint32_t timeNow(const TimeState &state, uint32_t awakeMs);
+// Estimated error (ms) at the given millis()
+uint32_t timeError(const TimeState &state);
+// Whether the time should be synced with NTP
+bool timeNeedsSync(const TimeState &state, uint32_t awakeMs, uint32_t resyncSec, uint32_t maxErrorMs);
+// Set the time from NTP (seconds resolution) and learn the drift
+void timeSynced(TimeState &state, uint32_t epoch, uint32_t awakeMs);
+// Record the start of a deep sleep of the given duration
+void timeSleep(TimeState &state, uint32_t awakeMs, uint32_t sleepMs);
+
+#endif
@@ -0,0 +1,49 @@
+#include "tlssessions.h"
+
+void loadTlsSessions(StorageHal &storage, TlsSessions &sessions)
+{
+  if (storage.read(TLS_SESSION_FILE, 0, sessions.slots, sizeof(sessions.slots)) != sizeof(sessions.slots))
+  {
+    memset(sessions.slots, 0, sizeof(sessions.slots));
+  }
+  memset(sessions.owners, 0, sizeof(sessions.owners));
+}
+
+const uint8_t *tlsSession(const TlsSessions &sessions, Backend backend)
+{
+  return sessions.slots[TLS_SESSION_SLOT(backend)];
+}
+
+TlsHandshake recordTlsSession(TlsSessions &sessions, Backend backend, const void *session, size_t size, int httpCode,
+                              StorageHal *flash)
+{
+  // No handshake happened if the connection failed
+  if (httpCode <= 0 || size > TLS_SESSION_SIZE)
+  {
+    return TLS_NO_HANDSHAKE;
+  }
+
+  // A resumed session keeps the same id and master secret
+  uint8_t *slot = sessions.slots[TLS_SESSION_SLOT(backend)];
+  if (memcmp(slot, session, size) == 0)
+  {
+    sessions.resumed++;
+    return TLS_RESUMED;
+  }
+
+  sessions.full++;
+  uint8_t &owner = sessions.owners[TLS_SESSION_SLOT(backend)];
+  bool evicted = owner != 0 && owner != backend + 1;
+  owner = backend + 1;
+  memcpy(slot, session, size);
+  memset(slot + size, 0, TLS_SESSION_SIZE - size);
+
+  // Only write flash when a new session was negotiated, not on each switch of a shared slot
+  if (flash && !evicted)
+  {
+    flash->remove(TLS_SESSION_FILE);
+    flash->append(TLS_SESSION_FILE, sessions.slots, sizeof(sessions.slots));
+  }
+
+  return TLS_FULL;
+}
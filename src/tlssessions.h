@@ -0,0 +1,44 @@
+#ifndef TLSSESSIONS_H
+#define TLSSESSIONS_H
+
+#include "compat.h"
+#include "hal.h"
+
+// TLS sessions of the backends, kept in RTC memory and offered again on the next wake for an
+// abbreviated handshake. A copy goes to flash when a new session is negotiated, restored when
+// the RTC memory is lost (power cycle). A session is opaque bytes: BearSSL::Session only wraps
+// the session parameters.
+#define TLS_SESSION_SIZE 88 // Room for BearSSL::Session, rounded up to words
+#define TLS_SESSION_FILE "/tls_sessions.bin"
+// Graphite and Prometheus share a session to fit in RTC memory: with both enabled they evict each
+// other's session, so each upload costs two full handshakes. Those sessions are not copied to
+// flash, which would take two writes per wake; after a power cycle both start with full ones.
+#define TLS_SESSION_SLOTS 2
+#define TLS_SESSION_SLOT(backend) ((backend) == BACKEND_LOKI ? 1 : 0)
+
+struct TlsSessions
+{
+  uint8_t resumed; // Abbreviated handshakes, wrap around
+  uint8_t full;    // Full handshakes, wrap around
+  uint8_t owners[TLS_SESSION_SLOTS]; // Backend + 1 that negotiated the session of the slot, 0 = unknown
+  uint8_t slots[TLS_SESSION_SLOTS][TLS_SESSION_SIZE];
+};
+
+enum TlsHandshake : uint8_t
+{
+  TLS_NO_HANDSHAKE, // The connection failed
+  TLS_RESUMED,
+  TLS_FULL
+};
+
+// Restore the copy in flash, no sessions if there is none
+void loadTlsSessions(StorageHal &storage, TlsSessions &sessions);
+// Session to offer to the backend, all zeros if there is none
+const uint8_t *tlsSession(const TlsSessions &sessions, Backend backend);
+// Record the session the backend ended up with after a request of the given HTTP code (<= 0 if
+// the connection failed). A new session is copied to flash if flash is not null, unless it
+// evicted the session of the other backend of its slot.
+TlsHandshake recordTlsSession(TlsSessions &sessions, Backend backend, const void *session, size_t size, int httpCode,
+                              StorageHal *flash);
+
+#endif
@@ -0,0 +1,51 @@
+#include "trace.h"
+
+static uint16_t saturate16(uint32_t value)
+{
+  return value < UINT16_MAX ? value : UINT16_MAX;
+}
+
+void traceRecord(Trace &trace, TracePhase phase, uint32_t durationUs, const HeapStats &heap)
+{
+  uint32_t ms = (durationUs + 500) / 1000;
+  if (traceHasPhase(trace, phase))
+  {
+    ms += trace.phaseMs[phase];
+  }
+
+  trace.phaseMs[phase] = saturate16(ms);
+  trace.freeHeap[phase] = saturate16(heap.freeHeap);
+  trace.maxFreeBlock[phase] = saturate16(heap.maxFreeBlock);
+  trace.fragmentation[phase] = heap.fragmentation;
+  trace.phases |= 1 << phase;
+}
+
+void traceCycle(Trace &trace, uint32_t ts, uint32_t awakeMs)
+{
+  trace.ts = ts;
+  trace.awakeMs = saturate16(awakeMs);
+}
+
+void traceMerge(Trace &trace, const Trace &cycle)
+{
+  for (uint8_t p = 0; p < TRACE_PHASE_COUNT; p++)
+  {
+    if (traceHasPhase(cycle, (TracePhase)p))
+    {
+      trace.phaseMs[p] = cycle.phaseMs[p];
+      trace.freeHeap[p] = cycle.freeHeap[p];
+      trace.maxFreeBlock[p] = cycle.maxFreeBlock[p];
+      trace.fragmentation[p] = cycle.fragmentation[p];
+    }
+  }
+
+  trace.phases |= cycle.phases;
+  trace.overruns = trace.overruns + cycle.overruns < UINT8_MAX ? trace.overruns + cycle.overruns : UINT8_MAX;
+  trace.ts = cycle.ts;
+  trace.awakeMs = cycle.awakeMs;
+}
+
+bool traceHasPhase(const Trace &trace, TracePhase phase)
+{
+  return trace.phases & (1 << phase);
+}
@@ -0,0 +1,54 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "compat.h"
+
+// Phases of the wake cycle, in order
+enum TracePhase
+{
+  TRACE_SETUP, // Boot, display init and RTC state
+  TRACE_SENSORS,
+  TRACE_WIFI,
+  TRACE_NTP,
+  TRACE_GRAPHITE,
+  TRACE_PROMETHEUS,
+  TRACE_LOKI,
+  TRACE_RELAY,
+  TRACE_MQTT,
+  TRACE_DISPLAY,
+  TRACE_PHASE_COUNT
+};
+
+struct HeapStats
+{
+  uint32_t freeHeap;
+  uint32_t maxFreeBlock;
+  uint8_t fragmentation; // %
+};
+
+// Duration of the phases and heap at their end, stored in RTC memory.
+// Each phase keeps its last run until it is shipped.
+struct Trace
+{
+  uint32_t ts;      // Time of the last traced cycle
+  uint16_t awakeMs; // Boot to deep sleep of the last traced cycle
+  uint16_t phases;  // Bit mask of the recorded phases
+  uint16_t phaseMs[TRACE_PHASE_COUNT];
+  uint16_t freeHeap[TRACE_PHASE_COUNT];
+  uint16_t maxFreeBlock[TRACE_PHASE_COUNT];
+  uint8_t fragmentation[TRACE_PHASE_COUNT];
+  uint8_t overruns; // Wakes cut short by their time budget
+  uint8_t reserved;
+};
+
+static_assert(TRACE_PHASE_COUNT <= 16, "Trace phases do not fit in the bit mask");
+
+// Record a phase that took the given time, multiple runs in a cycle are summed
+void traceRecord(Trace &trace, TracePhase phase, uint32_t durationUs, const HeapStats &heap);
+// Record the end of the cycle
+void traceCycle(Trace &trace, uint32_t ts, uint32_t awakeMs);
+// Copy the phases recorded in a cycle over the older ones, add up the overruns
+void traceMerge(Trace &trace, const Trace &cycle);
+bool traceHasPhase(const Trace &trace, TracePhase phase);
+
+#endif
@@ -0,0 +1,315 @@
+//
+// The patches of the updates over the air: the one of tools/delta.py (patch.h) gives the new
+// image whatever the parts it comes in, nothing is committed from a wrong image or a corrupted
+// patch, and the download reads it in parts that fit the TCP window.
+//
+
+#include <unity.h>
+
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "budget.h"
+#include "config.h"
+#include "crc32.h"
+#include "delta.h"
+#include "native/sim.h"
+#include "ota.h"
+#include "patch.h"
+
+#define OLD_IMAGE_SIZE 8000
+#define TCP_WINDOW 2920 // 2 segments, what lwIP of the ESP8266 advertises
+
+static uint32_t seed;
+
+// Same sequence on every run
+static uint32_t nextRandom()
+{
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+// Some code, as the simulated firmware
+static std::vector<uint8_t> oldImage()
+{
+  std::vector<uint8_t> image(OLD_IMAGE_SIZE);
+  uint32_t lcg = 1;
+  for (size_t i = 0; i < image.size(); i++)
+  {
+    lcg = lcg * 1103515245 + 12345;
+    image[i] = i % 7 == 0 ? 0 : lcg >> 24;
+  }
+
+  return image;
+}
+
+// The image patch.h was made for
+static std::vector<uint8_t> newImage()
+{
+  std::vector<uint8_t> old = oldImage();
+  std::vector<uint8_t> image(old.begin(), old.begin() + 3000);
+  for (size_t i = 1000; i < 1400; i += 13)
+  {
+    image[i] += 4;
+  }
+  for (int i = 0; i < 300; i++)
+  {
+    image.push_back(i * 7 + 3);
+  }
+  image.insert(image.end(), old.begin() + 6000, old.begin() + 7000);
+  image.insert(image.end(), old.begin() + 3000, old.begin() + 5500);
+  image.insert(image.end(), old.begin() + 7000, old.end());
+
+  return image;
+}
+
+// Flash with the running image and the staging area
+class TestFirmware : public FirmwareHal
+{
+public:
+  TestFirmware() : image(oldImage()), size(0), staging(false), begun(0), committed(false) {}
+
+  uint32_t imageSize() override { return image.size(); }
+  bool readImage(uint32_t offset, void *data, size_t length) override
+  {
+    if (offset > image.size() || length > image.size() - offset)
+    {
+      return false;
+    }
+    memcpy(data, image.data() + offset, length);
+    return true;
+  }
+  bool beginUpdate(uint32_t size) override
+  {
+    this->size = size;
+    staged.clear();
+    staging = true;
+    begun++;
+    return true;
+  }
+  bool writeUpdate(const uint8_t *data, size_t length) override
+  {
+    if (!staging || length > size - staged.size())
+    {
+      return false;
+    }
+    staged.insert(staged.end(), data, data + length);
+    return true;
+  }
+  bool endUpdate(bool commit) override
+  {
+    committed = commit && staging && staged.size() == size;
+    staging = false;
+    return committed || !commit;
+  }
+
+  std::vector<uint8_t> image;
+  std::vector<uint8_t> staged;
+  uint32_t size;
+  bool staging;
+  uint32_t begun;
+  bool committed;
+};
+
+// Update server answering with the patch, reads over the window fail as a peer waiting for
+// room would
+class PatchNetwork : public NetworkHal
+{
+public:
+  PatchNetwork(const uint8_t *patch, size_t length) : position(0), largestRead(0)
+  {
+    std::string header = "HTTP/1.0 200 OK\r\nContent-Length: " + std::to_string(length) + "\r\n\r\n";
+    response.assign(header.begin(), header.end());
+    response.insert(response.end(), patch, patch + length);
+  }
+
+  void begin(NetworkState &state, bool lost) override {}
+  void startConnect() override {}
+  bool connect(uint32_t timeoutMs) override { return true; }
+  void disconnect() override {}
+  bool getTime(uint32_t &epoch) override { return false; }
+  int post(Backend backend, const char *body, size_t length, uint32_t timeoutMs) override { return -1; }
+  size_t exchangeRelay(const uint8_t *data, size_t length, uint8_t *reply, size_t replySize) override { return 0; }
+  bool openStream(const char *host, uint16_t port) override
+  {
+    position = 0;
+    return true;
+  }
+  bool writeStream(const uint8_t *data, size_t length) override { return true; }
+  bool readStream(uint8_t *data, size_t length, uint32_t timeoutMs) override
+  {
+    largestRead = length > largestRead ? length : largestRead;
+    if (length > TCP_WINDOW || length > response.size() - position)
+    {
+      return false;
+    }
+    memcpy(data, response.data() + position, length);
+    position += length;
+    return true;
+  }
+  void closeStream() override {}
+
+  std::vector<uint8_t> response;
+  size_t position;
+  size_t largestRead;
+};
+
+// Feed the patch in random parts of 1 to maxPart bytes, return whether it was committed
+static bool apply(TestFirmware &firmware, const std::vector<uint8_t> &patch, size_t maxPart)
+{
+  DeltaPatch delta(firmware, crc32(firmware.image.data(), firmware.image.size()));
+  bool fed = true;
+  for (size_t i = 0; i < patch.size() && fed;)
+  {
+    size_t part = 1 + nextRandom() % maxPart;
+    part = part < patch.size() - i ? part : patch.size() - i;
+    fed = delta.feed(patch.data() + i, part);
+    i += part;
+  }
+
+  return fed && delta.finish();
+}
+
+void setUp(void)
+{
+  seed = 0x9e3779b9;
+}
+
+void tearDown(void)
+{
+}
+
+// Tests ----------------------------------------------------------------------
+
+static void test_apply(void)
+{
+  std::vector<uint8_t> image = newImage();
+  TestFirmware firmware;
+  DeltaPatch delta(firmware, crc32(firmware.image.data(), firmware.image.size()));
+  TEST_ASSERT_TRUE(delta.feed(PATCH, sizeof(PATCH)));
+  TEST_ASSERT_TRUE(delta.complete());
+  TEST_ASSERT_EQUAL(image.size(), delta.newSize());
+  TEST_ASSERT_EQUAL_HEX32(crc32(image.data(), image.size()), delta.newCrc());
+
+  // The last block waits for the CRC of the whole image
+  TEST_ASSERT_LESS_THAN(image.size(), firmware.staged.size());
+  TEST_ASSERT_FALSE(firmware.committed);
+
+  TEST_ASSERT_TRUE(delta.finish());
+  TEST_ASSERT_TRUE(firmware.committed);
+  TEST_ASSERT_TRUE(firmware.staged == image);
+}
+
+static void test_parts(void)
+{
+  std::vector<uint8_t> image = newImage();
+  std::vector<uint8_t> patch(PATCH, PATCH + sizeof(PATCH));
+  const size_t maxParts[] = {1, 3, 17, DELTA_BLOCK_SIZE, sizeof(PATCH)};
+  for (size_t maxPart : maxParts)
+  {
+    for (int run = 0; run < 20; run++)
+    {
+      TestFirmware firmware;
+      TEST_ASSERT_TRUE(apply(firmware, patch, maxPart));
+      TEST_ASSERT_TRUE(firmware.staged == image);
+    }
+  }
+}
+
+static void test_wrong_image(void)
+{
+  std::vector<uint8_t> patch(PATCH, PATCH + sizeof(PATCH));
+
+  // A byte changed: the CRC does not match, nothing is staged
+  TestFirmware changed;
+  changed.image[OLD_IMAGE_SIZE / 2] ^= 0x01;
+  TEST_ASSERT_FALSE(apply(changed, patch, sizeof(PATCH)));
+  TEST_ASSERT_EQUAL(0, changed.begun);
+
+  // Another size
+  TestFirmware longer;
+  longer.image.push_back(0);
+  TEST_ASSERT_FALSE(apply(longer, patch, sizeof(PATCH)));
+  TEST_ASSERT_EQUAL(0, longer.begun);
+
+  // Not a patch
+  TestFirmware firmware;
+  patch[0] ^= 0x20;
+  TEST_ASSERT_FALSE(apply(firmware, patch, sizeof(PATCH)));
+  TEST_ASSERT_EQUAL(0, firmware.begun);
+}
+
+static void test_corrupted_patch(void)
+{
+  std::vector<uint8_t> image = newImage();
+
+  // Any byte of the commands flipped: refused, or the same image when the byte does not matter
+  for (size_t i = DELTA_HEADER_SIZE; i < sizeof(PATCH); i++)
+  {
+    std::vector<uint8_t> patch(PATCH, PATCH + sizeof(PATCH));
+    patch[i] ^= 1 << (nextRandom() % 8);
+    TestFirmware firmware;
+    if (apply(firmware, patch, DELTA_BLOCK_SIZE))
+    {
+      TEST_ASSERT_TRUE(firmware.staged == image);
+    }
+    else
+    {
+      TEST_ASSERT_FALSE(firmware.committed);
+      TEST_ASSERT_FALSE(firmware.staging);
+    }
+  }
+}
+
+static void test_truncated_patch(void)
+{
+  for (size_t length = 0; length < sizeof(PATCH); length += 7)
+  {
+    TestFirmware firmware;
+    DeltaPatch delta(firmware, crc32(firmware.image.data(), firmware.image.size()));
+    TEST_ASSERT_TRUE(delta.feed(PATCH, length));
+    TEST_ASSERT_FALSE(delta.complete());
+    TEST_ASSERT_FALSE(delta.finish());
+    TEST_ASSERT_FALSE(firmware.committed);
+    TEST_ASSERT_FALSE(firmware.staging);
+  }
+
+  // Trailing bytes
+  std::vector<uint8_t> patch(PATCH, PATCH + sizeof(PATCH));
+  patch.push_back(0);
+  TestFirmware firmware;
+  TEST_ASSERT_FALSE(apply(firmware, patch, sizeof(PATCH) + 1));
+  TEST_ASSERT_FALSE(firmware.committed);
+}
+
+static void test_download(void)
+{
+  // The buffer of the wake, larger than the window
+  static uint8_t buffer[4 * TCP_WINDOW];
+  SimWorld world = {};
+  SimClock clock(world);
+  WakeBudget budget(clock, WAKE_BUDGET_MS);
+  budget.startPhase(BUDGET_UPDATE_MS);
+
+  PatchNetwork network(PATCH, sizeof(PATCH));
+  TestFirmware firmware;
+  TEST_ASSERT_EQUAL(UPDATE_STAGED, checkUpdate(network, firmware, budget, buffer, sizeof(buffer)));
+  TEST_ASSERT_TRUE(firmware.staged == newImage());
+  TEST_ASSERT_LESS_OR_EQUAL(DELTA_BLOCK_SIZE, network.largestRead);
+  TEST_ASSERT_EQUAL(network.response.size(), network.position);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_apply);
+  RUN_TEST(test_parts);
+  RUN_TEST(test_wrong_image);
+  RUN_TEST(test_corrupted_patch);
+  RUN_TEST(test_truncated_patch);
+  RUN_TEST(test_download);
+  return UNITY_END();
+}
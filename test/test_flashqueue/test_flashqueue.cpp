@@ -0,0 +1,292 @@
+//
+// The flash queue of the samples not uploaded, on the flash of the simulation: records come out
+// in order across the segments and the wrap of their sequence numbers, the oldest segment is
+// dropped when the ring is full, and the queue is replayed from flash when the RTC memory is
+// lost, even in the middle of a write.
+//
+
+#include <unity.h>
+
+#include <cstdio>
+#include <vector>
+
+#include "flashqueue.h"
+#include "native/sim.h"
+
+#define RECORD_SIZE 6
+#define SEGMENTS 4
+#define SEGMENT_RECORDS 3
+
+// Power loss after some bytes of a write
+class TornStorage : public StorageHal
+{
+public:
+  TornStorage(StorageHal &storage) : storage(storage), budget(-1) {}
+
+  size_t read(const char *path, uint32_t offset, void *data, size_t length) override { return storage.read(path, offset, data, length); }
+  bool append(const char *path, const void *data, size_t length) override
+  {
+    if (budget >= 0 && length > (size_t)budget)
+    {
+      storage.append(path, data, budget);
+      budget = 0;
+      return false;
+    }
+    budget -= budget >= 0 ? length : 0;
+    return storage.append(path, data, length);
+  }
+  void remove(const char *path) override { storage.remove(path); }
+  int32_t size(const char *path) override { return storage.size(path); }
+
+  StorageHal &storage;
+  int32_t budget; // Bytes written before the power loss, -1 = no power loss
+};
+
+// The flash outlives the RTC memory
+struct Node
+{
+  Node() : world(), flash(world), storage(flash), state(), queue(storage, state, {RECORD_SIZE, SEGMENTS, SEGMENT_RECORDS}) {}
+
+  // RTC memory lost, the state comes back from the segment headers
+  void powerLoss()
+  {
+    memset(&state, 0xa5, sizeof(state));
+    queue.recover();
+  }
+
+  SimWorld world;
+  SimStorage flash;
+  TornStorage storage;
+  QueueState state;
+  FlashQueue queue;
+};
+
+static void record(uint8_t *data, uint32_t value)
+{
+  memset(data, 0, RECORD_SIZE);
+  memcpy(data, &value, sizeof(value));
+}
+
+static uint32_t value(const uint8_t *data)
+{
+  uint32_t value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+static bool push(FlashQueue &queue, uint32_t first, size_t count)
+{
+  uint8_t records[16 * RECORD_SIZE];
+  for (size_t i = 0; i < count; i++)
+  {
+    record(records + i * RECORD_SIZE, first + i);
+  }
+
+  return queue.push(records, count);
+}
+
+// Read and take up to count records, return them
+static std::vector<uint32_t> take(FlashQueue &queue, size_t count)
+{
+  uint8_t records[16 * RECORD_SIZE];
+  size_t n = queue.read(records, count);
+  queue.commit();
+
+  std::vector<uint32_t> values;
+  for (size_t i = 0; i < n; i++)
+  {
+    values.push_back(value(records + i * RECORD_SIZE));
+  }
+  return values;
+}
+
+static void checkTake(FlashQueue &queue, uint32_t first, size_t count)
+{
+  std::vector<uint32_t> values = take(queue, count);
+  TEST_ASSERT_EQUAL(count, values.size());
+  for (size_t i = 0; i < count; i++)
+  {
+    TEST_ASSERT_EQUAL(first + i, values[i]);
+  }
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+// Tests ----------------------------------------------------------------------
+
+static void test_order(void)
+{
+  Node node;
+  TEST_ASSERT_TRUE(node.queue.empty());
+
+  TEST_ASSERT_TRUE(push(node.queue, 0, 5));
+  TEST_ASSERT_TRUE(push(node.queue, 5, 2));
+  TEST_ASSERT_EQUAL(7, node.queue.size());
+
+  // A read takes nothing until committed
+  uint8_t records[8 * RECORD_SIZE];
+  TEST_ASSERT_EQUAL(4, node.queue.read(records, 4));
+  TEST_ASSERT_EQUAL(0, value(records));
+  TEST_ASSERT_EQUAL(7, node.queue.size());
+
+  checkTake(node.queue, 0, 4);
+  checkTake(node.queue, 4, 3);
+  TEST_ASSERT_TRUE(node.queue.empty());
+  TEST_ASSERT_EQUAL(0, take(node.queue, 4).size());
+  TEST_ASSERT_EQUAL(0, node.queue.dropped());
+
+  // Empty: every segment file is gone
+  for (uint8_t slot = 0; slot < SEGMENTS; slot++)
+  {
+    char name[16];
+    snprintf(name, sizeof(name), QUEUE_FILE_PREFIX "%u", slot);
+    TEST_ASSERT_EQUAL(-1, node.flash.size(name));
+  }
+}
+
+static void test_sequence_wrap(void)
+{
+  Node node;
+
+  // Past 65535 segments, the slots follow the sequence numbers through the wrap
+  node.state.head = node.state.tail = UINT16_MAX - 5;
+  uint32_t next = 0;
+  for (uint32_t round = 0; round < 12; round++)
+  {
+    TEST_ASSERT_TRUE(push(node.queue, next, SEGMENT_RECORDS * 2 + 1));
+    checkTake(node.queue, next, SEGMENT_RECORDS * 2 + 1);
+    next += SEGMENT_RECORDS * 2 + 1;
+  }
+  TEST_ASSERT_TRUE(node.state.head < UINT16_MAX - 5);
+
+  // Across the wrap after a power loss too
+  node.state.head = node.state.tail = UINT16_MAX - 1;
+  node.state.read = node.state.written = 0;
+  TEST_ASSERT_TRUE(push(node.queue, 100, SEGMENT_RECORDS * 2));
+  node.powerLoss();
+  TEST_ASSERT_EQUAL(SEGMENT_RECORDS * 2, node.queue.size());
+  checkTake(node.queue, 100, SEGMENT_RECORDS * 2);
+}
+
+static void test_drop_oldest(void)
+{
+  Node node;
+
+  // The ring holds SEGMENTS - 1 full segments and the one written
+  uint32_t pushed = SEGMENTS * SEGMENT_RECORDS + 2;
+  for (uint32_t i = 0; i < pushed; i++)
+  {
+    TEST_ASSERT_TRUE(push(node.queue, i, 1));
+  }
+  uint32_t kept = (SEGMENTS - 1) * SEGMENT_RECORDS + 2;
+  TEST_ASSERT_EQUAL(kept, node.queue.size());
+  TEST_ASSERT_EQUAL(pushed - kept, node.queue.dropped());
+  checkTake(node.queue, pushed - kept, kept);
+
+  // A partly read tail only counts what was not read
+  Node partial;
+  push(partial.queue, 0, SEGMENTS * SEGMENT_RECORDS);
+  checkTake(partial.queue, 0, 1);
+  TEST_ASSERT_TRUE(push(partial.queue, SEGMENTS * SEGMENT_RECORDS, 1));
+  TEST_ASSERT_EQUAL(SEGMENT_RECORDS - 1, partial.queue.dropped());
+  checkTake(partial.queue, SEGMENT_RECORDS, (SEGMENTS - 1) * SEGMENT_RECORDS + 1);
+}
+
+static void test_power_loss_replay(void)
+{
+  Node node;
+  push(node.queue, 0, 8);
+  checkTake(node.queue, 0, 4);
+
+  // The tail segment is read again from its start: taken records may come again, none is lost
+  node.powerLoss();
+  std::vector<uint32_t> values = take(node.queue, 16);
+  TEST_ASSERT_GREATER_OR_EQUAL(4, values.size());
+  TEST_ASSERT_EQUAL(7, values.back());
+  for (size_t i = 1; i < values.size(); i++)
+  {
+    TEST_ASSERT_EQUAL(values[i - 1] + 1, values[i]);
+  }
+  TEST_ASSERT_LESS_OR_EQUAL(4, values.front());
+
+  // Nothing to recover on an empty flash
+  Node empty;
+  empty.powerLoss();
+  TEST_ASSERT_TRUE(empty.queue.empty());
+  TEST_ASSERT_TRUE(push(empty.queue, 0, 2));
+  checkTake(empty.queue, 0, 2);
+}
+
+static void test_power_loss_during_write(void)
+{
+  size_t recordLength = RECORD_SIZE + QUEUE_CRC_SIZE;
+
+  // Cut every write at every byte: the records before it come back, then the next pushes
+  for (int32_t budget = 0; budget < (int32_t)(QUEUE_HEADER_SIZE + 2 * recordLength); budget++)
+  {
+    Node node;
+    TEST_ASSERT_TRUE(push(node.queue, 0, 4));
+    node.storage.budget = budget;
+    push(node.queue, 4, 2);
+    node.storage.budget = -1;
+
+    node.powerLoss();
+    TEST_ASSERT_TRUE(push(node.queue, 10, 3));
+    std::vector<uint32_t> values = take(node.queue, 16);
+
+    // 0 to 3, then what made it of 4 and 5, then 10 to 12
+    size_t i = 0;
+    for (; i < 4; i++)
+    {
+      TEST_ASSERT_EQUAL(i, values[i]);
+    }
+    for (uint32_t expected = 4; i < values.size() && values[i] < 10; i++, expected++)
+    {
+      TEST_ASSERT_EQUAL(expected, values[i]);
+    }
+    TEST_ASSERT_EQUAL(i + 3, values.size());
+    for (uint32_t expected = 10; i < values.size(); i++, expected++)
+    {
+      TEST_ASSERT_EQUAL(expected, values[i]);
+    }
+  }
+}
+
+static void test_corrupted_record_skipped(void)
+{
+  Node node;
+  push(node.queue, 0, 3);
+
+  // Flip a byte of the second record in flash
+  char name[16];
+  snprintf(name, sizeof(name), QUEUE_FILE_PREFIX "%u", node.state.tail % SEGMENTS);
+  std::vector<uint8_t> segment(node.flash.size(name));
+  node.flash.read(name, 0, segment.data(), segment.size());
+  segment[QUEUE_HEADER_SIZE + RECORD_SIZE + QUEUE_CRC_SIZE + 1] ^= 0x40;
+  node.flash.remove(name);
+  node.flash.append(name, segment.data(), segment.size());
+
+  std::vector<uint32_t> values = take(node.queue, 3);
+  TEST_ASSERT_EQUAL(2, values.size());
+  TEST_ASSERT_EQUAL(0, values[0]);
+  TEST_ASSERT_EQUAL(2, values[1]);
+  TEST_ASSERT_TRUE(node.queue.empty());
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_order);
+  RUN_TEST(test_sequence_wrap);
+  RUN_TEST(test_drop_oldest);
+  RUN_TEST(test_power_loss_replay);
+  RUN_TEST(test_power_loss_during_write);
+  RUN_TEST(test_corrupted_record_skipped);
+  return UNITY_END();
+}
@@ -0,0 +1,330 @@
+//
+// The frames of the relay and of MQTT: what the sensors encode decodes to the same samples and
+// trace, and the relay rejects whatever is not a frame without reading past it. The corpus of
+// the fuzzing is derived from valid frames: truncated, bit flipped, bytes replaced, inserted or
+// deleted, with the crc made valid again so the parser itself is exercised.
+//
+
+#include <unity.h>
+
+#include <vector>
+
+#include "crc32.h"
+#include "frame.h"
+
+#define FUZZ_RUNS 20000
+
+static uint32_t seed;
+
+// Same sequence on every run
+static uint32_t nextRandom()
+{
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+static Sample sample(uint32_t i, uint8_t probes)
+{
+  Sample s = {};
+  s.ts = 1700000000 + i * 60;
+  s.air = {21.37f - i, 55.5f, -3.21f};
+  for (uint8_t p = 0; p < probes; p++)
+  {
+    s.soil[p] = {9000 + (int)(i * 10) - p * 2000, 70 - p};
+  }
+  s.probes = probes;
+  s.battery = {3.912f, 78.25f};
+  s.solarPanelVolt = 4.6f;
+  s.timeError = 0.25f;
+  s.interval = 60 + i;
+  s.suppressed = i;
+
+  return s;
+}
+
+static Trace trace()
+{
+  Trace t = {};
+  t.ts = 1700000000;
+  t.awakeMs = 612;
+  t.phases = 0x5a5;
+  t.overruns = 2;
+  for (uint8_t p = 0; p < TRACE_PHASE_COUNT; p++)
+  {
+    t.phaseMs[p] = 10 * p + 3;
+    t.freeHeap[p] = 40000 - p * 100;
+    t.maxFreeBlock[p] = 30000 - p * 100;
+    t.fragmentation[p] = p;
+  }
+
+  return t;
+}
+
+static size_t encode(uint8_t *buffer, size_t count, uint8_t probes, bool withTrace)
+{
+  Sample samples[FRAME_MAX_SAMPLES];
+  for (size_t i = 0; i < count; i++)
+  {
+    samples[i] = sample(i, probes);
+  }
+  Trace t = trace();
+
+  return encodeFrame(buffer, FRAME_MAX_SIZE, "plant-42", samples, count, withTrace ? &t : nullptr);
+}
+
+static void setCrc(uint8_t *data, size_t length)
+{
+  uint32_t crc = crc32(data, length - 4);
+  data[length - 4] = crc;
+  data[length - 3] = crc >> 8;
+  data[length - 2] = crc >> 16;
+  data[length - 1] = crc >> 24;
+}
+
+// A frame that decodes must encode back to a frame decoding the same
+static void checkDecoded(const Frame &frame)
+{
+  TEST_ASSERT_LESS_OR_EQUAL(FRAME_MAX_SAMPLES, frame.count);
+  TEST_ASSERT_LESS_OR_EQUAL(FRAME_MAX_ID_LENGTH, strlen(frame.sensorId));
+
+  uint8_t first[FRAME_MAX_SIZE];
+  size_t firstLength = encodeFrame(first, sizeof(first), frame.sensorId, frame.samples, frame.count, frame.hasTrace ? &frame.trace : nullptr);
+  TEST_ASSERT_GREATER_THAN(0, firstLength);
+
+  static Frame again;
+  TEST_ASSERT_TRUE(decodeFrame(first, firstLength, again));
+  uint8_t second[FRAME_MAX_SIZE];
+  size_t secondLength = encodeFrame(second, sizeof(second), again.sensorId, again.samples, again.count, again.hasTrace ? &again.trace : nullptr);
+  TEST_ASSERT_EQUAL(firstLength, secondLength);
+  TEST_ASSERT_EQUAL_MEMORY(first, second, firstLength);
+}
+
+void setUp(void)
+{
+  seed = 0x2545f491;
+}
+
+void tearDown(void)
+{
+}
+
+// Tests ----------------------------------------------------------------------
+
+static void test_round_trip(void)
+{
+  uint8_t data[FRAME_MAX_SIZE];
+  size_t length = encode(data, 3, 1, true);
+  TEST_ASSERT_EQUAL(7 + 8 + 3 * FRAME_SAMPLE_SIZE + FRAME_TRACE_SIZE + 4 - 1, length);
+
+  static Frame frame;
+  TEST_ASSERT_TRUE(decodeFrame(data, length, frame));
+  TEST_ASSERT_EQUAL_STRING("plant-42", frame.sensorId);
+  TEST_ASSERT_EQUAL(3, frame.count);
+  for (uint32_t i = 0; i < 3; i++)
+  {
+    Sample expected = sample(i, 1);
+    const Sample &s = frame.samples[i];
+    TEST_ASSERT_EQUAL(expected.ts, s.ts);
+    TEST_ASSERT_FLOAT_WITHIN(0.005f, expected.air.temp, s.air.temp);
+    TEST_ASSERT_FLOAT_WITHIN(0.005f, expected.air.humidity, s.air.humidity);
+    TEST_ASSERT_FLOAT_WITHIN(0.005f, expected.air.dew_point, s.air.dew_point);
+    TEST_ASSERT_EQUAL(expected.soil[0].raw, s.soil[0].raw);
+    TEST_ASSERT_EQUAL(expected.soil[0].percentage, s.soil[0].percentage);
+    TEST_ASSERT_EQUAL(1, s.probes);
+    TEST_ASSERT_FLOAT_WITHIN(0.0005f, expected.battery.raw, s.battery.raw);
+    TEST_ASSERT_FLOAT_WITHIN(0.005f, expected.battery.percentage, s.battery.percentage);
+    TEST_ASSERT_FLOAT_WITHIN(0.0005f, expected.solarPanelVolt, s.solarPanelVolt);
+    TEST_ASSERT_FLOAT_WITHIN(0.005f, expected.timeError, s.timeError);
+    TEST_ASSERT_EQUAL(expected.interval, s.interval);
+    TEST_ASSERT_EQUAL(expected.suppressed, s.suppressed);
+  }
+
+  Trace expected = trace();
+  TEST_ASSERT_TRUE(frame.hasTrace);
+  TEST_ASSERT_EQUAL(expected.ts, frame.trace.ts);
+  TEST_ASSERT_EQUAL(expected.awakeMs, frame.trace.awakeMs);
+  TEST_ASSERT_EQUAL(expected.phases, frame.trace.phases);
+  TEST_ASSERT_EQUAL(expected.overruns, frame.trace.overruns);
+  TEST_ASSERT_EQUAL_MEMORY(expected.phaseMs, frame.trace.phaseMs, sizeof(expected.phaseMs));
+  TEST_ASSERT_EQUAL_MEMORY(expected.freeHeap, frame.trace.freeHeap, sizeof(expected.freeHeap));
+  TEST_ASSERT_EQUAL_MEMORY(expected.maxFreeBlock, frame.trace.maxFreeBlock, sizeof(expected.maxFreeBlock));
+  TEST_ASSERT_EQUAL_MEMORY(expected.fragmentation, frame.trace.fragmentation, sizeof(expected.fragmentation));
+
+  checkDecoded(frame);
+}
+
+static void test_round_trip_probes(void)
+{
+  uint8_t data[FRAME_MAX_SIZE];
+  size_t length = encode(data, FRAME_MAX_SAMPLES, SAMPLE_MAX_PROBES, false);
+  TEST_ASSERT_GREATER_THAN(0, length);
+
+  static Frame frame;
+  TEST_ASSERT_TRUE(decodeFrame(data, length, frame));
+  TEST_ASSERT_FALSE(frame.hasTrace);
+  TEST_ASSERT_EQUAL(FRAME_MAX_SAMPLES, frame.count);
+  for (uint32_t i = 0; i < FRAME_MAX_SAMPLES; i++)
+  {
+    Sample expected = sample(i, SAMPLE_MAX_PROBES);
+    TEST_ASSERT_EQUAL(SAMPLE_MAX_PROBES, frame.samples[i].probes);
+    for (uint8_t p = 0; p < SAMPLE_MAX_PROBES; p++)
+    {
+      TEST_ASSERT_EQUAL(expected.soil[p].raw, frame.samples[i].soil[p].raw);
+      TEST_ASSERT_EQUAL(expected.soil[p].percentage, frame.samples[i].soil[p].percentage);
+    }
+  }
+}
+
+static void test_encode_limits(void)
+{
+  uint8_t data[FRAME_MAX_SIZE];
+  Sample samples[FRAME_MAX_SAMPLES + 1] = {};
+  samples[0].probes = 1;
+
+  TEST_ASSERT_EQUAL(0, encodeFrame(data, sizeof(data), "a-sensor-id-longer-than-32-chars!", samples, 1, nullptr));
+  TEST_ASSERT_EQUAL(0, encodeFrame(data, sizeof(data), "plant-42", samples, FRAME_MAX_SAMPLES + 1, nullptr));
+  samples[0].probes = 0;
+  TEST_ASSERT_EQUAL(0, encodeFrame(data, sizeof(data), "plant-42", samples, 1, nullptr));
+
+  // Too small a buffer, whatever its size
+  size_t length = encode(data, 3, 2, true);
+  for (size_t size = 0; size < length; size++)
+  {
+    uint8_t small[FRAME_MAX_SIZE];
+    Sample copy[3] = {sample(0, 2), sample(1, 2), sample(2, 2)};
+    Trace t = trace();
+    TEST_ASSERT_EQUAL(0, encodeFrame(small, size, "plant-42", copy, 3, &t));
+  }
+}
+
+static void test_truncated(void)
+{
+  uint8_t data[FRAME_MAX_SIZE];
+  size_t length = encode(data, 5, 2, true);
+
+  static Frame frame;
+  for (size_t i = 0; i < length; i++)
+  {
+    TEST_ASSERT_FALSE(decodeFrame(data, i, frame));
+  }
+
+  // Even with a valid crc
+  uint8_t cut[FRAME_MAX_SIZE];
+  for (size_t i = 4; i < length; i++)
+  {
+    memcpy(cut, data, i - 4);
+    setCrc(cut, i);
+    TEST_ASSERT_FALSE(decodeFrame(cut, i, frame));
+  }
+}
+
+static void test_bit_flips(void)
+{
+  uint8_t data[FRAME_MAX_SIZE];
+  size_t length = encode(data, 5, 2, true);
+
+  static Frame frame;
+  for (size_t bit = 0; bit < length * 8; bit++)
+  {
+    data[bit / 8] ^= 1 << bit % 8;
+    TEST_ASSERT_FALSE(decodeFrame(data, length, frame));
+    data[bit / 8] ^= 1 << bit % 8;
+  }
+  TEST_ASSERT_TRUE(decodeFrame(data, length, frame));
+}
+
+static void test_fuzz(void)
+{
+  static Frame frame;
+  uint32_t decoded = 0;
+
+  for (uint32_t run = 0; run < FUZZ_RUNS; run++)
+  {
+    // Exactly the length, out of bounds reads show with the sanitizers
+    uint8_t valid[FRAME_MAX_SIZE];
+    size_t length = encode(valid, nextRandom() % 6, 1 + nextRandom() % SAMPLE_MAX_PROBES, nextRandom() % 2);
+    std::vector<uint8_t> data(valid, valid + length);
+
+    for (uint32_t mutations = 1 + nextRandom() % 4; mutations > 0 && data.size() > 4; mutations--)
+    {
+      size_t at = nextRandom() % (data.size() - 4);
+      switch (nextRandom() % 4)
+      {
+      case 0:
+        data[at] ^= 1 << nextRandom() % 8;
+        break;
+      case 1:
+        data[at] = nextRandom();
+        break;
+      case 2:
+        data.insert(data.begin() + at, (uint8_t)nextRandom());
+        break;
+      default:
+        data.erase(data.begin() + at);
+        break;
+      }
+    }
+    if (data.size() > FRAME_MAX_SIZE)
+    {
+      continue;
+    }
+
+    setCrc(data.data(), data.size());
+    if (decodeFrame(data.data(), data.size(), frame))
+    {
+      checkDecoded(frame);
+      decoded++;
+    }
+  }
+
+  // Some mutations keep a valid frame (a value changed), most do not
+  TEST_ASSERT_GREATER_THAN(0, decoded);
+  TEST_ASSERT_LESS_THAN(FUZZ_RUNS, decoded);
+}
+
+static void test_random_bytes(void)
+{
+  static Frame frame;
+  uint8_t data[FRAME_MAX_SIZE + 1];
+
+  for (uint32_t run = 0; run < FUZZ_RUNS; run++)
+  {
+    size_t length = nextRandom() % sizeof(data);
+    for (size_t i = 0; i < length; i++)
+    {
+      data[i] = nextRandom();
+    }
+    TEST_ASSERT_FALSE(decodeFrame(data, length, frame));
+  }
+}
+
+static void test_ack(void)
+{
+  uint8_t data[FRAME_MAX_SIZE];
+  size_t length = encode(data, 2, 1, true);
+
+  uint8_t ack[FRAME_ACK_SIZE];
+  TEST_ASSERT_EQUAL(FRAME_ACK_SIZE, encodeFrameAck(ack, data, length));
+  TEST_ASSERT_TRUE(frameAckMatches(ack, sizeof(ack), data, length));
+  TEST_ASSERT_FALSE(frameAckMatches(ack, sizeof(ack) - 1, data, length));
+
+  // The acknowledgment of another frame
+  data[8] ^= 1;
+  TEST_ASSERT_FALSE(frameAckMatches(ack, sizeof(ack), data, length));
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_round_trip);
+  RUN_TEST(test_round_trip_probes);
+  RUN_TEST(test_encode_limits);
+  RUN_TEST(test_truncated);
+  RUN_TEST(test_bit_flips);
+  RUN_TEST(test_fuzz);
+  RUN_TEST(test_random_bytes);
+  RUN_TEST(test_ack);
+  return UNITY_END();
+}
@@ -0,0 +1,137 @@
+//
+// Payloads built before the metrics table (METRIC_TABLE) from the samples and trace of
+// test_metrics.cpp, with a single soil probe. Generated by building the same calls against the
+// old builders; the table must produce them byte for byte.
+//
+
+#ifndef GOLDEN_H
+#define GOLDEN_H
+
+#include <stdint.h>
+
+static const char GRAPHITE_1_TRACE[] =
+    "[{\"name\":\"temperature\",\"interval\":900,\"value\":-5.25,\"mtype\":\"gauge\",\"time\":1700000000},{\"name\":\""
+    "humidity\",\"interval\":900,\"value\":100.00,\"mtype\":\"gauge\",\"time\":1700000000},{\"name\":\"dew_point\",\""
+    "interval\":900,\"value\":-12.75,\"mtype\":\"gauge\",\"time\":1700000000},{\"name\":\"soil_moisture\",\"interva"
+    "l\":900,\"value\":0,\"mtype\":\"gauge\",\"time\":1700000000},{\"name\":\"battery_volts\",\"interval\":900,\"valu"
+    "e\":4.20,\"mtype\":\"gauge\",\"time\":1700000000},{\"name\":\"battery_perc\",\"interval\":900,\"value\":100.00,"
+    "\"mtype\":\"gauge\",\"time\":1700000000},{\"name\":\"solar_panel_volts\",\"interval\":900,\"value\":0.00,\"mtyp"
+    "e\":\"gauge\",\"time\":1700000000},{\"name\":\"time_error\",\"interval\":900,\"value\":0.00,\"mtype\":\"gauge\",\""
+    "time\":1700000000},{\"name\":\"suppressed_samples\",\"interval\":900,\"value\":0,\"mtype\":\"gauge\",\"time\":1"
+    "700000000},{\"name\":\"trace.awake_ms\",\"interval\":900,\"value\":2345,\"mtype\":\"gauge\",\"time\":170000123"
+    "4},{\"name\":\"trace.overruns\",\"interval\":900,\"value\":1,\"mtype\":\"gauge\",\"time\":1700001234},{\"name\":"
+    "\"trace.setup.ms\",\"interval\":900,\"value\":150,\"mtype\":\"gauge\",\"time\":1700001234},{\"name\":\"trace.se"
+    "tup.free_heap\",\"interval\":900,\"value\":41234,\"mtype\":\"gauge\",\"time\":1700001234},{\"name\":\"trace.se"
+    "tup.max_free_block\",\"interval\":900,\"value\":28672,\"mtype\":\"gauge\",\"time\":1700001234},{\"name\":\"tra"
+    "ce.setup.fragmentation\",\"interval\":900,\"value\":12,\"mtype\":\"gauge\",\"time\":1700001234},{\"name\":\"tr"
+    "ace.wifi.ms\",\"interval\":900,\"value\":1250,\"mtype\":\"gauge\",\"time\":1700001234},{\"name\":\"trace.wifi."
+    "free_heap\",\"interval\":900,\"value\":41234,\"mtype\":\"gauge\",\"time\":1700001234},{\"name\":\"trace.wifi.m"
+    "ax_free_block\",\"interval\":900,\"value\":28672,\"mtype\":\"gauge\",\"time\":1700001234},{\"name\":\"trace.wi"
+    "fi.fragmentation\",\"interval\":900,\"value\":12,\"mtype\":\"gauge\",\"time\":1700001234}]";
+static const char GRAPHITE_3[] =
+    "[{\"name\":\"temperature\",\"interval\":900,\"value\":-5.25,\"mtype\":\"gauge\",\"time\":1700000000},{\"name\":\""
+    "humidity\",\"interval\":900,\"value\":100.00,\"mtype\":\"gauge\",\"time\":1700000000},{\"name\":\"dew_point\",\""
+    "interval\":900,\"value\":-12.75,\"mtype\":\"gauge\",\"time\":1700000000},{\"name\":\"soil_moisture\",\"interva"
+    "l\":900,\"value\":0,\"mtype\":\"gauge\",\"time\":1700000000},{\"name\":\"battery_volts\",\"interval\":900,\"valu"
+    "e\":4.20,\"mtype\":\"gauge\",\"time\":1700000000},{\"name\":\"battery_perc\",\"interval\":900,\"value\":100.00,"
+    "\"mtype\":\"gauge\",\"time\":1700000000},{\"name\":\"solar_panel_volts\",\"interval\":900,\"value\":0.00,\"mtyp"
+    "e\":\"gauge\",\"time\":1700000000},{\"name\":\"time_error\",\"interval\":900,\"value\":0.00,\"mtype\":\"gauge\",\""
+    "time\":1700000000},{\"name\":\"suppressed_samples\",\"interval\":900,\"value\":0,\"mtype\":\"gauge\",\"time\":1"
+    "700000000},{\"name\":\"temperature\",\"interval\":600,\"value\":21.37,\"mtype\":\"gauge\",\"time\":1700000613}"
+    ",{\"name\":\"humidity\",\"interval\":600,\"value\":66.70,\"mtype\":\"gauge\",\"time\":1700000613},{\"name\":\"dew"
+    "_point\",\"interval\":600,\"value\":13.87,\"mtype\":\"gauge\",\"time\":1700000613},{\"name\":\"soil_moisture\","
+    "\"interval\":600,\"value\":45,\"mtype\":\"gauge\",\"time\":1700000613},{\"name\":\"battery_volts\",\"interval\":"
+    "600,\"value\":3.85,\"mtype\":\"gauge\",\"time\":1700000613},{\"name\":\"battery_perc\",\"interval\":600,\"value"
+    "\":58.30,\"mtype\":\"gauge\",\"time\":1700000613},{\"name\":\"solar_panel_volts\",\"interval\":600,\"value\":2."
+    "75,\"mtype\":\"gauge\",\"time\":1700000613},{\"name\":\"time_error\",\"interval\":600,\"value\":0.50,\"mtype\":\""
+    "gauge\",\"time\":1700000613},{\"name\":\"suppressed_samples\",\"interval\":600,\"value\":7,\"mtype\":\"gauge\","
+    "\"time\":1700000613},{\"name\":\"temperature\",\"interval\":300,\"value\":35.90,\"mtype\":\"gauge\",\"time\":170"
+    "0001226},{\"name\":\"humidity\",\"interval\":300,\"value\":33.40,\"mtype\":\"gauge\",\"time\":1700001226},{\"na"
+    "me\":\"dew_point\",\"interval\":300,\"value\":28.40,\"mtype\":\"gauge\",\"time\":1700001226},{\"name\":\"soil_mo"
+    "isture\",\"interval\":300,\"value\":90,\"mtype\":\"gauge\",\"time\":1700001226},{\"name\":\"battery_volts\",\"in"
+    "terval\":300,\"value\":3.50,\"mtype\":\"gauge\",\"time\":1700001226},{\"name\":\"battery_perc\",\"interval\":30"
+    "0,\"value\":16.60,\"mtype\":\"gauge\",\"time\":1700001226},{\"name\":\"solar_panel_volts\",\"interval\":300,\"v"
+    "alue\":5.50,\"mtype\":\"gauge\",\"time\":1700001226},{\"name\":\"time_error\",\"interval\":300,\"value\":1.00,\""
+    "mtype\":\"gauge\",\"time\":1700001226},{\"name\":\"suppressed_samples\",\"interval\":300,\"value\":14,\"mtype\""
+    ":\"gauge\",\"time\":1700001226}]";
+static const char LOKI_1[] =
+    "{\"streams\": [{ \"stream\": { \"plant_id\": \"plant\", \"monitoring_type\": \"plant\"}, \"values\": [ [ \"1700"
+    "000000000000000\", \"temperature=-5.25 humidity=100.00 dew_point=-12.75 soil_moisture=0 soil_moist"
+    "ure_raw=15000 battery_volts=4.20 battery_perc=100.00 solar_panel_volts=0.00 time_error=0.00 supp"
+    "ressed_samples=0 msg='New_samples!'\" ] ] }]}";
+static const char LOKI_3[] =
+    "{\"streams\": [{ \"stream\": { \"plant_id\": \"plant\", \"monitoring_type\": \"plant\"}, \"values\": [ [ \"1700"
+    "000000000000000\", \"temperature=-5.25 humidity=100.00 dew_point=-12.75 soil_moisture=0 soil_moist"
+    "ure_raw=15000 battery_volts=4.20 battery_perc=100.00 solar_panel_volts=0.00 time_error=0.00 supp"
+    "ressed_samples=0 msg='New_samples!'\" ], [ \"1700000613000000000\", \"temperature=21.37 humidity=66."
+    "70 dew_point=13.87 soil_moisture=45 soil_moisture_raw=10679 battery_volts=3.85 battery_perc=58.3"
+    "0 solar_panel_volts=2.75 time_error=0.50 suppressed_samples=7 msg='New_samples!'\" ], [ \"17000012"
+    "26000000000\", \"temperature=35.90 humidity=33.40 dew_point=28.40 soil_moisture=90 soil_moisture_r"
+    "aw=6358 battery_volts=3.50 battery_perc=16.60 solar_panel_volts=5.50 time_error=1.00 suppressed_"
+    "samples=14 msg='New_samples!'\" ] ] }]}";
+static const uint8_t REMOTE_WRITE_3_TRACE[] = {
+    0xb6, 0x0d, 0xa0, 0x0a, 0x62, 0x0a, 0x17, 0x0a, 0x08, 0x5f, 0x5f, 0x6e, 0x61, 0x6d, 0x65, 0x5f,
+    0x5f, 0x12, 0x0b, 0x74, 0x65, 0x6d, 0x70, 0x65, 0x72, 0x61, 0x74, 0x75, 0x72, 0x65, 0x0a, 0x11,
+    0x0a, 0x08, 0x70, 0x6c, 0x61, 0x6e, 0x74, 0x5f, 0x69, 0x64, 0x12, 0x05, 0x05, 0x0a, 0x0c, 0x12,
+    0x10, 0x09, 0x00, 0x05, 0x01, 0x20, 0x15, 0xc0, 0x10, 0x80, 0xd0, 0x95, 0xff, 0xbc, 0x31, 0x09,
+    0x12, 0x20, 0x60, 0xb8, 0x5e, 0x35, 0x40, 0x10, 0x88, 0x85, 0xbb, 0x15, 0x12, 0x3c, 0x40, 0x33,
+    0xf3, 0x41, 0x40, 0x10, 0x90, 0xba, 0xe0, 0xff, 0xbc, 0x31, 0x0a, 0x5f, 0x0a, 0x14, 0x1d, 0x64,
+    0x20, 0x08, 0x68, 0x75, 0x6d, 0x69, 0x64, 0x69, 0x74, 0x79, 0x6e, 0x61, 0x00, 0x04, 0x59, 0x40,
+    0x32, 0x61, 0x00, 0x0c, 0xc0, 0xcc, 0xac, 0x50, 0x3e, 0x61, 0x00, 0x04, 0xb3, 0x40, 0x15, 0x61,
+    0x08, 0x60, 0x0a, 0x15, 0x1d, 0x61, 0x24, 0x09, 0x64, 0x65, 0x77, 0x5f, 0x70, 0x6f, 0x69, 0x6e,
+    0x74, 0x6a, 0x62, 0x00, 0x04, 0x80, 0x29, 0x36, 0xc3, 0x00, 0x0c, 0xc0, 0x70, 0xbd, 0x2b, 0x36,
+    0x62, 0x00, 0x10, 0x80, 0x66, 0x66, 0x3c, 0x40, 0x11, 0xc3, 0x08, 0x64, 0x0a, 0x19, 0x1d, 0x62,
+    0x24, 0x0d, 0x73, 0x6f, 0x69, 0x6c, 0x5f, 0x6d, 0x6f, 0x69, 0x73, 0x7e, 0x29, 0x01, 0x04, 0x00,
+    0x00, 0x32, 0xc8, 0x00, 0x0c, 0x00, 0x00, 0x80, 0x46, 0x36, 0x66, 0x00, 0x0c, 0x00, 0x00, 0x80,
+    0x56, 0x5e, 0x66, 0x00, 0x30, 0x62, 0x61, 0x74, 0x74, 0x65, 0x72, 0x79, 0x5f, 0x76, 0x6f, 0x6c,
+    0x74, 0x73, 0x62, 0xcc, 0x00, 0x0c, 0xc0, 0xcc, 0xcc, 0x10, 0x3e, 0x2e, 0x01, 0x04, 0xcc, 0x0e,
+    0x36, 0x66, 0x00, 0x0c, 0xe0, 0xff, 0xff, 0x0b, 0x15, 0x66, 0x08, 0x63, 0x0a, 0x18, 0x1d, 0xcc,
+    0x00, 0x0c, 0x11, 0x66, 0x0c, 0x70, 0x65, 0x72, 0x63, 0x62, 0x65, 0x00, 0x08, 0x00, 0x00, 0x00,
+    0x3a, 0x93, 0x01, 0x0c, 0x60, 0x66, 0x26, 0x4d, 0x36, 0x65, 0x00, 0x0c, 0x80, 0x99, 0x99, 0x30,
+    0x15, 0x65, 0x08, 0x68, 0x0a, 0x1d, 0x1d, 0x65, 0x2c, 0x11, 0x73, 0x6f, 0x6c, 0x61, 0x72, 0x5f,
+    0x70, 0x61, 0x6e, 0x65, 0x6c, 0x7a, 0xcf, 0x00, 0x00, 0x00, 0x01, 0x01, 0x3a, 0x35, 0x01, 0x04,
+    0x00, 0x06, 0x36, 0x6a, 0x00, 0x0c, 0x00, 0x00, 0x00, 0x16, 0x15, 0x6a, 0x08, 0x61, 0x0a, 0x16,
+    0x1d, 0x6a, 0x28, 0x0a, 0x74, 0x69, 0x6d, 0x65, 0x5f, 0x65, 0x72, 0x72, 0x6f, 0x72, 0x6e, 0xcd,
+    0x00, 0x04, 0x00, 0x00, 0x3e, 0x63, 0x00, 0x10, 0xe0, 0x3f, 0x10, 0x88, 0x85, 0x59, 0xc1, 0x18,
+    0x00, 0x00, 0x00, 0xf0, 0x3f, 0x10, 0x90, 0x49, 0xc1, 0x08, 0x69, 0x0a, 0x1e, 0x1d, 0x63, 0x48,
+    0x12, 0x73, 0x75, 0x70, 0x70, 0x72, 0x65, 0x73, 0x73, 0x65, 0x64, 0x5f, 0x73, 0x61, 0x6d, 0x70,
+    0x6c, 0x65, 0x73, 0xb6, 0x6b, 0x00, 0x00, 0x1c, 0x42, 0xce, 0x00, 0x00, 0x2c, 0x15, 0xce, 0x08,
+    0x41, 0x0a, 0x1a, 0x1d, 0x6b, 0x34, 0x0e, 0x74, 0x72, 0x61, 0x63, 0x65, 0x5f, 0x61, 0x77, 0x61,
+    0x6b, 0x65, 0x5f, 0x6d, 0x6e, 0x67, 0x00, 0x18, 0x52, 0xa2, 0x40, 0x10, 0xd0, 0xf8, 0xe0, 0x61,
+    0x6f, 0x52, 0x43, 0x00, 0x18, 0x6f, 0x76, 0x65, 0x72, 0x72, 0x75, 0x6e, 0x6e, 0x43, 0x00, 0x08,
+    0x00, 0xf0, 0x3f, 0x11, 0x43, 0x08, 0x4b, 0x0a, 0x14, 0x1d, 0x86, 0x00, 0x08, 0x09, 0x86, 0x44,
+    0x6d, 0x73, 0x0a, 0x0e, 0x0a, 0x05, 0x70, 0x68, 0x61, 0x73, 0x65, 0x12, 0x05, 0x73, 0x65, 0x74,
+    0x75, 0x70, 0x6a, 0xf7, 0x00, 0x04, 0xc0, 0x62, 0x15, 0x90, 0x08, 0x52, 0x0a, 0x1b, 0x1d, 0x4d,
+    0x00, 0x0f, 0x09, 0x4d, 0x20, 0x66, 0x72, 0x65, 0x65, 0x5f, 0x68, 0x65, 0x61, 0x70, 0xa6, 0x54,
+    0x00, 0x08, 0x40, 0x22, 0xe4, 0x15, 0x54, 0x08, 0x57, 0x0a, 0x20, 0x1d, 0x54, 0x04, 0x14, 0x74,
+    0x25, 0x27, 0x34, 0x6d, 0x61, 0x78, 0x5f, 0x66, 0x72, 0x65, 0x65, 0x5f, 0x62, 0x6c, 0x6f, 0x63,
+    0x6b, 0xa6, 0x59, 0x00, 0x08, 0x00, 0x00, 0xdc, 0x15, 0x59, 0x08, 0x56, 0x0a, 0x1f, 0x1d, 0x59,
+    0x00, 0x13, 0x09, 0x59, 0x30, 0x66, 0x72, 0x61, 0x67, 0x6d, 0x65, 0x6e, 0x74, 0x61, 0x74, 0x69,
+    0x6f, 0x6e, 0xae, 0x58, 0x00, 0x00, 0x28, 0x15, 0x58, 0x00, 0x4a, 0x5a, 0x52, 0x01, 0x04, 0x0d,
+    0x0a, 0x2d, 0x52, 0x10, 0x04, 0x77, 0x69, 0x66, 0x69, 0x6a, 0x51, 0x01, 0x04, 0x88, 0x93, 0x15,
+    0x4c, 0x00, 0x51, 0x76, 0x51, 0x01, 0x9e, 0x53, 0x00, 0x2e, 0x50, 0x01, 0x00, 0x56, 0x8a, 0x50,
+    0x01, 0x9e, 0x58, 0x00, 0x2e, 0x4f, 0x01, 0x00, 0x55, 0x86, 0x4f, 0x01, 0xa6, 0x57, 0x00, 0x35,
+    0x4e,
+};
+static const uint8_t REMOTE_WRITE_1[] = {
+    0xcc, 0x04, 0xa0, 0x0a, 0x3e, 0x0a, 0x17, 0x0a, 0x08, 0x5f, 0x5f, 0x6e, 0x61, 0x6d, 0x65, 0x5f,
+    0x5f, 0x12, 0x0b, 0x74, 0x65, 0x6d, 0x70, 0x65, 0x72, 0x61, 0x74, 0x75, 0x72, 0x65, 0x0a, 0x11,
+    0x0a, 0x08, 0x70, 0x6c, 0x61, 0x6e, 0x74, 0x5f, 0x69, 0x64, 0x12, 0x05, 0x05, 0x0a, 0x0c, 0x12,
+    0x10, 0x09, 0x00, 0x05, 0x01, 0x30, 0x15, 0xc0, 0x10, 0x80, 0xd0, 0x95, 0xff, 0xbc, 0x31, 0x0a,
+    0x3b, 0x0a, 0x14, 0x1d, 0x40, 0x20, 0x08, 0x68, 0x75, 0x6d, 0x69, 0x64, 0x69, 0x74, 0x79, 0x6e,
+    0x3d, 0x00, 0x04, 0x59, 0x40, 0x11, 0x3d, 0x08, 0x3c, 0x0a, 0x15, 0x1d, 0x3d, 0x24, 0x09, 0x64,
+    0x65, 0x77, 0x5f, 0x70, 0x6f, 0x69, 0x6e, 0x74, 0x6a, 0x3e, 0x00, 0x04, 0x80, 0x29, 0x15, 0x7b,
+    0x08, 0x40, 0x0a, 0x19, 0x1d, 0x3e, 0x2c, 0x0d, 0x73, 0x6f, 0x69, 0x6c, 0x5f, 0x6d, 0x6f, 0x69,
+    0x73, 0x74, 0x75, 0x76, 0xbd, 0x00, 0x08, 0x00, 0x00, 0x10, 0x0d, 0xbd, 0x3a, 0x42, 0x00, 0x30,
+    0x62, 0x61, 0x74, 0x74, 0x65, 0x72, 0x79, 0x5f, 0x76, 0x6f, 0x6c, 0x74, 0x73, 0x62, 0x84, 0x00,
+    0x0c, 0xc0, 0xcc, 0xcc, 0x10, 0x15, 0xc2, 0x0c, 0x3f, 0x0a, 0x18, 0x0a, 0x39, 0x3f, 0x00, 0x0c,
+    0x11, 0x42, 0x0c, 0x70, 0x65, 0x72, 0x63, 0x62, 0x41, 0x00, 0x08, 0x00, 0x00, 0x00, 0x39, 0x03,
+    0x08, 0x44, 0x0a, 0x1d, 0x1d, 0x41, 0x2c, 0x11, 0x73, 0x6f, 0x6c, 0x61, 0x72, 0x5f, 0x70, 0x61,
+    0x6e, 0x65, 0x6c, 0x7a, 0x87, 0x00, 0x00, 0x00, 0x01, 0x01, 0x11, 0xc9, 0x08, 0x3d, 0x0a, 0x16,
+    0x1d, 0x46, 0x28, 0x0a, 0x74, 0x69, 0x6d, 0x65, 0x5f, 0x65, 0x72, 0x72, 0x6f, 0x72, 0x6e, 0x85,
+    0x00, 0x04, 0x00, 0x00, 0x11, 0x3f, 0x08, 0x45, 0x0a, 0x1e, 0x1d, 0x3f, 0x48, 0x12, 0x73, 0x75,
+    0x70, 0x70, 0x72, 0x65, 0x73, 0x73, 0x65, 0x64, 0x5f, 0x73, 0x61, 0x6d, 0x70, 0x6c, 0x65, 0x73,
+    0x92, 0x47, 0x00,
+};
+
+#endif
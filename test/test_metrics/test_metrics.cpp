@@ -0,0 +1,163 @@
+//
+// The metrics table: the payloads generated from it are the ones of the hand written builders
+// it replaced (golden.h), and its ranges decide which samples are valid.
+//
+
+#include <unity.h>
+
+#include <string.h>
+
+#include "golden.h"
+#include "metrics.h"
+#include "payload.h"
+#include "remotewrite.h"
+
+// The payloads of golden.h were built with these
+#define GOLDEN_SENSOR_ID "plant"
+#define GOLDEN_LOKI_MESSAGE "New_samples!"
+
+static char buffer[16384];
+static Sample samples[3];
+static Trace trace;
+
+void setUp(void)
+{
+  const float temps[3] = {-5.25f, 21.37f, 35.9f};
+  for (int i = 0; i < 3; i++)
+  {
+    Sample &s = samples[i];
+    s = {};
+    s.ts = 1700000000 + i * 613;
+    s.air = {temps[i], 100.0f - i * 33.3f, temps[i] - 7.5f};
+    s.soil[0] = {15000 - i * 4321, i * 45};
+    s.probes = 1;
+    s.battery = {4.2f - i * 0.35f, 100.0f - i * 41.7f};
+    s.solarPanelVolt = i * 2.75f;
+    s.timeError = 0.5f * i;
+    s.interval = 900 - i * 300;
+    s.suppressed = i * 7;
+  }
+
+  trace = {};
+  HeapStats heap = {41234, 28672, 12};
+  traceRecord(trace, (TracePhase)0, 150000, heap);
+  traceRecord(trace, (TracePhase)2, 1250000, heap);
+  traceCycle(trace, 1700001234, 2345);
+  trace.overruns = 1;
+}
+
+void tearDown(void)
+{
+}
+
+static void checkText(const char *expected, size_t length)
+{
+  TEST_ASSERT_EQUAL(strlen(expected), length);
+  buffer[length] = '\0';
+  TEST_ASSERT_EQUAL_STRING(expected, buffer);
+}
+
+// Tests ----------------------------------------------------------------------
+
+static void test_graphite_golden(void)
+{
+  checkText(GRAPHITE_1_TRACE, buildGraphitePayload(buffer, sizeof(buffer), samples, 1, &trace));
+  checkText(GRAPHITE_3, buildGraphitePayload(buffer, sizeof(buffer), samples, 3, nullptr));
+}
+
+static void test_loki_golden(void)
+{
+  checkText(LOKI_1, buildLokiPayload(buffer, sizeof(buffer), samples, 1, GOLDEN_SENSOR_ID, GOLDEN_LOKI_MESSAGE));
+  checkText(LOKI_3, buildLokiPayload(buffer, sizeof(buffer), samples, 3, GOLDEN_SENSOR_ID, GOLDEN_LOKI_MESSAGE));
+}
+
+static void test_remote_write_golden(void)
+{
+  size_t length = buildRemoteWritePayload((uint8_t *)buffer, sizeof(buffer), samples, 3, &trace, GOLDEN_SENSOR_ID);
+  TEST_ASSERT_EQUAL(sizeof(REMOTE_WRITE_3_TRACE), length);
+  TEST_ASSERT_EQUAL_MEMORY(REMOTE_WRITE_3_TRACE, buffer, length);
+
+  length = buildRemoteWritePayload((uint8_t *)buffer, sizeof(buffer), samples, 1, nullptr, GOLDEN_SENSOR_ID);
+  TEST_ASSERT_EQUAL(sizeof(REMOTE_WRITE_1), length);
+  TEST_ASSERT_EQUAL_MEMORY(REMOTE_WRITE_1, buffer, length);
+}
+
+static void test_series(void)
+{
+  // Every metric but the raw soil value is a series, each once and in the order of the table
+  TEST_ASSERT_EQUAL(METRIC_COUNT - 1, METRIC_SERIES_COUNT);
+  for (uint8_t i = 1; i < METRIC_SERIES_COUNT; i++)
+  {
+    TEST_ASSERT_LESS_THAN(seriesMetric(i), seriesMetric(i - 1));
+  }
+  for (uint8_t m = 0; m < METRIC_COUNT; m++)
+  {
+    for (uint8_t n = 0; n < m; n++)
+    {
+      TEST_ASSERT_TRUE(strcmp(metricName((MetricId)m), metricName((MetricId)n)) != 0);
+    }
+  }
+
+  Sample s = samples[1];
+  s.probes = 3;
+  TEST_ASSERT_EQUAL(3, metricProbes(s, METRIC_SOIL_MOISTURE));
+  TEST_ASSERT_EQUAL(1, metricProbes(s, METRIC_TEMPERATURE));
+  TEST_ASSERT_EQUAL(METRIC_SERIES_COUNT + 2, METRIC_SAMPLE_SERIES_COUNT(3));
+}
+
+static void test_valid_ranges(void)
+{
+  for (int i = 0; i < 3; i++)
+  {
+    TEST_ASSERT_TRUE(metricsValid(samples[i]));
+  }
+
+  // The error codes of the SHT20 and the values out of physical ranges
+  Sample s = samples[1];
+  s.air.temp = 998;
+  TEST_ASSERT_FALSE(metricsValid(s));
+  s = samples[1];
+  s.air.temp = -41;
+  TEST_ASSERT_FALSE(metricsValid(s));
+  s = samples[1];
+  s.air.humidity = 100.5f;
+  TEST_ASSERT_FALSE(metricsValid(s));
+  s = samples[1];
+  s.timeError = -1;
+  TEST_ASSERT_FALSE(metricsValid(s));
+
+  // Each probe is checked
+  s = samples[1];
+  s.probes = 3;
+  s.soil[1] = {9000, 50};
+  s.soil[2] = {9000, 101};
+  TEST_ASSERT_FALSE(metricsValid(s));
+  s.probes = 2;
+  TEST_ASSERT_TRUE(metricsValid(s));
+}
+
+static void test_nan_not_valid(void)
+{
+  // Even for the metrics without bounds
+  Sample s = samples[1];
+  s.air.temp = NAN;
+  TEST_ASSERT_FALSE(metricsValid(s));
+  s = samples[1];
+  s.solarPanelVolt = NAN;
+  TEST_ASSERT_FALSE(metricsValid(s));
+  s = samples[1];
+  s.battery.raw = INFINITY;
+  TEST_ASSERT_TRUE(metricsValid(s));
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_graphite_golden);
+  RUN_TEST(test_loki_golden);
+  RUN_TEST(test_remote_write_golden);
+  RUN_TEST(test_series);
+  RUN_TEST(test_valid_ranges);
+  RUN_TEST(test_nan_not_valid);
+  return UNITY_END();
+}
@@ -0,0 +1,385 @@
+//
+// The payloads must stay byte-identical to the ones the String concatenations built, which
+// the backends parse. The reference builders below keep those concatenations, with a String
+// behaving as the one of the ESP8266 core. The benchmark compares both, for a full batch.
+//
+
+#include <chrono>
+#include <limits.h>
+#include <math.h>
+#include <unity.h>
+
+#include "config.h"
+#include "native/sim.h"
+#include "payload.h"
+
+// String ---------------------------------------------------------------------
+
+// dtostrf of the ESP8266 core, which String(float) calls with a width of 4 and 2 decimals
+static char *dtostrf(double number, signed char width, unsigned char prec, char *s)
+{
+  bool negative = false;
+  if (isnan(number))
+  {
+    strcpy(s, "nan");
+    return s;
+  }
+  if (isinf(number))
+  {
+    strcpy(s, "inf");
+    return s;
+  }
+
+  char *out = s;
+  int fillme = width;
+  if (prec > 0)
+  {
+    fillme -= (prec + 1);
+  }
+  if (number < 0.0)
+  {
+    negative = true;
+    fillme--;
+    number = -number;
+  }
+
+  double rounding = 2.0;
+  for (uint8_t i = 0; i < prec; ++i)
+  {
+    rounding *= 10.0;
+  }
+  rounding = 1.0 / rounding;
+  number += rounding;
+
+  double tenpow = 1.0;
+  int digitcount = 1;
+  while (number >= 10.0 * tenpow)
+  {
+    tenpow *= 10.0;
+    digitcount++;
+  }
+  number /= tenpow;
+  fillme -= digitcount;
+
+  while (fillme-- > 0)
+  {
+    *out++ = ' ';
+  }
+  if (negative)
+  {
+    *out++ = '-';
+  }
+
+  digitcount += prec;
+  int8_t digit = 0;
+  while (digitcount-- > 0)
+  {
+    digit = (int8_t)number;
+    if (digit > 9)
+    {
+      digit = 9;
+    }
+    *out++ = (char)('0' | digit);
+    if ((digitcount == prec) && (prec > 0))
+    {
+      *out++ = '.';
+    }
+    number -= digit;
+    number *= 10.0;
+  }
+  *out = 0;
+  return s;
+}
+
+// Reallocates to the exact length on each concatenation and keeps up to 11 characters inline,
+// as the String of the ESP8266 core
+class String
+{
+public:
+  String(const char *str = "") : buffer(nullptr), len(0) { concat(str, strlen(str)); }
+  String(const String &other) : buffer(nullptr), len(0) { concat(other.c_str(), other.len); }
+  explicit String(long value) : buffer(nullptr), len(0)
+  {
+    char digits[24];
+    snprintf(digits, sizeof(digits), "%ld", value);
+    concat(digits, strlen(digits));
+  }
+  explicit String(unsigned long value) : buffer(nullptr), len(0)
+  {
+    char digits[24];
+    snprintf(digits, sizeof(digits), "%lu", value);
+    concat(digits, strlen(digits));
+  }
+  explicit String(float value) : buffer(nullptr), len(0)
+  {
+    char digits[40];
+    dtostrf(value, 4, 2, digits);
+    concat(digits, strlen(digits));
+  }
+  ~String() { delete[] buffer; }
+
+  String &operator=(const String &other)
+  {
+    if (this != &other)
+    {
+      len = 0;
+      inline_[0] = '\0';
+      delete[] buffer;
+      buffer = nullptr;
+      concat(other.c_str(), other.len);
+    }
+    return *this;
+  }
+
+  const char *c_str() const { return buffer ? buffer : inline_; }
+  size_t length() const { return len; }
+
+  String &operator+=(const String &other)
+  {
+    concat(other.c_str(), other.len);
+    return *this;
+  }
+
+private:
+  void concat(const char *str, size_t length)
+  {
+    size_t newLen = len + length;
+    if (newLen < sizeof(inline_))
+    {
+      memcpy(inline_ + len, str, length);
+      inline_[newLen] = '\0';
+    }
+    else
+    {
+      char *grown = new char[newLen + 1];
+      memcpy(grown, c_str(), len);
+      memcpy(grown + len, str, length);
+      grown[newLen] = '\0';
+      delete[] buffer;
+      buffer = grown;
+    }
+    len = newLen;
+  }
+
+  char *buffer;
+  char inline_[12] = "";
+  size_t len;
+};
+
+static String operator+(const String &a, const String &b)
+{
+  String s(a);
+  s += b;
+  return s;
+}
+
+static String operator+(const String &a, const char *b) { return a + String(b); }
+static String operator+(const String &a, int b) { return a + String((long)b); }
+static String operator+(const String &a, unsigned long b) { return a + String(b); }
+static String operator+(const String &a, unsigned int b) { return a + String((unsigned long)b); }
+static String operator+(const String &a, float b) { return a + String(b); }
+
+// Reference ------------------------------------------------------------------
+
+// One sample as sendToGraphite built it, with the series added since
+static String graphiteEntries(const Sample &s)
+{
+  return String("{\"name\":\"temperature\",\"interval\":") + s.interval + ",\"value\":" + s.air.temp + ",\"mtype\":\"gauge\",\"time\":" + s.ts + "}," +
+         "{\"name\":\"humidity\",\"interval\":" + s.interval + ",\"value\":" + s.air.humidity + ",\"mtype\":\"gauge\",\"time\":" + s.ts + "}," +
+         "{\"name\":\"dew_point\",\"interval\":" + s.interval + ",\"value\":" + s.air.dew_point + ",\"mtype\":\"gauge\",\"time\":" + s.ts + "}," +
+         "{\"name\":\"soil_moisture\",\"interval\":" + s.interval + ",\"value\":" + s.soil[0].percentage + ",\"mtype\":\"gauge\",\"time\":" + s.ts + "}," +
+         "{\"name\":\"battery_volts\",\"interval\":" + s.interval + ",\"value\":" + s.battery.raw + ",\"mtype\":\"gauge\",\"time\":" + s.ts + "}," +
+         "{\"name\":\"battery_perc\",\"interval\":" + s.interval + ",\"value\":" + s.battery.percentage + ",\"mtype\":\"gauge\",\"time\":" + s.ts + "}," +
+         "{\"name\":\"solar_panel_volts\",\"interval\":" + s.interval + ",\"value\":" + s.solarPanelVolt + ",\"mtype\":\"gauge\",\"time\":" + s.ts + "}," +
+         "{\"name\":\"time_error\",\"interval\":" + s.interval + ",\"value\":" + s.timeError + ",\"mtype\":\"gauge\",\"time\":" + s.ts + "}," +
+         "{\"name\":\"suppressed_samples\",\"interval\":" + s.interval + ",\"value\":" + s.suppressed + ",\"mtype\":\"gauge\",\"time\":" + s.ts + "}";
+}
+
+static String graphiteReference(const Sample *samples, size_t count)
+{
+  String body("[");
+  for (size_t i = 0; i < count; i++)
+  {
+    body = body + (i > 0 ? "," : "") + graphiteEntries(samples[i]);
+  }
+  return body + "]";
+}
+
+// One value of the stream as sendToLoki built it, with the keys added since
+static String lokiValue(const Sample &s, const char *message)
+{
+  return String("[ \"") + s.ts + "000000000\", \"" + "temperature=" + s.air.temp + " humidity=" + s.air.humidity + " dew_point=" + s.air.dew_point + " soil_moisture=" + s.soil[0].percentage + +" soil_moisture_raw=" + s.soil[0].raw + " battery_volts=" + s.battery.raw + " battery_perc=" + s.battery.percentage + " solar_panel_volts=" + s.solarPanelVolt + " time_error=" + s.timeError + " suppressed_samples=" + s.suppressed + " msg=\'" + message + "\'\" ]";
+}
+
+static String lokiReference(const Sample *samples, size_t count, const char *sensorId, const char *message)
+{
+  String body = String("{\"streams\": [{ \"stream\": { \"plant_id\": \"") + sensorId + "\", \"monitoring_type\": \"plant\"}, \"values\": [ ";
+  for (size_t i = 0; i < count; i++)
+  {
+    body = body + (i > 0 ? ", " : "") + lokiValue(samples[i], message);
+  }
+  return body + " ] }]}";
+}
+
+// Samples --------------------------------------------------------------------
+
+static Sample makeSample(uint32_t seed)
+{
+  Sample s = {};
+  s.ts = 1700000000UL + seed * 300;
+  s.air = {21.37f + seed * 0.61f, 48.5f - seed * 1.3f, 9.995f - seed * 2.5f};
+  s.soil[0] = {14000 - (int)seed * 777, 55 - (int)seed * 3};
+  s.probes = 1;
+  s.battery = {3.8749f - seed * 0.01f, 79.125f - seed * 0.5f};
+  s.solarPanelVolt = seed * 0.333f;
+  s.timeError = seed * 0.125f;
+  s.interval = 300 + seed;
+  s.suppressed = seed;
+  return s;
+}
+
+static Sample samples[BATCH_MAX_SAMPLES];
+static char buffer[GRAPHITE_PAYLOAD_SIZE(BATCH_MAX_SAMPLES, 1, false) + LOKI_PAYLOAD_SIZE(BATCH_MAX_SAMPLES, 1, 32)];
+
+void setUp(void)
+{
+  for (uint32_t i = 0; i < BATCH_MAX_SAMPLES; i++)
+  {
+    samples[i] = makeSample(i);
+  }
+}
+
+void tearDown(void)
+{
+}
+
+// Tests ----------------------------------------------------------------------
+
+static void test_graphite_single_sample(void)
+{
+  size_t length = buildGraphitePayload(buffer, sizeof(buffer), samples, 1, nullptr);
+  String expected = graphiteReference(samples, 1);
+  TEST_ASSERT_EQUAL_STRING(expected.c_str(), buffer);
+  TEST_ASSERT_EQUAL(expected.length(), length);
+}
+
+static void test_graphite_batch(void)
+{
+  size_t length = buildGraphitePayload(buffer, sizeof(buffer), samples, BATCH_MAX_SAMPLES, nullptr);
+  String expected = graphiteReference(samples, BATCH_MAX_SAMPLES);
+  TEST_ASSERT_EQUAL_STRING(expected.c_str(), buffer);
+  TEST_ASSERT_EQUAL(expected.length(), length);
+}
+
+static void test_loki_batch(void)
+{
+  size_t length = buildLokiPayload(buffer, sizeof(buffer), samples, BATCH_MAX_SAMPLES, "plant", "New_samples!");
+  String expected = lokiReference(samples, BATCH_MAX_SAMPLES, "plant", "New_samples!");
+  TEST_ASSERT_EQUAL_STRING(expected.c_str(), buffer);
+  TEST_ASSERT_EQUAL(expected.length(), length);
+}
+
+static void test_floats_as_string(void)
+{
+  // Halfway values, negatives, carries into a new digit and values past 2^32
+  static const float values[] = {0.0f, 0.005f, 0.125f, -0.004f, -0.006f, 9.995f, 99.999f, -273.15f,
+                                 1e10f, 123456.789f, NAN, INFINITY, -INFINITY};
+  for (float value : values)
+  {
+    PayloadWriter w(buffer, sizeof(buffer));
+    w.writeFloat(value);
+    String expected(value);
+    TEST_ASSERT_EQUAL_STRING(expected.c_str(), buffer);
+  }
+}
+
+static void test_integer_limits(void)
+{
+  char expected[24];
+  PayloadWriter w(buffer, sizeof(buffer));
+  w.writeUInt(ULONG_MAX);
+  snprintf(expected, sizeof(expected), "%lu", ULONG_MAX);
+  TEST_ASSERT_EQUAL_STRING(expected, buffer);
+
+  PayloadWriter n(buffer, sizeof(buffer));
+  n.writeInt(LONG_MIN);
+  snprintf(expected, sizeof(expected), "%ld", LONG_MIN);
+  TEST_ASSERT_EQUAL_STRING(expected, buffer);
+}
+
+static void test_overflow(void)
+{
+  size_t length = graphiteReference(samples, 1).length();
+
+  // The terminator needs a byte too
+  TEST_ASSERT_EQUAL(0, buildGraphitePayload(buffer, length, samples, 1, nullptr));
+  TEST_ASSERT_EQUAL(length, buildGraphitePayload(buffer, length + 1, samples, 1, nullptr));
+}
+
+// Benchmark ------------------------------------------------------------------
+
+#define BENCH_RUNS 2000
+
+static void report(const char *name, size_t allocated, double us, size_t length)
+{
+  char line[128];
+  snprintf(line, sizeof(line), "%-16s %6zu bytes allocated, %7.2f us per payload of %zu bytes", name, allocated, us, length);
+  TEST_MESSAGE(line);
+}
+
+static void test_benchmark(void)
+{
+  typedef std::chrono::steady_clock Clock;
+  size_t length = 0;
+
+  size_t allocated = simHeapAllocated;
+  Clock::time_point start = Clock::now();
+  for (int i = 0; i < BENCH_RUNS; i++)
+  {
+    length = graphiteReference(samples, BATCH_MAX_SAMPLES).length();
+  }
+  double us = std::chrono::duration<double, std::micro>(Clock::now() - start).count() / BENCH_RUNS;
+  report("graphite String", (simHeapAllocated - allocated) / BENCH_RUNS, us, length);
+
+  allocated = simHeapAllocated;
+  start = Clock::now();
+  for (int i = 0; i < BENCH_RUNS; i++)
+  {
+    length = buildGraphitePayload(buffer, sizeof(buffer), samples, BATCH_MAX_SAMPLES, nullptr);
+  }
+  us = std::chrono::duration<double, std::micro>(Clock::now() - start).count() / BENCH_RUNS;
+  report("graphite writer", (simHeapAllocated - allocated) / BENCH_RUNS, us, length);
+  TEST_ASSERT_EQUAL(allocated, simHeapAllocated);
+
+  allocated = simHeapAllocated;
+  start = Clock::now();
+  for (int i = 0; i < BENCH_RUNS; i++)
+  {
+    length = lokiReference(samples, BATCH_MAX_SAMPLES, "plant", "New_samples!").length();
+  }
+  us = std::chrono::duration<double, std::micro>(Clock::now() - start).count() / BENCH_RUNS;
+  report("loki String", (simHeapAllocated - allocated) / BENCH_RUNS, us, length);
+
+  allocated = simHeapAllocated;
+  start = Clock::now();
+  for (int i = 0; i < BENCH_RUNS; i++)
+  {
+    length = buildLokiPayload(buffer, sizeof(buffer), samples, BATCH_MAX_SAMPLES, "plant", "New_samples!");
+  }
+  us = std::chrono::duration<double, std::micro>(Clock::now() - start).count() / BENCH_RUNS;
+  report("loki writer", (simHeapAllocated - allocated) / BENCH_RUNS, us, length);
+  TEST_ASSERT_EQUAL(allocated, simHeapAllocated);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_graphite_single_sample);
+  RUN_TEST(test_graphite_batch);
+  RUN_TEST(test_loki_batch);
+  RUN_TEST(test_floats_as_string);
+  RUN_TEST(test_integer_limits);
+  RUN_TEST(test_overflow);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
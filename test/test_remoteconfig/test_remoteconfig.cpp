@@ -0,0 +1,99 @@
+//
+// The documents of the remote config: the values land in the settings of the node in their
+// units, and a document with a value out of range, not a number, or bounds of the scheduler the
+// wrong way round is refused whole.
+//
+
+#include <unity.h>
+
+#include <string.h>
+#include <string>
+
+#include "config.h"
+#include "plant.h"
+#include "remoteconfig.h"
+
+static RemoteConfig config;
+
+// parseConfig() works in place
+static bool parse(const char *document)
+{
+  std::string text(document);
+  return parseConfig(&text[0], config);
+}
+
+void setUp(void)
+{
+  config = {};
+}
+
+void tearDown(void)
+{
+}
+
+// Tests ----------------------------------------------------------------------
+
+static void test_apply(void)
+{
+  TEST_ASSERT_TRUE(parse("interval=300  # Seconds\n"
+                         "min_interval = 120\r\n"
+                         "max_interval=3600\n"
+                         "\n"
+                         "soil_band=1.5\n"
+                         "display_low_power=1\n"
+                         "soil_trim_0=21400:8900\n"
+                         "future_key=whatever"));
+
+  NodeConfig node = defaultNodeConfig();
+  applyConfig(config, node);
+  TEST_ASSERT_EQUAL(300, node.sampleIntervalSec);
+  TEST_ASSERT_EQUAL(120, node.minIntervalSec);
+  TEST_ASSERT_EQUAL(3600, node.maxIntervalSec);
+  TEST_ASSERT_TRUE(node.deadband.soilMoisture == 1.5f);
+  TEST_ASSERT_TRUE(node.displayLowPower);
+  TEST_ASSERT_EQUAL(21400, node.soilTrims[0].air);
+  TEST_ASSERT_EQUAL(8900, node.soilTrims[0].water);
+
+  // The keys left out keep the values of config.h
+  TEST_ASSERT_EQUAL(BATCH_UPLOAD_EVERY, node.uploadEvery);
+  TEST_ASSERT_TRUE(node.deadband.temp == (float)DEADBAND_TEMP);
+}
+
+static void test_bad_values(void)
+{
+  const char *bad[] = {"interval=0",          "interval=65536",      "interval=12s",    "upload_every=",
+                       "temp_band=-0.1",      "temp_band=nan",       "temp_band=NAN",   "soil_band=-nan",
+                       "battery_band=inf",    "display_low_power=2", "soil_trim_0=5:5", "soil_trim_99=1:2",
+                       "heartbeat=2147483648"};
+  for (const char *document : bad)
+  {
+    TEST_ASSERT_TRUE_MESSAGE(!parse(document), document);
+  }
+
+  // One bad line and nothing is kept
+  TEST_ASSERT_FALSE(parse("interval=300\nsoil_band=nan\n"));
+}
+
+static void test_interval_bounds(void)
+{
+  TEST_ASSERT_TRUE(parse("min_interval=600\nmax_interval=600"));
+  TEST_ASSERT_FALSE(parse("min_interval=601\nmax_interval=600"));
+  TEST_ASSERT_FALSE(parse("max_interval=600\nmin_interval=601"));
+
+  // Against the bound of config.h when only one is given
+  std::string below = "max_interval=" + std::to_string(SCHED_MIN_INTERVAL_SEC - 1);
+  std::string above = "min_interval=" + std::to_string(SCHED_MAX_INTERVAL_SEC + 1);
+  TEST_ASSERT_FALSE(parse(below.c_str()));
+  TEST_ASSERT_FALSE(parse(above.c_str()));
+  std::string same = "min_interval=" + std::to_string(SCHED_MAX_INTERVAL_SEC);
+  TEST_ASSERT_TRUE(parse(same.c_str()));
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_apply);
+  RUN_TEST(test_bad_values);
+  RUN_TEST(test_interval_bounds);
+  return UNITY_END();
+}
@@ -0,0 +1,325 @@
+//
+// Prometheus remote write: the snappy compressor against the decoder of the receiver stand-in,
+// and the payloads as Prometheus reads them (labels sorted, samples in order) with the values of
+// the samples and the trace.
+//
+
+#include <unity.h>
+
+#include <string>
+#include <vector>
+
+#include "config.h"
+#include "metrics.h"
+#include "native/sim.h"
+#include "remotewrite.h"
+
+#define PROBES 3
+
+static uint32_t seed;
+
+// Same sequence on every run
+static uint32_t nextRandom()
+{
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+// Compress in chunks of the given size (0 = a byte at a time)
+static std::vector<uint8_t> compress(const std::vector<uint8_t> &input, size_t chunk, size_t size)
+{
+  std::vector<uint8_t> out(size);
+  SnappyWriter w(out.data(), out.size(), input.size());
+  for (size_t i = 0; i < input.size(); i += chunk > 0 ? chunk : 1)
+  {
+    if (chunk == 0)
+    {
+      w.write(input[i]);
+    }
+    else
+    {
+      w.write(input.data() + i, input.size() - i < chunk ? input.size() - i : chunk);
+    }
+  }
+  out.resize(w.finish());
+
+  return out;
+}
+
+static void checkSnappy(const std::vector<uint8_t> &input)
+{
+  std::vector<uint8_t> compressed = compress(input, 0, SNAPPY_MAX_COMPRESSED(input.size()));
+  TEST_ASSERT_GREATER_THAN(0, compressed.size());
+
+  std::vector<uint8_t> output;
+  TEST_ASSERT_TRUE(snappyUncompress(compressed.data(), compressed.size(), output));
+  TEST_ASSERT_TRUE(output == input);
+
+  // The chunks fed do not change the output
+  TEST_ASSERT_TRUE(compressed == compress(input, 7, SNAPPY_MAX_COMPRESSED(input.size())));
+  TEST_ASSERT_TRUE(compressed == compress(input, input.size() + 1, SNAPPY_MAX_COMPRESSED(input.size())));
+}
+
+static void fillSamples(Sample *samples, size_t count, uint8_t probes)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    Sample &s = samples[i];
+    s = {};
+    s.ts = 1700000000 + i * 300;
+    s.air = {21.37f + i * 0.1f, 54.2f - i * 0.3f, 11.82f};
+    for (uint8_t p = 0; p < probes; p++)
+    {
+      s.soil[p] = {9312 + (int)i * 7 + p * 1500, 72 - p * 16};
+    }
+    s.probes = probes;
+    s.battery = {3.912f, 79.43f};
+    s.solarPanelVolt = 4.71f;
+    s.timeError = 0.4f;
+    s.interval = 300;
+    s.suppressed = i % 3;
+  }
+}
+
+static Trace makeTrace()
+{
+  Trace trace = {};
+  HeapStats heap = {41234, 28672, 12};
+  for (uint8_t p = 0; p < TRACE_PHASE_COUNT; p += 2)
+  {
+    traceRecord(trace, (TracePhase)p, 1000 * (100 + 37 * p), heap);
+  }
+  traceCycle(trace, 1700000000, 1234);
+  trace.overruns = 2;
+
+  return trace;
+}
+
+static const SimLabel *label(const SimSeries &series, const char *name)
+{
+  for (const SimLabel &l : series.labels)
+  {
+    if (l.name == name)
+    {
+      return &l;
+    }
+  }
+
+  return nullptr;
+}
+
+// What the receiver decoded against the samples and trace of the payload
+static void checkSeries(const std::vector<SimSeries> &series, const Sample *samples, size_t count, const Trace *trace)
+{
+  size_t n = METRIC_SAMPLE_SERIES_COUNT(samples[0].probes);
+  size_t phases = 0;
+  for (uint8_t p = 0; trace && p < TRACE_PHASE_COUNT; p++)
+  {
+    phases += traceHasPhase(*trace, (TracePhase)p);
+  }
+  TEST_ASSERT_EQUAL(n + (trace ? 2 + phases * 4 : 0), series.size());
+
+  const SimSeries *s = series.data();
+  for (uint8_t m = 0; m < METRIC_SERIES_COUNT; m++)
+  {
+    MetricId metric = seriesMetric(m);
+    uint8_t probes = metricProbes(samples[0], metric);
+    for (uint8_t p = 0; p < probes; p++, s++)
+    {
+      TEST_ASSERT_EQUAL_STRING(metricName(metric), s->labels[0].value.c_str());
+      TEST_ASSERT_EQUAL_STRING(SENSOR_ID, label(*s, "plant_id")->value.c_str());
+      if (probes > 1)
+      {
+        std::string probe = std::to_string(p);
+        TEST_ASSERT_EQUAL_STRING(probe.c_str(), label(*s, "probe")->value.c_str());
+      }
+      else
+      {
+        TEST_ASSERT_TRUE(label(*s, "probe") == nullptr);
+      }
+
+      TEST_ASSERT_EQUAL(count, s->samples.size());
+      for (size_t i = 0; i < count; i++)
+      {
+        TEST_ASSERT_TRUE(s->samples[i].value == (double)metricValue(samples[i], metric, p));
+        TEST_ASSERT_TRUE(s->samples[i].timestampMs == (int64_t)samples[i].ts * 1000);
+      }
+    }
+  }
+
+  if (!trace)
+  {
+    return;
+  }
+
+  TEST_ASSERT_EQUAL_STRING("trace_awake_ms", series[n].labels[0].value.c_str());
+  TEST_ASSERT_TRUE(series[n].samples[0].value == trace->awakeMs);
+  TEST_ASSERT_TRUE(series[n].samples[0].timestampMs == (int64_t)trace->ts * 1000);
+  TEST_ASSERT_EQUAL_STRING("trace_overruns", series[n + 1].labels[0].value.c_str());
+  TEST_ASSERT_TRUE(series[n + 1].samples[0].value == trace->overruns);
+
+  s = &series[n + 2];
+  for (uint8_t p = 0; p < TRACE_PHASE_COUNT; p++)
+  {
+    if (!traceHasPhase(*trace, (TracePhase)p))
+    {
+      continue;
+    }
+    TEST_ASSERT_EQUAL_STRING(tracePhaseName(p), label(*s, "phase")->value.c_str());
+    TEST_ASSERT_TRUE(s[0].samples[0].value == trace->phaseMs[p]);
+    TEST_ASSERT_TRUE(s[1].samples[0].value == trace->freeHeap[p]);
+    TEST_ASSERT_TRUE(s[2].samples[0].value == trace->maxFreeBlock[p]);
+    TEST_ASSERT_TRUE(s[3].samples[0].value == trace->fragmentation[p]);
+    s += 4;
+  }
+}
+
+static void checkPayload(size_t count, uint8_t probes, bool withTrace)
+{
+  static uint8_t buffer[REMOTE_WRITE_PAYLOAD_SIZE(BATCH_MAX_SAMPLES, SAMPLE_MAX_PROBES, sizeof(SENSOR_ID), true)];
+  Sample samples[BATCH_MAX_SAMPLES];
+  fillSamples(samples, count, probes);
+  Trace trace = makeTrace();
+  const Trace *t = withTrace ? &trace : nullptr;
+
+  size_t length = buildRemoteWritePayload(buffer, sizeof(buffer), samples, count, t, SENSOR_ID);
+  TEST_ASSERT_GREATER_THAN(0, length);
+  TEST_ASSERT_LESS_OR_EQUAL(REMOTE_WRITE_PAYLOAD_SIZE(count, probes, strlen(SENSOR_ID), withTrace), length);
+
+  std::vector<SimSeries> series;
+  size_t protoLength = 0;
+  TEST_ASSERT_TRUE(receiveRemoteWrite(buffer, length, series, protoLength));
+  TEST_ASSERT_LESS_OR_EQUAL(REMOTE_WRITE_PROTO_SIZE(count, probes, strlen(SENSOR_ID), withTrace), protoLength);
+  checkSeries(series, samples, count, t);
+}
+
+void setUp(void)
+{
+  seed = 0x9e3779b9;
+}
+
+void tearDown(void)
+{
+}
+
+// Tests ----------------------------------------------------------------------
+
+static void test_snappy_round_trip(void)
+{
+  checkSnappy({});
+  checkSnappy({42});
+
+  // Repeated labels, as in a payload
+  std::string labels;
+  while (labels.size() < 5000)
+  {
+    labels += "__name__soil_moisture_percentageplant_id" SENSOR_ID "probe" + std::to_string(labels.size() % 3);
+  }
+  checkSnappy(std::vector<uint8_t>(labels.begin(), labels.end()));
+
+  // Random, nothing to match
+  std::vector<uint8_t> random(4096);
+  for (uint8_t &b : random)
+  {
+    b = nextRandom();
+  }
+  checkSnappy(random);
+
+  // Runs longer than the copies, matches further than the window
+  std::vector<uint8_t> largest(SNAPPY_MAX_INPUT);
+  for (size_t i = 0; i < largest.size(); i++)
+  {
+    largest[i] = i < 3000 ? 'a' : (i % 1500 < 700 ? random[i % 1500] : nextRandom() % 4);
+  }
+  checkSnappy(largest);
+}
+
+static void test_snappy_compresses_payloads(void)
+{
+  std::string labels;
+  while (labels.size() < 2000)
+  {
+    labels += "__name__air_temperatureplant_id" SENSOR_ID;
+  }
+  std::vector<uint8_t> input(labels.begin(), labels.end());
+  TEST_ASSERT_LESS_THAN(input.size() / 4, compress(input, 0, SNAPPY_MAX_COMPRESSED(input.size())).size());
+}
+
+static void test_snappy_overflow(void)
+{
+  std::vector<uint8_t> input(600);
+  for (uint8_t &b : input)
+  {
+    b = nextRandom() % 8;
+  }
+  size_t length = compress(input, 0, SNAPPY_MAX_COMPRESSED(input.size())).size();
+
+  for (size_t size = 0; size < length; size++)
+  {
+    TEST_ASSERT_EQUAL(0, compress(input, 0, size).size());
+  }
+  TEST_ASSERT_EQUAL(length, compress(input, 0, length).size());
+}
+
+static void test_snappy_wrong_length(void)
+{
+  uint8_t out[64];
+  const uint8_t input[] = "remote write";
+
+  SnappyWriter shorter(out, sizeof(out), sizeof(input) + 1);
+  shorter.write(input, sizeof(input));
+  TEST_ASSERT_EQUAL(0, shorter.finish());
+
+  SnappyWriter longer(out, sizeof(out), sizeof(input) - 1);
+  longer.write(input, sizeof(input));
+  TEST_ASSERT_EQUAL(0, longer.finish());
+}
+
+static void test_payload(void)
+{
+  for (size_t count = 1; count <= BATCH_MAX_SAMPLES; count++)
+  {
+    checkPayload(count, 1, true);
+    checkPayload(count, 1, false);
+  }
+}
+
+static void test_payload_probes(void)
+{
+  for (size_t count = 1; count <= BATCH_MAX_SAMPLES; count++)
+  {
+    checkPayload(count, PROBES, true);
+    checkPayload(count, SAMPLE_MAX_PROBES, false);
+  }
+}
+
+static void test_payload_overflow(void)
+{
+  static uint8_t buffer[REMOTE_WRITE_PAYLOAD_SIZE(BATCH_MAX_SAMPLES, 1, sizeof(SENSOR_ID), true)];
+  Sample samples[BATCH_MAX_SAMPLES];
+  fillSamples(samples, BATCH_MAX_SAMPLES, 1);
+  Trace trace = makeTrace();
+
+  size_t length = buildRemoteWritePayload(buffer, sizeof(buffer), samples, BATCH_MAX_SAMPLES, &trace, SENSOR_ID);
+  TEST_ASSERT_GREATER_THAN(0, length);
+  for (size_t size = 0; size < length; size += 13)
+  {
+    TEST_ASSERT_EQUAL(0, buildRemoteWritePayload(buffer, size, samples, BATCH_MAX_SAMPLES, &trace, SENSOR_ID));
+  }
+  TEST_ASSERT_EQUAL(0, buildRemoteWritePayload(buffer, length - 1, samples, BATCH_MAX_SAMPLES, &trace, SENSOR_ID));
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_snappy_round_trip);
+  RUN_TEST(test_snappy_compresses_payloads);
+  RUN_TEST(test_snappy_overflow);
+  RUN_TEST(test_snappy_wrong_length);
+  RUN_TEST(test_payload);
+  RUN_TEST(test_payload_probes);
+  RUN_TEST(test_payload_overflow);
+  return UNITY_END();
+}
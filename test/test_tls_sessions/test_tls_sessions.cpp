@@ -0,0 +1,202 @@
+//
+// TLS sessions across wakes: the sessions kept in RTC memory are resumed by the backends, the
+// copy in flash after a power loss, and flash is only written for a new session. The backends
+// are the stand-ins of the simulated network, which resume the sessions they issued until
+// they expire.
+//
+
+#include <unity.h>
+
+#include "config.h"
+#include "native/sim.h"
+#include "tlssessions.h"
+
+// Counts the writes to the flash of the simulation
+class CountingStorage : public StorageHal
+{
+public:
+  CountingStorage(StorageHal &storage) : storage(storage), appends(0) {}
+
+  size_t read(const char *path, uint32_t offset, void *data, size_t length) override { return storage.read(path, offset, data, length); }
+  bool append(const char *path, const void *data, size_t length) override
+  {
+    appends++;
+    return storage.append(path, data, length);
+  }
+  void remove(const char *path) override { storage.remove(path); }
+  int32_t size(const char *path) override { return storage.size(path); }
+
+  StorageHal &storage;
+  uint32_t appends;
+};
+
+// The backends and the flash outlive the wakes
+struct Node
+{
+  Node() : world(), storage(world), rtc() {}
+
+  // A wake posting to each backend, return the handshakes resumed
+  uint32_t wake(bool lost)
+  {
+    static const char body[] = "[]";
+
+    world.cycle = {};
+    SimNetwork network(world, storage);
+    network.begin(rtc, lost);
+    network.post(BACKEND_GRAPHITE, body, sizeof(body) - 1, BUDGET_UPLOAD_MS);
+    network.post(BACKEND_LOKI, body, sizeof(body) - 1, BUDGET_UPLOAD_MS);
+
+    return world.cycle.tlsResumed;
+  }
+
+  SimWorld world;
+  SimStorage storage;
+  NetworkState rtc;
+};
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+static void fillSession(uint8_t *session, uint8_t value)
+{
+  memset(session, value, TLS_SESSION_SIZE);
+}
+
+// Tests ----------------------------------------------------------------------
+
+static void test_new_session_goes_to_flash(void)
+{
+  Node node;
+  CountingStorage flash(node.storage);
+  TlsSessions sessions = {};
+  uint8_t session[TLS_SESSION_SIZE];
+  fillSession(session, 1);
+
+  TEST_ASSERT_EQUAL(TLS_FULL, recordTlsSession(sessions, BACKEND_GRAPHITE, session, sizeof(session), 200, &flash));
+  TEST_ASSERT_EQUAL(1, flash.appends);
+  TEST_ASSERT_EQUAL_MEMORY(session, tlsSession(sessions, BACKEND_GRAPHITE), sizeof(session));
+
+  // Same session: resumed, flash untouched
+  TEST_ASSERT_EQUAL(TLS_RESUMED, recordTlsSession(sessions, BACKEND_GRAPHITE, session, sizeof(session), 200, &flash));
+  TEST_ASSERT_EQUAL(1, flash.appends);
+  TEST_ASSERT_EQUAL(1, sessions.resumed);
+  TEST_ASSERT_EQUAL(1, sessions.full);
+
+  TlsSessions restored = {};
+  loadTlsSessions(flash, restored);
+  TEST_ASSERT_EQUAL_MEMORY(sessions.slots, restored.slots, sizeof(restored.slots));
+}
+
+static void test_failed_connection_keeps_session(void)
+{
+  Node node;
+  CountingStorage flash(node.storage);
+  TlsSessions sessions = {};
+  uint8_t session[TLS_SESSION_SIZE];
+  fillSession(session, 1);
+  recordTlsSession(sessions, BACKEND_LOKI, session, sizeof(session), 204, &flash);
+
+  uint8_t other[TLS_SESSION_SIZE];
+  fillSession(other, 2);
+  TEST_ASSERT_EQUAL(TLS_NO_HANDSHAKE, recordTlsSession(sessions, BACKEND_LOKI, other, sizeof(other), -1, &flash));
+  TEST_ASSERT_EQUAL_MEMORY(session, tlsSession(sessions, BACKEND_LOKI), sizeof(session));
+  TEST_ASSERT_EQUAL(1, flash.appends);
+}
+
+static void test_shared_slot(void)
+{
+  Node node;
+  CountingStorage flash(node.storage);
+  TlsSessions sessions = {};
+  uint8_t graphite[TLS_SESSION_SIZE];
+  uint8_t prometheus[TLS_SESSION_SIZE];
+  fillSession(graphite, 1);
+  fillSession(prometheus, 2);
+
+  // Graphite and Prometheus replace the session of each other, Loki keeps its own
+  recordTlsSession(sessions, BACKEND_GRAPHITE, graphite, sizeof(graphite), 200, &flash);
+  recordTlsSession(sessions, BACKEND_LOKI, graphite, sizeof(graphite), 204, &flash);
+  TEST_ASSERT_EQUAL(2, flash.appends);
+  for (int wake = 0; wake < 10; wake++)
+  {
+    TEST_ASSERT_EQUAL(TLS_FULL, recordTlsSession(sessions, BACKEND_PROMETHEUS, prometheus, sizeof(prometheus), 200, &flash));
+    TEST_ASSERT_EQUAL(TLS_FULL, recordTlsSession(sessions, BACKEND_GRAPHITE, graphite, sizeof(graphite), 200, &flash));
+    TEST_ASSERT_EQUAL(TLS_RESUMED, recordTlsSession(sessions, BACKEND_LOKI, graphite, sizeof(graphite), 204, &flash));
+  }
+
+  // The switches of the shared slot do not wear the flash, a new session of the same backend does
+  TEST_ASSERT_EQUAL(2, flash.appends);
+  fillSession(graphite, 3);
+  TEST_ASSERT_EQUAL(TLS_FULL, recordTlsSession(sessions, BACKEND_GRAPHITE, graphite, sizeof(graphite), 200, &flash));
+  TEST_ASSERT_EQUAL(3, flash.appends);
+}
+
+static void test_missing_flash_copy(void)
+{
+  TlsSessions sessions;
+  memset(&sessions, 0xff, sizeof(sessions));
+  Node node;
+  loadTlsSessions(node.storage, sessions);
+
+  uint8_t zeros[TLS_SESSION_SIZE] = {};
+  TEST_ASSERT_EQUAL_MEMORY(zeros, tlsSession(sessions, BACKEND_GRAPHITE), sizeof(zeros));
+  TEST_ASSERT_EQUAL_MEMORY(zeros, tlsSession(sessions, BACKEND_LOKI), sizeof(zeros));
+}
+
+static void test_resumed_across_wakes(void)
+{
+  Node node;
+  TEST_ASSERT_EQUAL(0, node.wake(true));
+  TEST_ASSERT_EQUAL(2, node.wake(false));
+  TEST_ASSERT_EQUAL(2, node.wake(false));
+}
+
+static void test_resumed_after_power_loss(void)
+{
+  Node node;
+  node.wake(true);
+
+  // The RTC memory is lost, the sessions come back from flash
+  memset(&node.rtc, 0, sizeof(node.rtc));
+  TEST_ASSERT_EQUAL(TLS_SESSION_FLASH ? 2 : 0, node.wake(true));
+}
+
+static void test_expired_sessions(void)
+{
+  Node node;
+  node.wake(true);
+  node.world.advance(SIM_TLS_SESSION_US);
+
+  // The backends forgot the sessions, the new ones are resumed from then on
+  TEST_ASSERT_EQUAL(0, node.wake(false));
+  TEST_ASSERT_EQUAL(2, node.wake(false));
+}
+
+static void test_outage_keeps_sessions(void)
+{
+  Node node;
+  node.wake(true);
+  node.world.outage = true;
+  TEST_ASSERT_EQUAL(0, node.wake(false));
+  node.world.outage = false;
+  TEST_ASSERT_EQUAL(2, node.wake(false));
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_new_session_goes_to_flash);
+  RUN_TEST(test_failed_connection_keeps_session);
+  RUN_TEST(test_shared_slot);
+  RUN_TEST(test_missing_flash_copy);
+  RUN_TEST(test_resumed_across_wakes);
+  RUN_TEST(test_resumed_after_power_loss);
+  RUN_TEST(test_expired_sessions);
+  RUN_TEST(test_outage_keeps_sessions);
+  return UNITY_END();
+}
@@ -0,0 +1,204 @@
+//
+// The wake cycle on the simulated backends, as env:native runs it: deterministic, asleep after
+// every wake, the radio only up for the uploads and no heap left behind.
+//
+
+#include <unity.h>
+
+#include "config.h"
+#include "native/sim.h"
+#include "plant.h"
+
+#define CYCLES 60
+
+// Everything a node keeps across its wakes
+struct Node
+{
+  Node(const NodeConfig &config)
+      : world(), sensors(world), clock(world), sleep(world), storage(world), network(world, storage), display(world),
+        system(world), firmware(world), hal({sensors, network, clock, sleep, storage, display, system, firmware}),
+        config(config)
+  {
+  }
+
+  bool wake(uint32_t cycle)
+  {
+    world.cycle = {};
+    world.sleepUs = 0;
+    world.bootUs = world.nowUs;
+    firmware.boot();
+    world.advance(SIM_BOOT_US);
+    sensors.select(cycle);
+
+    return simWake(world, hal, config);
+  }
+
+  SimWorld world;
+  SimSensors sensors;
+  SimClock clock;
+  SimSleep sleep;
+  SimStorage storage;
+  SimNetwork network;
+  SimDisplay display;
+  SimSystem system;
+  SimFirmware firmware;
+  const Hal hal;
+  NodeConfig config;
+};
+
+static NodeConfig config;
+
+void setUp(void)
+{
+  config = defaultNodeConfig();
+  config.sampleIntervalSec = 60;
+  config.minIntervalSec = 60;
+  config.maxIntervalSec = 60;
+  config.uploadEvery = 3;
+  config.exporters = EXPORTER_BIT(EXPORTER_GRAPHITE) | EXPORTER_BIT(EXPORTER_LOKI);
+  config.updateCheckSec = 0;
+  config.configEvery = 0;
+}
+
+void tearDown(void)
+{
+}
+
+// Tests ----------------------------------------------------------------------
+
+static void test_deterministic(void)
+{
+  Node a(config);
+  Node b(config);
+  for (uint32_t i = 0; i < CYCLES; i++)
+  {
+    TEST_ASSERT_TRUE(a.wake(i));
+    TEST_ASSERT_TRUE(b.wake(i));
+    TEST_ASSERT_EQUAL(a.world.cycle.awakeUs, b.world.cycle.awakeUs);
+    TEST_ASSERT_EQUAL(a.world.cycle.bytesSent, b.world.cycle.bytesSent);
+    TEST_ASSERT_EQUAL(a.world.sleepUs, b.world.sleepUs);
+  }
+  TEST_ASSERT_TRUE(a.world.delivered == b.world.delivered);
+}
+
+static void test_radio_only_for_uploads(void)
+{
+  Node node(config);
+  uint32_t uploads = 0;
+  for (uint32_t i = 0; i < CYCLES; i++)
+  {
+    TEST_ASSERT_TRUE(node.wake(i));
+    const SimCycle &cycle = node.world.cycle;
+    if (cycle.posts == 0)
+    {
+      TEST_ASSERT_EQUAL(0, cycle.radioUs);
+      TEST_ASSERT_EQUAL(0, cycle.bytesSent);
+    }
+    else
+    {
+      uploads++;
+    }
+  }
+
+  // Every third wake at most, the deadbands may skip some
+  TEST_ASSERT_GREATER_THAN(0, uploads);
+  TEST_ASSERT_LESS_OR_EQUAL(CYCLES / 3 + 1, uploads);
+  TEST_ASSERT_EQUAL(0, node.world.duplicates);
+  TEST_ASSERT_EQUAL(0, node.world.rejected);
+}
+
+static void test_heap(void)
+{
+  Node node(config);
+  for (uint32_t i = 0; i < CYCLES; i++)
+  {
+    size_t heapStart = simHeapUsed;
+    TEST_ASSERT_TRUE(node.wake(i));
+    TEST_ASSERT_EQUAL(heapStart, simHeapUsed);
+
+    // The node itself allocates nothing, the clients of the requests do
+    const SimCycle &cycle = node.world.cycle;
+    TEST_ASSERT_EQUAL(cycle.posts > 0 ? SIM_TLS_HEAP_BYTES : 0, cycle.heapPeak);
+  }
+}
+
+static void test_buffered_samples_survive_sleep(void)
+{
+  // Uploads every third wake carry the samples of the wakes in between
+  config.deadband = {};
+  Node node(config);
+  for (uint32_t i = 0; i < CYCLES; i++)
+  {
+    TEST_ASSERT_TRUE(node.wake(i));
+  }
+
+  TEST_ASSERT_GREATER_OR_EQUAL(CYCLES - 3, node.world.delivered.size());
+}
+
+static void test_outage_backs_off(void)
+{
+  // Nothing answers from the first wake: the time sync fails like the uploads would
+  Node node(config);
+  node.world.outage = true;
+  uint32_t attempts = 0;
+  for (uint32_t i = 0; i < 16; i++)
+  {
+    TEST_ASSERT_TRUE(node.wake(i));
+    attempts += node.world.cycle.radioUs > 0;
+  }
+
+  // Wakes 0, 2, 5 and 10
+  TEST_ASSERT_EQUAL(4, attempts);
+}
+
+static void test_outage_within_budget(void)
+{
+  Node node(config);
+  for (uint32_t i = 0; i < 3; i++)
+  {
+    TEST_ASSERT_TRUE(node.wake(i));
+  }
+
+  // The requests give up when the budget of the upload is spent
+  node.world.outage = true;
+  for (uint32_t i = 3; i < CYCLES; i++)
+  {
+    TEST_ASSERT_TRUE(node.wake(i));
+    TEST_ASSERT_LESS_OR_EQUAL((uint64_t)WAKE_BUDGET_MS * 1000, node.world.cycle.awakeUs);
+  }
+  TEST_ASSERT_EQUAL(0, node.world.overruns);
+}
+
+static void test_no_time_not_suppressed(void)
+{
+  // Every sample leaves the deadbands, none can be timestamped until the time sync succeeds
+  config.deadband = {};
+  Node node(config);
+  node.world.outage = true;
+  for (uint32_t i = 0; i < 6; i++)
+  {
+    TEST_ASSERT_TRUE(node.wake(i));
+  }
+  node.world.outage = false;
+  for (uint32_t i = 6; i < CYCLES; i++)
+  {
+    TEST_ASSERT_TRUE(node.wake(i));
+  }
+
+  // They are not counted as within the deadbands
+  TEST_ASSERT_GREATER_THAN(0, node.world.delivered.size());
+  TEST_ASSERT_EQUAL(0, node.world.suppressed);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_deterministic);
+  RUN_TEST(test_radio_only_for_uploads);
+  RUN_TEST(test_heap);
+  RUN_TEST(test_buffered_samples_survive_sleep);
+  RUN_TEST(test_outage_backs_off);
+  RUN_TEST(test_outage_within_budget);
+  RUN_TEST(test_no_time_not_suppressed);
+  return UNITY_END();
+}
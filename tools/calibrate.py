@@ -0,0 +1,216 @@
+#!/usr/bin/env python3
+#
+# Fits the piecewise linear calibration curves (see src/calibration.h) to recorded pairs.
+#
+# Usage: tools/calibrate.py [-n POINTS] [-o OUTPUT.h] [INPUT.csv ...]
+# Defaults to assets/calibration/*.csv -> src/calibration_curves.h, at most 8 points per curve.
+# Each file holds one "raw,reference" pair per line (e.g. an ADC result and the moisture
+# measured by weighing the pot, or millivolts and the charge left), "#" starts a comment. The
+# curve is named after the file: soil_1.csv gives SOIL_1_CURVE. Also runs as a PlatformIO pre
+# script, regenerating the curves when a file is newer than the header.
+#
+# The points are added one at a time where they reduce the least squares error the most, the
+# curve going through all of them when the file has fewer distinct raw values.
+#
+
+import argparse
+import glob
+import math
+import os
+import sys
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+DEFAULT_INPUTS = os.path.join(ROOT, "assets", "calibration", "*.csv")
+DEFAULT_OUTPUT = os.path.join(ROOT, "src", "calibration_curves.h")
+DEFAULT_POINTS = 8
+
+FRACTION_BITS = 8  # CAL_FRACTION_BITS
+CANDIDATES = 64  # Raw values where a point may be added, spread over the pairs
+INT16_MIN, INT16_MAX = -(1 << 15), (1 << 15) - 1
+
+
+# Input ------------------------------------------------------------------------
+
+
+def read_pairs(path):
+    pairs = []
+    with open(path) as file:
+        for number, line in enumerate(file, 1):
+            line = line.split("#")[0].strip()
+            if not line:
+                continue
+            fields = line.split(",")
+            try:
+                pairs.append((float(fields[0]), float(fields[1])))
+            except (ValueError, IndexError):
+                if pairs:
+                    raise ValueError("%s:%d: expected raw,reference" % (path, number))
+                # Header
+    if len(pairs) < 2:
+        raise ValueError("%s: at least 2 pairs are needed" % path)
+    return pairs
+
+
+def average_duplicates(pairs):
+    sums = {}
+    for x, y in pairs:
+        total, n = sums.get(x, (0.0, 0))
+        sums[x] = (total + y, n + 1)
+    return sorted((x, total / n) for x, (total, n) in sums.items())
+
+
+# Fit --------------------------------------------------------------------------
+
+
+def fit_values(pairs, knots):
+    # Least squares of the values at the knots (raw values of pairs sorted by raw value), the
+    # hat functions making a tridiagonal system
+    n = len(knots)
+    diag = [0.0] * n
+    upper = [0.0] * n
+    rhs = [0.0] * n
+    k = 0
+    for x, y in pairs:
+        while k < n - 2 and x > knots[k + 1]:
+            k += 1
+        t = min(max((x - knots[k]) / (knots[k + 1] - knots[k]), 0.0), 1.0)
+        wa, wb = 1 - t, t
+        diag[k] += wa * wa
+        diag[k + 1] += wb * wb
+        upper[k] += wa * wb
+        rhs[k] += wa * y
+        rhs[k + 1] += wb * y
+
+    # Thomas algorithm
+    c = [0.0] * n
+    d = [0.0] * n
+    for i in range(n):
+        lower = upper[i - 1] if i > 0 else 0.0
+        denom = diag[i] - (lower * c[i - 1] if i > 0 else 0.0)
+        c[i] = upper[i] / denom
+        d[i] = (rhs[i] - (lower * d[i - 1] if i > 0 else 0.0)) / denom
+    values = [0.0] * n
+    for i in reversed(range(n)):
+        values[i] = d[i] - (c[i] * values[i + 1] if i < n - 1 else 0.0)
+    return values
+
+
+def interpolate(points, x):
+    if x <= points[0][0]:
+        return points[0][1]
+    for (xa, ya), (xb, yb) in zip(points, points[1:]):
+        if x < xb:
+            return ya + (x - xa) * (yb - ya) / (xb - xa)
+    return points[-1][1]
+
+
+def errors(points, pairs):
+    residuals = [interpolate(points, x) - y for x, y in pairs]
+    return math.sqrt(sum(r * r for r in residuals) / len(residuals)), max(abs(r) for r in residuals)
+
+
+def fit_curve(pairs, max_points):
+    pairs = sorted(pairs)
+    distinct = average_duplicates(pairs)
+    if len(distinct) <= max_points:
+        return distinct
+
+    xs = [x for x, _ in distinct]
+    step = max(1, (len(xs) - 2) // CANDIDATES)
+    candidates = set(xs[1:-1:step])
+    knots = [xs[0], xs[-1]]
+    while len(knots) < max_points and candidates:
+        best = None
+        for x in candidates:
+            trial = sorted(knots + [x])
+            points = list(zip(trial, fit_values(pairs, trial)))
+            rms = errors(points, pairs)[0]
+            if best is None or rms < best[0]:
+                best = (rms, x)
+        knots = sorted(knots + [best[1]])
+        candidates.discard(best[1])
+
+    # Held within the reference range, as the fit may overshoot at the ends
+    low = min(y for _, y in pairs)
+    high = max(y for _, y in pairs)
+    return [(x, min(max(y, low), high)) for x, y in zip(knots, fit_values(pairs, knots))]
+
+
+def to_fixed(points, path):
+    fixed = [(int(round(x)), int(round(y * (1 << FRACTION_BITS)))) for x, y in points]
+    for x, y in fixed:
+        if not INT16_MIN <= x <= INT16_MAX or not INT16_MIN <= y <= INT16_MAX:
+            raise ValueError("%s: point (%d, %d) does not fit in 16 bits" % (path, x, y))
+    for (xa, ya), (xb, yb) in zip(fixed, fixed[1:]):
+        if xb <= xa:
+            raise ValueError("%s: raw values %d and %d round to the same point" % (path, xa, xb))
+        # calEvaluate multiplies them in 32 bits
+        if (xb - xa) * abs(yb - ya) >= 1 << 31:
+            raise ValueError("%s: segment %d..%d too steep for 32 bits" % (path, xa, xb))
+    return fixed
+
+
+# Output -----------------------------------------------------------------------
+
+
+def curve_name(path):
+    return os.path.splitext(os.path.basename(path))[0].upper().replace("-", "_") + "_CURVE"
+
+
+def write_header(path, curves):
+    guard = os.path.basename(path).upper().replace(".", "_")
+    sources = ", ".join(os.path.relpath(source, ROOT) for source, _, _, _ in curves)
+    lines = [
+        "// Generated by tools/calibrate.py from %s, do not edit" % sources,
+        "#ifndef %s" % guard,
+        "#define %s" % guard,
+        "",
+        '#include "calibration.h"',
+    ]
+    for source, pairs, fixed, (rms, worst) in curves:
+        name = curve_name(source)
+        points = ", ".join("{%d, %d}" % point for point in fixed)
+        lines += [
+            "",
+            "// %d points fitted to %d pairs, error rms %.2f max %.2f" % (len(fixed), len(pairs), rms, worst),
+            "static const CalPoint %s_POINTS[] PROGMEM = {%s};" % (name, points),
+            "static const CalCurve %s = {%s_POINTS, %d};" % (name, name, len(fixed)),
+        ]
+    lines += ["", "#endif", ""]
+    with open(path, "w") as file:
+        file.write("\n".join(lines))
+
+
+def generate(sources, output, max_points):
+    curves = []
+    for source in sources:
+        pairs = read_pairs(source)
+        fixed = to_fixed(fit_curve(pairs, max_points), source)
+        scale = 1 << FRACTION_BITS
+        rms, worst = errors([(x, y / scale) for x, y in fixed], pairs)
+        curves.append((source, pairs, fixed, (rms, worst)))
+        print("%s: %d points, error rms %.2f max %.2f" % (curve_name(source), len(fixed), rms, worst))
+    write_header(output, curves)
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description="Fits the calibration curves to recorded pairs")
+    parser.add_argument("-n", "--points", type=int, default=DEFAULT_POINTS, help="points per curve")
+    parser.add_argument("-o", "--output", default=DEFAULT_OUTPUT)
+    parser.add_argument("inputs", nargs="*")
+    args = parser.parse_args(argv[1:])
+    if args.points < 2:
+        parser.error("a curve needs at least 2 points")
+
+    generate(sorted(args.inputs or glob.glob(DEFAULT_INPUTS)), args.output, args.points)
+    return 0
+
+
+try:
+    Import("env")  # noqa: F821, defined when run by PlatformIO
+    sources = sorted(glob.glob(DEFAULT_INPUTS))
+    if not os.path.exists(DEFAULT_OUTPUT) or any(os.path.getmtime(s) > os.path.getmtime(DEFAULT_OUTPUT) for s in sources):
+        generate(sources, DEFAULT_OUTPUT, DEFAULT_POINTS)
+except NameError:
+    if __name__ == "__main__":
+        sys.exit(main(sys.argv))
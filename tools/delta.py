@@ -0,0 +1,295 @@
+#!/usr/bin/env python3
+#
+# Firmware patches for the updates over the air (see src/delta.h and src/ota.h).
+#
+# Usage: tools/delta.py diff OLD.bin NEW.bin PATCH
+#        tools/delta.py serve DIR [--port PORT]
+# diff writes the patch from the image running on the sensors to the new one, applies it back
+# to check it and prints its size. serve answers the update checks of the sensors with the
+# patches of DIR (*.patch, read again on each request): the one made from the image of the
+# request, 204 when there is none. A sensor runs the latest image once DIR has no patch from it.
+#
+# The patch is made the way bsdiff does: exact matches of the new image in the old one, each
+# extended forward while most bytes still match, the difference against the old bytes (mostly
+# zero in compiled code moved by a few bytes) coded as runs, and the bytes in between copied.
+#
+
+import argparse
+import glob
+import http.server
+import os
+import struct
+import sys
+import urllib.parse
+import zlib
+
+MAGIC = 0x544C4450  # DELTA_MAGIC, "PDLT"
+HEADER = struct.Struct("<5I")
+
+GRAM = 8  # Bytes looked up in the index of the old image
+GRAM_STEP = 4  # Positions of the old image indexed, matches are extended backwards
+GRAM_POSITIONS = 4  # Positions kept per gram
+MIN_MATCH = 24  # Shorter matches are copied, a command costs a few bytes
+PATH = "/update"  # OTA_PATH
+
+
+# Varints ----------------------------------------------------------------------
+
+
+def varint(value):
+    out = bytearray()
+    while value >= 0x80:
+        out.append(value & 0x7F | 0x80)
+        value >>= 7
+    out.append(value)
+    return out
+
+
+def zigzag(value):
+    return value << 1 if value >= 0 else (-value << 1) - 1
+
+
+def read_varint(data, pos):
+    value = shift = 0
+    while True:
+        byte = data[pos]
+        pos += 1
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if not byte & 0x80:
+            return value, pos
+
+
+# Matches ----------------------------------------------------------------------
+
+
+def build_index(old):
+    index = {}
+    for pos in range(0, len(old) - GRAM + 1, GRAM_STEP):
+        positions = index.setdefault(old[pos : pos + GRAM], [])
+        if len(positions) < GRAM_POSITIONS:
+            positions.append(pos)
+    return index
+
+
+def match_length(old, o, new, n):
+    # Slices compare faster than bytes one at a time
+    limit = min(len(old) - o, len(new) - n)
+    length, step = 0, 64
+    while length < limit and step > 0:
+        size = min(step, limit - length)
+        if old[o + length : o + length + size] == new[n + length : n + length + size]:
+            length += size
+            step *= 2
+        else:
+            step = size // 2
+    return length
+
+
+def find_matches(old, new):
+    # Greedy, the alignment of the previous match first
+    index = build_index(old)
+    matches = []
+    align = None
+    end = 0  # Of the previous match in the new image
+    n = 0
+    while n <= len(new) - GRAM:
+        best = None
+        if align is not None and 0 <= n + align <= len(old) - GRAM:
+            length = match_length(old, n + align, new, n)
+            if length >= GRAM:
+                best = (n + align, length)
+        for o in index.get(new[n : n + GRAM], ()):
+            length = match_length(old, o, new, n)
+            if best is None or length > best[1] + GRAM:
+                best = (o, length)
+        if best is None or best[1] < MIN_MATCH:
+            n += 1
+            continue
+
+        o, length = best
+        while n > end and o > 0 and old[o - 1] == new[n - 1]:
+            n, o, length = n - 1, o - 1, length + 1
+        if matches and o - n == align:
+            # Same alignment, the bytes in between become part of the add
+            start, old_start, _ = matches[-1]
+            matches[-1] = (start, old_start, n + length - start)
+        else:
+            matches.append((n, o, length))
+        align = o - n
+        end = n + length
+        n = end
+    return matches
+
+
+def extend(old, new, o, n, limit):
+    # Longest forward extension where the bytes matched outnumber the others twice, as bsdiff
+    best = score = length = best_length = 0
+    while length < limit and o + length < len(old):
+        score += 1 if old[o + length] == new[n + length] else -1
+        length += 1
+        if score > best:
+            best = score
+            best_length = length
+    return best_length
+
+
+# Patch ------------------------------------------------------------------------
+
+
+def encode_add(diff):
+    # Runs of zeros and of literals, the literal count left out after the last zeros
+    out = bytearray()
+    pos = 0
+    while True:
+        start = pos
+        while pos < len(diff) and diff[pos] == 0:
+            pos += 1
+        out += varint(pos - start)
+        if pos == len(diff):
+            return out
+        start = pos
+        # A run of zeros costs 2 bytes of counts, shorter ones stay in the literals
+        while pos < len(diff):
+            if diff[pos] != 0:
+                pos += 1
+                continue
+            zeros = pos
+            while zeros < len(diff) and diff[zeros] == 0:
+                zeros += 1
+            if zeros - pos > 2 or zeros == len(diff):
+                break
+            pos = zeros
+        out += varint(pos - start) + diff[start:pos]
+        if pos == len(diff):
+            return out
+
+
+def diff(old, new):
+    matches = find_matches(old, new)
+    patch = bytearray(HEADER.pack(MAGIC, len(old), zlib.crc32(old), len(new), zlib.crc32(new)))
+    if not matches or matches[0][0] > 0:
+        # Copied up to the first match
+        first = matches[0] if matches else (len(new), 0, 0)
+        patch += varint(0) + varint(first[0]) + varint(zigzag(first[1])) + new[: first[0]]
+    for i, (n, o, length) in enumerate(matches):
+        next_n, next_o = matches[i + 1][:2] if i + 1 < len(matches) else (len(new), o + length)
+        length += extend(old, new, o + length, n + length, next_n - n - length)
+        add = bytes((new[n + k] - old[o + k]) & 0xFF for k in range(length))
+        extra = new[n + length : next_n]
+        patch += varint(length) + varint(len(extra)) + varint(zigzag(next_o - o - length))
+        patch += encode_add(add) + extra
+    return bytes(patch)
+
+
+def apply(old, patch):
+    # As src/delta.cpp does, to check the patch
+    magic, old_size, old_crc, new_size, new_crc = HEADER.unpack_from(patch)
+    if magic != MAGIC or old_size != len(old) or old_crc != zlib.crc32(old):
+        raise ValueError("patch not made from this image")
+    new = bytearray()
+    pos = HEADER.size
+    o = 0
+    while len(new) < new_size:
+        add, pos = read_varint(patch, pos)
+        extra, pos = read_varint(patch, pos)
+        seek, pos = read_varint(patch, pos)
+        left = add
+        while left > 0:
+            zeros, pos = read_varint(patch, pos)
+            new += old[o : o + zeros]
+            o += zeros
+            left -= zeros
+            if left == 0:
+                break
+            count, pos = read_varint(patch, pos)
+            new += bytes((old[o + k] + patch[pos + k]) & 0xFF for k in range(count))
+            o += count
+            pos += count
+            left -= count
+        new += patch[pos : pos + extra]
+        pos += extra
+        o += (seek >> 1) ^ -(seek & 1)
+    if pos != len(patch) or len(new) != new_size or zlib.crc32(new) != new_crc:
+        raise ValueError("patch does not give the new image")
+    return bytes(new)
+
+
+# Server -----------------------------------------------------------------------
+
+
+def load_patches(directory):
+    patches = {}
+    for path in glob.glob(os.path.join(directory, "*.patch")):
+        with open(path, "rb") as file:
+            patch = file.read()
+        if len(patch) >= HEADER.size and HEADER.unpack_from(patch)[0] == MAGIC:
+            _, old_size, old_crc = HEADER.unpack_from(patch)[:3]
+            patches[(old_crc, old_size)] = patch
+    return patches
+
+
+def make_handler(directory):
+    class Handler(http.server.BaseHTTPRequestHandler):
+        def do_GET(self):
+            url = urllib.parse.urlsplit(self.path)
+            query = urllib.parse.parse_qs(url.query)
+            try:
+                key = (int(query["image"][0], 16), int(query["size"][0]))
+            except (KeyError, ValueError):
+                self.send_error(400)
+                return
+            if url.path != PATH:
+                self.send_error(404)
+                return
+
+            patch = load_patches(directory).get(key)
+            if patch is None:
+                self.send_response(204)
+                self.end_headers()
+                return
+            self.send_response(200)
+            self.send_header("Content-Type", "application/octet-stream")
+            self.send_header("Content-Length", str(len(patch)))
+            self.end_headers()
+            self.wfile.write(patch)
+
+    return Handler
+
+
+# Main -------------------------------------------------------------------------
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description="Firmware patches for the updates over the air")
+    commands = parser.add_subparsers(dest="command", required=True)
+    diff_parser = commands.add_parser("diff", help="patch from the running image to the new one")
+    diff_parser.add_argument("old")
+    diff_parser.add_argument("new")
+    diff_parser.add_argument("patch")
+    serve_parser = commands.add_parser("serve", help="answer the update checks with the patches of a directory")
+    serve_parser.add_argument("directory")
+    serve_parser.add_argument("--port", type=int, default=8266, help="OTA_PORT")
+    args = parser.parse_args(argv[1:])
+
+    if args.command == "diff":
+        with open(args.old, "rb") as file:
+            old = file.read()
+        with open(args.new, "rb") as file:
+            new = file.read()
+        patch = diff(old, new)
+        if apply(old, patch) != new:
+            raise ValueError("patch does not give the new image")
+        with open(args.patch, "wb") as file:
+            file.write(patch)
+        print("%08x (%d bytes) -> %08x (%d bytes): %d bytes of patch, %.1f%% of the image"
+              % (zlib.crc32(old), len(old), zlib.crc32(new), len(new), len(patch), 100.0 * len(patch) / len(new)))
+    else:
+        server = http.server.HTTPServer(("", args.port), make_handler(args.directory))
+        print("Serving the patches of %s on port %d" % (args.directory, args.port))
+        server.serve_forever()
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
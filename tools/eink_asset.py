@@ -0,0 +1,208 @@
+#!/usr/bin/env python3
+#
+# Converts a 1 bpp e-ink image into a run-length compressed PROGMEM asset (see src/rle.h).
+#
+# Usage: tools/eink_asset.py [INPUT.png|INPUT.svg] [OUTPUT.h]
+# Defaults to assets/eink-background.png -> src/eink_background.h. SVG files are rasterized
+# with rsvg-convert. Also runs as a PlatformIO pre script, regenerating the default asset when
+# the image is newer than the header.
+#
+# Pixels are composited over white and are white when their luminance is over 128, as the
+# online converter the background was made with did.
+#
+
+import os
+import struct
+import subprocess
+import sys
+import zlib
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+DEFAULT_INPUT = os.path.join(ROOT, "assets", "eink-background.png")
+DEFAULT_OUTPUT = os.path.join(ROOT, "src", "eink_background.h")
+
+
+# PNG --------------------------------------------------------------------------
+
+
+def read_png(data):
+    if data[:8] != b"\x89PNG\r\n\x1a\n":
+        raise ValueError("not a PNG file")
+
+    pos = 8
+    idat = b""
+    palette = None
+    transparency = None
+    while pos < len(data):
+        length, kind = struct.unpack(">I4s", data[pos : pos + 8])
+        chunk = data[pos + 8 : pos + 8 + length]
+        pos += 12 + length
+        if kind == b"IHDR":
+            width, height, depth, color, _, _, interlace = struct.unpack(">IIBBBBB", chunk)
+        elif kind == b"PLTE":
+            palette = [tuple(chunk[i : i + 3]) for i in range(0, len(chunk), 3)]
+        elif kind == b"tRNS":
+            transparency = chunk
+        elif kind == b"IDAT":
+            idat += chunk
+
+    if depth != 8 or interlace != 0 or color not in (0, 2, 3, 4, 6):
+        raise ValueError("only 8 bit, non interlaced PNG files are supported")
+
+    channels = {0: 1, 2: 3, 3: 1, 4: 2, 6: 4}[color]
+    stride = width * channels
+    raw = zlib.decompress(idat)
+    rows = []
+    prev = bytearray(stride)
+    pos = 0
+    for _ in range(height):
+        kind = raw[pos]
+        line = bytearray(raw[pos + 1 : pos + 1 + stride])
+        pos += 1 + stride
+        for i in range(stride):
+            a = line[i - channels] if i >= channels else 0
+            b = prev[i]
+            c = prev[i - channels] if i >= channels else 0
+            if kind == 1:
+                line[i] = (line[i] + a) & 0xFF
+            elif kind == 2:
+                line[i] = (line[i] + b) & 0xFF
+            elif kind == 3:
+                line[i] = (line[i] + (a + b) // 2) & 0xFF
+            elif kind == 4:
+                pa, pb, pc = abs(b - c), abs(a - c), abs(a + b - 2 * c)
+                line[i] = (line[i] + (a if pa <= pb and pa <= pc else b if pb <= pc else c)) & 0xFF
+        rows.append(line)
+        prev = line
+
+    # RGBA pixels
+    def pixel(row, x):
+        p = row[x * channels : (x + 1) * channels]
+        if color == 0:
+            return (p[0], p[0], p[0], 255)
+        if color == 2:
+            return (p[0], p[1], p[2], 255)
+        if color == 3:
+            alpha = transparency[p[0]] if transparency and p[0] < len(transparency) else 255
+            return palette[p[0]] + (alpha,)
+        if color == 4:
+            return (p[0], p[0], p[0], p[1])
+        return tuple(p)
+
+    return width, height, [[pixel(row, x) for x in range(width)] for row in rows]
+
+
+def read_image(path):
+    if path.endswith(".svg"):
+        data = subprocess.run(["rsvg-convert", "--format=png", path], check=True, stdout=subprocess.PIPE).stdout
+    else:
+        with open(path, "rb") as file:
+            data = file.read()
+    return read_png(data)
+
+
+def is_white(pixel):
+    r, g, b, a = pixel
+    # (r + g + b) / 3 over white > 128, in integers
+    return (r + g + b) * a + 3 * 255 * (255 - a) > 128 * 3 * 255
+
+
+# RLE --------------------------------------------------------------------------
+
+
+def encode_runs(bits):
+    runs = []
+    color = True  # The first run is white
+    length = 0
+    for bit in bits:
+        if bit == color:
+            length += 1
+        else:
+            runs.append(length)
+            color = bit
+            length = 1
+    runs.append(length)
+
+    out = bytearray()
+    for run in runs:
+        while run >= 0x80:
+            out.append(run & 0x7F | 0x80)
+            run >>= 7
+        out.append(run)
+    return bytes(out), len(runs)
+
+
+def decode_runs(data):
+    bits = []
+    color = False
+    pos = 0
+    while pos < len(data):
+        run = 0
+        shift = 0
+        while True:
+            byte = data[pos]
+            pos += 1
+            run |= (byte & 0x7F) << shift
+            shift += 7
+            if not byte & 0x80:
+                break
+        color = not color
+        bits.extend([color] * run)
+    return bits
+
+
+# Output -----------------------------------------------------------------------
+
+
+def write_header(path, source, name, width, height, data, runs):
+    guard = os.path.basename(path).upper().replace(".", "_")
+    lines = [
+        "// Generated by tools/eink_asset.py from %s, do not edit" % os.path.relpath(source, ROOT),
+        "#ifndef %s" % guard,
+        "#define %s" % guard,
+        "",
+        '#include "rle.h"',
+        "",
+        "// %dx%d, %d runs in %d bytes (%d bytes raw)" % (width, height, runs, len(data), (width + 7) // 8 * height),
+        "static const uint8_t %s_RUNS[] PROGMEM = {" % name,
+    ]
+    for i in range(0, len(data), 16):
+        chunk = ", ".join("0x%02x" % b for b in data[i : i + 16])
+        lines.append("    %s%s" % (chunk, "," if i + 16 < len(data) else "};"))
+    lines += [
+        "",
+        "static const RleImage %s = {%d, %d, %s_RUNS, sizeof(%s_RUNS)};" % (name, width, height, name, name),
+        "",
+        "#endif",
+        "",
+    ]
+    with open(path, "w") as file:
+        file.write("\n".join(lines))
+
+
+def convert(source, output):
+    width, height, pixels = read_image(source)
+    bits = [is_white(p) for row in pixels for p in row]
+    data, runs = encode_runs(bits)
+    if decode_runs(data) != bits:
+        raise RuntimeError("round trip failed")
+
+    name = os.path.splitext(os.path.basename(output))[0].upper()
+    write_header(output, source, name, width, height, data, runs)
+    print("%s: %dx%d, %d runs, %d bytes" % (os.path.relpath(output, ROOT), width, height, runs, len(data)))
+
+
+def main(argv):
+    source = argv[1] if len(argv) > 1 else DEFAULT_INPUT
+    output = argv[2] if len(argv) > 2 else DEFAULT_OUTPUT
+    convert(source, output)
+    return 0
+
+
+try:
+    Import("env")  # noqa: F821, defined when run by PlatformIO
+    if not os.path.exists(DEFAULT_OUTPUT) or os.path.getmtime(DEFAULT_INPUT) > os.path.getmtime(DEFAULT_OUTPUT):
+        convert(DEFAULT_INPUT, DEFAULT_OUTPUT)
+except NameError:
+    if __name__ == "__main__":
+        sys.exit(main(sys.argv))